@@ -0,0 +1,313 @@
+﻿#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "PerfLogsReader.h"
+
+using namespace std;
+
+//Замеры движка на синтетическом источнике: открытие, чтение каталога,
+//get_values на разных масштабах и формирование JSON
+//PerfLogsBench [--counters 10,100,1000] [--samples 3600,86400] [--points 1000] [--repeat 5]
+//  [--save-baseline file.json] [--baseline file.json] [--threshold 0.1] [--memory-threshold 0.05]
+//С --baseline результаты сравниваются с сохраненными, при значимом ухудшении код возврата 2
+
+struct Measure {
+    vector<double> seconds_;
+    size_t bytes_ = 0;      //размер ответа за один прогон
+    uint64_t values_ = 0;   //значений счетчиков, просканированных за один прогон
+    size_t peak_bytes_ = 0; //пик бюджета памяти за замер
+};
+
+//Результат сценария в базовой линии: сценарий, медиана, разброс и пик памяти
+struct BaselineEntry {
+    string key_;
+    double p50_ = 0;
+    double noise_ = 0;          //относительный разброс прогонов (MAD / медиана)
+    double values_per_second_ = 0;
+    size_t peak_bytes_ = 0;
+};
+
+struct Baseline {
+    map<string, BaselineEntry> entries_;
+    string source_ = "synthetic";
+    uint64_t points_ = 0;
+    void add(const string& name, size_t counters, uint64_t samples, const Measure& m);
+};
+
+vector<uint64_t> parseList(const char* arg);
+Measure measure(size_t repeat, const function<size_t()>& run);
+Measure measure(PerfLogsReader& reader, size_t repeat, const function<size_t()>& run);
+double percentile(vector<double> seconds, double p);
+double relativeNoise(const vector<double>& seconds);
+void report(const string& name, size_t counters, uint64_t samples, const Measure& m);
+bool saveBaseline(const string& path, const Baseline& baseline);
+bool loadBaseline(const string& path, Baseline& baseline);
+size_t compareBaseline(const Baseline& base, const Baseline& current, double threshold, double memory_threshold);
+
+int main(int argc, char* argv[]) {
+    vector<uint64_t> counters_list = { 10, 100, 1000 };
+    vector<uint64_t> samples_list = { 3600, 86400 };
+    uint64_t points = 1000;
+    size_t repeat = 5;
+    string save_path;
+    string baseline_path;
+    double threshold = 0.1;
+    double memory_threshold = 0.05;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "--counters")) counters_list = parseList(argv[i + 1]);
+        else if (!strcmp(argv[i], "--samples")) samples_list = parseList(argv[i + 1]);
+        else if (!strcmp(argv[i], "--points")) points = stoull(argv[i + 1]);
+        else if (!strcmp(argv[i], "--repeat")) repeat = stoull(argv[i + 1]);
+        else if (!strcmp(argv[i], "--save-baseline")) save_path = argv[i + 1];
+        else if (!strcmp(argv[i], "--baseline")) baseline_path = argv[i + 1];
+        else if (!strcmp(argv[i], "--threshold")) threshold = stod(argv[i + 1]);
+        else if (!strcmp(argv[i], "--memory-threshold")) memory_threshold = stod(argv[i + 1]);
+        else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    Baseline base;
+    if (!baseline_path.empty() && !loadBaseline(baseline_path, base)) {
+        fprintf(stderr, "Cannot read baseline %s\n", baseline_path.c_str());
+        return 1;
+    }
+    Baseline current;
+    current.points_ = points;
+
+    printf("%-22s %8s %9s %10s %10s %10s %12s %10s\n",
+        "scenario", "counters", "samples", "p50 ms", "p90 ms", "p99 ms", "Msamples/s", "MB/s");
+
+    for (uint64_t counters : counters_list) {
+        for (uint64_t samples : samples_list) {
+            PerfLogsReader reader;
+            const string open_cmd = "{\"cmd\":\"open\",\"source\":\"synthetic\",\"counters\":" + to_string(counters)
+                + ",\"samples\":" + to_string(samples) + "}";
+
+            Measure open_measure = measure(reader, repeat, [&]() {
+                return reader.executeCommand(open_cmd).size();
+            });
+            report("open", counters, samples, open_measure);
+            current.add("open", counters, samples, open_measure);
+
+            //Каталог строится при первом чтении после открытия
+            Measure read_measure = measure(reader, repeat, [&]() {
+                reader.executeCommand(open_cmd);
+                return reader.executeCommand("{\"cmd\":\"read\"}").size();
+            });
+            report("read", counters, samples, read_measure);
+            current.add("read", counters, samples, read_measure);
+
+            const uint64_t start = reader.getStartTime();
+            const uint64_t end = reader.getEndTime();
+            for (uint64_t zoom : { 1, 10, 100 }) {
+                //Окно 1/zoom периода в его середине
+                const uint64_t width = (end - start) / zoom;
+                const uint64_t window_start = start + ((end - start) - width) / 2;
+                const uint64_t window_end = window_start + width;
+                const uint64_t records = samples / zoom;
+                const string suffix = " 1/" + to_string(zoom);
+
+                Measure values = measure(reader, repeat, [&]() {
+                    return reader.getValues(window_start, window_end, points).size();
+                });
+                values.bytes_ = 0;
+                values.values_ = records * counters;
+                report("getValues" + suffix, counters, samples, values);
+                current.add("getValues" + suffix, counters, samples, values);
+
+                const string get_values_cmd = "{\"cmd\":\"get_values\",\"start_time\":\"" + ticksToJson(window_start)
+                    + "\",\"end_time\":\"" + ticksToJson(window_end) + "\",\"points\":" + to_string(points) + "}";
+                //Повтор команды иначе отдается из кэша ответов
+                Measure command = measure(reader, repeat, [&]() {
+                    reader.executeCommand("{\"cmd\":\"memory\",\"clear_cache\":true}");
+                    return reader.executeCommand(get_values_cmd).size();
+                });
+                command.values_ = records * counters;
+                report("get_values" + suffix, counters, samples, command);
+                current.add("get_values" + suffix, counters, samples, command);
+
+                //Формирование JSON - разница команды и расчета значений
+                Measure json_measure;
+                json_measure.bytes_ = command.bytes_;
+                for (size_t i = 0; i < command.seconds_.size(); ++i) {
+                    json_measure.seconds_.push_back(max(0.0, command.seconds_[i] - values.seconds_[i]));
+                }
+                report("json" + suffix, counters, samples, json_measure);
+            }
+        }
+    }
+
+    if (!save_path.empty() && !saveBaseline(save_path, current)) {
+        fprintf(stderr, "Cannot write baseline %s\n", save_path.c_str());
+        return 1;
+    }
+    if (!baseline_path.empty() && compareBaseline(base, current, threshold, memory_threshold)) {
+        return 2;
+    }
+    return 0;
+}
+
+//Ключ сценария: замер, источник, счетчики, выборки и точки
+void Baseline::add(const string& name, size_t counters, uint64_t samples, const Measure& m) {
+    BaselineEntry entry;
+    entry.key_ = name + "|" + source_ + "|" + to_string(counters) + "|" + to_string(samples) + "|" + to_string(points_);
+    entry.p50_ = percentile(m.seconds_, 0.5);
+    entry.noise_ = relativeNoise(m.seconds_);
+    entry.values_per_second_ = entry.p50_ > 0 ? m.values_ / entry.p50_ : 0;
+    entry.peak_bytes_ = m.peak_bytes_;
+    entries_[entry.key_] = entry;
+}
+
+vector<uint64_t> parseList(const char* arg) {
+    vector<uint64_t> list;
+    string str(arg);
+    size_t pos = 0;
+    while (pos < str.size()) {
+        size_t comma = str.find(',', pos);
+        if (comma == string::npos) comma = str.size();
+        list.push_back(stoull(str.substr(pos, comma - pos)));
+        pos = comma + 1;
+    }
+    return list;
+}
+
+//Первый прогон прогревает кэши и не учитывается
+Measure measure(size_t repeat, const function<size_t()>& run) {
+    Measure m;
+    run();
+    for (size_t i = 0; i < repeat; ++i) {
+        auto begin = chrono::steady_clock::now();
+        m.bytes_ = run();
+        m.seconds_.push_back(chrono::duration<double>(chrono::steady_clock::now() - begin).count());
+    }
+    return m;
+}
+
+//Замер с пиком бюджета памяти компоненты, отсчитанным от начала замера
+Measure measure(PerfLogsReader& reader, size_t repeat, const function<size_t()>& run) {
+    namespace json = boost::json;
+    reader.executeCommand("{\"cmd\":\"memory\",\"reset_peak\":true}");
+    Measure m = measure(repeat, run);
+    json::value j_memory = json::parse(reader.executeCommand("{\"cmd\":\"memory\"}"));
+    m.peak_bytes_ = json::value_to<size_t>(j_memory.as_object().at("peak"));
+    return m;
+}
+
+double percentile(vector<double> seconds, double p) {
+    if (seconds.empty()) return 0;
+    sort(seconds.begin(), seconds.end());
+    size_t rank = static_cast<size_t>(p * seconds.size() + 0.999999);
+    return seconds[min(seconds.size(), max<size_t>(rank, 1)) - 1];
+}
+
+void report(const string& name, size_t counters, uint64_t samples, const Measure& m) {
+    const double p50 = percentile(m.seconds_, 0.5);
+    const double rate = p50 > 0 && m.values_ ? m.values_ / p50 / 1e6 : 0;
+    const double throughput = p50 > 0 && m.bytes_ ? m.bytes_ / p50 / (1024.0 * 1024.0) : 0;
+    printf("%-22s %8zu %9llu %10.3f %10.3f %10.3f %12.2f %10.2f\n",
+        name.c_str(), counters, static_cast<unsigned long long>(samples),
+        p50 * 1000, percentile(m.seconds_, 0.9) * 1000, percentile(m.seconds_, 0.99) * 1000, rate, throughput);
+}
+
+//Медианное абсолютное отклонение, приведенное к сигме и отнесенное к медиане
+double relativeNoise(const vector<double>& seconds) {
+    const double median = percentile(seconds, 0.5);
+    if (median <= 0) return 0;
+    vector<double> deviations;
+    for (double value : seconds) {
+        deviations.push_back(fabs(value - median));
+    }
+    return 1.4826 * percentile(deviations, 0.5) / median;
+}
+
+bool saveBaseline(const string& path, const Baseline& baseline) {
+    namespace json = boost::json;
+    json::array j_scenarios;
+    for (auto& item : baseline.entries_) {
+        const BaselineEntry& entry = item.second;
+        json::object j_entry;
+        j_entry.emplace("key", entry.key_);
+        j_entry.emplace("p50", entry.p50_);
+        j_entry.emplace("noise", entry.noise_);
+        j_entry.emplace("values_per_second", entry.values_per_second_);
+        j_entry.emplace("peak_bytes", entry.peak_bytes_);
+        j_scenarios.push_back(j_entry);
+    }
+    json::object j_baseline;
+    j_baseline.emplace("version", 1);
+    j_baseline.emplace("scenarios", j_scenarios);
+    ofstream file(path, ios::binary);
+    file << json::serialize(j_baseline);
+    return static_cast<bool>(file);
+}
+
+bool loadBaseline(const string& path, Baseline& baseline) {
+    namespace json = boost::json;
+    ifstream file(path, ios::binary);
+    if (!file) return false;
+    stringstream text;
+    text << file.rdbuf();
+    error_code ec;
+    json::value j_baseline = json::parse(text.str(), ec);
+    if (ec || !j_baseline.is_object()) return false;
+    const json::value* j_scenarios = j_baseline.as_object().if_contains("scenarios");
+    if (!j_scenarios || !j_scenarios->is_array()) return false;
+    for (auto& j_item : j_scenarios->as_array()) {
+        const json::object& j_entry = j_item.as_object();
+        BaselineEntry entry;
+        entry.key_ = j_entry.at("key").as_string().c_str();
+        entry.p50_ = json::value_to<double>(j_entry.at("p50"));
+        entry.noise_ = json::value_to<double>(j_entry.at("noise"));
+        entry.values_per_second_ = json::value_to<double>(j_entry.at("values_per_second"));
+        entry.peak_bytes_ = json::value_to<size_t>(j_entry.at("peak_bytes"));
+        baseline.entries_[entry.key_] = entry;
+    }
+    return true;
+}
+
+//Замедление значимо, если больше порога и втрое больше разброса прогонов обоих замеров;
+//очень короткие замеры (меньше 50 мкс) сравниваются только по памяти.
+//Пик памяти почти не шумит: достаточно порога и разницы больше 64 КБ. Возвращает число ухудшений
+size_t compareBaseline(const Baseline& base, const Baseline& current, double threshold, double memory_threshold) {
+    printf("\n%-50s %10s %10s %8s %12s %12s %8s  %s\n",
+        "scenario", "base ms", "ms", "time %", "base peak", "peak", "peak %", "verdict");
+    size_t regressions = 0;
+    for (auto& item : current.entries_) {
+        const BaselineEntry& entry = item.second;
+        auto it = base.entries_.find(item.first);
+        if (it == base.entries_.end()) {
+            printf("%-50s %10s %10.3f %8s %12s %12zu %8s  new\n", entry.key_.c_str(), "-", entry.p50_ * 1000, "-", "-",
+                entry.peak_bytes_, "-");
+            continue;
+        }
+        const BaselineEntry& old = it->second;
+        const double time_change = old.p50_ > 0 ? entry.p50_ / old.p50_ - 1 : 0;
+        const double time_limit = max(threshold, 3 * max(old.noise_, entry.noise_));
+        const bool slower = old.p50_ >= 50e-6 && entry.p50_ - old.p50_ >= 50e-6 && time_change > time_limit;
+        const double peak_change = old.peak_bytes_ ? static_cast<double>(entry.peak_bytes_) / old.peak_bytes_ - 1 : 0;
+        const bool bigger = entry.peak_bytes_ > old.peak_bytes_ + 64 * 1024 && peak_change > memory_threshold;
+        string verdict = "ok";
+        if (slower || bigger) {
+            verdict = slower && bigger ? "REGRESSION time, memory" : slower ? "REGRESSION time" : "REGRESSION memory";
+            ++regressions;
+        }
+        else if (time_change < -time_limit) {
+            verdict = "faster";
+        }
+        printf("%-50s %10.3f %10.3f %8.1f %12zu %12zu %8.1f  %s\n", entry.key_.c_str(), old.p50_ * 1000, entry.p50_ * 1000,
+            time_change * 100, old.peak_bytes_, entry.peak_bytes_, peak_change * 100, verdict.c_str());
+    }
+    printf("\n%zu regression(s) against baseline\n", regressions);
+    return regressions;
+}
@@ -0,0 +1,207 @@
+﻿#include "ArchiveIndex.h"
+#include "Conversion.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+#include "boost/json.hpp"
+
+using namespace std;
+
+ArchiveIndex::ArchiveIndex(filesystem::path root) :
+    root_(move(root)) {}
+
+bool ArchiveIndex::load() {
+    namespace json = boost::json;
+    files_.clear();
+    counter_sets_.clear();
+    ifstream file(root_ / FILE_NAME, ios::binary);
+    if (!file) return false;
+    stringstream content;
+    content << file.rdbuf();
+    error_code ec;
+    json::value jv = json::parse(content.str(), ec);
+    if (ec || !jv.is_object()) return false;
+
+    try {
+        const json::object& j_index = jv.as_object();
+        for (auto& j_set : j_index.at("counter_sets").as_array()) {
+            vector<string> counters;
+            for (auto& j_counter : j_set.as_array()) {
+                counters.push_back(j_counter.as_string().c_str());
+            }
+            counter_sets_.push_back(move(counters));
+        }
+        for (auto& j_file : j_index.at("files").as_array()) {
+            const json::object& j_object = j_file.as_object();
+            ArchiveFile info;
+            info.path_ = j_object.at("path").as_string().c_str();
+            info.size_ = json::value_to<uint64_t>(j_object.at("size"));
+            info.mtime_ = json::value_to<int64_t>(j_object.at("mtime"));
+            info.start_time_ = jsonToTicks(j_object.at("start_time").as_string().c_str());
+            info.end_time_ = jsonToTicks(j_object.at("end_time").as_string().c_str());
+            for (auto& j_machine : j_object.at("machines").as_array()) {
+                info.machines_.push_back(j_machine.as_string().c_str());
+            }
+            info.counter_set_ = json::value_to<size_t>(j_object.at("counter_set"));
+            if (info.counter_set_ >= counter_sets_.size()) throw out_of_range("counter_set");
+            files_.push_back(move(info));
+        }
+    }
+    catch (const exception&) {
+        files_.clear();
+        counter_sets_.clear();
+        return false;
+    }
+    return true;
+}
+
+bool ArchiveIndex::save() const {
+    namespace json = boost::json;
+    json::array j_sets;
+    for (auto& counters : counter_sets_) {
+        json::array j_set;
+        for (auto& counter : counters) {
+            j_set.emplace_back(counter);
+        }
+        j_sets.push_back(j_set);
+    }
+    json::array j_files;
+    for (auto& info : files_) {
+        json::array j_machines;
+        for (auto& machine : info.machines_) {
+            j_machines.emplace_back(machine);
+        }
+        json::object j_file;
+        j_file.emplace("path", info.path_);
+        j_file.emplace("size", info.size_);
+        j_file.emplace("mtime", info.mtime_);
+        j_file.emplace("start_time", ticksToJson(info.start_time_));
+        j_file.emplace("end_time", ticksToJson(info.end_time_));
+        j_file.emplace("machines", j_machines);
+        j_file.emplace("counter_set", info.counter_set_);
+        j_files.push_back(j_file);
+    }
+    json::object j_index;
+    j_index.emplace("version", 1);
+    j_index.emplace("counter_sets", j_sets);
+    j_index.emplace("files", j_files);
+
+    //Запись через временный файл: прерванное обновление не портит прежний индекс
+    const filesystem::path path = root_ / FILE_NAME;
+    filesystem::path temp = path;
+    temp += ".tmp";
+    {
+        ofstream file(temp, ios::binary | ios::trunc);
+        const string text = json::serialize(j_index);
+        file.write(text.data(), text.size());
+        if (!file.flush()) return false;
+    }
+    error_code ec;
+    filesystem::rename(temp, path, ec);
+    return !ec;
+}
+
+ArchiveUpdate ArchiveIndex::update(const ArchiveProbe& probe, const vector<string>& extensions) {
+    ArchiveUpdate result;
+    map<string, ArchiveFile> known;
+    for (auto& info : files_) {
+        known.emplace(info.path_, move(info));
+    }
+    vector<ArchiveFile> files;
+
+    error_code ec;
+    vector<filesystem::path> paths;
+    for (auto& entry : filesystem::recursive_directory_iterator(root_, ec)) {
+        if (!entry.is_regular_file()) continue;
+        string extension = entry.path().extension().u8string();
+        transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return static_cast<char>(tolower(c)); });
+        if (find(extensions.begin(), extensions.end(), extension) != extensions.end()) {
+            paths.push_back(entry.path());
+        }
+    }
+    sort(paths.begin(), paths.end());
+
+    for (auto& path : paths) {
+        ArchiveFile info;
+        info.path_ = path.lexically_relative(root_).generic_u8string();
+        info.size_ = filesystem::file_size(path, ec);
+        info.mtime_ = static_cast<int64_t>(filesystem::last_write_time(path, ec).time_since_epoch().count());
+
+        auto it = known.find(info.path_);
+        if (it != known.end() && it->second.size_ == info.size_ && it->second.mtime_ == info.mtime_) {
+            files.push_back(move(it->second));
+            known.erase(it);
+            continue;
+        }
+        ArchiveProbeResult probed;
+        if (!probe(path, probed)) {
+            //Измененный файл, который не удалось прочитать, остается с прежним описанием
+            //и проверяется снова при следующем обновлении
+            if (it != known.end()) {
+                files.push_back(move(it->second));
+                known.erase(it);
+            }
+            ++result.failed_;
+            continue;
+        }
+        if (it != known.end()) {
+            ++result.updated_;
+            known.erase(it);
+        }
+        else {
+            ++result.added_;
+        }
+        info.start_time_ = probed.start_time_;
+        info.end_time_ = probed.end_time_;
+        info.machines_ = move(probed.machines_);
+        info.counter_set_ = counterSet(move(probed.counters_));
+        files.push_back(move(info));
+    }
+    result.removed_ = known.size();
+
+    //Наборы счетчиков, на которые больше не ссылается ни один файл, удаляются
+    vector<size_t> renumber(counter_sets_.size(), counter_sets_.size());
+    vector<vector<string>> counter_sets;
+    for (auto& info : files) {
+        if (renumber[info.counter_set_] == counter_sets_.size()) {
+            renumber[info.counter_set_] = counter_sets.size();
+            counter_sets.push_back(move(counter_sets_[info.counter_set_]));
+        }
+        info.counter_set_ = renumber[info.counter_set_];
+    }
+    counter_sets_ = move(counter_sets);
+    files_ = move(files);
+    return result;
+}
+
+vector<const ArchiveFile*> ArchiveIndex::select(uint64_t start_time, uint64_t end_time,
+    const string& machine, const vector<string>& counters) const {
+    vector<const ArchiveFile*> selected;
+    for (auto& info : files_) {
+        if (info.end_time_ < start_time || info.start_time_ > end_time) continue;
+        if (!machine.empty() && find(info.machines_.begin(), info.machines_.end(), machine) == info.machines_.end()) continue;
+        const vector<string>& set = counter_sets_[info.counter_set_];
+        if (!all_of(counters.begin(), counters.end(), [&](const string& counter) { return binary_search(set.begin(), set.end(), counter); })) continue;
+        selected.push_back(&info);
+    }
+    sort(selected.begin(), selected.end(), [](const ArchiveFile* a, const ArchiveFile* b) { return a->start_time_ < b->start_time_; });
+    return selected;
+}
+
+filesystem::path ArchiveIndex::absolutePath(const ArchiveFile& file) const {
+    return root_ / filesystem::u8path(file.path_);
+}
+
+size_t ArchiveIndex::counterSet(vector<string> counters) {
+    sort(counters.begin(), counters.end());
+    counters.erase(unique(counters.begin(), counters.end()), counters.end());
+    auto it = find(counter_sets_.begin(), counter_sets_.end(), counters);
+    if (it != counter_sets_.end()) {
+        return it - counter_sets_.begin();
+    }
+    counter_sets_.push_back(move(counters));
+    return counter_sets_.size() - 1;
+}
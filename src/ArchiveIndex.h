@@ -0,0 +1,63 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+
+//Файл архива журналов: период, компьютеры и набор счетчиков
+struct ArchiveFile {
+	std::string path_;				//UTF-8, относительно корня архива
+	std::uint64_t size_ = 0;
+	std::int64_t mtime_ = 0;
+	std::uint64_t start_time_ = 0;
+	std::uint64_t end_time_ = 0;
+	std::vector<std::string> machines_;
+	std::size_t counter_set_ = 0;	//номер в ArchiveIndex::counterSets()
+};
+
+//Описание файла, прочитанное источником: период, компьютеры и имена счетчиков без компьютера
+struct ArchiveProbeResult {
+	std::uint64_t start_time_ = 0;
+	std::uint64_t end_time_ = 0;
+	std::vector<std::string> machines_;
+	std::vector<std::string> counters_;
+};
+
+using ArchiveProbe = std::function<bool(const std::filesystem::path& file, ArchiveProbeResult& result)>;
+
+struct ArchiveUpdate {
+	std::size_t added_ = 0;
+	std::size_t updated_ = 0;
+	std::size_t removed_ = 0;
+	std::size_t failed_ = 0;
+};
+
+//Индекс каталога ротируемых журналов. Хранится компактным JSON в корне архива: одинаковые наборы
+//счетчиков разных файлов записываются один раз. Обновление перечитывает только новые файлы
+//и файлы с изменившимися размером или временем изменения
+class ArchiveIndex {
+public:
+	static constexpr const char* FILE_NAME = "perflogs.index.json";
+
+	explicit ArchiveIndex(std::filesystem::path root);
+	const std::filesystem::path& root() const { return root_; }
+	//false - индекса нет или он поврежден, индекс остается пустым
+	bool load();
+	bool save() const;
+	ArchiveUpdate update(const ArchiveProbe& probe, const std::vector<std::string>& extensions);
+	const std::vector<ArchiveFile>& files() const { return files_; }
+	const std::vector<std::vector<std::string>>& counterSets() const { return counter_sets_; }
+	//Файлы, пересекающие [start_time, end_time], по времени начала. Пустой machine - любой компьютер,
+	//counters - имена без компьютера, которые должны быть в файле
+	std::vector<const ArchiveFile*> select(std::uint64_t start_time, std::uint64_t end_time,
+		const std::string& machine, const std::vector<std::string>& counters) const;
+	std::filesystem::path absolutePath(const ArchiveFile& file) const;
+private:
+	std::size_t counterSet(std::vector<std::string> counters);
+
+	std::filesystem::path root_;
+	std::vector<ArchiveFile> files_;
+	std::vector<std::vector<std::string>> counter_sets_;	//отсортированные имена
+};
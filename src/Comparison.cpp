@@ -0,0 +1,62 @@
+﻿#include "Comparison.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+using namespace std;
+
+double changeScore(const CounterDelta& delta, bool relative);
+
+void compareSeries(const vector<optional<double>>& base, const vector<optional<double>>& target,
+    vector<optional<double>>& difference, vector<optional<double>>& ratio, CounterDelta& delta) {
+    const size_t size = min(base.size(), target.size());
+    difference.assign(size, nullopt);
+    ratio.assign(size, nullopt);
+    delta.max_delta_.reset();
+    delta.max_delta_bucket_ = 0;
+    for (size_t i = 0; i < size; ++i) {
+        if (!base[i] || !target[i]) continue;
+        const double d = *target[i] - *base[i];
+        difference[i] = d;
+        if (*base[i] != 0) {
+            ratio[i] = *target[i] / *base[i];
+        }
+        if (!delta.max_delta_ || fabs(d) > fabs(*delta.max_delta_)) {
+            delta.max_delta_ = d;
+            delta.max_delta_bucket_ = i;
+        }
+    }
+}
+
+void completeDelta(CounterDelta& delta) {
+    delta.delta_.reset();
+    delta.ratio_.reset();
+    if (!delta.base_ || !delta.target_) return;
+    delta.delta_ = *delta.target_ - *delta.base_;
+    if (*delta.base_ != 0) {
+        delta.ratio_ = *delta.target_ / *delta.base_;
+    }
+}
+
+vector<size_t> orderByChange(const vector<CounterDelta>& deltas, bool relative) {
+    vector<double> scores(deltas.size());
+    for (size_t i = 0; i < deltas.size(); ++i) {
+        scores[i] = changeScore(deltas[i], relative);
+    }
+    vector<size_t> order(deltas.size());
+    iota(order.begin(), order.end(), size_t(0));
+    //Устойчивая сортировка сохраняет порядок каталога при равных изменениях
+    stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return scores[a] > scores[b]; });
+    return order;
+}
+
+//Ключ сортировки; -1 - изменение не определено
+double changeScore(const CounterDelta& delta, bool relative) {
+    if (!delta.delta_) return -1;
+    const double change = fabs(*delta.delta_);
+    if (!relative) return change;
+    if (*delta.base_ != 0) return change / fabs(*delta.base_);
+    return change > 0 ? numeric_limits<double>::infinity() : 0;
+}
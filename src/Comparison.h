@@ -0,0 +1,32 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+//Изменение счетчика между базовым и сравниваемым диапазоном
+struct CounterDelta {
+	std::optional<double> base_;			//среднее базового диапазона
+	std::optional<double> target_;			//среднее сравниваемого диапазона
+	std::optional<double> delta_;			//target_ - base_
+	std::optional<double> ratio_;			//target_ / base_, нет при нулевом base_
+	std::optional<double> max_delta_;		//наибольшая по модулю разность в интервале сетки
+	std::size_t max_delta_bucket_ = 0;
+};
+
+//Разность и отношение рядов на общей относительной сетке: i-й интервал одного диапазона
+//сопоставлен i-му интервалу другого. Интервал без значения в любом из рядов пропускается
+void compareSeries(
+	const std::vector<std::optional<double>>& base,
+	const std::vector<std::optional<double>>& target,
+	std::vector<std::optional<double>>& difference,
+	std::vector<std::optional<double>>& ratio,
+	CounterDelta& delta);
+
+//Заполняет delta_ и ratio_ по средним base_ и target_
+void completeDelta(CounterDelta& delta);
+
+//Порядок счетчиков по убыванию изменения: относительного (|delta| / |base|) или абсолютного.
+//Появление значения при нулевом базовом среднем считается наибольшим относительным изменением,
+//счетчики без значений в одном из диапазонов идут последними
+std::vector<std::size_t> orderByChange(const std::vector<CounterDelta>& deltas, bool relative);
@@ -23,6 +23,7 @@
 #include <locale>
 
 #include "Component.h"
+#include "Stats.h"
 
 #ifdef _WINDOWS
 #pragma warning (disable : 4267)
@@ -372,6 +373,8 @@ void Component::storeVariable(const variant_t &src, tVariant &dst) {
 }
 
 void Component::storeVariable(const std::string &src, tVariant &dst) {
+    //Ответы команд передаются в 1С здесь: перекодирование в UTF-16 и копирование в память платформы
+    ScopedTimer timer(StatPhase::Store);
 
     std::u16string tmp = toUTF16String(src);
 
@@ -0,0 +1,159 @@
+﻿#include "Conversion.h"
+
+#include <chrono>
+#include <ctime>
+
+#ifdef _WINDOWS
+#include <windows.h>
+#else
+#include <codecvt>
+#include <locale>
+#endif
+
+using namespace std;
+
+//Число дней от 1601-01-01 до 1970-01-01
+constexpr int64_t DAYS_1601_TO_1970 = 134774;
+constexpr uint64_t TICKS_PER_DAY = 86400 * TICKS_PER_SECOND;
+
+//Переводы даты в число дней от 1970-01-01 и обратно (алгоритмы Howard Hinnant)
+int64_t daysFromCivil(int64_t year, unsigned month, unsigned day) {
+    year -= month <= 2;
+    const int64_t era = (year >= 0 ? year : year - 399) / 400;
+    const unsigned yoe = static_cast<unsigned>(year - era * 400);
+    const unsigned doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+CivilTime civilFromTicks(uint64_t ticks) {
+    CivilTime time;
+    int64_t days = static_cast<int64_t>(ticks / TICKS_PER_DAY) - DAYS_1601_TO_1970;
+    uint64_t ms_of_day = ticks % TICKS_PER_DAY / 10000;
+
+    days += 719468;
+    const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    const unsigned doe = static_cast<unsigned>(days - era * 146097);
+    const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const unsigned mp = (5 * doy + 2) / 153;
+    time.day_ = doy - (153 * mp + 2) / 5 + 1;
+    time.month_ = mp < 10 ? mp + 3 : mp - 9;
+    time.year_ = static_cast<int>(static_cast<int64_t>(yoe) + era * 400 + (time.month_ <= 2));
+
+    time.hour_ = static_cast<unsigned>(ms_of_day / 3600000);
+    time.minute_ = static_cast<unsigned>(ms_of_day / 60000 % 60);
+    time.second_ = static_cast<unsigned>(ms_of_day / 1000 % 60);
+    time.millis_ = static_cast<unsigned>(ms_of_day % 1000);
+    return time;
+}
+
+uint64_t ticksFromCivil(const CivilTime& time) {
+    int64_t days = daysFromCivil(time.year_, time.month_, time.day_) + DAYS_1601_TO_1970;
+    uint64_t ms = (static_cast<uint64_t>(time.hour_) * 3600 + time.minute_ * 60 + time.second_) * 1000 + time.millis_;
+    return static_cast<uint64_t>(days) * TICKS_PER_DAY + ms * 10000;
+}
+
+string ticksToJson(uint64_t ticks) {
+    CivilTime time = civilFromTicks(ticks);
+    char buf[20];
+    auto put = [](char* p, unsigned value, size_t width) {
+        for (size_t i = width; i > 0; --i) {
+            p[i - 1] = static_cast<char>('0' + value % 10);
+            value /= 10;
+        }
+    };
+    put(buf, static_cast<unsigned>(time.year_), 4);
+    buf[4] = '-';
+    put(buf + 5, time.month_, 2);
+    buf[7] = '-';
+    put(buf + 8, time.day_, 2);
+    buf[10] = 'T';
+    put(buf + 11, time.hour_, 2);
+    buf[13] = ':';
+    put(buf + 14, time.minute_, 2);
+    buf[16] = ':';
+    put(buf + 17, time.second_, 2);
+    return string(buf, 19);
+}
+
+uint64_t jsonToTicks(const string& str) {
+    CivilTime time{};
+    time.year_ = stoi(str.substr(0, 4));
+    time.month_ = stoi(str.substr(5, 2));
+    time.day_ = stoi(str.substr(8, 2));
+    time.hour_ = stoi(str.substr(11, 2));
+    time.minute_ = stoi(str.substr(14, 2));
+    time.second_ = stoi(str.substr(17, 2));
+    return ticksFromCivil(time);
+}
+
+size_t ticksToCsv(uint64_t ticks, char* out) {
+    CivilTime civil = civilFromTicks(ticks);
+
+    auto put2 = [](char* p, unsigned v) { p[0] = '0' + v / 10; p[1] = '0' + v % 10; };
+    put2(out, civil.month_);
+    out[2] = '/';
+    put2(out + 3, civil.day_);
+    out[5] = '/';
+    put2(out + 6, static_cast<unsigned>(civil.year_ / 100));
+    put2(out + 8, static_cast<unsigned>(civil.year_ % 100));
+    out[10] = ' ';
+    put2(out + 11, civil.hour_);
+    out[13] = ':';
+    put2(out + 14, civil.minute_);
+    out[16] = ':';
+    put2(out + 17, civil.second_);
+    out[19] = '.';
+    out[20] = '0' + civil.millis_ / 100;
+    put2(out + 21, civil.millis_ % 100);
+    return 23;
+}
+
+uint64_t currentLocalTicks() {
+#ifdef _WINDOWS
+    FILETIME utc;
+    FILETIME local;
+    GetSystemTimeAsFileTime(&utc);
+    FileTimeToLocalFileTime(&utc, &local);
+    return (static_cast<uint64_t>(local.dwHighDateTime) << 32) | local.dwLowDateTime;
+#else
+    using namespace chrono;
+    auto now = system_clock::now();
+    time_t t = system_clock::to_time_t(now);
+    tm local{};
+    localtime_r(&t, &local);
+    int64_t unix_ticks = duration_cast<microseconds>(now.time_since_epoch()).count() * 10;
+    return static_cast<uint64_t>(unix_ticks + (DAYS_1601_TO_1970 * 86400 + local.tm_gmtoff) * static_cast<int64_t>(TICKS_PER_SECOND));
+#endif
+}
+
+#ifdef _WINDOWS
+
+wstring utfToWideChar(const string& str) {
+    int count = MultiByteToWideChar(CP_UTF8, 0, str.c_str(), static_cast<int>(str.length()), NULL, 0);
+    std::wstring wstr(count, 0);
+    MultiByteToWideChar(CP_UTF8, 0, str.c_str(), static_cast<int>(str.length()), &wstr[0], count);
+    return wstr;
+}
+
+string wideCharToUtf(const wstring& wstr) {
+    int count = WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), static_cast<int>(wstr.length()), NULL, 0, NULL, NULL);
+    std::string str(count, 0);
+    WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), -1, &str[0], count, NULL, NULL);
+    return str;
+}
+
+#else
+
+wstring utfToWideChar(const string& str) {
+    wstring_convert<codecvt_utf8<wchar_t>> conv;
+    return conv.from_bytes(str);
+}
+
+string wideCharToUtf(const wstring& wstr) {
+    wstring_convert<codecvt_utf8<wchar_t>> conv;
+    return conv.to_bytes(wstr);
+}
+
+#endif
@@ -0,0 +1,30 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <string>
+
+//Время хранится в тиках FILETIME: 100 нс от 1601-01-01, как в записях журналов PDH
+constexpr std::uint64_t TICKS_PER_SECOND = 10000000;
+
+struct CivilTime {
+	int year_;
+	unsigned month_;
+	unsigned day_;
+	unsigned hour_;
+	unsigned minute_;
+	unsigned second_;
+	unsigned millis_;
+};
+
+CivilTime civilFromTicks(std::uint64_t ticks);
+std::uint64_t ticksFromCivil(const CivilTime& time);
+//Формат дат в командах: YYYY-MM-DDTHH:MM:SS
+std::string ticksToJson(std::uint64_t ticks);
+std::uint64_t jsonToTicks(const std::string& str);
+//Время в формате CSV Performance monitor: MM/DD/YYYY HH:MM:SS.mmm (23 символа без завершающего нуля)
+std::size_t ticksToCsv(std::uint64_t ticks, char* out);
+//Текущее локальное время в тиках
+std::uint64_t currentLocalTicks();
+
+std::wstring utfToWideChar(const std::string& str);
+std::string wideCharToUtf(const std::wstring& wstr);
@@ -0,0 +1,204 @@
+﻿#include "Correlation.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CORRELATION_SSE2
+#endif
+
+using namespace std;
+
+struct PreparedSeries {
+    bool valid_ = false;
+    vector<double> z_;
+    //Префиксные суммы z и z^2 для расчета по перекрытию при сдвиге
+    vector<double> sum_;
+    vector<double> sum_sq_;
+};
+
+vector<double> fillGaps(const vector<optional<double>>& series, bool& has_values);
+vector<double> ranks(const vector<double>& values);
+bool normalize(vector<double>& values);
+double pearsonWithLag(const PreparedSeries& x, const PreparedSeries& y, int lag);
+
+double dotProduct(const double* a, const double* b, size_t n) {
+    size_t i = 0;
+    double sum = 0;
+#ifdef CORRELATION_SSE2
+    __m128d s0 = _mm_setzero_pd();
+    __m128d s1 = _mm_setzero_pd();
+    for (; i + 4 <= n; i += 4) {
+        s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        s1 = _mm_add_pd(s1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+    }
+    double buf[2];
+    _mm_storeu_pd(buf, _mm_add_pd(s0, s1));
+    sum = buf[0] + buf[1];
+#else
+    double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    sum = (s0 + s1) + (s2 + s3);
+#endif
+    for (; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+CorrelationMatrix correlate(
+    const vector<vector<optional<double>>>& series,
+    CorrelationMethod method,
+    size_t max_lag,
+    WorkerPool& pool,
+    size_t threads) {
+
+    const size_t size = series.size();
+    CorrelationMatrix matrix;
+    matrix.size_ = size;
+    matrix.r_.assign(size * size, numeric_limits<double>::quiet_NaN());
+    if (max_lag) {
+        matrix.lag_.assign(size * size, 0);
+    }
+    if (!size) return matrix;
+
+    const size_t points = series[0].size();
+    //Сдвиг не может превышать длину ряда за вычетом минимального перекрытия
+    if (points < 3) {
+        max_lag = 0;
+    }
+    else if (max_lag > points - 3) {
+        max_lag = points - 3;
+    }
+
+    vector<PreparedSeries> prepared(size);
+    for (size_t k = 0; k < size; ++k) {
+        PreparedSeries& p = prepared[k];
+        bool has_values = false;
+        p.z_ = fillGaps(series[k], has_values);
+        if (!has_values) continue;
+        if (method == CorrelationMethod::Spearman) {
+            p.z_ = ranks(p.z_);
+        }
+        p.valid_ = normalize(p.z_);
+        if (p.valid_ && max_lag) {
+            p.sum_.resize(points + 1);
+            p.sum_sq_.resize(points + 1);
+            p.sum_[0] = 0;
+            p.sum_sq_[0] = 0;
+            for (size_t i = 0; i < points; ++i) {
+                p.sum_[i + 1] = p.sum_[i] + p.z_[i];
+                p.sum_sq_[i + 1] = p.sum_sq_[i] + p.z_[i] * p.z_[i];
+            }
+        }
+    }
+
+    //Строки верхнего треугольника раздаются потокам по одной: работа по строкам неравномерна
+    pool.parallelFor(size, [&](size_t i) {
+        const PreparedSeries& x = prepared[i];
+        if (!x.valid_) return;
+        matrix.r_[i * size + i] = 1;
+        for (size_t j = i + 1; j < size; ++j) {
+            const PreparedSeries& y = prepared[j];
+            if (!y.valid_) continue;
+            double r = max(-1.0, min(1.0, dotProduct(x.z_.data(), y.z_.data(), points)));
+            int best_lag = 0;
+            for (int lag = 1; lag <= static_cast<int>(max_lag); ++lag) {
+                double r_forward = pearsonWithLag(x, y, lag);
+                if (fabs(r_forward) > fabs(r)) {
+                    r = r_forward;
+                    best_lag = lag;
+                }
+                double r_backward = pearsonWithLag(x, y, -lag);
+                if (fabs(r_backward) > fabs(r)) {
+                    r = r_backward;
+                    best_lag = -lag;
+                }
+            }
+            matrix.r_[i * size + j] = r;
+            matrix.r_[j * size + i] = r;
+            if (max_lag) {
+                matrix.lag_[i * size + j] = best_lag;
+                matrix.lag_[j * size + i] = -best_lag;
+            }
+        }
+    }, threads);
+
+    return matrix;
+}
+
+//Пропуски заполняются последним известным значением, начальные - первым известным
+vector<double> fillGaps(const vector<optional<double>>& series, bool& has_values) {
+    vector<double> values(series.size());
+    auto it_first = find_if(series.begin(), series.end(), [](const optional<double>& v) { return v.has_value(); });
+    has_values = it_first != series.end();
+    if (!has_values) return values;
+
+    double last = **it_first;
+    for (size_t i = 0; i < series.size(); ++i) {
+        if (series[i]) last = *series[i];
+        values[i] = last;
+    }
+    return values;
+}
+
+//Ранги с усреднением для равных значений
+vector<double> ranks(const vector<double>& values) {
+    vector<size_t> order(values.size());
+    iota(order.begin(), order.end(), 0);
+    sort(order.begin(), order.end(), [&values](size_t a, size_t b) { return values[a] < values[b]; });
+
+    vector<double> result(values.size());
+    for (size_t i = 0; i < order.size();) {
+        size_t j = i + 1;
+        while (j < order.size() && values[order[j]] == values[order[i]]) ++j;
+        double rank = (i + j - 1) / 2.0;
+        for (size_t k = i; k < j; ++k) {
+            result[order[k]] = rank;
+        }
+        i = j;
+    }
+    return result;
+}
+
+//Центрирование и приведение к единичной норме: после него r(x, y) = (x, y)
+bool normalize(vector<double>& values) {
+    if (values.empty()) return false;
+    double mean = accumulate(values.begin(), values.end(), 0.0) / values.size();
+    for (auto& v : values) {
+        v -= mean;
+    }
+    double norm = sqrt(dotProduct(values.data(), values.data(), values.size()));
+    if (norm <= numeric_limits<double>::epsilon() * values.size()) return false;
+    for (auto& v : values) {
+        v /= norm;
+    }
+    return true;
+}
+
+//Корреляция x(t) и y(t + lag) по перекрывающейся части рядов
+double pearsonWithLag(const PreparedSeries& x, const PreparedSeries& y, int lag) {
+    const size_t points = x.z_.size();
+    const size_t shift = static_cast<size_t>(lag < 0 ? -lag : lag);
+    const size_t m = points - shift;
+    const size_t x_begin = lag < 0 ? shift : 0;
+    const size_t y_begin = lag < 0 ? 0 : shift;
+
+    double sx = x.sum_[x_begin + m] - x.sum_[x_begin];
+    double sy = y.sum_[y_begin + m] - y.sum_[y_begin];
+    double sxx = x.sum_sq_[x_begin + m] - x.sum_sq_[x_begin];
+    double syy = y.sum_sq_[y_begin + m] - y.sum_sq_[y_begin];
+    double sxy = dotProduct(x.z_.data() + x_begin, y.z_.data() + y_begin, m);
+
+    double denominator = (m * sxx - sx * sx) * (m * syy - sy * sy);
+    if (denominator <= 0) return 0;
+    return max(-1.0, min(1.0, (m * sxy - sx * sy) / sqrt(denominator)));
+}
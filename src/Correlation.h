@@ -0,0 +1,33 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "WorkerPool.h"
+
+enum class CorrelationMethod {
+	Pearson,
+	Spearman
+};
+
+struct CorrelationMatrix {
+	std::size_t size_ = 0;
+	//Коэффициенты корреляции size_ x size_, NaN - ряд постоянный или пустой
+	std::vector<double> r_;
+	//Сдвиг второго ряда (в интервалах сетки), при котором достигнут максимум |r|
+	std::vector<int> lag_;
+	double at(std::size_t i, std::size_t j) const { return r_[i * size_ + j]; }
+	int lagAt(std::size_t i, std::size_t j) const { return lag_.empty() ? 0 : lag_[i * size_ + j]; }
+};
+
+//Ряды на общей сетке: series[k][i] - значение k-го ряда в i-м интервале.
+//Строки матрицы считаются в пуле, threads - предел числа потоков (0 - весь пул)
+CorrelationMatrix correlate(
+	const std::vector<std::vector<std::optional<double>>>& series,
+	CorrelationMethod method,
+	std::size_t max_lag,
+	WorkerPool& pool,
+	std::size_t threads);
+
+double dotProduct(const double* a, const double* b, std::size_t n);
@@ -0,0 +1,140 @@
+﻿#include "CounterCooking.h"
+
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+//Выборок в блоке расчета: предыдущие значения блока лежат в буферах на стеке
+constexpr size_t COOK_BLOCK = 256;
+
+bool cookFormula(uint32_t counter_type, CookFormula& formula) {
+    switch (counter_type) {
+    case 0x00000000:    //PERF_COUNTER_RAWCOUNT_HEX
+    case 0x00000100:    //PERF_COUNTER_LARGE_RAWCOUNT_HEX
+    case 0x00010000:    //PERF_COUNTER_RAWCOUNT
+    case 0x00010100:    //PERF_COUNTER_LARGE_RAWCOUNT
+        formula = CookFormula::Raw;
+        return true;
+    case 0x00400400:    //PERF_COUNTER_DELTA
+    case 0x00400500:    //PERF_COUNTER_LARGE_DELTA
+        formula = CookFormula::Delta;
+        return true;
+    case 0x10410400:    //PERF_COUNTER_COUNTER
+    case 0x10410500:    //PERF_COUNTER_BULK_COUNT
+        formula = CookFormula::Rate;
+        return true;
+    case 0x20410500:    //PERF_COUNTER_TIMER
+    case 0x20510500:    //PERF_100NSEC_TIMER
+    case 0x20570500:    //PERF_PRECISION_100NS_TIMER
+    case 0x20C20400:    //PERF_SAMPLE_FRACTION
+        formula = CookFormula::Fraction;
+        return true;
+    case 0x21410500:    //PERF_COUNTER_TIMER_INV
+    case 0x21510500:    //PERF_100NSEC_TIMER_INV
+        formula = CookFormula::FractionInverse;
+        return true;
+    case 0x00550500:    //PERF_COUNTER_100NS_QUEUELEN_TYPE
+    case 0x40020500:    //PERF_AVERAGE_BULK
+        formula = CookFormula::Ratio;
+        return true;
+    case 0x30020400:    //PERF_AVERAGE_TIMER
+        formula = CookFormula::AverageTimer;
+        return true;
+    case 0x20020400:    //PERF_RAW_FRACTION
+    case 0x20020500:    //PERF_LARGE_RAW_FRACTION
+        formula = CookFormula::RawFraction;
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool needsPrevious(CookFormula formula) {
+    return formula != CookFormula::Raw && formula != CookFormula::RawFraction;
+}
+
+//Предыдущие годные значения находятся проходом по блоку, формула считается циклом без ветвлений,
+//который компилятор векторизует; отбраковка по знаменателю и приращению - маской NaN
+void cookColumn(CookFormula formula, const int64_t* first, const int64_t* second, const bool* ok,
+    size_t count, double time_base, double scale, RawPrevious& previous, double* out, SampleStatus* status) {
+    const double nan = numeric_limits<double>::quiet_NaN();
+    const bool with_previous = needsPrevious(formula);
+    //Приращения в целых: сырые значения 64-разрядные, double терял бы младшие разряды
+    double dx[COOK_BLOCK];
+    double dy[COOK_BLOCK];
+    double x[COOK_BLOCK];
+    double y[COOK_BLOCK];
+    double rejected[COOK_BLOCK];  //0 - выборка годна, NaN - нет
+    for (size_t block = 0; block < count; block += COOK_BLOCK) {
+        const size_t n = min(COOK_BLOCK, count - block);
+        for (size_t k = 0; k < n; ++k) {
+            const size_t i = block + k;
+            x[k] = static_cast<double>(first[i]);
+            y[k] = static_cast<double>(second[i]);
+            rejected[k] = ok[i] ? 0.0 : nan;
+            if (!ok[i]) {
+                status[i] = SampleStatus::Invalid;
+                dx[k] = nan;
+                dy[k] = nan;
+                continue;
+            }
+            if (with_previous && !previous.valid_) {
+                status[i] = SampleStatus::FirstSample;
+                dx[k] = nan;
+                dy[k] = nan;
+            }
+            else {
+                status[i] = SampleStatus::Invalid;
+                dx[k] = static_cast<double>(first[i] - previous.first_);
+                dy[k] = static_cast<double>(second[i] - previous.second_);
+            }
+            previous = { true, first[i], second[i] };
+        }
+
+        double* block_out = out + block;
+        //Недопустимое значение дает NaN-добавку, деление остается безусловным
+        switch (formula) {
+        case CookFormula::Raw:
+            for (size_t k = 0; k < n; ++k) {
+                block_out[k] = x[k] * scale + rejected[k];
+            }
+            break;
+        case CookFormula::Delta:
+            for (size_t k = 0; k < n; ++k) {
+                block_out[k] = dx[k] * scale;
+            }
+            break;
+        case CookFormula::Rate:
+            for (size_t k = 0; k < n; ++k) {
+                block_out[k] = dx[k] * time_base / dy[k] * scale + (dy[k] > 0 && dx[k] >= 0 ? 0.0 : nan);
+            }
+            break;
+        case CookFormula::Fraction:
+            for (size_t k = 0; k < n; ++k) {
+                block_out[k] = 100.0 * dx[k] / dy[k] * scale + (dy[k] > 0 && dx[k] >= 0 ? 0.0 : nan);
+            }
+            break;
+        case CookFormula::FractionInverse:
+            for (size_t k = 0; k < n; ++k) {
+                block_out[k] = 100.0 * (1.0 - dx[k] / dy[k]) * scale + (dy[k] > 0 && dx[k] >= 0 ? 0.0 : nan);
+            }
+            break;
+        case CookFormula::Ratio:
+            for (size_t k = 0; k < n; ++k) {
+                block_out[k] = dx[k] / dy[k] * scale + (dy[k] > 0 && dx[k] >= 0 ? 0.0 : nan);
+            }
+            break;
+        case CookFormula::AverageTimer:
+            for (size_t k = 0; k < n; ++k) {
+                block_out[k] = dx[k] / time_base / dy[k] * scale + (dy[k] > 0 && dx[k] >= 0 && time_base > 0 ? 0.0 : nan);
+            }
+            break;
+        case CookFormula::RawFraction:
+            for (size_t k = 0; k < n; ++k) {
+                block_out[k] = 100.0 * x[k] / y[k] * scale + rejected[k] + (y[k] > 0 ? 0.0 : nan);
+            }
+            break;
+        }
+    }
+}
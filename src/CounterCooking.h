@@ -0,0 +1,37 @@
+﻿#pragma once
+
+#include <cstdint>
+
+#include "CounterSource.h"
+
+//Формулы вычисления значений счетчиков Performance Data по сырым выборкам.
+//x - первое сырое значение, y - второе (время или база), 0 - предыдущая годная выборка, TB - частота времени
+enum class CookFormula {
+	Raw,				//x
+	Delta,				//x - x0
+	Rate,				//(x - x0) / ((y - y0) / TB)
+	Fraction,			//100 * (x - x0) / (y - y0)
+	FractionInverse,	//100 * (1 - (x - x0) / (y - y0))
+	Ratio,				//(x - x0) / (y - y0)
+	AverageTimer,		//(x - x0) / TB / (y - y0)
+	RawFraction			//100 * x / y
+};
+
+//Формула по типу счетчика (dwType из WinPerf.h); false - тип вычисляется только PDH
+bool cookFormula(std::uint32_t counter_type, CookFormula& formula);
+
+//Формуле нужна предыдущая выборка
+bool needsPrevious(CookFormula formula);
+
+//Последняя годная выборка перед блоком, сбрасывается в начале сканирования
+struct RawPrevious {
+	bool valid_ = false;
+	std::int64_t first_ = 0;
+	std::int64_t second_ = 0;
+};
+
+//Значения блока выборок одного счетчика. first, second - сырые значения, ok - выборка годна.
+//out - значение или NaN, тогда status - причина: первая выборка без предыдущей или ошибочная выборка
+//(в том числе неположительный знаменатель и отрицательное приращение). scale - множитель шкалы счетчика
+void cookColumn(CookFormula formula, const std::int64_t* first, const std::int64_t* second, const bool* ok,
+	std::size_t count, double time_base, double scale, RawPrevious& previous, double* out, SampleStatus* status);
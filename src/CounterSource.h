@@ -0,0 +1,119 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//Описание счетчика в каталоге: национальные и английские имена частей пути
+struct CounterInfo {
+	std::wstring computer_;
+	std::wstring object_;
+	std::wstring instances_;
+	std::wstring counter_;
+	std::wstring national_name_;
+	std::wstring computer_eng_;
+	std::wstring object_eng_;
+	std::wstring instances_eng_;
+	std::wstring counter_eng_;
+	std::wstring english_name_;
+};
+
+//Оценка памяти каталога: описания счетчиков и строки имен
+inline std::size_t catalogBytes(const std::vector<CounterInfo>& counters) {
+	std::size_t bytes = counters.capacity() * sizeof(CounterInfo);
+	for (auto& info : counters) {
+		bytes += (info.computer_.size() + info.object_.size() + info.instances_.size() + info.counter_.size()
+			+ info.national_name_.size() + info.computer_eng_.size() + info.object_eng_.size()
+			+ info.instances_eng_.size() + info.counter_eng_.size() + info.english_name_.size()) * sizeof(wchar_t);
+	}
+	return bytes;
+}
+
+//Причина, по которой выборка счетчика в записи не дала значения
+enum class SampleStatus {
+	Invalid,		//ошибочный статус выборки или ошибка вычисления значения
+	FirstSample,	//первая выборка сканирования: значению скорости нужна предыдущая
+	Missing			//счетчика нет в записи: экземпляр отсутствует или пропуск компьютера
+};
+
+//Качество выборок счетчика: значения, отброшенные выборки и наибольший разрыв между значениями
+struct CounterQuality {
+	std::uint64_t valid_ = 0;
+	std::uint64_t invalid_ = 0;
+	std::uint64_t first_skipped_ = 0;
+	std::uint64_t gaps_ = 0;
+	std::uint64_t longest_gap_ = 0;		//тики
+	std::uint64_t last_time_ = 0;		//время последнего значения для расчета разрыва
+
+	void value(std::uint64_t timestamp) {
+		if (last_time_ && timestamp > last_time_ && timestamp - last_time_ > longest_gap_) {
+			longest_gap_ = timestamp - last_time_;
+		}
+		if (timestamp > last_time_) last_time_ = timestamp;
+		++valid_;
+	}
+	void skipped(SampleStatus status) {
+		if (status == SampleStatus::Invalid) ++invalid_;
+		else if (status == SampleStatus::FirstSample) ++first_skipped_;
+		else ++gaps_;
+	}
+	void add(const CounterQuality& other) {
+		valid_ += other.valid_;
+		invalid_ += other.invalid_;
+		first_skipped_ += other.first_skipped_;
+		gaps_ += other.gaps_;
+		if (other.longest_gap_ > longest_gap_) longest_gap_ = other.longest_gap_;
+	}
+};
+
+//Приемник значений при сканировании источника
+class ValueSink {
+public:
+	virtual ~ValueSink() = default;
+	//column - позиция счетчика в списке, переданном в scan
+	virtual void value(std::size_t column, std::uint64_t timestamp, double value) = 0;
+	//Выборка счетчика в записи не дала значения
+	virtual void skipped(std::size_t, SampleStatus) {}
+	//Конец очередной записи (выборки) источника
+	virtual void endRecord() {}
+	//true - записи нужны строго по времени для всех столбцов вместе (выгрузка строками).
+	//Остальным приемникам достаточно порядка времени внутри столбца
+	virtual bool ordered() const { return false; }
+};
+
+template<typename OnValue>
+class CallbackSink : public ValueSink {
+public:
+	explicit CallbackSink(OnValue on_value) : on_value_(on_value) {}
+	void value(std::size_t column, std::uint64_t timestamp, double value) override { on_value_(column, timestamp, value); }
+private:
+	OnValue on_value_;
+};
+
+template<typename OnValue>
+CallbackSink<OnValue> makeSink(OnValue on_value) { return CallbackSink<OnValue>(on_value); }
+
+//Источник значений счетчиков: файлы журналов PDH, локальный сборщик и т.п.
+//Время - тики FILETIME (см. Conversion.h)
+class CounterSource {
+public:
+	virtual ~CounterSource() = default;
+	//Построение каталога счетчиков и определение периода данных
+	virtual bool read() = 0;
+	virtual const std::vector<CounterInfo>& counters() const = 0;
+	virtual std::uint64_t startTime() const = 0;
+	virtual std::uint64_t endTime() const = 0;
+	//Вычисленные значения выбранных счетчиков за период в порядке времени
+	virtual bool scan(std::uint64_t start, std::uint64_t end, const std::vector<std::size_t>& counters, ValueSink& sink) = 0;
+	//Число записей за период, но не больше limit + 1
+	virtual std::uint64_t countRecords(std::uint64_t start, std::uint64_t end, std::uint64_t limit) = 0;
+	//false - счетчик не удалось добавить в запрос, значений у него не будет
+	virtual bool available(std::size_t) const { return true; }
+	//Учет данных, появившихся после read(); true - конец периода сдвинулся
+	virtual bool refresh() { return false; }
+	//Память каталога и собственных буферов источника после read(), байт
+	virtual std::size_t memoryUsage() const { return catalogBytes(counters()); }
+	const std::wstring& error() const { return error_; }
+protected:
+	std::wstring error_;
+};
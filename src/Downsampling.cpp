@@ -0,0 +1,154 @@
+﻿#include "Downsampling.h"
+#include "Conversion.h"
+
+#include <cmath>
+
+using namespace std;
+
+bool downsamplingModeFromString(const string& name, DownsamplingMode& mode) {
+    if (name == "max") mode = DownsamplingMode::Max;
+    else if (name == "min") mode = DownsamplingMode::Min;
+    else if (name == "avg") mode = DownsamplingMode::Avg;
+    else if (name == "m4") mode = DownsamplingMode::M4;
+    else if (name == "lttb") mode = DownsamplingMode::Lttb;
+    else return false;
+    return true;
+}
+
+size_t pointsPerBucket(DownsamplingMode mode) {
+    return mode == DownsamplingMode::M4 ? 4 : 1;
+}
+
+uint64_t alignedBucketWidth(uint64_t span, uint64_t points) {
+    static const uint64_t units[] = {
+        1, 2, 5, 10, 15, 30,
+        60, 2 * 60, 5 * 60, 10 * 60, 15 * 60, 30 * 60,
+        3600, 2 * 3600, 3 * 3600, 6 * 3600, 12 * 3600,
+        86400, 7 * 86400
+    };
+    if (!points) points = 1;
+    const uint64_t min_width = span / points + 1;
+    for (uint64_t unit : units) {
+        if (unit * TICKS_PER_SECOND >= min_width) return unit * TICKS_PER_SECOND;
+    }
+    const uint64_t week = 7 * 86400 * TICKS_PER_SECOND;
+    return (min_width + week - 1) / week * week;
+}
+
+void BucketAggregate::add(uint64_t time, double value) {
+    if (!count_) {
+        first_time_ = last_time_ = min_time_ = max_time_ = time;
+        first_ = last_ = min_ = max_ = value;
+    }
+    else {
+        //Значения приходят в порядке времени, но на стыке файлов порядок не гарантирован
+        if (time < first_time_) {
+            first_time_ = time;
+            first_ = value;
+        }
+        if (time >= last_time_) {
+            last_time_ = time;
+            last_ = value;
+        }
+        if (value < min_) {
+            min_ = value;
+            min_time_ = time;
+        }
+        if (value > max_) {
+            max_ = value;
+            max_time_ = time;
+        }
+    }
+    sum_ += value;
+    ++count_;
+}
+
+optional<double> BucketAggregate::value(DownsamplingMode mode) const {
+    if (!count_) return {};
+    switch (mode) {
+    case DownsamplingMode::Min: return min_;
+    case DownsamplingMode::Avg: return sum_ / count_;
+    default: return max_;
+    }
+}
+
+void BucketAggregate::m4(optional<double> values[4]) const {
+    if (!count_) {
+        for (size_t i = 0; i < 4; ++i) values[i].reset();
+        return;
+    }
+    values[0] = first_;
+    if (min_time_ <= max_time_) {
+        values[1] = min_;
+        values[2] = max_;
+    }
+    else {
+        values[1] = max_;
+        values[2] = min_;
+    }
+    values[3] = last_;
+}
+
+vector<optional<double>> lttb(const BucketAggregate* aggregates, size_t buckets, size_t stride) {
+    vector<optional<double>> result(buckets);
+
+    //Опорная точка - выбранная в предыдущем непустом интервале
+    bool has_anchor = false;
+    double anchor_time = 0;
+    double anchor_value = 0;
+
+    //Следующий непустой интервал для каждого интервала - обратным проходом, buckets - нет такого
+    vector<size_t> next_filled(buckets);
+    for (size_t b = buckets, next = buckets; b-- > 0;) {
+        next_filled[b] = next;
+        if (aggregates[b * stride].count_) next = b;
+    }
+
+    for (size_t b = 0; b < buckets; ++b) {
+        const BucketAggregate& current = aggregates[b * stride];
+        if (!current.count_) continue;
+
+        //Среднее следующего непустого интервала - третья вершина треугольника
+        const BucketAggregate* next = next_filled[b] < buckets ? &aggregates[next_filled[b] * stride] : nullptr;
+
+        double selected_time;
+        double selected_value;
+        if (!has_anchor) {
+            selected_time = static_cast<double>(current.first_time_);
+            selected_value = current.first_;
+        }
+        else if (!next) {
+            selected_time = static_cast<double>(current.last_time_);
+            selected_value = current.last_;
+        }
+        else {
+            double next_time = (static_cast<double>(next->first_time_) + static_cast<double>(next->last_time_)) / 2;
+            double next_value = next->sum_ / next->count_;
+            const pair<uint64_t, double> candidates[4] = {
+                { current.first_time_, current.first_ },
+                { current.min_time_, current.min_ },
+                { current.max_time_, current.max_ },
+                { current.last_time_, current.last_ }
+            };
+            double max_area = -1;
+            selected_time = 0;
+            selected_value = 0;
+            for (const auto& candidate : candidates) {
+                double t = static_cast<double>(candidate.first);
+                double area = fabs((anchor_time - next_time) * (candidate.second - anchor_value)
+                    - (anchor_time - t) * (next_value - anchor_value));
+                if (area > max_area) {
+                    max_area = area;
+                    selected_time = t;
+                    selected_value = candidate.second;
+                }
+            }
+        }
+
+        result[b] = selected_value;
+        has_anchor = true;
+        anchor_time = selected_time;
+        anchor_value = selected_value;
+    }
+    return result;
+}
@@ -0,0 +1,46 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+enum class DownsamplingMode {
+	Max,	//максимум за интервал
+	Min,	//минимум за интервал
+	Avg,	//среднее за интервал
+	M4,		//первое, минимум, максимум, последнее значение интервала
+	Lttb	//Largest-Triangle-Three-Buckets по кандидатам M4
+};
+
+bool downsamplingModeFromString(const std::string& name, DownsamplingMode& mode);
+
+//Число выходных точек на один интервал сетки
+std::size_t pointsPerBucket(DownsamplingMode mode);
+
+//Ширина выровненного интервала в тиках: наименьшая естественная единица (1 с, 5 с, 1 мин, 5 мин, 1 ч...),
+//при которой на диапазон span приходится не больше points полных интервалов. Кратные ширине границы
+//отсчитываются от начала эпохи FILETIME, поэтому сутки и недели начинаются в полночь понедельника
+std::uint64_t alignedBucketWidth(std::uint64_t span, std::uint64_t points);
+
+//Потоковый агрегат значений одного счетчика в одном интервале
+struct BucketAggregate {
+	std::uint64_t first_time_ = 0;
+	std::uint64_t last_time_ = 0;
+	std::uint64_t min_time_ = 0;
+	std::uint64_t max_time_ = 0;
+	double first_ = 0;
+	double last_ = 0;
+	double min_ = 0;
+	double max_ = 0;
+	double sum_ = 0;
+	std::uint32_t count_ = 0;
+
+	void add(std::uint64_t time, double value);
+	std::optional<double> value(DownsamplingMode mode) const;
+	//Значения в порядке времени: первое, экстремумы по порядку, последнее
+	void m4(std::optional<double> values[4]) const;
+};
+
+//Выбор одного значения на интервал по LTTB. Агрегаты ряда лежат с шагом stride
+std::vector<std::optional<double>> lttb(const BucketAggregate* aggregates, std::size_t buckets, std::size_t stride);
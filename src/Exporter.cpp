@@ -0,0 +1,489 @@
+﻿#include "Exporter.h"
+#include "Conversion.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+
+using namespace std;
+
+constexpr size_t WRITE_BUFFER_SIZE = 4 * 1024 * 1024;
+constexpr size_t BATCH_BYTES = 4 * 1024 * 1024;
+constexpr size_t MAX_QUEUED_BATCHES = 3;
+
+//Смещение FILETIME (100 нс с 1601 года) относительно 1970 года
+constexpr uint64_t FILETIME_UNIX_EPOCH = 116444736000000000ULL;
+
+//Минимальный построитель flatbuffers для метаданных Arrow. Объекты пишутся от начала
+//буфера к концу: таблица раньше своих дочерних объектов, смещения дописываются после
+class FlatBuffer {
+public:
+    struct Field {
+        uint16_t id_;
+        uint8_t size_;      //0 - смещение на дочерний объект
+        uint64_t value_;
+    };
+
+    FlatBuffer() : data_(4, 0) {}
+
+    //Возвращает позицию таблицы, в offsets - позиции полей-смещений в порядке fields
+    size_t table(const vector<Field>& fields, vector<size_t>& offsets) {
+        uint16_t slots = 0;
+        for (auto& field : fields) slots = max<uint16_t>(slots, field.id_ + 1);
+
+        vector<const Field*> ordered;
+        for (auto& field : fields) ordered.push_back(&field);
+        stable_sort(ordered.begin(), ordered.end(), [](const Field* a, const Field* b) { return fieldSize(*a) > fieldSize(*b); });
+
+        vector<uint16_t> vtable(slots, 0);
+        vector<size_t> inline_offsets(fields.size());
+        size_t table_size = 4;
+        for (auto field : ordered) {
+            size_t size = fieldSize(*field);
+            table_size = (table_size + size - 1) / size * size;
+            vtable[field->id_] = static_cast<uint16_t>(table_size);
+            inline_offsets[field - &fields[0]] = table_size;
+            table_size += size;
+        }
+
+        pad(2);
+        size_t vtable_pos = data_.size();
+        append<uint16_t>(static_cast<uint16_t>(4 + 2 * slots));
+        append<uint16_t>(static_cast<uint16_t>(table_size));
+        for (auto offset : vtable) append<uint16_t>(offset);
+
+        pad(8);
+        size_t table_pos = data_.size();
+        data_.resize(table_pos + table_size, 0);
+        put<int32_t>(table_pos, static_cast<int32_t>(table_pos - vtable_pos));
+        offsets.clear();
+        for (size_t i = 0; i < fields.size(); ++i) {
+            size_t pos = table_pos + inline_offsets[i];
+            if (fields[i].size_) {
+                memcpy(&data_[pos], &fields[i].value_, fields[i].size_);
+            }
+            else {
+                offsets.push_back(pos);
+            }
+        }
+        return table_pos;
+    }
+
+    //Вектор из count элементов; элементы начинаются с позиции + 4
+    size_t vectorOf(size_t count, size_t element_size, size_t element_align) {
+        pad(4);
+        while ((data_.size() + 4) % element_align) append<uint32_t>(0);
+        size_t pos = data_.size();
+        append<uint32_t>(static_cast<uint32_t>(count));
+        data_.resize(data_.size() + count * element_size, 0);
+        return pos;
+    }
+
+    size_t string(const std::string& str) {
+        pad(4);
+        size_t pos = data_.size();
+        append<uint32_t>(static_cast<uint32_t>(str.size()));
+        data_.insert(data_.end(), str.begin(), str.end());
+        data_.push_back(0);
+        return pos;
+    }
+
+    void patch(size_t field_pos, size_t target_pos) {
+        put<uint32_t>(field_pos, static_cast<uint32_t>(target_pos - field_pos));
+    }
+
+    void root(size_t table_pos) { patch(0, table_pos); }
+
+    template<typename T>
+    void put(size_t pos, T value) { memcpy(&data_[pos], &value, sizeof(T)); }
+
+    const vector<uint8_t>& data() const { return data_; }
+
+private:
+    static size_t fieldSize(const Field& field) { return field.size_ ? field.size_ : 4; }
+
+    template<typename T>
+    void append(T value) {
+        size_t pos = data_.size();
+        data_.resize(pos + sizeof(T));
+        put<T>(pos, value);
+    }
+
+    void pad(size_t align) {
+        while (data_.size() % align) data_.push_back(0);
+    }
+
+    vector<uint8_t> data_;
+};
+
+size_t writeArrowSchema(FlatBuffer& fb, const vector<string>& columns);
+size_t alignTo8(size_t size);
+
+//Версия метаданных Arrow V5 и типы заголовков сообщений
+constexpr uint16_t ARROW_METADATA_V5 = 4;
+constexpr uint8_t ARROW_HEADER_SCHEMA = 1;
+constexpr uint8_t ARROW_HEADER_RECORD_BATCH = 3;
+constexpr uint8_t ARROW_TYPE_FLOATING_POINT = 3;
+constexpr uint8_t ARROW_TYPE_TIMESTAMP = 10;
+
+bool exportFormatFromString(const string& name, ExportFormat& format) {
+    if (name == "csv") format = ExportFormat::Csv;
+    else if (name == "arrow") format = ExportFormat::Arrow;
+    else return false;
+    return true;
+}
+
+ExportBatch::ExportBatch(size_t columns, size_t capacity) :
+    columns_(columns),
+    capacity_(capacity),
+    times_(capacity),
+    values_(columns * capacity),
+    valid_(columns * capacity, 0) {}
+
+void ExportBatch::clear() {
+    rows_ = 0;
+    fill(valid_.begin(), valid_.end(), 0);
+}
+
+Exporter::Exporter(ExportFormat format, const filesystem::path& path, vector<string> columns) :
+    format_(format),
+    path_(path),
+    columns_(move(columns)) {
+    //Пачка порядка BATCH_BYTES, но не меньше 256 строк
+    batch_rows_ = max<size_t>(256, BATCH_BYTES / (columns_.size() * (sizeof(double) + 1) + sizeof(uint64_t)));
+}
+
+Exporter::~Exporter() {
+    if (writer_.joinable()) {
+        finish();
+    }
+}
+
+bool Exporter::start() {
+    file_.open(path_, ios::binary | ios::trunc);
+    if (!file_) {
+        error_ = u8"Не удалось открыть файл для записи: " + path_.u8string();
+        return false;
+    }
+    buffer_.resize(WRITE_BUFFER_SIZE);
+
+    if (format_ == ExportFormat::Csv) encodeCsvHeader();
+    else encodeArrowHeader();
+
+    filling_ = make_unique<ExportBatch>(columns_.size(), batch_rows_);
+    writer_ = thread(&Exporter::writerLoop, this);
+    return true;
+}
+
+void Exporter::beginRow(uint64_t time) {
+    filling_->times_[filling_->rows_] = time;
+}
+
+void Exporter::setValue(size_t column, double value) {
+    size_t index = column * filling_->capacity_ + filling_->rows_;
+    filling_->values_[index] = value;
+    filling_->valid_[index] = 1;
+}
+
+void Exporter::endRow() {
+    ++filling_->rows_;
+    ++rows_;
+    if (filling_->full()) {
+        pushBatch();
+    }
+}
+
+void Exporter::pushBatch() {
+    unique_lock<mutex> lock(mutex_);
+    cv_.wait(lock, [this]() { return queue_.size() < MAX_QUEUED_BATCHES; });
+    queue_.push_back(move(filling_));
+    if (free_.empty()) {
+        filling_ = make_unique<ExportBatch>(columns_.size(), batch_rows_);
+    }
+    else {
+        filling_ = move(free_.back());
+        free_.pop_back();
+    }
+    lock.unlock();
+    cv_.notify_all();
+}
+
+bool Exporter::finish() {
+    if (!writer_.joinable()) return error_.empty();
+
+    if (filling_ && filling_->rows_) {
+        pushBatch();
+    }
+    {
+        lock_guard<mutex> lock(mutex_);
+        finished_ = true;
+    }
+    cv_.notify_all();
+    writer_.join();
+
+    if (format_ == ExportFormat::Arrow) encodeArrowFooter();
+    flush();
+    file_.close();
+    if (file_.fail() && error_.empty()) {
+        error_ = u8"Ошибка записи в файл: " + path_.u8string();
+    }
+    return error_.empty();
+}
+
+void Exporter::writerLoop() {
+    for (;;) {
+        unique_lock<mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return !queue_.empty() || finished_; });
+        if (queue_.empty()) break;
+        unique_ptr<ExportBatch> batch = move(queue_.front());
+        queue_.pop_front();
+        lock.unlock();
+        cv_.notify_all();
+
+        encode(*batch);
+        batch->clear();
+
+        lock.lock();
+        free_.push_back(move(batch));
+    }
+}
+
+void Exporter::encode(const ExportBatch& batch) {
+    if (format_ == ExportFormat::Csv) encodeCsv(batch);
+    else encodeArrow(batch);
+}
+
+void Exporter::write(const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    bytes_ += size;
+    while (size) {
+        size_t chunk = min(size, buffer_.size() - buffer_used_);
+        memcpy(&buffer_[buffer_used_], p, chunk);
+        buffer_used_ += chunk;
+        p += chunk;
+        size -= chunk;
+        if (buffer_used_ == buffer_.size()) flush();
+    }
+}
+
+void Exporter::flush() {
+    if (!buffer_used_) return;
+    file_.write(buffer_.data(), buffer_used_);
+    if (!file_ && error_.empty()) {
+        error_ = u8"Ошибка записи в файл: " + path_.u8string();
+    }
+    buffer_used_ = 0;
+}
+
+void Exporter::encodeCsvHeader() {
+    string header = "\"(PDH-CSV 4.0)\"";
+    for (auto& column : columns_) {
+        header += ",\"";
+        for (char c : column) {
+            if (c == '"') header += '"';
+            header += c;
+        }
+        header += '"';
+    }
+    header += "\r\n";
+    write(header.data(), header.size());
+}
+
+void Exporter::encodeCsv(const ExportBatch& batch) {
+    //Строка собирается в локальном буфере: время, затем значения в кавычках
+    vector<char> line(32 + batch.columns_ * 32);
+    for (size_t row = 0; row < batch.rows_; ++row) {
+        char* p = line.data();
+        *p++ = '"';
+        p += ticksToCsv(batch.times_[row], p);
+        *p++ = '"';
+        for (size_t column = 0; column < batch.columns_; ++column) {
+            size_t index = column * batch.capacity_ + row;
+            *p++ = ',';
+            *p++ = '"';
+            if (batch.valid_[index]) {
+                p = to_chars(p, p + 30, batch.values_[index]).ptr;
+            }
+            else {
+                *p++ = ' ';
+            }
+            *p++ = '"';
+        }
+        *p++ = '\r';
+        *p++ = '\n';
+        write(line.data(), p - line.data());
+    }
+}
+
+void Exporter::encodeArrowHeader() {
+    const char magic[8] = { 'A', 'R', 'R', 'O', 'W', '1', 0, 0 };
+    write(magic, sizeof(magic));
+
+    FlatBuffer fb;
+    vector<size_t> offsets;
+    size_t message = fb.table({
+        { 0, 2, ARROW_METADATA_V5 },
+        { 1, 1, ARROW_HEADER_SCHEMA },
+        { 2, 0, 0 },
+        { 3, 8, 0 } }, offsets);
+    fb.root(message);
+    fb.patch(offsets[0], writeArrowSchema(fb, columns_));
+
+    const auto& data = fb.data();
+    uint32_t continuation = 0xFFFFFFFF;
+    int32_t meta_length = static_cast<int32_t>(alignTo8(data.size()));
+    write(&continuation, sizeof(continuation));
+    write(&meta_length, sizeof(meta_length));
+    write(data.data(), data.size());
+    const char zeros[8] = {};
+    write(zeros, meta_length - data.size());
+}
+
+void Exporter::encodeArrow(const ExportBatch& batch) {
+    const size_t rows = batch.rows_;
+    const size_t values_size = alignTo8(rows * sizeof(double));
+    const size_t bitmap_size = alignTo8((rows + 7) / 8);
+
+    //Тело: значения времени, затем для каждого столбца битовая маска и значения
+    vector<int64_t> null_counts(batch.columns_, 0);
+    for (size_t column = 0; column < batch.columns_; ++column) {
+        const uint8_t* valid = &batch.valid_[column * batch.capacity_];
+        null_counts[column] = rows - count(valid, valid + rows, 1);
+    }
+    const int64_t body_length = values_size + batch.columns_ * (bitmap_size + values_size);
+
+    FlatBuffer fb;
+    vector<size_t> offsets;
+    size_t message = fb.table({
+        { 0, 2, ARROW_METADATA_V5 },
+        { 1, 1, ARROW_HEADER_RECORD_BATCH },
+        { 2, 0, 0 },
+        { 3, 8, static_cast<uint64_t>(body_length) } }, offsets);
+    fb.root(message);
+
+    vector<size_t> batch_offsets;
+    size_t record_batch = fb.table({
+        { 0, 8, rows },
+        { 1, 0, 0 },
+        { 2, 0, 0 } }, batch_offsets);
+    fb.patch(offsets[0], record_batch);
+
+    size_t nodes = fb.vectorOf(batch.columns_ + 1, 16, 8);
+    fb.patch(batch_offsets[0], nodes);
+    for (size_t column = 0; column <= batch.columns_; ++column) {
+        size_t pos = nodes + 4 + column * 16;
+        fb.put<int64_t>(pos, rows);
+        fb.put<int64_t>(pos + 8, column ? null_counts[column - 1] : 0);
+    }
+
+    size_t buffers = fb.vectorOf(2 * (batch.columns_ + 1), 16, 8);
+    fb.patch(batch_offsets[1], buffers);
+    int64_t offset = 0;
+    auto addBuffer = [&fb, &offset, buffers](size_t index, int64_t length) {
+        fb.put<int64_t>(buffers + 4 + index * 16, offset);
+        fb.put<int64_t>(buffers + 4 + index * 16 + 8, length);
+        offset += length;
+    };
+    addBuffer(0, 0);
+    addBuffer(1, values_size);
+    for (size_t column = 0; column < batch.columns_; ++column) {
+        addBuffer(2 + 2 * column, bitmap_size);
+        addBuffer(3 + 2 * column, values_size);
+    }
+
+    const auto& data = fb.data();
+    ArrowBlock block;
+    block.offset_ = static_cast<int64_t>(bytes_);
+    block.meta_length_ = static_cast<int32_t>(8 + alignTo8(data.size()));
+    block.body_length_ = body_length;
+    arrow_blocks_.push_back(block);
+
+    uint32_t continuation = 0xFFFFFFFF;
+    int32_t meta_length = block.meta_length_ - 8;
+    const char zeros[8] = {};
+    write(&continuation, sizeof(continuation));
+    write(&meta_length, sizeof(meta_length));
+    write(data.data(), data.size());
+    write(zeros, meta_length - data.size());
+
+    vector<int64_t> times(rows);
+    for (size_t row = 0; row < rows; ++row) {
+        times[row] = static_cast<int64_t>(batch.times_[row] - FILETIME_UNIX_EPOCH) / 10000;
+    }
+    write(times.data(), rows * sizeof(int64_t));
+    write(zeros, values_size - rows * sizeof(int64_t));
+
+    vector<uint8_t> bitmap(bitmap_size);
+    for (size_t column = 0; column < batch.columns_; ++column) {
+        const uint8_t* valid = &batch.valid_[column * batch.capacity_];
+        fill(bitmap.begin(), bitmap.end(), 0);
+        for (size_t row = 0; row < rows; ++row) {
+            bitmap[row >> 3] |= valid[row] << (row & 7);
+        }
+        write(bitmap.data(), bitmap_size);
+        write(&batch.values_[column * batch.capacity_], rows * sizeof(double));
+        write(zeros, values_size - rows * sizeof(double));
+    }
+}
+
+void Exporter::encodeArrowFooter() {
+    //Признак конца потока
+    const uint32_t eos[2] = { 0xFFFFFFFF, 0 };
+    write(eos, sizeof(eos));
+
+    FlatBuffer fb;
+    vector<size_t> offsets;
+    size_t footer = fb.table({
+        { 0, 2, ARROW_METADATA_V5 },
+        { 1, 0, 0 },
+        { 2, 0, 0 },
+        { 3, 0, 0 } }, offsets);
+    fb.root(footer);
+    fb.patch(offsets[0], writeArrowSchema(fb, columns_));
+    fb.patch(offsets[1], fb.vectorOf(0, 24, 8));
+    size_t blocks = fb.vectorOf(arrow_blocks_.size(), 24, 8);
+    fb.patch(offsets[2], blocks);
+    for (size_t i = 0; i < arrow_blocks_.size(); ++i) {
+        size_t pos = blocks + 4 + i * 24;
+        fb.put<int64_t>(pos, arrow_blocks_[i].offset_);
+        fb.put<int32_t>(pos + 8, arrow_blocks_[i].meta_length_);
+        fb.put<int64_t>(pos + 16, arrow_blocks_[i].body_length_);
+    }
+
+    const auto& data = fb.data();
+    write(data.data(), data.size());
+    int32_t footer_length = static_cast<int32_t>(data.size());
+    write(&footer_length, sizeof(footer_length));
+    const char magic[6] = { 'A', 'R', 'R', 'O', 'W', '1' };
+    write(magic, sizeof(magic));
+}
+
+size_t writeArrowSchema(FlatBuffer& fb, const vector<string>& columns) {
+    vector<size_t> offsets;
+    size_t schema = fb.table({ { 0, 2, 0 }, { 1, 0, 0 } }, offsets);
+    size_t fields = fb.vectorOf(columns.size() + 1, 4, 4);
+    fb.patch(offsets[0], fields);
+
+    for (size_t k = 0; k <= columns.size(); ++k) {
+        vector<size_t> field_offsets;
+        size_t field = fb.table({
+            { 0, 0, 0 },
+            { 1, 1, k ? 1u : 0u },
+            { 2, 1, k ? ARROW_TYPE_FLOATING_POINT : ARROW_TYPE_TIMESTAMP },
+            { 3, 0, 0 },
+            { 5, 0, 0 } }, field_offsets);
+        fb.patch(fields + 4 + 4 * k, field);
+        fb.patch(field_offsets[0], fb.string(k ? columns[k - 1] : "time"));
+
+        vector<size_t> none;
+        //Timestamp: единица MILLISECOND; FloatingPoint: точность DOUBLE
+        size_t type = fb.table({ { 0, 2, k ? 2u : 1u } }, none);
+        fb.patch(field_offsets[1], type);
+        fb.patch(field_offsets[2], fb.vectorOf(0, 4, 4));
+    }
+    return schema;
+}
+
+size_t alignTo8(size_t size) {
+    return (size + 7) / 8 * 8;
+}
@@ -0,0 +1,88 @@
+﻿#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class ExportFormat {
+	Csv,	//CSV в формате Performance monitor (PDH-CSV 4.0)
+	Arrow	//Apache Arrow IPC file (Feather v2): время timestamp[ms] и столбцы double
+};
+
+bool exportFormatFromString(const std::string& name, ExportFormat& format);
+
+//Пачка строк в столбцовом виде: значения столбца col лежат в values_[col * capacity_ + row]
+struct ExportBatch {
+	ExportBatch(std::size_t columns, std::size_t capacity);
+	std::size_t columns_;
+	std::size_t capacity_;
+	std::size_t rows_ = 0;
+	std::vector<std::uint64_t> times_;
+	std::vector<double> values_;
+	std::vector<std::uint8_t> valid_;
+	bool full() const { return rows_ == capacity_; }
+	void clear();
+};
+
+//Конвейер выгрузки: вызывающий поток заполняет пачки, поток записи кодирует их
+//и пишет в файл крупными последовательными блоками. Очередь ограничена, поэтому
+//память не зависит от длины выгружаемого периода
+class Exporter {
+public:
+	Exporter(ExportFormat format, const std::filesystem::path& path, std::vector<std::string> columns);
+	~Exporter();
+	bool start();
+	//Начало строки с меткой времени FILETIME; значения строки задаются через setValue
+	void beginRow(std::uint64_t time);
+	void setValue(std::size_t column, double value);
+	void endRow();
+	bool finish();
+	std::uint64_t rows() const { return rows_; }
+	std::uint64_t bytes() const { return bytes_; }
+	const std::string& error() const { return error_; }
+private:
+	void writerLoop();
+	void encode(const ExportBatch& batch);
+	void encodeCsvHeader();
+	void encodeCsv(const ExportBatch& batch);
+	void encodeArrowHeader();
+	void encodeArrow(const ExportBatch& batch);
+	void encodeArrowFooter();
+	void write(const void* data, std::size_t size);
+	void flush();
+	void pushBatch();
+
+	ExportFormat format_;
+	std::filesystem::path path_;
+	std::vector<std::string> columns_;
+	std::size_t batch_rows_;
+	std::ofstream file_;
+	std::vector<char> buffer_;
+	std::size_t buffer_used_ = 0;
+	std::uint64_t rows_ = 0;
+	std::uint64_t bytes_ = 0;
+	std::string error_;
+
+	std::unique_ptr<ExportBatch> filling_;
+	std::deque<std::unique_ptr<ExportBatch>> queue_;
+	std::vector<std::unique_ptr<ExportBatch>> free_;
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	bool finished_ = false;
+	std::thread writer_;
+
+	//Блоки record batch для футера Arrow: смещение, длина метаданных, длина тела
+	struct ArrowBlock {
+		std::int64_t offset_;
+		std::int32_t meta_length_;
+		std::int64_t body_length_;
+	};
+	std::vector<ArrowBlock> arrow_blocks_;
+};
@@ -0,0 +1,88 @@
+﻿#include "InstancePresence.h"
+
+#include <algorithm>
+
+using namespace std;
+
+//Признак отсутствия открытого отрезка
+constexpr uint64_t NOT_OPEN = UINT64_MAX;
+
+void InstancePresence::begin(vector<uint32_t> counter_instances, size_t instances) {
+    clear();
+    counter_instances_ = move(counter_instances);
+    open_.resize(instances);
+    for (size_t i = 0; i < instances; ++i) {
+        open_[i] = { static_cast<uint32_t>(i), NOT_OPEN, 0 };
+    }
+}
+
+void InstancePresence::seen(size_t instance, uint64_t timestamp) {
+    Interval& interval = open_[instance];
+    if (interval.start_ == NOT_OPEN) {
+        interval.start_ = timestamp;
+    }
+    interval.end_ = max(interval.end_, timestamp);
+}
+
+void InstancePresence::absent(size_t instance) {
+    Interval& interval = open_[instance];
+    if (interval.start_ == NOT_OPEN) return;
+    closed_.push_back(interval);
+    interval.start_ = NOT_OPEN;
+    interval.end_ = 0;
+}
+
+void InstancePresence::finish(uint64_t covered) {
+    for (size_t i = 0; i < open_.size(); ++i) {
+        absent(i);
+    }
+    //Отрезки одного экземпляра закрывались по времени, устойчивая сортировка сохраняет этот порядок
+    stable_sort(closed_.begin(), closed_.end(), [](const Interval& a, const Interval& b) {
+        return a.instance_ < b.instance_;
+    });
+    offsets_.assign(open_.size() + 1, 0);
+    starts_.resize(closed_.size());
+    ends_.resize(closed_.size());
+    for (size_t i = 0; i < closed_.size(); ++i) {
+        ++offsets_[closed_[i].instance_ + 1];
+        starts_[i] = closed_[i].start_;
+        ends_[i] = closed_[i].end_;
+    }
+    for (size_t i = 1; i < offsets_.size(); ++i) {
+        offsets_[i] += offsets_[i - 1];
+    }
+    covered_ = covered;
+    built_ = true;
+    vector<Interval>().swap(open_);
+    vector<Interval>().swap(closed_);
+}
+
+void InstancePresence::clear() {
+    counter_instances_.clear();
+    offsets_.clear();
+    starts_.clear();
+    ends_.clear();
+    open_.clear();
+    closed_.clear();
+    covered_ = 0;
+    built_ = false;
+}
+
+bool InstancePresence::present(size_t counter, uint64_t start, uint64_t end) const {
+    if (!built_ || counter >= counter_instances_.size() || end > covered_) return true;
+    const uint32_t instance = counter_instances_[counter];
+    if (instance == NO_INSTANCE) return true;
+
+    //Последний отрезок, начавшийся не позже end, пересекает период, если заканчивается не раньше start
+    auto first = starts_.begin() + offsets_[instance];
+    auto last = starts_.begin() + offsets_[instance + 1];
+    auto it = upper_bound(first, last, end);
+    if (it == first) return false;
+    return ends_[it - starts_.begin() - 1] >= start;
+}
+
+size_t InstancePresence::memoryUsage() const {
+    return counter_instances_.capacity() * sizeof(uint32_t) + offsets_.capacity() * sizeof(uint32_t)
+        + (starts_.capacity() + ends_.capacity()) * sizeof(uint64_t)
+        + (open_.capacity() + closed_.capacity()) * sizeof(Interval);
+}
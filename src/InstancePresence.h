@@ -0,0 +1,47 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//Периоды присутствия экземпляров объектов в журнале: отрезки времени записей, в которых у экземпляра
+//есть данные. Строится одним проходом по записям при чтении источника, после построения только читается.
+//Отрезки всех экземпляров лежат подряд по экземплярам, offsets_ - начало отрезков экземпляра
+class InstancePresence {
+public:
+	//Счетчик вне экземпляров (объект без экземпляров) присутствует всегда
+	static constexpr std::uint32_t NO_INSTANCE = UINT32_MAX;
+
+	//counter_instances - экземпляр каждого счетчика каталога, instances - число экземпляров
+	void begin(std::vector<std::uint32_t> counter_instances, std::size_t instances);
+	//Очередная запись прохода: у экземпляра есть данные со временем timestamp или их нет
+	void seen(std::size_t instance, std::uint64_t timestamp);
+	void absent(std::size_t instance);
+	//Конец прохода: covered - время последней просмотренной записи
+	void finish(std::uint64_t covered);
+	void clear();
+
+	bool built() const { return built_; }
+	std::size_t instances() const { return offsets_.empty() ? 0 : offsets_.size() - 1; }
+	std::size_t intervals() const { return starts_.size(); }
+	//У экземпляра счетчика есть данные на [start, end]. Время после прохода и непостроенный индекс - true:
+	//о дописанных записях индекс ничего не знает
+	bool present(std::size_t counter, std::uint64_t start, std::uint64_t end) const;
+	std::size_t memoryUsage() const;
+private:
+	std::vector<std::uint32_t> counter_instances_;
+	std::vector<std::uint32_t> offsets_;
+	std::vector<std::uint64_t> starts_;
+	std::vector<std::uint64_t> ends_;
+	std::uint64_t covered_ = 0;
+	bool built_ = false;
+
+	//Состояние прохода: открытый отрезок экземпляра и закрытые отрезки в порядке закрытия
+	struct Interval {
+		std::uint32_t instance_;
+		std::uint64_t start_;
+		std::uint64_t end_;
+	};
+	std::vector<Interval> open_;
+	std::vector<Interval> closed_;
+};
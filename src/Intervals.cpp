@@ -0,0 +1,88 @@
+﻿#include "Intervals.h"
+
+using namespace std;
+
+bool thresholdOpFromString(const string& name, ThresholdOp& op) {
+    if (name == ">") op = ThresholdOp::Greater;
+    else if (name == ">=") op = ThresholdOp::GreaterEqual;
+    else if (name == "<") op = ThresholdOp::Less;
+    else if (name == "<=") op = ThresholdOp::LessEqual;
+    else return false;
+    return true;
+}
+
+bool ThresholdRule::holds(double value) const {
+    switch (op_) {
+    case ThresholdOp::Greater: return value > value_;
+    case ThresholdOp::GreaterEqual: return value >= value_;
+    case ThresholdOp::Less: return value < value_;
+    default: return value <= value_;
+    }
+}
+
+bool ThresholdRule::mayHold(double min, double max) const {
+    return upper() ? holds(max) : holds(min);
+}
+
+IntervalTracker::IntervalTracker(size_t counter, size_t rule, const ThresholdRule& threshold) :
+    threshold_(threshold) {
+    current_.counter_ = counter;
+    current_.rule_ = rule;
+}
+
+void IntervalTracker::add(uint64_t time, double value, vector<ThresholdInterval>& intervals) {
+    const uint64_t step = last_time_ && time > last_time_ ? time - last_time_ : 0;
+    if (!threshold_.holds(value)) {
+        if (inside_) {
+            //Разрыв данных больше прежнего шага не засчитывается в интервал
+            current_.end_ = step_ && step > step_ ? last_time_ + step_ : time;
+            close(intervals);
+        }
+        last_time_ = time;
+        step_ = step;
+        return;
+    }
+    if (!inside_) {
+        inside_ = true;
+        current_.start_ = time;
+        current_.peak_ = value;
+        current_.peak_time_ = time;
+    }
+    else if (threshold_.upper() ? value > current_.peak_ : value < current_.peak_) {
+        current_.peak_ = value;
+        current_.peak_time_ = time;
+    }
+    current_.end_ = time;
+    last_time_ = time;
+    step_ = step;
+}
+
+void IntervalTracker::finish(vector<ThresholdInterval>& intervals) {
+    if (inside_) {
+        current_.end_ += step_;
+        close(intervals);
+    }
+    if (has_pending_) emit(intervals);
+}
+
+void IntervalTracker::close(vector<ThresholdInterval>& intervals) {
+    inside_ = false;
+    if (has_pending_ && current_.start_ - pending_.end_ <= threshold_.merge_gap_) {
+        if (threshold_.upper() ? current_.peak_ > pending_.peak_ : current_.peak_ < pending_.peak_) {
+            pending_.peak_ = current_.peak_;
+            pending_.peak_time_ = current_.peak_time_;
+        }
+        pending_.end_ = current_.end_;
+        return;
+    }
+    if (has_pending_) emit(intervals);
+    pending_ = current_;
+    has_pending_ = true;
+}
+
+void IntervalTracker::emit(vector<ThresholdInterval>& intervals) {
+    has_pending_ = false;
+    if (pending_.end_ - pending_.start_ >= threshold_.min_duration_) {
+        intervals.push_back(pending_);
+    }
+}
@@ -0,0 +1,66 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum class ThresholdOp {
+	Greater,
+	GreaterEqual,
+	Less,
+	LessEqual
+};
+
+bool thresholdOpFromString(const std::string& name, ThresholdOp& op);
+
+//Правило: значение сравнивается с порогом; интервал засчитывается, если длится не меньше min_duration_,
+//интервалы с разрывом не больше merge_gap_ сливаются. Время в тиках
+struct ThresholdRule {
+	ThresholdOp op_ = ThresholdOp::Greater;
+	double value_ = 0;
+	std::uint64_t min_duration_ = 0;
+	std::uint64_t merge_gap_ = 0;
+
+	bool holds(double value) const;
+	//Правило на превышение порога: пик интервала - максимум
+	bool upper() const { return op_ == ThresholdOp::Greater || op_ == ThresholdOp::GreaterEqual; }
+	//Выполняется ли правило хотя бы для одного значения из [min, max]
+	bool mayHold(double min, double max) const;
+};
+
+//Интервал выполнения правила: от первой подходящей выборки до следующей за последней подходящей
+//(последняя выборка держит значение свой интервал опроса, но не дольше предыдущего шага между выборками).
+//Пик - наибольшее значение для > и >=, наименьшее для < и <=
+struct ThresholdInterval {
+	std::size_t counter_ = 0;
+	std::size_t rule_ = 0;
+	std::uint64_t start_ = 0;
+	std::uint64_t end_ = 0;
+	double peak_ = 0;
+	std::uint64_t peak_time_ = 0;
+};
+
+//Потоковый поиск интервалов в одном ряду, значения подаются в порядке времени
+class IntervalTracker {
+public:
+	IntervalTracker(std::size_t counter, std::size_t rule, const ThresholdRule& threshold);
+	const ThresholdRule& threshold() const { return threshold_; }
+	bool inside() const { return inside_; }
+	void add(std::uint64_t time, double value, std::vector<ThresholdInterval>& intervals);
+	//Конец данных: открытый интервал продлевается на шаг между последними выборками
+	void finish(std::vector<ThresholdInterval>& intervals);
+private:
+	void close(std::vector<ThresholdInterval>& intervals);
+	void emit(std::vector<ThresholdInterval>& intervals);
+
+	ThresholdRule threshold_;
+	ThresholdInterval current_;
+	bool inside_ = false;
+	//Время последней выборки и шаг до нее, 0 - шаг неизвестен
+	std::uint64_t last_time_ = 0;
+	std::uint64_t step_ = 0;
+	//Закрытый интервал ждет, не сольется ли он со следующим
+	ThresholdInterval pending_;
+	bool has_pending_ = false;
+};
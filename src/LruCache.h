@@ -0,0 +1,98 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <unordered_map>
+
+#include "MemoryBudget.h"
+
+//Кэш с вытеснением давно использованных элементов. Размер элементов учитывается
+//в бюджете памяти, бюджет сам вытесняет элементы, когда памяти не хватает другим структурам
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class LruCache : public EvictableCache {
+public:
+	//max_bytes - собственный предел кэша, действует и при бюджете без ограничения
+	LruCache(MemoryBudget& budget, std::size_t max_bytes) : budget_(budget), max_bytes_(max_bytes) { budget_.addCache(this); }
+	~LruCache() override {
+		clear();
+		budget_.removeCache(this);
+	}
+	LruCache(const LruCache&) = delete;
+	LruCache& operator=(const LruCache&) = delete;
+
+	//nullptr - элемента нет; найденный элемент становится самым новым
+	const Value* find(const Key& key) {
+		auto it = index_.find(key);
+		if (it == index_.end()) {
+			++misses_;
+			return nullptr;
+		}
+		++hits_;
+		it->second->use_ = budget_.nextUse();
+		entries_.splice(entries_.begin(), entries_, it->second);
+		return &it->second->value_;
+	}
+
+	//false - элемент не помещается в бюджет и не сохранен
+	bool insert(const Key& key, Value value, std::size_t bytes) {
+		erase(key);
+		if (bytes > max_bytes_) return false;
+		while (bytes_ + bytes > max_bytes_) {
+			evictOldest();
+		}
+		if (!budget_.reserve(MemoryArea::Cache, bytes)) return false;
+		entries_.push_front({ key, std::move(value), bytes, budget_.nextUse() });
+		index_[key] = entries_.begin();
+		bytes_ += bytes;
+		return true;
+	}
+
+	void erase(const Key& key) {
+		auto it = index_.find(key);
+		if (it == index_.end()) return;
+		remove(it->second);
+		index_.erase(it);
+	}
+
+	void clear() {
+		while (!entries_.empty()) {
+			evictOldest();
+		}
+	}
+
+	std::size_t size() const { return entries_.size(); }
+	std::size_t bytes() const { return bytes_; }
+	std::uint64_t hits() const { return hits_; }
+	std::uint64_t misses() const { return misses_; }
+
+	std::uint64_t oldestUse() const override { return entries_.empty() ? 0 : entries_.back().use_; }
+	void evictOldest() override {
+		if (entries_.empty()) return;
+		auto last = std::prev(entries_.end());
+		index_.erase(last->key_);
+		remove(last);
+	}
+private:
+	struct Entry {
+		Key key_;
+		Value value_;
+		std::size_t bytes_;
+		std::uint64_t use_;
+	};
+
+	void remove(typename std::list<Entry>::iterator it) {
+		budget_.release(MemoryArea::Cache, it->bytes_);
+		bytes_ -= it->bytes_;
+		entries_.erase(it);
+	}
+
+	MemoryBudget& budget_;
+	const std::size_t max_bytes_;
+	std::list<Entry> entries_;	//от новых к старым
+	std::unordered_map<Key, typename std::list<Entry>::iterator, Hash> index_;
+	std::size_t bytes_ = 0;
+	std::uint64_t hits_ = 0;
+	std::uint64_t misses_ = 0;
+};
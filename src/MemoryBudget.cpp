@@ -0,0 +1,63 @@
+﻿#include "MemoryBudget.h"
+
+#include <algorithm>
+
+using namespace std;
+
+const char* memoryAreaName(MemoryArea area) {
+    static const char* names[MEMORY_AREAS] = { "catalog", "samples", "aggregates", "output", "cache", "index" };
+    return names[static_cast<size_t>(area)];
+}
+
+MemoryBudget::MemoryBudget(size_t limit) :
+    limit_(limit) {}
+
+//Уменьшение лимита сразу вытесняет кэши; занятое структурами освобождается с их удалением
+void MemoryBudget::setLimit(size_t limit) {
+    limit_ = limit;
+    while (limit_ && used_ > limit_ && evictOldest()) {}
+}
+
+bool MemoryBudget::reserve(MemoryArea area, size_t bytes) {
+    if (limit_) {
+        if (bytes > limit_) return false;
+        while (used_ + bytes > limit_) {
+            if (!evictOldest()) return false;
+        }
+    }
+    used_ += bytes;
+    areas_[static_cast<size_t>(area)] += bytes;
+    peak_ = max(peak_, used_);
+    return true;
+}
+
+void MemoryBudget::release(MemoryArea area, size_t bytes) {
+    used_ -= min(used_, bytes);
+    size_t& area_used = areas_[static_cast<size_t>(area)];
+    area_used -= min(area_used, bytes);
+}
+
+void MemoryBudget::addCache(EvictableCache* cache) {
+    caches_.push_back(cache);
+}
+
+void MemoryBudget::removeCache(EvictableCache* cache) {
+    caches_.erase(remove(caches_.begin(), caches_.end(), cache), caches_.end());
+}
+
+//Удаляет самый давно использованный элемент среди всех кэшей, false - вытеснять нечего
+bool MemoryBudget::evictOldest() {
+    EvictableCache* oldest = nullptr;
+    uint64_t oldest_use = 0;
+    for (EvictableCache* cache : caches_) {
+        uint64_t use = cache->oldestUse();
+        if (use && (!oldest || use < oldest_use)) {
+            oldest = cache;
+            oldest_use = use;
+        }
+    }
+    if (!oldest) return false;
+    oldest->evictOldest();
+    ++evictions_;
+    return true;
+}
@@ -0,0 +1,104 @@
+﻿#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+//Крупные структуры, учитываемые в бюджете памяти
+enum class MemoryArea : std::size_t {
+	Catalog,	//каталог счетчиков и буферы источника
+	Samples,	//матрица точек и ряды для корреляции
+	Aggregates,	//агрегаты интервалов при прореживании
+	Output,		//объекты и строка ответа
+	Cache,		//вытесняемые кэши
+	Index,		//индексы диапазонов загруженных рядов
+	Count
+};
+
+constexpr std::size_t MEMORY_AREAS = static_cast<std::size_t>(MemoryArea::Count);
+
+const char* memoryAreaName(MemoryArea area);
+
+//Вытесняемый кэш: бюджет освобождает память, удаляя самые давно использованные элементы всех кэшей
+class EvictableCache {
+public:
+	virtual ~EvictableCache() = default;
+	//Метка использования самого старого элемента, 0 - кэш пуст
+	virtual std::uint64_t oldestUse() const = 0;
+	virtual void evictOldest() = 0;
+};
+
+//Бюджет памяти компоненты. Компонента работает в процессе клиента 1С, в том числе 32-разрядного:
+//запрос, который не помещается в бюджет даже после вытеснения кэшей, отклоняется с ошибкой.
+//Не потокобезопасен: используется под блокировкой команд PerfLogsReader
+class MemoryBudget {
+public:
+	explicit MemoryBudget(std::size_t limit);
+	//0 - без ограничения
+	void setLimit(std::size_t limit);
+	std::size_t limit() const { return limit_; }
+	std::size_t used() const { return used_; }
+	std::size_t used(MemoryArea area) const { return areas_[static_cast<std::size_t>(area)]; }
+	std::size_t peak() const { return peak_; }
+	//Пик отсчитывается заново от текущего использования
+	void resetPeak() { peak_ = used_; }
+	std::uint64_t evictions() const { return evictions_; }
+	//false - память не выделена: bytes не помещается в бюджет
+	bool reserve(MemoryArea area, std::size_t bytes);
+	void release(MemoryArea area, std::size_t bytes);
+	void addCache(EvictableCache* cache);
+	void removeCache(EvictableCache* cache);
+	//Монотонная метка использования элементов кэшей
+	std::uint64_t nextUse() { return ++use_; }
+private:
+	bool evictOldest();
+
+	std::size_t limit_;
+	std::size_t used_ = 0;
+	std::size_t peak_ = 0;
+	std::array<std::size_t, MEMORY_AREAS> areas_{};
+	std::uint64_t evictions_ = 0;
+	std::uint64_t use_ = 0;
+	std::vector<EvictableCache*> caches_;
+};
+
+//Резерв бюджета на время жизни структуры
+class MemoryReservation {
+public:
+	MemoryReservation() = default;
+	~MemoryReservation() { reset(); }
+	MemoryReservation(MemoryReservation&& other) noexcept { *this = std::move(other); }
+	MemoryReservation& operator=(MemoryReservation&& other) noexcept {
+		if (this != &other) {
+			reset();
+			budget_ = other.budget_;
+			area_ = other.area_;
+			bytes_ = other.bytes_;
+			other.budget_ = nullptr;
+			other.bytes_ = 0;
+		}
+		return *this;
+	}
+	MemoryReservation(const MemoryReservation&) = delete;
+	MemoryReservation& operator=(const MemoryReservation&) = delete;
+	bool reserve(MemoryBudget& budget, MemoryArea area, std::size_t bytes) {
+		reset();
+		if (!budget.reserve(area, bytes)) return false;
+		budget_ = &budget;
+		area_ = area;
+		bytes_ = bytes;
+		return true;
+	}
+	void reset() {
+		if (budget_) budget_->release(area_, bytes_);
+		budget_ = nullptr;
+		bytes_ = 0;
+	}
+	std::size_t bytes() const { return bytes_; }
+private:
+	MemoryBudget* budget_ = nullptr;
+	MemoryArea area_ = MemoryArea::Output;
+	std::size_t bytes_ = 0;
+};
@@ -0,0 +1,874 @@
+﻿#include "PdhCounterSource.h"
+#include "Conversion.h"
+#include "Stats.h"
+#include "Trace.h"
+
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <cstring>
+
+using namespace std;
+
+wstring makeCounter(const wchar_t* computer, const wchar_t* object, const wchar_t* instance, const wchar_t* counter);
+CounterInfo makeCounterInfo(
+    const wchar_t* computer, const wchar_t* object, const wchar_t* instances, const wchar_t* counter,
+    const wchar_t* computer_eng, const wchar_t* object_eng, const wchar_t* instances_eng, const wchar_t* counter_eng);
+vector<wchar_t> vectorToWideChar(const vector<wstring>& files);
+vector<wstring> pdhListToVector(const vector<wchar_t>& v_wchar_t);
+LONGLONG fileTimeToLongLong(const FILETIME& fileTime);
+
+//Буфер блока сканирования: выборок на все счетчики и наибольшее число записей
+constexpr size_t COOK_BUFFER = 65536;
+constexpr size_t COOK_RECORDS = 256;
+
+PerfCounters::PerfCounters(PDH_HLOG phDataSource) :
+    phDataSource_(phDataSource) {}
+
+void PerfCounters::read() {
+    DWORD  pcchBufferSize = 0;
+    PdhEnumMachinesHW(phDataSource_, NULL, &pcchBufferSize);
+    vector<wchar_t> v_wchar_t(pcchBufferSize);
+    PdhEnumMachinesHW(phDataSource_, &v_wchar_t[0], &pcchBufferSize);
+
+    wchar_t* start = &v_wchar_t[0];
+    for (wchar_t* p = &v_wchar_t[0]; p < &v_wchar_t.back(); ++p) {
+        if (*p == L'\000') {
+            computers_.push_back(PerfCountersComp(phDataSource_, wstring(start)));
+            computers_.back().read();
+            start = p + 1;
+        }
+    }
+}
+
+PerfCountersComp::PerfCountersComp(PDH_HLOG phDataSource, std::wstring computer) :
+    phDataSource_(phDataSource),
+    computer_(computer) {}
+
+void PerfCountersComp::read() {
+    DWORD  pcchBufferSize = 0;
+    PdhEnumObjectsHW(phDataSource_, computer_.c_str(), NULL, &pcchBufferSize, PERF_DETAIL_WIZARD, TRUE);
+    vector<wchar_t> v_wchar_t(pcchBufferSize);
+    PdhEnumObjectsHW(phDataSource_, computer_.c_str(), &v_wchar_t[0], &pcchBufferSize, PERF_DETAIL_WIZARD, TRUE);
+
+    wchar_t* start = &v_wchar_t[0];
+    for (wchar_t* p = &v_wchar_t[0]; p < &v_wchar_t.back(); ++p) {
+        if (*p == L'\000') {
+            objects_.push_back(PerfCountersObject(phDataSource_, computer_, wstring(start)));
+            objects_.back().read();
+            start = p + 1;
+        }
+    }
+}
+
+PerfCountersObject::PerfCountersObject(PDH_HLOG phDataSource, std::wstring computer, std::wstring object) :
+    phDataSource_(phDataSource),
+    computer_(computer),
+    object_(object) {}
+
+void PerfCountersObject::read() {
+    TraceScope trace("object", Tracer::instance().enabled() ? wideCharToUtf(computer_ + L"\\" + object_) : string());
+    DWORD pcchCounterListLength = 0;
+    DWORD pcchInstanceListLength = 0;
+    PdhEnumObjectItemsHW(phDataSource_, computer_.c_str(), object_.c_str(), NULL, &pcchCounterListLength, NULL, &pcchInstanceListLength, PERF_DETAIL_WIZARD, 0);
+
+    vector<wchar_t> mszCounterList(pcchCounterListLength);
+    vector<wchar_t> mszInstanceList;
+    if (pcchInstanceListLength) {
+        mszInstanceList.resize(pcchInstanceListLength);
+        PdhEnumObjectItemsHW(phDataSource_, computer_.c_str(), object_.c_str(),
+            &mszCounterList[0], &pcchCounterListLength,
+            &mszInstanceList[0], &pcchInstanceListLength,
+            PERF_DETAIL_WIZARD, 0);
+        counters_ = pdhListToVector(mszCounterList);
+        instances_ = pdhListToVector(mszInstanceList);
+    }
+    else {
+        PdhEnumObjectItemsHW(phDataSource_, computer_.c_str(), object_.c_str(),
+            &mszCounterList[0], &pcchCounterListLength,
+            NULL, &pcchInstanceListLength,
+            PERF_DETAIL_WIZARD, 0);
+        counters_ = pdhListToVector(mszCounterList);
+        instances_.clear();
+    }
+}
+
+PdhCounterSource::PdhCounterSource() :
+    phDataSource_(nullptr),
+    phQuery_(nullptr),
+    start_time_(0),
+    end_time_(0),
+    files_size_(0) {}
+
+PdhCounterSource::~PdhCounterSource() {
+    close();
+}
+
+bool PdhCounterSource::open(const vector<wstring>& files) {
+
+    close();
+
+    if (files.size() > 32) {
+        error_ = L"Можно открыть не более 32 файлов одновременно!";
+        return false;
+    }
+
+    files_ = files;
+    files_size_ = filesSize();
+    return bind();
+}
+
+void PdhCounterSource::close() {
+    names_ = nullptr;
+    catalog_ = nullptr;
+    presence_ = nullptr;
+    handles_.clear();
+    prev_values_.clear();
+    cooking_.clear();
+    if (phQuery_) {
+        PdhCloseQuery(phQuery_);
+        phQuery_ = nullptr;
+    }
+    if (phDataSource_) {
+        PdhCloseLog(phDataSource_, PDH_FLAGS_CLOSE_QUERY);
+        phDataSource_ = nullptr;
+    }
+}
+
+bool PdhCounterSource::bind() {
+    TraceScope trace("bind", to_string(files_.size()) + " files");
+    vector<wchar_t> logFileNameList = vectorToWideChar(files_);
+
+    //Формируем указатель на источник файлов логов
+    PDH_STATUS pdhStatus = PdhBindInputDataSourceW(&phDataSource_, &logFileNameList[0]);
+    if (pdhStatus != ERROR_SUCCESS) {
+        messageErrorPdh(pdhStatus);
+        return false;
+    }
+
+    return true;
+}
+
+bool PdhCounterSource::read() {
+    if (phDataSource_) {
+        if (!readTimeRange()) {
+            return false;
+        }
+
+        names_ = PdhNameTables::shared();
+        catalog_ = sharedCatalog();
+        {
+            TraceScope trace("create_query", to_string(catalog_->size()) + " counters");
+            createQuery();
+        }
+        presence_ = sharedPresence();
+
+        return true;
+    }
+    else {
+        error_ = L"Файлы не открыты!";
+        return false;
+    }
+}
+
+const vector<CounterInfo>& PdhCounterSource::counters() const {
+    static const vector<CounterInfo> empty;
+    return catalog_ ? *catalog_ : empty;
+}
+
+//Перечисление объектов журнала - самая долгая часть чтения, поэтому каталог строится один раз
+//на набор файлов и разделяется между сессиями. Размер файлов в ключе отделяет дописанные журналы
+wstring PdhCounterSource::catalogKey() const {
+    wstring key;
+    for (auto& file : files_) {
+        key += filesystem::absolute(file).wstring() + L'|';
+    }
+    return key + to_wstring(files_size_);
+}
+
+shared_ptr<const vector<CounterInfo>> PdhCounterSource::sharedCatalog() {
+    static mutex catalogs_mutex;
+    static map<wstring, weak_ptr<const vector<CounterInfo>>> catalogs;
+
+    const wstring key = catalogKey();
+
+    lock_guard<mutex> lock(catalogs_mutex);
+    for (auto it = catalogs.begin(); it != catalogs.end();) {
+        if (it->second.expired()) it = catalogs.erase(it);
+        else ++it;
+    }
+    if (auto catalog = catalogs[key].lock()) {
+        return catalog;
+    }
+
+    PerfCounters perfCounters(phDataSource_);
+    {
+        TraceScope trace("enumerate");
+        perfCounters.read();
+    }
+    auto catalog = make_shared<vector<CounterInfo>>();
+    fillCounters(perfCounters, *catalog);
+    catalogs[key] = catalog;
+    return catalog;
+}
+
+//Индекс строится проходом по всем записям журнала, поэтому тоже один раз на набор файлов
+shared_ptr<const InstancePresence> PdhCounterSource::sharedPresence() {
+    static mutex presences_mutex;
+    static map<wstring, weak_ptr<const InstancePresence>> presences;
+
+    const wstring key = catalogKey();
+    lock_guard<mutex> lock(presences_mutex);
+    for (auto it = presences.begin(); it != presences.end();) {
+        if (it->second.expired()) it = presences.erase(it);
+        else ++it;
+    }
+    if (auto presence = presences[key].lock()) {
+        return presence;
+    }
+
+    auto presence = make_shared<InstancePresence>();
+    buildPresence(*presence);
+    presences[key] = presence;
+    return presence;
+}
+
+//Экземпляр - компьютер, объект и экземпляр счетчика. Присутствие экземпляра определяет один его счетчик:
+//в записи без экземпляра PDH возвращает PDH_CSTATUS_NO_INSTANCE для всех его счетчиков
+void PdhCounterSource::buildPresence(InstancePresence& presence) {
+    TraceScope trace("presence");
+    const vector<CounterInfo>& counters = this->counters();
+    map<wstring, uint32_t> instances;
+    vector<uint32_t> counter_instances(counters.size(), InstancePresence::NO_INSTANCE);
+    vector<size_t> representatives;
+    for (size_t i = 0; i < counters.size(); ++i) {
+        const CounterInfo& info = counters[i];
+        if (info.instances_ == L"- - -") continue;
+        auto inserted = instances.emplace(info.computer_ + L'\\' + info.object_ + L'(' + info.instances_ + L')',
+            static_cast<uint32_t>(representatives.size()));
+        if (inserted.second) representatives.push_back(i);
+        counter_instances[i] = inserted.first->second;
+    }
+    if (representatives.empty()) return;
+
+    HQUERY phQuery = nullptr;
+    if (PdhOpenQueryH(phDataSource_, 0, &phQuery) != ERROR_SUCCESS) return;
+    vector<HCOUNTER> handles(representatives.size(), NULL);
+    for (size_t i = 0; i < representatives.size(); ++i) {
+        if (PdhAddCounterW(phQuery, counters[representatives[i]].national_name_.c_str(), 0, &handles[i]) != ERROR_SUCCESS) {
+            handles[i] = NULL;
+        }
+    }
+
+    //Экземпляр, счетчик которого не удалось добавить, считается присутствующим всегда
+    for (auto& instance : counter_instances) {
+        if (instance != InstancePresence::NO_INSTANCE && !handles[instance]) {
+            instance = InstancePresence::NO_INSTANCE;
+        }
+    }
+    presence.begin(move(counter_instances), representatives.size());
+    PDH_TIME_INFO pInfo = { static_cast<LONGLONG>(start_time_), static_cast<LONGLONG>(end_time_), 1 };
+    PdhSetQueryTimeRange(phQuery, &pInfo);
+    uint64_t covered = 0;
+    while (PdhCollectQueryData(phQuery) == ERROR_SUCCESS) {
+        for (size_t i = 0; i < handles.size(); ++i) {
+            DWORD lpdwType = 0;
+            PDH_RAW_COUNTER pValue;
+            if (!handles[i]) continue;
+            if (PdhGetRawCounterValue(handles[i], &lpdwType, &pValue) != ERROR_SUCCESS
+                || PDH_CSTATUS_NO_INSTANCE == pValue.CStatus || PDH_CSTATUS_NO_OBJECT == pValue.CStatus
+                || PDH_CSTATUS_NO_COUNTER == pValue.CStatus || PDH_CSTATUS_NO_MACHINE == pValue.CStatus) {
+                presence.absent(i);
+                continue;
+            }
+            const uint64_t timestamp = fileTimeToLongLong(pValue.TimeStamp);
+            presence.seen(i, timestamp);
+            covered = max(covered, timestamp);
+        }
+    }
+    PdhCloseQuery(phQuery);
+    presence.finish(max(covered, end_time_));
+}
+
+bool PdhCounterSource::readTimeRange() {
+    DWORD pdwNumEntries = 0;
+    PDH_TIME_INFO pInfo;
+    DWORD pdwBufferSize = sizeof(PDH_TIME_INFO);
+    PDH_STATUS pdhStatus = PdhGetDataSourceTimeRangeH(phDataSource_, &pdwNumEntries, &pInfo, &pdwBufferSize);
+    if (pdhStatus != ERROR_SUCCESS) {
+        messageErrorPdh(pdhStatus);
+        return false;
+    }
+
+    start_time_ = pInfo.StartTime;
+    end_time_ = pInfo.EndTime;
+    return true;
+}
+
+bool PdhCounterSource::createQuery() {
+    PDH_STATUS pdhStatus = PdhOpenQueryH(phDataSource_, 0, &phQuery_);
+    if (pdhStatus != ERROR_SUCCESS) {
+        messageErrorPdh(pdhStatus);
+        return false;
+    }
+
+    const vector<CounterInfo>& counters = this->counters();
+    handles_.assign(counters.size(), NULL);
+    prev_values_.assign(counters.size(), { PDH_CSTATUS_ITEM_NOT_VALIDATED , 0, 0, 0, 0 });
+    cooking_.assign(counters.size(), {});
+    for (size_t i = 0; i < counters.size(); ++i) {
+        pdhStatus = PdhAddCounterW(phQuery_, counters[i].national_name_.c_str(), 0, &handles_[i]);
+        if (pdhStatus != ERROR_SUCCESS) {
+            handles_[i] = NULL;
+        }
+    }
+    return true;
+}
+
+//Записи читаются блоками: сырые значения счетчиков с собственным вычислением копятся по столбцам
+//и вычисляются формулами CounterCooking на весь блок, остальные - PdhCalculateCounterFromRawValue
+//при чтении. Значения блока передаются в приемник в порядке записей
+bool PdhCounterSource::scan(uint64_t start, uint64_t end, const vector<size_t>& counters, ValueSink& sink) {
+    if (!phQuery_) {
+        error_ = L"Файлы не открыты!";
+        return false;
+    }
+
+    //Предыдущее сырое значение относится к одному сканированию. Экземпляры, которых нет в журнале
+    //за период, PDH не запрашиваются: их выборки сразу отмечаются пропущенными
+    vector<bool> native(counters.size());
+    vector<size_t> active;
+    active.reserve(counters.size());
+    for (size_t column = 0; column < counters.size(); ++column) {
+        const size_t index = counters[column];
+        if (presence_ && !presence_->present(index, start, end)) continue;
+        active.push_back(column);
+        prev_values_[index] = { PDH_CSTATUS_ITEM_NOT_VALIDATED , 0, 0, 0, 0 };
+        native[column] = prepareCooking(index);
+        cooking_[index].previous_raw_ = { PDH_CSTATUS_ITEM_NOT_VALIDATED , 0, 0, 0, 0 };
+    }
+
+    PDH_TIME_INFO pInfo = { static_cast<LONGLONG>(start), static_cast<LONGLONG>(end), 1 };
+    PdhSetQueryTimeRange(phQuery_, &pInfo);
+
+    //Столбец счетчика занимает block подряд идущих элементов буфера
+    const size_t block = max<size_t>(1, min(COOK_RECORDS, COOK_BUFFER / max<size_t>(counters.size(), 1)));
+    const size_t cells = block * counters.size();
+    vector<PDH_RAW_COUNTER> raw(cells);
+    vector<int64_t> first(cells);
+    vector<int64_t> second(cells);
+    unique_ptr<bool[]> ok(new bool[cells]);
+    vector<double> values(cells, NAN);
+    vector<SampleStatus> statuses(cells, SampleStatus::Missing);
+    vector<uint64_t> times(cells);
+
+    //Время чтения записей и вычисления значений копится локально и попадает в статистику один раз
+    uint64_t records = 0;
+    uint64_t values_count = 0;
+    uint64_t skipped[3] = {};
+    chrono::steady_clock::duration collect_time{};
+    chrono::steady_clock::duration cook_time{};
+    bool more = true;
+    while (more) {
+        auto now = chrono::steady_clock::now();
+        size_t filled = 0;
+        for (; filled < block; ++filled) {
+            if (PdhCollectQueryData(phQuery_) != ERROR_SUCCESS) {
+                more = false;
+                break;
+            }
+            for (size_t column : active) {
+                const size_t index = counters[column];
+                const size_t cell = column * block + filled;
+                if (!native[column]) {
+                    uint64_t timestamp = 0;
+                    double value = 0;
+                    SampleStatus status;
+                    values[cell] = cookValue(index, timestamp, value, status) ? value : NAN;
+                    statuses[cell] = status;
+                    times[cell] = timestamp;
+                    continue;
+                }
+                DWORD lpdwType = 0;
+                PDH_RAW_COUNTER& pValue = raw[cell];
+                if (PdhGetRawCounterValue(handles_[index], &lpdwType, &pValue) != ERROR_SUCCESS) {
+                    pValue.CStatus = PDH_CSTATUS_INVALID_DATA;
+                }
+                ok[cell] = PDH_CSTATUS_NEW_DATA == pValue.CStatus || PDH_CSTATUS_VALID_DATA == pValue.CStatus;
+                first[cell] = pValue.FirstValue;
+                second[cell] = pValue.SecondValue;
+                times[cell] = fileTimeToLongLong(pValue.TimeStamp);
+            }
+        }
+        auto collected = chrono::steady_clock::now();
+        collect_time += collected - now;
+        if (!filled) break;
+
+        for (size_t column : active) {
+            if (!native[column]) continue;
+            const size_t index = counters[column];
+            const size_t cell = column * block;
+            NativeCooking& cooking = cooking_[index];
+            cookColumn(cooking.formula_, &first[cell], &second[cell], &ok[cell], filled,
+                cooking.time_base_, cooking.scale_, cooking.previous_, &values[cell], &statuses[cell]);
+            for (size_t r = 0; r < filled; ++r) {
+                const DWORD cstatus = raw[cell + r].CStatus;
+                if (PDH_CSTATUS_NO_INSTANCE == cstatus || PDH_CSTATUS_NO_OBJECT == cstatus
+                    || PDH_CSTATUS_NO_COUNTER == cstatus || PDH_CSTATUS_NO_MACHINE == cstatus) {
+                    statuses[cell + r] = SampleStatus::Missing;
+                }
+            }
+            if (cooking.state_ == NativeCooking::State::Checking) {
+                checkCooking(index, &raw[cell], &values[cell], &statuses[cell], filled);
+                if (cooking.state_ == NativeCooking::State::Pdh) native[column] = false;
+            }
+        }
+
+        for (size_t r = 0; r < filled; ++r) {
+            for (size_t column = 0; column < counters.size(); ++column) {
+                const size_t cell = column * block + r;
+                if (!isnan(values[cell])) {
+                    sink.value(column, times[cell], values[cell]);
+                    ++values_count;
+                }
+                else if (handles_[counters[column]]) {
+                    sink.skipped(column, statuses[cell]);
+                    ++skipped[static_cast<size_t>(statuses[cell])];
+                }
+            }
+            sink.endRecord();
+            ++records;
+        }
+        cook_time += chrono::steady_clock::now() - collected;
+    }
+
+    Stats& stats = Stats::instance();
+    stats.add(StatPhase::Collect, chrono::duration_cast<chrono::nanoseconds>(collect_time).count());
+    stats.add(StatPhase::Cook, chrono::duration_cast<chrono::nanoseconds>(cook_time).count());
+    stats.add(StatCounter::Records, records);
+    stats.add(StatCounter::Values, values_count);
+    stats.add(StatCounter::Invalid, skipped[static_cast<size_t>(SampleStatus::Invalid)]);
+    stats.add(StatCounter::Skipped, skipped[static_cast<size_t>(SampleStatus::FirstSample)]);
+    stats.add(StatCounter::Gaps, skipped[static_cast<size_t>(SampleStatus::Missing)]);
+    return true;
+}
+
+//Тип, частота времени и шкала счетчика; false - счетчик вычисляется через PDH
+bool PdhCounterSource::prepareCooking(size_t index) {
+    NativeCooking& cooking = cooking_[index];
+    cooking.previous_ = {};
+    if (cooking.state_ == NativeCooking::State::Unknown) {
+        cooking.state_ = NativeCooking::State::Pdh;
+        HCOUNTER hCounter = handles_[index];
+        DWORD size = 0;
+        if (!hCounter || PdhGetCounterInfoW(hCounter, FALSE, &size, NULL) != PDH_MORE_DATA) {
+            return false;
+        }
+        vector<BYTE> buffer(size);
+        auto info = reinterpret_cast<PDH_COUNTER_INFO_W*>(buffer.data());
+        LONGLONG time_base = 0;
+        if (PdhGetCounterInfoW(hCounter, FALSE, &size, info) != ERROR_SUCCESS
+            || !cookFormula(info->dwType, cooking.formula_)) {
+            return false;
+        }
+        //Частота нужна только формулам со временем в тиках счетчика
+        if (PdhGetCounterTimeBase(hCounter, &time_base) != ERROR_SUCCESS) {
+            time_base = 0;
+        }
+        if (!time_base && (cooking.formula_ == CookFormula::Rate || cooking.formula_ == CookFormula::AverageTimer)) {
+            return false;
+        }
+        cooking.time_base_ = static_cast<double>(time_base);
+        cooking.scale_ = pow(10.0, info->lScale);
+        cooking.state_ = NativeCooking::State::Checking;
+    }
+    return cooking.state_ != NativeCooking::State::Pdh;
+}
+
+//Сверка первого вычисленного значения с PDH. При расхождении значения блока пересчитываются через PDH,
+//а следующие выборки вычисляются cookValue с той же предыдущей выборкой
+void PdhCounterSource::checkCooking(size_t index, const PDH_RAW_COUNTER* raw, double* values, SampleStatus* statuses, size_t count) {
+    NativeCooking& cooking = cooking_[index];
+    const bool previous_needed = needsPrevious(cooking.formula_);
+    auto valid = [](const auto& value) {
+        return PDH_CSTATUS_NEW_DATA == value.CStatus || PDH_CSTATUS_VALID_DATA == value.CStatus;
+    };
+    //Сверка сдвигает previous_raw_ по блоку, пересчету нужна выборка до блока
+    const PDH_RAW_COUNTER block_previous = cooking.previous_raw_;
+    for (size_t r = 0; r < count && cooking.state_ == NativeCooking::State::Checking; ++r) {
+        if (!valid(raw[r])) continue;
+        PDH_RAW_COUNTER current = raw[r];
+        PDH_RAW_COUNTER& previous = cooking.previous_raw_;
+        if (!isnan(values[r]) && (!previous_needed || valid(previous))) {
+            PDH_FMT_COUNTERVALUE fmtValue;
+            PDH_STATUS pdhStatus = PdhCalculateCounterFromRawValue(handles_[index], PDH_FMT_DOUBLE | PDH_FMT_NOCAP100,
+                &current, previous_needed ? &previous : NULL, &fmtValue);
+            if (ERROR_SUCCESS == pdhStatus && valid(fmtValue)) {
+                const double expected = fmtValue.doubleValue;
+                cooking.state_ = fabs(values[r] - expected) <= 1e-6 * max(1.0, fabs(expected))
+                    ? NativeCooking::State::Verified : NativeCooking::State::Pdh;
+                continue;
+            }
+        }
+        previous = current;
+    }
+    if (cooking.state_ != NativeCooking::State::Pdh) return;
+
+    //Пересчет блока через PDH от последней годной выборки перед ним
+    PDH_RAW_COUNTER& prevValue = prev_values_[index];
+    prevValue = block_previous;
+    for (size_t r = 0; r < count; ++r) {
+        PDH_RAW_COUNTER current = raw[r];
+        values[r] = NAN;
+        if (!valid(current)) continue;
+        statuses[r] = SampleStatus::Invalid;
+        if (!valid(prevValue)) {
+            statuses[r] = SampleStatus::FirstSample;
+        }
+        else {
+            PDH_FMT_COUNTERVALUE fmtValue;
+            PDH_STATUS pdhStatus = PdhCalculateCounterFromRawValue(handles_[index], PDH_FMT_DOUBLE | PDH_FMT_NOCAP100, &current, &prevValue, &fmtValue);
+            if (ERROR_SUCCESS == pdhStatus && valid(fmtValue)) {
+                values[r] = fmtValue.doubleValue;
+            }
+        }
+        prevValue = current;
+    }
+}
+
+//Буферы запроса PDH и доля общих каталога, словарей имен и периодов присутствия экземпляров
+size_t PdhCounterSource::memoryUsage() const {
+    size_t bytes = handles_.capacity() * sizeof(HCOUNTER) + prev_values_.capacity() * sizeof(PDH_RAW_COUNTER)
+        + cooking_.capacity() * sizeof(NativeCooking);
+    if (catalog_) {
+        bytes += catalogBytes(*catalog_) / catalog_.use_count();
+    }
+    if (names_) {
+        bytes += names_->memoryUsage() / names_.use_count();
+    }
+    if (presence_) {
+        bytes += presence_->memoryUsage() / presence_.use_count();
+    }
+    return bytes;
+}
+
+uint64_t PdhCounterSource::countRecords(uint64_t start, uint64_t end, uint64_t limit) {
+    if (!phQuery_) return 0;
+    ScopedTimer timer(StatPhase::Collect);
+    PDH_TIME_INFO pInfo = { static_cast<LONGLONG>(start), static_cast<LONGLONG>(end), 1 };
+    PDH_STATUS pdhStatus = PdhSetQueryTimeRange(phQuery_, &pInfo);
+    pdhStatus = PdhCollectQueryData(phQuery_);
+    uint64_t points_count = 0;
+    while (ERROR_SUCCESS == pdhStatus) {
+        pdhStatus = PdhCollectQueryData(phQuery_);
+        if (ERROR_SUCCESS == pdhStatus) {
+            ++points_count;
+            if (points_count > limit) return points_count;
+        }
+    }
+    return points_count;
+}
+
+//Повторная привязка источника, чтобы PDH увидел дописанные записи. Счетчики сохраняются
+bool PdhCounterSource::refresh() {
+    uintmax_t files_size = filesSize();
+    if (files_size == files_size_) return false;
+    files_size_ = files_size;
+
+    if (phQuery_) {
+        PdhCloseQuery(phQuery_);
+        phQuery_ = nullptr;
+    }
+    if (phDataSource_) {
+        PdhCloseLog(phDataSource_, PDH_FLAGS_CLOSE_QUERY);
+        phDataSource_ = nullptr;
+    }
+
+    uint64_t end_time = end_time_;
+    if (!bind() || !createQuery() || !readTimeRange()) return false;
+    return end_time_ > end_time;
+}
+
+//Расчет значения счетчика по текущей и предыдущей сырой выборке
+//status - причина, если значения нет. Отсутствие экземпляра, объекта или компьютера в записи - пропуск,
+//остальные статусы и ошибки вычисления - ошибочные выборки
+bool PdhCounterSource::cookValue(size_t index, uint64_t& timestamp, double& value, SampleStatus& status) {
+    HCOUNTER hCounter = handles_[index];
+    status = SampleStatus::Invalid;
+    if (!hCounter) return false;
+
+    DWORD lpdwType = 0;
+    PDH_RAW_COUNTER pValue;
+    PDH_FMT_COUNTERVALUE fmtValue;
+    PDH_RAW_COUNTER& prevValue = prev_values_[index];
+    bool cooked = false;
+    PDH_STATUS pdhStatusCounterValue = PdhGetRawCounterValue(hCounter, &lpdwType, &pValue);
+    if (ERROR_SUCCESS == pdhStatusCounterValue && (PDH_CSTATUS_NO_INSTANCE == pValue.CStatus
+        || PDH_CSTATUS_NO_OBJECT == pValue.CStatus || PDH_CSTATUS_NO_COUNTER == pValue.CStatus
+        || PDH_CSTATUS_NO_MACHINE == pValue.CStatus)) {
+        status = SampleStatus::Missing;
+    }
+    if (ERROR_SUCCESS == pdhStatusCounterValue && (PDH_CSTATUS_NEW_DATA == pValue.CStatus || PDH_CSTATUS_VALID_DATA == pValue.CStatus)) {
+        if (prevValue.CStatus == PDH_CSTATUS_ITEM_NOT_VALIDATED) {
+            status = SampleStatus::FirstSample;
+        }
+        else {
+            pdhStatusCounterValue = PdhCalculateCounterFromRawValue(hCounter, PDH_FMT_DOUBLE | PDH_FMT_NOCAP100, &pValue, &prevValue, &fmtValue);
+            if (ERROR_SUCCESS == pdhStatusCounterValue && (PDH_CSTATUS_NEW_DATA == fmtValue.CStatus || PDH_CSTATUS_VALID_DATA == fmtValue.CStatus)) {
+                timestamp = fileTimeToLongLong(pValue.TimeStamp);
+                value = fmtValue.doubleValue;
+                cooked = true;
+            }
+        }
+        prevValue = pValue;
+    }
+    return cooked;
+}
+
+uintmax_t PdhCounterSource::filesSize() const {
+    uintmax_t size = 0;
+    for (auto& file : files_) {
+        error_code ec;
+        uintmax_t file_size = filesystem::file_size(file, ec);
+        if (!ec) size += file_size;
+    }
+    return size;
+}
+
+void PdhCounterSource::messageErrorPdh(DWORD dwErrorCode) {
+    HANDLE hPdhLibrary = NULL;
+    LPWSTR pMessage = NULL;
+
+    wstringstream wss;
+
+    hPdhLibrary = LoadLibrary(L"pdh.dll");
+    if (NULL == hPdhLibrary)
+    {
+        wss << L"LoadLibrary failed with " << GetLastError();
+        error_ = wss.str();
+        return;
+    }
+
+    if (!FormatMessage(FORMAT_MESSAGE_FROM_HMODULE |
+        FORMAT_MESSAGE_ALLOCATE_BUFFER |
+        FORMAT_MESSAGE_IGNORE_INSERTS,
+        hPdhLibrary,
+        dwErrorCode,
+        0,
+        (LPWSTR)&pMessage,
+        0,
+        NULL))
+    {
+        wss << L"Format message failed with " << GetLastError();
+        error_ = wss.str();
+        return;
+    }
+
+    wss << L"Formatted message: " << pMessage;
+    error_ = wss.str();
+
+    LocalFree(pMessage);
+}
+
+//Словари читаются из реестра при первом открытии и живут, пока открыт хотя бы один источник
+shared_ptr<const PdhNameTables> PdhNameTables::shared() {
+    static mutex tables_mutex;
+    static weak_ptr<const PdhNameTables> tables;
+
+    lock_guard<mutex> lock(tables_mutex);
+    if (auto shared_tables = tables.lock()) {
+        return shared_tables;
+    }
+    TraceScope trace("registry");
+    auto new_tables = make_shared<PdhNameTables>();
+    new_tables->fillNationalIndicesFromRegistry();
+    new_tables->fillEngCountersFromRegistry();
+    tables = new_tables;
+    return new_tables;
+}
+
+size_t PdhNameTables::memoryUsage() const {
+    size_t bytes = 0;
+    for (auto& item : eng_counters_map_) {
+        bytes += sizeof(item) + item.second.size() * sizeof(wchar_t);
+    }
+    for (auto& item : national_index_counters_map_) {
+        bytes += sizeof(item) + item.first.size() * sizeof(wchar_t);
+    }
+    return bytes;
+}
+
+bool PdhNameTables::fillEngCountersFromRegistry() {
+    HKEY hKey;
+    if (RegOpenKeyExW(HKEY_LOCAL_MACHINE, L"SOFTWARE\\Microsoft\\Windows NT\\CurrentVersion\\Perflib\\009", 0, KEY_QUERY_VALUE, &hKey) != ERROR_SUCCESS) {
+        return false;
+    };
+    DWORD lpType;
+    DWORD lpcbData = 0;
+    if (RegQueryValueExW(hKey, L"Counter", NULL, &lpType, NULL, &lpcbData) != ERROR_SUCCESS) {
+        return false;
+    }
+    vector<wchar_t> lpData(lpcbData / sizeof(wchar_t));
+    if (RegQueryValueExW(hKey, L"Counter", NULL, &lpType, reinterpret_cast<LPBYTE>(&lpData[0]), &lpcbData) != ERROR_SUCCESS) {
+        return false;
+    }
+
+    vector<wstring> index_name_counters = pdhListToVector(lpData);
+    for (size_t index = 1; index < index_name_counters.size(); ++index) {
+        if (index % 2) {
+            eng_counters_map_.insert({ _wtol(&index_name_counters[index - 1][0]), index_name_counters[index] });
+        }
+    }
+    return true;
+}
+
+bool PdhNameTables::fillNationalIndicesFromRegistry() {
+    HKEY hKey;
+    if (RegOpenKeyExW(HKEY_LOCAL_MACHINE, L"SOFTWARE\\Microsoft\\Windows NT\\CurrentVersion\\Perflib\\CurrentLanguage", 0, KEY_QUERY_VALUE, &hKey) != ERROR_SUCCESS) {
+        return false;
+    };
+    DWORD lpType;
+    DWORD lpcbData = 0;
+    if (RegQueryValueExW(hKey, L"Counter", NULL, &lpType, NULL, &lpcbData) != ERROR_SUCCESS) {
+        return false;
+    }
+    vector<wchar_t> lpData(lpcbData / sizeof(wchar_t));
+    if (RegQueryValueExW(hKey, L"Counter", NULL, &lpType, reinterpret_cast<LPBYTE>(&lpData[0]), &lpcbData) != ERROR_SUCCESS) {
+        return false;
+    }
+
+    vector<wstring> index_name_counters = pdhListToVector(lpData);
+    for (size_t index = 1; index < index_name_counters.size(); ++index) {
+        if (index % 2) {
+            national_index_counters_map_.insert({ index_name_counters[index], _wtol(&index_name_counters[index - 1][0]) });
+        }
+    }
+    return true;
+}
+
+const wstring& PdhNameTables::getEngName(const std::wstring& national_name) const {
+    auto it_index = national_index_counters_map_.find(national_name);
+    if (it_index == national_index_counters_map_.end()) {
+        return national_name;
+    }
+
+    auto it = eng_counters_map_.find(it_index->second);
+    if (it == eng_counters_map_.end()) {
+        return national_name;
+    }
+    return it->second;
+}
+
+void PdhCounterSource::fillCounters(const PerfCounters& perfCounters, vector<CounterInfo>& catalog) const {
+    auto& computers = perfCounters.getComputers();
+    for (auto it_computer = computers.begin(); it_computer < computers.end(); ++it_computer) {
+        const wchar_t* pComputer = it_computer->getCompName().c_str();
+        auto& objects = it_computer->getObjects();
+        for (auto it_object = objects.begin(); it_object < objects.end(); ++it_object) {
+            const wchar_t* pObject = it_object->getObjName().c_str();
+            const wchar_t* pObjectEng = names_->getEngName(it_object->getObjName()).c_str();
+            auto& counters = it_object->getCounters();
+            for (auto it_counter = counters.begin(); it_counter < counters.end(); ++it_counter) {
+                const wchar_t* pCounter = it_counter->c_str();
+                const wchar_t* pCounterEng = names_->getEngName(*it_counter).c_str();
+                auto& instances = it_object->getInstances();
+                if (instances.size()) {
+                    for (auto it_instance = instances.begin(); it_instance < instances.end(); ++it_instance) {
+                        const wchar_t* pInstances = it_instance->c_str();
+                        const wchar_t* pInstancesEng = names_->getEngName(*it_instance).c_str();
+                        catalog.push_back(makeCounterInfo(
+                                pComputer, pObject, pInstances, pCounter,
+                                pComputer, pObjectEng, pInstancesEng, pCounterEng
+                            ));
+                    }
+                }
+                else {
+                    catalog.push_back(makeCounterInfo(
+                            pComputer, pObject, NULL, pCounter,
+                            pComputer, pObjectEng, NULL, pCounterEng
+                        ));
+                }
+            }
+        }
+    }
+}
+
+CounterInfo makeCounterInfo(
+    const wchar_t* computer, const wchar_t* object, const wchar_t* instances, const wchar_t* counter,
+    const wchar_t* computer_eng, const wchar_t* object_eng, const wchar_t* instances_eng, const wchar_t* counter_eng) {
+    CounterInfo info;
+    info.computer_ = computer;
+    info.object_ = object;
+    info.instances_ = (instances) ? instances : L"- - -";
+    info.counter_ = counter;
+    info.computer_eng_ = computer_eng;
+    info.object_eng_ = object_eng;
+    info.instances_eng_ = (instances_eng) ? instances_eng : L"- - -";
+    info.counter_eng_ = counter_eng;
+    info.national_name_ = makeCounter(computer, object, instances, counter);
+    info.english_name_ = makeCounter(computer_eng, object_eng, instances_eng, counter_eng);
+    return info;
+}
+
+wstring  makeCounter(const wchar_t* computer, const wchar_t* object, const wchar_t* instance, const wchar_t* counter) {
+    _PDH_COUNTER_PATH_ELEMENTS_W  pdhElement{
+        const_cast<wchar_t*>(computer),
+        const_cast<wchar_t*>(object),
+        const_cast<wchar_t*>(instance),
+        NULL,
+        NULL,
+        const_cast<wchar_t*>(counter)
+    };
+
+    DWORD pcchBufferSize = 0;
+    PdhMakeCounterPathW(&pdhElement, NULL, &pcchBufferSize, 0);
+    wstring wstr(pcchBufferSize, L'\000');
+    PdhMakeCounterPathW(&pdhElement, &wstr[0], &pcchBufferSize, 0);
+
+    wstr.pop_back();
+    return  wstr;
+}
+
+vector<wchar_t> vectorToWideChar(const vector<wstring>& files) {
+    //Считаем место под wchar_t
+    size_t wchar_t_size = 0;
+    for (auto it = files.begin(); it < files.end(); ++it) {
+        wchar_t_size += (it->size() + 1);
+    }
+    ++wchar_t_size;
+
+    //Формируем vector<wchar> списка файлов для PdhBindInputDataSourceW
+    vector<wchar_t> v_wchar_t(wchar_t_size);
+    wchar_t* p = &v_wchar_t[0];
+    for (auto it = files.begin(); it < files.end(); ++it) {
+        wmemcpy(p, it->c_str(), it->size());
+        p += it->size();
+        *p = L'\000';
+        ++p;
+    }
+    *p = L'\000';
+
+    return v_wchar_t;
+}
+
+vector<wstring> pdhListToVector(const vector<wchar_t>& v_wchar_t) {
+    vector<wstring> v;
+    const wchar_t* start = &v_wchar_t[0];
+    for (const wchar_t* p = &v_wchar_t[0]; p < &v_wchar_t.back(); ++p) {
+        if (*p == L'\000') {
+            v.push_back(wstring(start));
+            start = p + 1;
+            if (*start == L'\000') break;
+        }
+    }
+    return v;
+}
+
+LONGLONG fileTimeToLongLong(const FILETIME& fileTime) {
+    uint64_t uTime;
+    memcpy(&uTime, &fileTime, sizeof(uTime));
+    return uTime;
+}
@@ -0,0 +1,129 @@
+﻿#pragma once
+
+#include <memory>
+#include <vector>
+#include <string>
+#include <Pdh.h>
+#include <PdhMsg.h>
+#include <unordered_map>
+
+#include "CounterCooking.h"
+#include "CounterSource.h"
+#include "InstancePresence.h"
+
+#pragma comment(lib,"pdh.lib")
+
+class PerfCountersComp;
+class PerfCountersObject;
+class PerfCountersItem;
+
+class PerfCounters {
+public:
+	PerfCounters(PDH_HLOG phDataSource);
+	void read();
+	const std::vector<PerfCountersComp>& getComputers() const { return computers_; }
+private:
+	const PDH_HLOG phDataSource_;
+	std::vector<PerfCountersComp> computers_;
+};
+
+class PerfCountersComp {
+public:
+	PerfCountersComp(PDH_HLOG phDataSource, std::wstring computer);
+	void read();
+	const std::vector<PerfCountersObject>& getObjects() const { return objects_; }
+	const std::wstring& getCompName() const { return computer_; }
+private:
+	const PDH_HLOG phDataSource_;
+	std::wstring computer_;
+	std::vector< PerfCountersObject> objects_;
+};
+
+class PerfCountersObject {
+public:
+	PerfCountersObject(PDH_HLOG phDataSource, std::wstring computer, std::wstring object);
+	void read();
+	const std::vector<std::wstring>& getInstances() const { return instances_; }
+	const std::vector<std::wstring>& getCounters() const { return counters_; }
+	const std::wstring& getObjName() const { return object_; }
+private:
+	const PDH_HLOG phDataSource_;
+	std::wstring computer_;
+	std::wstring object_;
+	std::vector<std::wstring> counters_;
+	std::vector<std::wstring> instances_;
+};
+
+//Словари имен счетчиков из реестра: национальное имя -> индекс -> английское имя.
+//Не меняются после построения и общие для всех сессий и экземпляров компоненты
+class PdhNameTables {
+public:
+	static std::shared_ptr<const PdhNameTables> shared();
+	const std::wstring& getEngName(const std::wstring& national_name) const;
+	std::size_t memoryUsage() const;
+private:
+	bool fillEngCountersFromRegistry();
+	bool fillNationalIndicesFromRegistry();
+
+	std::unordered_map<std::uint32_t, std::wstring> eng_counters_map_;
+	std::unordered_map<std::wstring, std::uint32_t> national_index_counters_map_;
+};
+
+//Собственное вычисление значений счетчика. Тип и шкала читаются при первом сканировании, первое значение
+//сверяется с PdhCalculateCounterFromRawValue: при расхождении счетчик навсегда вычисляется через PDH
+struct NativeCooking {
+	enum class State { Unknown, Checking, Verified, Pdh };
+	State state_ = State::Unknown;
+	CookFormula formula_ = CookFormula::Raw;
+	double time_base_ = 0;
+	double scale_ = 1;
+	RawPrevious previous_;
+	PDH_RAW_COUNTER previous_raw_{};	//последняя годная выборка до сверки
+};
+
+//Двоичные журналы Performance monitor (до 32 файлов как единый источник)
+class PdhCounterSource : public CounterSource {
+public:
+	PdhCounterSource();
+	~PdhCounterSource() override;
+	bool open(const std::vector<std::wstring>& files);
+	bool read() override;
+	const std::vector<CounterInfo>& counters() const override;
+	std::uint64_t startTime() const override { return start_time_; }
+	std::uint64_t endTime() const override { return end_time_; }
+	bool scan(std::uint64_t start, std::uint64_t end, const std::vector<std::size_t>& counters, ValueSink& sink) override;
+	std::uint64_t countRecords(std::uint64_t start, std::uint64_t end, std::uint64_t limit) override;
+	bool refresh() override;
+	bool available(std::size_t counter) const override { return counter < handles_.size() && handles_[counter]; }
+	std::size_t memoryUsage() const override;
+private:
+	void close();
+	bool bind();
+	bool readTimeRange();
+	std::wstring catalogKey() const;
+	std::shared_ptr<const std::vector<CounterInfo>> sharedCatalog();
+	std::shared_ptr<const InstancePresence> sharedPresence();
+	void buildPresence(InstancePresence& presence);
+	void fillCounters(const PerfCounters& perfCounters, std::vector<CounterInfo>& catalog) const;
+	bool createQuery();
+	bool cookValue(std::size_t index, std::uint64_t& timestamp, double& value, SampleStatus& status);
+	bool prepareCooking(std::size_t index);
+	void checkCooking(std::size_t index, const PDH_RAW_COUNTER* raw, double* values, SampleStatus* statuses, std::size_t count);
+	void messageErrorPdh(DWORD dwErrorCode);
+	std::uintmax_t filesSize() const;
+
+	PDH_HLOG phDataSource_;
+	HQUERY phQuery_;
+	std::uint64_t start_time_;
+	std::uint64_t end_time_;
+	std::shared_ptr<const PdhNameTables> names_;
+	//Каталог общий с другими источниками, открывшими те же файлы того же размера
+	std::shared_ptr<const std::vector<CounterInfo>> catalog_;
+	//Периоды присутствия экземпляров, общие так же, как каталог
+	std::shared_ptr<const InstancePresence> presence_;
+	std::vector<HCOUNTER> handles_;
+	std::vector<PDH_RAW_COUNTER> prev_values_;
+	std::vector<NativeCooking> cooking_;
+	std::vector<std::wstring> files_;
+	std::uintmax_t files_size_;
+};
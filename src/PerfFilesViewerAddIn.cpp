@@ -41,6 +41,11 @@ PerfFilesViewerAddIn::PerfFilesViewerAddIn() {
         return std::make_shared<variant_t>(std::move(s));
     });
 
+    //Статистика выполнения команд в JSON, как ответ команды stats
+    AddProperty(L"Stats", L"Статистика", [&]() {
+        return std::make_shared<variant_t>(perf_logs_reader_->executeCommand("{\"cmd\":\"stats\"}"));
+    });
+
     // Method registration.
     // Lambdas as method handlers are not supported.
     AddMethod(L"Add", L"Сложить", this, &PerfFilesViewerAddIn::add);
@@ -61,6 +66,9 @@ PerfFilesViewerAddIn::PerfFilesViewerAddIn() {
     AddMethod(L"Sleep", L"Ожидать", this, &PerfFilesViewerAddIn::sleep, {{0, 5}});
 
     perf_logs_reader_ = std::make_unique<PerfLogsReader>();
+    perf_logs_reader_->setEventHandler([this](const std::string &event, const std::string &data) {
+        ExternalEvent(extensionName(), event, data);
+    });
 }
 
 // Sample of addition method. Support both integer and string params.
@@ -127,5 +135,9 @@ variant_t PerfFilesViewerAddIn::currentDate() {
 }
 
 variant_t PerfFilesViewerAddIn::executeCommand(const variant_t& cmd) {
+    // Follow mode pushes events from a background thread, keep a queue for them
+    if (GetEventBufferDepth() < EventBufferDepth) {
+        SetEventBufferDepth(EventBufferDepth);
+    }
     return perf_logs_reader_->executeCommand(std::get<std::string>(cmd));
 }
\ No newline at end of file
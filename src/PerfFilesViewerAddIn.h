@@ -37,6 +37,7 @@ private:
     variant_t currentDate();
     std::shared_ptr<variant_t> sample_property;
 
+    static constexpr long EventBufferDepth = 100;
     std::unique_ptr<PerfLogsReader> perf_logs_reader_;
     variant_t executeCommand(const variant_t& cmd);
 };
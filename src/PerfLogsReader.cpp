@@ -1,103 +1,240 @@
 ﻿#include "PerfLogsReader.h"
 
+#ifdef _WINDOWS
+#include "PdhCounterSource.h"
+#elif defined(__linux__)
+#include "ProcCounterSource.h"
+#endif
+#include "Stats.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <fstream>
+#include <numeric>
+
 using namespace std;
 
-stringstream ss_;
-
-wstring makeCounter(const wchar_t* computer, const wchar_t* object, const wchar_t* instance, const wchar_t* counter);
-wstring utfToWideChar(const string& str);
-string wideCharToUtf(const wstring& wstr);
-vector<wchar_t> vectorToWideChar(const vector<wstring>& files);
-vector<wstring> getComputers(const PDH_HLOG phDataSource);
-vector<wstring> pdhListToVector(const vector<wchar_t>& v_wchar_t);
-SYSTEMTIME longLongToSystemtime(LONGLONG ll);
-LONGLONG fileTimeToLongLong(const FILETIME& fileTime);
-LONGLONG systemtimeToLongLong(const SYSTEMTIME& time);
-string systemtimeToJson(const SYSTEMTIME& time);
-SYSTEMTIME stringToSystemtime(const string& str);
-double distanceBetweenPoints(const SYSTEMTIME& startTime, const SYSTEMTIME& endTime, uint64_t points);
-void printSystemtime(const SYSTEMTIME& time);
-int dayOfWeek(unsigned int year, unsigned int month, unsigned int day);
+//Бюджет по умолчанию: 32-разрядному клиенту 1С доступно не больше 2-4 ГБ адресного пространства
+constexpr size_t DEFAULT_MEMORY_LIMIT = (sizeof(void*) == 4 ? 1024 : 8192) * size_t(1024 * 1024);
+//Оценка памяти на одно значение ответа: узел JSON и его текст
+constexpr size_t JSON_VALUE_BYTES = 48;
+constexpr size_t RESPONSE_CACHE_BYTES = 64 * 1024 * 1024;
+constexpr size_t BUCKET_CACHE_BYTES = 128 * 1024 * 1024;
+//Столько файлов PDH открывает одним источником
+constexpr size_t MAX_OPEN_FILES = 32;
+//Сессия команд без параметра session
+const char* const DEFAULT_SESSION = "default";
+//Хранимых заданий, включая выполненные, но не запрошенные
+constexpr size_t MAX_JOBS = 64;
+
+double distanceBetweenPoints(uint64_t startTime, uint64_t endTime, uint64_t points);
+string serializeResponse(const boost::json::object& j_response);
+boost::json::object statSnapshotToJson(const StatSnapshot& snapshot);
 double getScale(double max_value, double max_scale_value);
-
-PerfCounters::PerfCounters(PDH_HLOG phDataSource) :
-    phDataSource_(phDataSource) {}
-
-void PerfCounters::read() {
-    DWORD  pcchBufferSize = 0;
-    PdhEnumMachinesHW(phDataSource_, NULL, &pcchBufferSize);
-    vector<wchar_t> v_wchar_t(pcchBufferSize);
-    PdhEnumMachinesHW(phDataSource_, &v_wchar_t[0], &pcchBufferSize);
-
-    wchar_t* start = &v_wchar_t[0];
-    for (wchar_t* p = &v_wchar_t[0]; p < &v_wchar_t.back(); ++p) {
-        if (*p == L'\000') {
-            computers_.push_back(PerfCountersComp(phDataSource_, wstring(start)));
-            computers_.back().read();
-            start = p + 1;
+size_t samplesBytes(size_t rows, size_t counters);
+wstring memoryBudgetError(size_t bytes, const MemoryBudget& budget);
+wstring counterKey(const CounterInfo& info);
+bool probeLogFile(const filesystem::path& file, ArchiveProbeResult& result);
+template <typename Value>
+void sortByTime(vector<uint64_t>& times, vector<Value>& values);
+CounterQuality indexedQuality(CounterSource& source, const RangeIndex& index, const IndexedQuality& skipped,
+    size_t first, size_t last, uint64_t start, uint64_t end);
+boost::json::value optionalToJson(const optional<double>& value);
+boost::json::object qualityToJson(const CounterQuality& quality, bool available);
+
+//Приемник сканирования для выгрузки: каждая запись источника становится строкой
+class ExportSink : public ValueSink {
+public:
+    explicit ExportSink(Exporter& exporter) : exporter_(exporter), row_started_(false) {}
+    void value(size_t column, uint64_t timestamp, double value) override {
+        if (!row_started_) {
+            exporter_.beginRow(timestamp);
+            row_started_ = true;
         }
+        exporter_.setValue(column, value);
     }
-}
-
-PerfCountersComp::PerfCountersComp(PDH_HLOG phDataSource, std::wstring computer) :
-    phDataSource_(phDataSource),
-    computer_(computer) {}
-
-void PerfCountersComp::read() {
-    DWORD  pcchBufferSize = 0;
-    PdhEnumObjectsHW(phDataSource_, computer_.c_str(), NULL, &pcchBufferSize, PERF_DETAIL_WIZARD, TRUE);
-    vector<wchar_t> v_wchar_t(pcchBufferSize);
-    PdhEnumObjectsHW(phDataSource_, computer_.c_str(), &v_wchar_t[0], &pcchBufferSize, PERF_DETAIL_WIZARD, TRUE);
-
-    wchar_t* start = &v_wchar_t[0];
-    for (wchar_t* p = &v_wchar_t[0]; p < &v_wchar_t.back(); ++p) {
-        if (*p == L'\000') {
-            objects_.push_back(PerfCountersObject(phDataSource_, computer_, wstring(start)));
-            objects_.back().read();
-            start = p + 1;
+    bool ordered() const override { return true; }
+    void endRecord() override {
+        if (row_started_) {
+            exporter_.endRow();
+            row_started_ = false;
         }
     }
-}
-
-PerfCountersObject::PerfCountersObject(PDH_HLOG phDataSource, std::wstring computer, std::wstring object) :
-    phDataSource_(phDataSource),
-    computer_(computer),
-    object_(object) {}
+private:
+    Exporter& exporter_;
+    bool row_started_;
+};
+
+//Учет качества выборок поверх приемника запроса: column - позиция в indices
+class QualitySink : public ValueSink {
+public:
+    QualitySink(ValueSink& target, const vector<size_t>& indices, vector<CounterStat>& stats) :
+        target_(target), indices_(indices), stats_(stats) {}
+    void value(size_t column, uint64_t timestamp, double value) override {
+        stats_[indices_[column]].quality_.value(timestamp);
+        target_.value(column, timestamp, value);
+    }
+    void skipped(size_t column, SampleStatus status) override {
+        stats_[indices_[column]].quality_.skipped(status);
+    }
+    void endRecord() override { target_.endRecord(); }
+private:
+    ValueSink& target_;
+    const vector<size_t>& indices_;
+    vector<CounterStat>& stats_;
+};
+
+//Отброшенные выборки для индекса. Время записи берется по ее значениям; записи без значений
+//собираются в отрезки между соседними записями со временем или границами сканирования
+class IndexQualitySink : public ValueSink {
+public:
+    IndexQualitySink(ValueSink& target, vector<IndexedQuality>& quality, uint64_t start, uint64_t end) :
+        target_(target), quality_(quality), start_(start), end_(end), column_runs_(quality.size(), 0) {}
+    void value(size_t column, uint64_t timestamp, double value) override {
+        record_time_ = timestamp;
+        record_known_ = true;
+        target_.value(column, timestamp, value);
+    }
+    void skipped(size_t column, SampleStatus status) override {
+        if (status == SampleStatus::FirstSample) quality_[column].rate_ = true;
+        skipped_.push_back({ unknown_records_, column, status });
+    }
+    void endRecord() override {
+        if (record_known_) {
+            closeRun(record_time_ - 1);
+            for (auto& entry : skipped_) {
+                quality_[entry.column_].times_.push_back(record_time_);
+                quality_[entry.column_].statuses_.push_back(entry.status_);
+            }
+            skipped_.clear();
+            last_time_ = record_time_;
+            known_ = true;
+            record_known_ = false;
+        }
+        else {
+            ++unknown_records_;
+        }
+        target_.endRecord();
+    }
+    //Записи без значений в конце сканирования
+    void finish() {
+        closeRun(end_);
+        skipped_.clear();
+    }
+private:
+    struct Entry {
+        uint64_t record_;
+        size_t column_;
+        SampleStatus status_;
+    };
 
-void PerfCountersObject::read() {
-    DWORD pcchCounterListLength = 0;
-    DWORD pcchInstanceListLength = 0;
-    PdhEnumObjectItemsHW(phDataSource_, computer_.c_str(), object_.c_str(), NULL, &pcchCounterListLength, NULL, &pcchInstanceListLength, PERF_DETAIL_WIZARD, 0);
+    //Выборки записей без времени переходят в отрезки своих счетчиков
+    void closeRun(uint64_t last) {
+        if (!unknown_records_) return;
+        const uint64_t first = known_ ? last_time_ + 1 : start_;
+        ++runs_;
+        for (auto& entry : skipped_) {
+            if (entry.record_ >= unknown_records_) continue;
+            IndexedQuality& quality = quality_[entry.column_];
+            if (column_runs_[entry.column_] != runs_) {
+                column_runs_[entry.column_] = runs_;
+                quality.runs_.push_back({ first, last, unknown_records_, quality.run_records_.size() });
+            }
+            quality.run_records_.push_back(entry.record_);
+            quality.run_statuses_.push_back(entry.status_);
+        }
+        skipped_.erase(remove_if(skipped_.begin(), skipped_.end(),
+            [&](const Entry& entry) { return entry.record_ < unknown_records_; }), skipped_.end());
+        for (auto& entry : skipped_) {
+            entry.record_ = 0;
+        }
+        unknown_records_ = 0;
+    }
 
-    vector<wchar_t> mszCounterList(pcchCounterListLength);
-    vector<wchar_t> mszInstanceList;
-    if (pcchInstanceListLength) {
-        mszInstanceList.resize(pcchInstanceListLength);
-        PdhEnumObjectItemsHW(phDataSource_, computer_.c_str(), object_.c_str(),
-            &mszCounterList[0], &pcchCounterListLength,
-            &mszInstanceList[0], &pcchInstanceListLength,
-            PERF_DETAIL_WIZARD, 0);
-        counters_ = pdhListToVector(mszCounterList);
-        instances_ = pdhListToVector(mszInstanceList);
+    ValueSink& target_;
+    vector<IndexedQuality>& quality_;
+    uint64_t start_;
+    uint64_t end_;
+    uint64_t record_time_ = 0;
+    bool record_known_ = false;
+    uint64_t last_time_ = 0;
+    bool known_ = false;
+    uint64_t unknown_records_ = 0;
+    size_t runs_ = 0;
+    vector<size_t> column_runs_;
+    vector<Entry> skipped_;
+};
+
+//Запас перед участком выровненных интервалов: выборки из него только задают предыдущие
+//значения скоростей, сами значения и пропуски отбрасываются
+constexpr uint64_t RUN_LEAD_IN = 5 * 60 * TICKS_PER_SECOND;
+
+class LeadInSink : public ValueSink {
+public:
+    explicit LeadInSink(ValueSink& target) : target_(target) {}
+    void start(uint64_t from) {
+        from_ = from;
+        seen_ = false;
+        record_lead_in_ = false;
+        skipped_.clear();
     }
-    else {
-        PdhEnumObjectItemsHW(phDataSource_, computer_.c_str(), object_.c_str(),
-            &mszCounterList[0], &pcchCounterListLength,
-            NULL, &pcchInstanceListLength,
-            PERF_DETAIL_WIZARD, 0);
-        counters_ = pdhListToVector(mszCounterList);
-        instances_.clear();
+    //true - в запасе была хотя бы одна выборка со значением
+    bool seen() const { return seen_; }
+    void value(size_t column, uint64_t timestamp, double value) override {
+        if (timestamp < from_) {
+            seen_ = true;
+            record_lead_in_ = true;
+            return;
+        }
+        flushSkipped();
+        target_.value(column, timestamp, value);
     }
-}
+    //Время записи известно только по значениям, поэтому пропуски ждут конца записи
+    void skipped(size_t column, SampleStatus status) override {
+        skipped_.push_back({ column, status });
+    }
+    void endRecord() override {
+        if (record_lead_in_) {
+            skipped_.clear();
+            record_lead_in_ = false;
+            return;
+        }
+        flushSkipped();
+        target_.endRecord();
+    }
+private:
+    void flushSkipped() {
+        for (auto& entry : skipped_) {
+            target_.skipped(entry.first, entry.second);
+        }
+        skipped_.clear();
+    }
+
+    ValueSink& target_;
+    uint64_t from_ = 0;
+    bool seen_ = false;
+    bool record_lead_in_ = false;
+    vector<pair<size_t, SampleStatus>> skipped_;
+};
 
 PerfLogsReader::PerfLogsReader() :
-    phDataSource_(nullptr),
-    phQuery_(nullptr),
-    start_time_({ 0, 0 }),
-    end_time_({ 0, 0 }) {}
+    memory_budget_(DEFAULT_MEMORY_LIMIT),
+    session_(nullptr),
+    follow_session_(nullptr),
+    follow_stop_(false),
+    follow_interval_(5000),
+    follow_bucket_(0),
+    follow_last_time_(0),
+    follow_mode_(DownsamplingMode::Max),
+    next_job_(1),
+    pool_(make_unique<WorkerPool>()) {
+    selectSession(DEFAULT_SESSION);
+}
 
+//Задания в очереди выполняются до остановки слежения и освобождения сессий
 PerfLogsReader::~PerfLogsReader() {
-    close();
+    pool_ = nullptr;
+    stopFollow();
 }
 
 wstring PerfLogsReader::executeCommandW(const string& cmd) {
@@ -106,180 +243,1985 @@ wstring PerfLogsReader::executeCommandW(const string& cmd) {
 
 string PerfLogsReader::executeCommand(const string& cmd) {
     namespace json = boost::json;
+    auto parse_start = chrono::steady_clock::now();
     error_code ec;
     json::value jv = json::parse(cmd, ec);
     if (ec) {
         wcout << "Parsing failed: " << utfToWideChar(ec.message()) << '\n';
     }
+    auto parse_time = chrono::steady_clock::now() - parse_start;
 
     if (json::object* j_object = jv.if_object()) {
         string cmd(j_object->at("cmd").if_string()->c_str());
-        if (cmd == "open") {
-            return executeCommandOpen(j_object->at("files").if_array());
+        //Состояние заданий и постановка в очередь не ждут выполняющихся команд
+        if (cmd == "job_status") {
+            return executeCommandJobStatus(j_object);
         }
-        else if (cmd == "read") {
-            return executeCommandRead();
+        if (const json::value* j_async = j_object->if_contains("async")) {
+            if (j_async->as_bool()) {
+                return submitJob(cmd, move(jv), parse_time);
+            }
         }
-        else if (cmd == "get_values") {
-            return executeCommandGetValues(j_object);
+        //Пока выполняется задание, синхронная команда его не ждет: статистика и трассировка отвечают
+        //без данных сессии, остальные команды получают отказ. Короткий шаг слежения ожидается
+        unique_lock<mutex> lock(mutex_, defer_lock);
+        while (!lock.try_lock()) {
+            if (jobsPending()) {
+                if (cmd == "stats") {
+                    return executeCommandStats(j_object, false);
+                }
+                if (cmd == "trace_start" || cmd == "trace_stop") {
+                    return executeCommandTrace(j_object, cmd == "trace_start");
+                }
+                json::object j_response;
+                j_response.emplace("status", false);
+                j_response.emplace("busy", true);
+                j_response.emplace("error", u8"Выполняется задание, повторите команду позже!");
+                return serializeResponse(j_response);
+            }
+            this_thread::sleep_for(chrono::milliseconds(1));
         }
+        return executeObject(cmd, j_object, parse_time);
+    }
+
+    return "";
+}
+
+//Есть задания в очереди или в работе
+bool PerfLogsReader::jobsPending() {
+    lock_guard<mutex> lock(jobs_mutex_);
+    return !job_queue_.empty() || any_of(jobs_.begin(), jobs_.end(), [](const auto& job) {
+        return job.second.state_ == JobState::Running;
+    });
+}
+
+//Выполнение разобранной команды под блокировкой mutex_
+string PerfLogsReader::executeObject(const string& cmd, boost::json::object* j_object, chrono::steady_clock::duration parse_time) {
+    namespace json = boost::json;
+    //Запросы статистики и трассировки сами в статистику не попадают
+    if (cmd == "stats") {
+        return executeCommandStats(j_object, true);
+    }
+    else if (cmd == "trace_start" || cmd == "trace_stop") {
+        return executeCommandTrace(j_object, cmd == "trace_start");
+    }
+    //Команда относится к сессии из параметра session, без него - к сессии по умолчанию
+    string session_name = DEFAULT_SESSION;
+    if (const json::value* j_session = j_object->if_contains("session")) {
+        session_name = j_session->as_string().c_str();
+    }
+    selectSession(session_name);
+
+    Stats& stats = Stats::instance();
+    stats.beginCommand(cmd, currentLocalTicks());
+    stats.add(StatPhase::Parse, chrono::duration_cast<chrono::nanoseconds>(parse_time).count());
+    ScopedTimer timer(StatPhase::Command, cmd);
+
+    if (cmd == "open") {
+        return executeCommandOpen(j_object);
+    }
+    else if (cmd == "read") {
+        return executeCommandRead();
+    }
+    else if (cmd == "get_values") {
+        return executeCommandGetValues(j_object);
+    }
+    else if (cmd == "correlate") {
+        return executeCommandCorrelate(j_object);
+    }
+    else if (cmd == "compare") {
+        return executeCommandCompare(j_object);
+    }
+    else if (cmd == "index") {
+        return executeCommandIndex(j_object);
+    }
+    else if (cmd == "intervals") {
+        return executeCommandIntervals(j_object);
+    }
+    else if (cmd == "resample") {
+        return executeCommandResample(j_object);
+    }
+    else if (cmd == "clock_skew") {
+        return executeCommandClockSkew(j_object);
+    }
+    else if (cmd == "archive_index") {
+        return executeCommandArchiveIndex(j_object);
+    }
+    else if (cmd == "open_range") {
+        return executeCommandOpenRange(j_object);
+    }
+    else if (cmd == "export") {
+        return executeCommandExport(j_object);
+    }
+    else if (cmd == "follow") {
+        return executeCommandFollow(j_object);
+    }
+    else if (cmd == "memory") {
+        return executeCommandMemory(j_object);
+    }
+    else if (cmd == "close") {
+        return executeCommandClose();
+    }
+    else if (cmd == "sessions") {
+        return executeCommandSessions();
     }
 
     return "";
 }
 
-string PerfLogsReader::executeCommandOpen(const boost::json::array* j_array) {
+//Команда с "async":true выполняется в пуле: ответ сразу содержит номер задания,
+//результат приходит внешним событием job и доступен команде job_status.
+//Задания выполняются по одному в порядке поступления, как и синхронные команды
+string PerfLogsReader::submitJob(const string& cmd, boost::json::value jv, chrono::steady_clock::duration parse_time) {
+    namespace json = boost::json;
+    uint64_t id;
+    {
+        lock_guard<mutex> lock(jobs_mutex_);
+        id = next_job_++;
+        Job& job = jobs_[id];
+        job.command_ = cmd;
+        job.request_ = move(jv);
+        job.parse_time_ = parse_time;
+        job_queue_.push_back(id);
+        //Завершенные задания, результат которых так и не запросили, хранятся ограниченно
+        while (jobs_.size() > MAX_JOBS) {
+            auto it = find_if(jobs_.begin(), jobs_.end(), [](const auto& job) { return job.second.state_ == JobState::Done; });
+            if (it == jobs_.end()) break;
+            jobs_.erase(it);
+        }
+    }
+
+    //Задача пула берет старейшее задание уже под mutex_, поэтому порядок не зависит от того,
+    //какой поток пула начнет первым
+    pool_->submit([this]() {
+        unique_lock<mutex> lock(mutex_);
+        uint64_t id;
+        string cmd;
+        json::value request;
+        chrono::steady_clock::duration parse_time;
+        {
+            lock_guard<mutex> jobs_lock(jobs_mutex_);
+            id = job_queue_.front();
+            job_queue_.pop_front();
+            Job& job = jobs_.at(id);
+            job.state_ = JobState::Running;
+            cmd = job.command_;
+            request = move(job.request_);
+            parse_time = job.parse_time_;
+        }
+        string result;
+        //Исключение в потоке пула некому перехватить, поэтому оно становится ответом задания
+        try {
+            result = executeObject(cmd, request.if_object(), parse_time);
+        }
+        catch (const exception& e) {
+            json::object j_error;
+            j_error.emplace("status", false);
+            j_error.emplace("error", e.what());
+            result = serializeResponse(j_error);
+        }
+        lock.unlock();
+
+        if (event_handler_) {
+            event_handler_("job", "{\"job\":" + to_string(id) + ",\"cmd\":" + json::serialize(json::value(cmd))
+                + ",\"result\":" + (result.empty() ? string("null") : result) + "}");
+        }
+        lock_guard<mutex> jobs_lock(jobs_mutex_);
+        auto it = jobs_.find(id);
+        if (it != jobs_.end()) {
+            it->second.state_ = JobState::Done;
+            it->second.result_ = move(result);
+        }
+    });
+
+    json::object j_response;
+    j_response.emplace("status", true);
+    j_response.emplace("job", id);
+    return serializeResponse(j_response);
+}
+
+//Состояние задания; результат выполненного задания отдается один раз
+string PerfLogsReader::executeCommandJobStatus(boost::json::object* j_cmd) {
+    namespace json = boost::json;
+    const uint64_t id = json::value_to<uint64_t>(j_cmd->at("job"));
+    json::object j_response;
+    lock_guard<mutex> lock(jobs_mutex_);
+    auto it = jobs_.find(id);
+    if (it == jobs_.end()) {
+        j_response.emplace("status", false);
+        j_response.emplace("error", u8"Задание не найдено!");
+        return serializeResponse(j_response);
+    }
+
+    static const char* states[] = { "queued", "running", "done" };
+    j_response.emplace("status", true);
+    j_response.emplace("job", id);
+    j_response.emplace("cmd", it->second.command_);
+    j_response.emplace("state", states[static_cast<size_t>(it->second.state_)]);
+    if (it->second.state_ != JobState::Done) {
+        return serializeResponse(j_response);
+    }
+    //Ответ команды - JSON, иначе передается строкой
+    const string& result = it->second.result_;
+    error_code ec;
+    json::value j_result = result.empty() ? json::value(nullptr) : json::parse(result, ec);
+    j_response.emplace("result", ec ? json::value(result) : move(j_result));
+    jobs_.erase(it);
+    return serializeResponse(j_response);
+}
+
+string PerfLogsReader::executeCommandOpen(const boost::json::object* j_cmd) {
+    namespace json = boost::json;
+    json::object j_response;
+    bool opened = false;
+    if (const json::value* j_source = j_cmd->if_contains("source")) {
+        string source(j_source->as_string().c_str());
+        if (source == "proc") {
+            //Период опроса в секундах и глубина кольцевого буфера в выборках
+            double interval = 1;
+            if (const json::value* j_interval = j_cmd->if_contains("interval")) {
+                interval = json::value_to<double>(*j_interval);
+            }
+            if (interval < 0.1) interval = 0.1;
+            size_t capacity = 3600;
+            if (const json::value* j_capacity = j_cmd->if_contains("capacity")) {
+                capacity = json::value_to<size_t>(*j_capacity);
+            }
+            if (capacity < 2) capacity = 2;
+            opened = openProc(chrono::milliseconds(static_cast<int64_t>(interval * 1000)), capacity);
+        }
+        else if (source == "synthetic") {
+            SyntheticOptions options;
+            if (const json::value* j_counters = j_cmd->if_contains("counters")) {
+                options.counters_ = json::value_to<size_t>(*j_counters);
+            }
+            if (const json::value* j_samples = j_cmd->if_contains("samples")) {
+                options.samples_ = json::value_to<uint64_t>(*j_samples);
+            }
+            if (const json::value* j_interval = j_cmd->if_contains("interval")) {
+                options.interval_ = static_cast<uint64_t>(json::value_to<double>(*j_interval) * TICKS_PER_SECOND);
+            }
+            if (const json::value* j_start_time = j_cmd->if_contains("start_time")) {
+                options.start_time_ = jsonToTicks(string(j_start_time->as_string().c_str()));
+            }
+            if (const json::value* j_seed = j_cmd->if_contains("seed")) {
+                options.seed_ = json::value_to<uint64_t>(*j_seed);
+            }
+            if (const json::value* j_machines = j_cmd->if_contains("machines")) {
+                options.machines_ = json::value_to<size_t>(*j_machines);
+            }
+            if (const json::value* j_lifetime = j_cmd->if_contains("lifetime")) {
+                options.lifetime_ = json::value_to<uint64_t>(*j_lifetime);
+            }
+            if (const json::value* j_gaps = j_cmd->if_contains("gaps")) {
+                options.gaps_ = json::value_to<double>(*j_gaps);
+            }
+            opened = openSynthetic(options);
+        }
+        else {
+            j_response.emplace("status", false);
+            j_response.emplace("error", u8"Неизвестный источник счетчиков: " + source);
+            return serializeResponse(j_response);
+        }
+    }
+    else {
+        const json::array& j_array = j_cmd->at("files").as_array();
+        vector<wstring> files(j_array.size());
+        auto it_files = files.begin();
+        for (auto it = j_array.begin(); it < j_array.end(); ++it) {
+            *it_files = utfToWideChar(string(it->as_string().c_str()));
+            ++it_files;
+        }
+        opened = open(files);
+    }
+
+    if (opened) {
+        j_response.emplace("status", true);
+    }
+    else {
+        j_response.emplace("status", false);
+        j_response.emplace("error", wideCharToUtf(message_error_));
+    }
+    return serializeResponse(j_response);
+}
+
+string PerfLogsReader::executeCommandRead() {
+    namespace json = boost::json;
+    json::object j_response;
+    if (read()) {
+        json::object j_data;
+        j_data.emplace("start_time", ticksToJson(session_->source_->startTime()));
+        j_data.emplace("end_time", ticksToJson(session_->source_->endTime()));
+        j_data.emplace("counters", countersToJsonObject());
+
+        j_response.emplace("status", true);
+        j_response.emplace("data", j_data);
+    }
+    else {
+        j_response.emplace("status", false);
+        j_response.emplace("error", wideCharToUtf(message_error_));
+    }
+    return serializeResponse(j_response);
+}
+
+string PerfLogsReader::executeCommandGetValues(boost::json::object* j_cmd) {
+    namespace json = boost::json;
+    uint64_t start_time = jsonToTicks(string(j_cmd->at("start_time").if_string()->c_str()));
+    uint64_t end_time = jsonToTicks(string(j_cmd->at("end_time").if_string()->c_str()));
+    uint64_t points = json::value_to<uint64_t>(j_cmd->at("points"));
+
+    json::object j_response;
+    DownsamplingMode mode = DownsamplingMode::Max;
+    if (const json::value* j_mode = j_cmd->if_contains("mode")) {
+        string mode_name(j_mode->as_string().c_str());
+        if (!downsamplingModeFromString(mode_name, mode)) {
+            j_response.emplace("status", false);
+            j_response.emplace("error", u8"Неизвестный режим прореживания: " + mode_name);
+            return serializeResponse(j_response);
+        }
+    }
+
+    //Выровненные интервалы переиспользуются между запросами при сдвиге и масштабировании
+    bool aligned = false;
+    if (const json::value* j_aligned = j_cmd->if_contains("aligned")) {
+        aligned = j_aligned->as_bool();
+    }
+
+    //Повтор запроса к неизменившемуся источнику отдается из кэша ответов
+    string cache_key;
+    if (session_->source_) {
+        cache_key = json::serialize(*j_cmd) + '|' + to_string(session_->source_->endTime());
+        //Статистика и качество счетчиков восстанавливаются, как после повторного чтения
+        if (const CachedResponse* cached = session_->responses_.find(cache_key)) {
+            session_->counters_stat_ = cached->counters_stat_;
+            vector<size_t> indices(session_->counters_stat_.size());
+            for (size_t i = 0; i < indices.size(); ++i) {
+                indices[i] = i;
+            }
+            accumulateQuality(indices);
+            return cached->response_;
+        }
+    }
+
+    uint64_t width = 0;
+    vector<Sample> samples = aligned ? getAlignedValues(start_time, end_time, points, mode, width)
+        : getValues(start_time, end_time, points, mode);
+
+    if (!samples.size() && !message_error_.empty()) {
+        j_response.emplace("status", false);
+        j_response.emplace("error", wideCharToUtf(message_error_));
+        return serializeResponse(j_response);
+    }
+
+    MemoryReservation output_memory;
+    const size_t output_bytes = samples.size() * (session_->counters_stat_.size() + 1) * JSON_VALUE_BYTES;
+    if (!output_memory.reserve(memory_budget_, MemoryArea::Output, output_bytes)) {
+        j_response.emplace("status", false);
+        j_response.emplace("error", wideCharToUtf(memoryBudgetError(output_bytes, memory_budget_)));
+        return serializeResponse(j_response);
+    }
+
+    json::array j_counters_stat;
+    json::array j_samples;
+    json::array j_points;
+    {
+        ScopedTimer timer(StatPhase::Json);
+        for (auto it = session_->counters_stat_.begin(); it < session_->counters_stat_.end(); ++it) {
+
+            json::object j_counter_stat;
+            if (it->max_value_) { j_counter_stat.emplace("max", *it->max_value_); }
+            else { j_counter_stat.emplace("max", nullptr); }
+            if (it->sum_value_) { j_counter_stat.emplace("sum", *it->sum_value_); }
+            else { j_counter_stat.emplace("sum", nullptr); }
+            if (it->count_value_) {
+                j_counter_stat.emplace("count", *it->count_value_);
+                double avg = *it->sum_value_ / *it->count_value_;
+                j_counter_stat.emplace("avg", avg);
+            }
+            else {
+                j_counter_stat.emplace("count", nullptr);
+                j_counter_stat.emplace("avg", nullptr);
+            }
+            const size_t index = it - session_->counters_stat_.begin();
+            j_counter_stat.emplace("quality", qualityToJson(it->quality_, session_->source_->available(index)));
+            j_counters_stat.push_back(j_counter_stat);
+        }
+
+        for (auto it_sample = samples.begin(); it_sample < samples.end(); ++it_sample) {
+            json::array j_values;
+            for (size_t index = 0; index < it_sample->values_.size(); ++index) {
+                if (it_sample->values_[index]) { j_values.push_back(*it_sample->values_[index]); }
+                else { j_values.push_back(nullptr); }
+            }
+            j_samples.push_back(j_values);
+            j_points.push_back(ticksToJson(it_sample->point_time_).c_str());
+        }
+    }
+
+    j_response.emplace("status", true);
+    j_response.emplace("counters_stat", j_counters_stat);
+    j_response.emplace("points", j_points);
+    j_response.emplace("samples", j_samples);
+    if (aligned) {
+        j_response.emplace("bucket_width", static_cast<double>(width) / TICKS_PER_SECOND);
+    }
+
+    string response = serializeResponse(j_response);
+    session_->responses_.insert(cache_key, { response, session_->counters_stat_ },
+        cache_key.size() + response.size() + session_->counters_stat_.size() * sizeof(CounterStat));
+    return response;
+}
+
+string PerfLogsReader::executeCommandCorrelate(boost::json::object* j_cmd) {
+    namespace json = boost::json;
+    json::object j_response;
+
+    vector<size_t> indices;
+    if (!selectedCounters(j_cmd, indices)) {
+        j_response.emplace("status", false);
+        j_response.emplace("error", wideCharToUtf(message_error_));
+        return serializeResponse(j_response);
+    }
+
+    uint64_t start_time = jsonToTicks(string(j_cmd->at("start_time").if_string()->c_str()));
+    uint64_t end_time = jsonToTicks(string(j_cmd->at("end_time").if_string()->c_str()));
+    uint64_t points = json::value_to<uint64_t>(j_cmd->at("points"));
+
+    CorrelationMethod method = CorrelationMethod::Pearson;
+    if (const json::value* j_method = j_cmd->if_contains("method")) {
+        string method_name(j_method->as_string().c_str());
+        if (method_name == "spearman") {
+            method = CorrelationMethod::Spearman;
+        }
+        else if (method_name != "pearson") {
+            j_response.emplace("status", false);
+            j_response.emplace("error", u8"Неизвестный метод корреляции: " + method_name);
+            return serializeResponse(j_response);
+        }
+    }
+    size_t max_lag = 0;
+    if (const json::value* j_max_lag = j_cmd->if_contains("max_lag")) {
+        max_lag = json::value_to<size_t>(*j_max_lag);
+    }
+    size_t threads = 0;
+    if (const json::value* j_threads = j_cmd->if_contains("threads")) {
+        threads = json::value_to<size_t>(*j_threads);
+    }
+
+    //С fill ряды - значения в узлах равномерной сетки, без него - максимумы интервалов getValues
+    FillMode fill = FillMode::Linear;
+    uint64_t max_gap = 0;
+    const bool resample = j_cmd->if_contains("fill") != nullptr;
+    if (resample && !resampleOptions(j_cmd, fill, max_gap)) {
+        j_response.emplace("status", false);
+        j_response.emplace("error", wideCharToUtf(message_error_));
+        return serializeResponse(j_response);
+    }
+    vector<Sample> samples;
+    vector<vector<double>> columns;
+    const ResampleGrid grid = uniformGrid(start_time, end_time, points);
+    bool loaded = true;
+    if (resample) {
+        loaded = resampleCounters(grid, indices, fill, max_gap, columns);
+    }
+    else {
+        samples = getValues(start_time, end_time, points);
+        loaded = samples.size() || message_error_.empty();
+    }
+    if (!loaded) {
+        j_response.emplace("status", false);
+        j_response.emplace("error", wideCharToUtf(message_error_));
+        return serializeResponse(j_response);
+    }
+    const size_t series_points = resample ? grid.points_ : samples.size();
+
+    //Ряды выбранных счетчиков и матрицы коэффициентов и лагов
+    MemoryReservation series_memory;
+    const size_t series_bytes = indices.size() * series_points * sizeof(optional<double>)
+        + indices.size() * indices.size() * (sizeof(double) + sizeof(int));
+    if (!series_memory.reserve(memory_budget_, MemoryArea::Samples, series_bytes)) {
+        j_response.emplace("status", false);
+        j_response.emplace("error", wideCharToUtf(memoryBudgetError(series_bytes, memory_budget_)));
+        return serializeResponse(j_response);
+    }
+
+    vector<vector<optional<double>>> series(indices.size(), vector<optional<double>>(series_points));
+    for (size_t k = 0; k < indices.size(); ++k) {
+        for (size_t i = 0; i < series_points; ++i) {
+            if (!resample) {
+                series[k][i] = samples[i].values_[indices[k]];
+            }
+            else if (!isnan(columns[k][i])) {
+                series[k][i] = columns[k][i];
+            }
+        }
+    }
+
+    CorrelationMatrix matrix = correlate(series, method, max_lag, *pool_, threads);
+
+    json::array j_counters;
+    json::array j_matrix;
+    json::array j_lags;
+    {
+        ScopedTimer timer(StatPhase::Json);
+        for (auto index : indices) {
+            j_counters.push_back(index);
+        }
+
+        for (size_t i = 0; i < matrix.size_; ++i) {
+            json::array j_row;
+            json::array j_lag_row;
+            for (size_t j = 0; j < matrix.size_; ++j) {
+                double r = matrix.at(i, j);
+                if (isnan(r)) { j_row.push_back(nullptr); }
+                else { j_row.push_back(r); }
+                j_lag_row.push_back(matrix.lagAt(i, j));
+            }
+            j_matrix.push_back(j_row);
+            if (max_lag) { j_lags.push_back(j_lag_row); }
+        }
+    }
+
+    j_response.emplace("status", true);
+    j_response.emplace("counters", j_counters);
+    j_response.emplace("points", series_points);
+    j_response.emplace("interval", (resample ? static_cast<double>(grid.step_)
+        : distanceBetweenPoints(start_time, end_time, samples.size())) / TICKS_PER_SECOND);
+    j_response.emplace("matrix", j_matrix);
+    if (max_lag) {
+        j_response.emplace("lags", j_lags);
+    }
+
+    return serializeResponse(j_response);
+}
+
+//Значения счетчиков в узлах равномерной сетки: points узлов или шаг step (секунды) от start_time
+//до end_time. fill - none, step или linear (по умолчанию), max_gap - предел заполнения в секундах
+string PerfLogsReader::executeCommandResample(boost::json::object* j_cmd) {
+    namespace json = boost::json;
+    json::object j_response;
+    vector<size_t> indices;
+    FillMode fill = FillMode::Linear;
+    uint64_t max_gap = 0;
+    if (!selectedCounters(j_cmd, indices) || !resampleOptions(j_cmd, fill, max_gap)) {
+        j_response.emplace("status", false);
+        j_response.emplace("error", wideCharToUtf(message_error_));
+        return serializeResponse(j_response);
+    }
+
+    uint64_t start_time = jsonToTicks(string(j_cmd->at("start_time").as_string().c_str()));
+    uint64_t end_time = jsonToTicks(string(j_cmd->at("end_time").as_string().c_str()));
+    ResampleGrid grid;
+    if (const json::value* j_step = j_cmd->if_contains("step")) {
+        grid.start_ = start_time;
+        grid.step_ = max<uint64_t>(llround(json::value_to<double>(*j_step) * TICKS_PER_SECOND), 1);
+        grid.points_ = end_time > start_time ? (end_time - start_time) / grid.step_ + 1 : 1;
+    }
+    else {
+        grid = uniformGrid(start_time, end_time, json::value_to<size_t>(j_cmd->at("points")));
+    }
+
+    vector<vector<double>> columns;
+    if (!resampleCounters(grid, indices, fill, max_gap, columns)) {
+        j_response.emplace("status", false);
+        j_response.emplace("error", wideCharToUtf(message_error_));
+        return serializeResponse(j_response);
+    }
+
+    MemoryReservation output_memory;
+    const size_t output_bytes = grid.points_ * (indices.size() + 1) * JSON_VALUE_BYTES;
+    if (!output_memory.reserve(memory_budget_, MemoryArea::Output, output_bytes)) {
+        j_response.emplace("status", false);
+        j_response.emplace("error", wideCharToUtf(memoryBudgetError(output_bytes, memory_budget_)));
+        return serializeResponse(j_response);
+    }
+    json::array j_counters;
+    json::array j_points;
+    json::array j_samples;
+    {
+        ScopedTimer timer(StatPhase::Json);
+        for (auto index : indices) {
+            j_counters.push_back(index);
+        }
+        for (size_t i = 0; i < grid.points_; ++i) {
+            json::array j_values;
+            for (auto& column : columns) {
+                if (isnan(column[i])) { j_values.push_back(nullptr); }
+                else { j_values.push_back(column[i]); }
+            }
+            j_samples.push_back(j_values);
+            j_points.push_back(ticksToJson(grid.time(i)).c_str());
+        }
+    }
+    j_response.emplace("status", true);
+    j_response.emplace("counters", j_counters);
+    j_response.emplace("step", static_cast<double>(grid.step_) / TICKS_PER_SECOND);
+    j_response.emplace("points", j_points);
+    j_response.emplace("samples", j_samples);
+    return serializeResponse(j_response);
+}
+
+bool PerfLogsReader::resampleOptions(const boost::json::object* j_cmd, FillMode& fill, uint64_t& max_gap) {
+    namespace json = boost::json;
+    if (const json::value* j_fill = j_cmd->if_contains("fill")) {
+        string fill_name(j_fill->as_string().c_str());
+        if (!fillModeFromString(fill_name, fill)) {
+            message_error_ = L"Неизвестный способ заполнения: " + utfToWideChar(fill_name);
+            return false;
+        }
+    }
+    if (const json::value* j_max_gap = j_cmd->if_contains("max_gap")) {
+        max_gap = llround(json::value_to<double>(*j_max_gap) * TICKS_PER_SECOND);
+    }
+    return true;
+}
+
+//Ряды счетчиков в узлах сетки. Выборки берутся из действующего индекса диапазонов или сканируются
+//с запасом по краям (max_gap или шаг сетки), чтобы у крайних узлов были соседи
+bool PerfLogsReader::resampleCounters(const ResampleGrid& grid, const vector<size_t>& indices, FillMode fill,
+    uint64_t max_gap, vector<vector<double>>& columns) {
+    if (!session_->source_) {
+        message_error_ = L"Файлы не открыты!";
+        return false;
+    }
+    MemoryReservation columns_memory;
+    const size_t columns_bytes = indices.size() * grid.points_ * sizeof(double);
+    if (!columns_memory.reserve(memory_budget_, MemoryArea::Samples, columns_bytes)) {
+        message_error_ = memoryBudgetError(columns_bytes, memory_budget_);
+        return false;
+    }
+
+    const bool use_index = !session_->indexes_.empty() && session_->indexed_end_ == session_->source_->endTime();
+    vector<const RangeIndex*> loaded(indices.size(), nullptr);
+    vector<size_t> scanned;
+    for (size_t k = 0; k < indices.size(); ++k) {
+        auto it = use_index ? session_->indexes_.find(indices[k]) : session_->indexes_.end();
+        if (it != session_->indexes_.end()) {
+            loaded[k] = &it->second;
+        }
+        else {
+            scanned.push_back(k);
+        }
+    }
+
+    //Выборки резервируются до сканирования: ряды источника - по числу записей периода сетки с запасом,
+    //ряды индекса хранятся сжатыми и разворачиваются только на этот период
+    const uint64_t margin = max_gap ? max_gap : grid.step_;
+    const uint64_t first = grid.start_ > margin ? grid.start_ - margin : 0;
+    const uint64_t last = grid.time(grid.points_ - 1) + margin;
+    const size_t sample_bytes = sizeof(uint64_t) + sizeof(double);
+    size_t loaded_bytes = 0;
+    vector<pair<size_t, size_t>> windows(indices.size());
+    for (size_t k = 0; k < indices.size(); ++k) {
+        if (!loaded[k]) continue;
+        windows[k] = { loaded[k]->lowerBound(first), loaded[k]->lowerBound(last + 1) };
+        loaded_bytes += (windows[k].second - windows[k].first) * sample_bytes;
+    }
+    uint64_t records = 0;
+    if (!scanned.empty()) {
+        const uint64_t records_limit = memory_budget_.limit() / (sample_bytes * scanned.size()) + 1;
+        TraceScope trace("count_records");
+        records = min(session_->source_->countRecords(first, last, records_limit), records_limit);
+        loaded_bytes += static_cast<size_t>(records) * scanned.size() * sample_bytes;
+    }
+    MemoryReservation loaded_memory;
+    if (!loaded_memory.reserve(memory_budget_, MemoryArea::Samples, loaded_bytes)) {
+        message_error_ = memoryBudgetError(loaded_bytes, memory_budget_);
+        return false;
+    }
+
+    vector<vector<uint64_t>> times(scanned.size());
+    vector<vector<double>> values(scanned.size());
+    if (!scanned.empty()) {
+        vector<size_t> scan_indices;
+        for (size_t s = 0; s < scanned.size(); ++s) {
+            scan_indices.push_back(indices[scanned[s]]);
+            times[s].reserve(records);
+            values[s].reserve(records);
+        }
+        auto sink = makeSink([&](size_t column, uint64_t timestamp, double value) {
+            times[column].push_back(timestamp);
+            values[column].push_back(value);
+        });
+        TraceScope trace("scan", to_string(scan_indices.size()) + " counters");
+        session_->source_->scan(first, last, scan_indices, sink);
+    }
+
+    ScopedTimer timer(StatPhase::Aggregate);
+    columns.assign(indices.size(), vector<double>(grid.points_));
+    pool_->parallelFor(indices.size(), [&](size_t k) {
+        if (loaded[k]) {
+            const size_t count = windows[k].second - windows[k].first;
+            vector<uint64_t> window_times(count);
+            vector<double> window_values(count);
+            loaded[k]->decode(windows[k].first, windows[k].second, window_times.data(), window_values.data());
+            resampleColumn(window_times.data(), window_values.data(), count, grid, fill, max_gap, columns[k].data());
+            return;
+        }
+        const size_t s = lower_bound(scanned.begin(), scanned.end(), k) - scanned.begin();
+        sortByTime(times[s], values[s]);
+        resampleColumn(times[s].data(), values[s].data(), times[s].size(), grid, fill, max_gap, columns[k].data());
+    });
+    return true;
+}
+
+//Сравнение двух диапазонов одной или разных сессий на общей относительной сетке:
+//ряды обоих диапазонов, их разность и отношение, изменения счетчиков по убыванию
+string PerfLogsReader::executeCommandCompare(boost::json::object* j_cmd) {
+    namespace json = boost::json;
+    json::object j_response;
+    auto fail = [&](const wstring& error) {
+        j_response.emplace("status", false);
+        j_response.emplace("error", wideCharToUtf(error));
+        return serializeResponse(j_response);
+    };
+
+    struct Range {
+        string session_;
+        uint64_t start_time_;
+        uint64_t end_time_;
+        vector<Sample> samples_;
+        vector<CounterStat> counters_stat_;
+    };
+    Range ranges[2];
+    const char* range_names[2] = { "base", "target" };
+    for (size_t r = 0; r < 2; ++r) {
+        const json::object& j_range = j_cmd->at(range_names[r]).as_object();
+        ranges[r].session_ = session_name_;
+        if (const json::value* j_session = j_range.if_contains("session")) {
+            ranges[r].session_ = j_session->as_string().c_str();
+        }
+        ranges[r].start_time_ = jsonToTicks(string(j_range.at("start_time").as_string().c_str()));
+        ranges[r].end_time_ = jsonToTicks(string(j_range.at("end_time").as_string().c_str()));
+    }
+    uint64_t points = json::value_to<uint64_t>(j_cmd->at("points"));
+
+    //Сравниваются значения интервалов, поэтому режимы с несколькими точками на интервал не подходят
+    DownsamplingMode mode = DownsamplingMode::Avg;
+    if (const json::value* j_mode = j_cmd->if_contains("mode")) {
+        string mode_name(j_mode->as_string().c_str());
+        if (!downsamplingModeFromString(mode_name, mode) || pointsPerBucket(mode) != 1) {
+            j_response.emplace("status", false);
+            j_response.emplace("error", u8"Режим не подходит для сравнения: " + mode_name);
+            return serializeResponse(j_response);
+        }
+    }
+    bool relative = true;
+    if (const json::value* j_sort = j_cmd->if_contains("sort")) {
+        relative = j_sort->as_string() != "absolute";
+    }
+    size_t top = 0;
+    if (const json::value* j_top = j_cmd->if_contains("top")) {
+        top = json::value_to<size_t>(*j_top);
+    }
+    bool with_series = true;
+    if (const json::value* j_series = j_cmd->if_contains("series")) {
+        with_series = j_series->as_bool();
+    }
+
+    //Номера счетчиков относятся к базовой сессии
+    const string command_session = session_name_;
+    selectSession(ranges[0].session_);
+    vector<size_t> indices;
+    if (!session_->source_) {
+        selectSession(command_session);
+        return fail(L"Файлы не открыты!");
+    }
+    if (!selectedCounters(j_cmd, indices)) {
+        selectSession(command_session);
+        return fail(message_error_);
+    }
+    const vector<CounterInfo>& base_counters = session_->source_->counters();
+
+    //Сетка одна на оба диапазона: число точек ограничивается более редким из них
+    for (auto& range : ranges) {
+        selectSession(range.session_);
+        if (!session_->source_) {
+            selectSession(command_session);
+            return fail(L"Файлы не открыты!");
+        }
+        TraceScope trace("count_records");
+        points = min(points, pointsInPeriod(range.start_time_, range.end_time_, points));
+    }
+
+    //Каждый диапазон сканируется один раз; точки первого хранятся, пока читается второй.
+    //Точки диапазона резервируются до чтения по числу точек сетки (не меньше двух, как в getValues)
+    //и счетчиков его сессии
+    MemoryReservation ranges_memory;
+    size_t kept_bytes = 0;
+    for (auto& range : ranges) {
+        selectSession(range.session_);
+        const size_t range_bytes = samplesBytes(max<uint64_t>(points, 2), session_->source_->counters().size());
+        if (!ranges_memory.reserve(memory_budget_, MemoryArea::Samples, kept_bytes + range_bytes)) {
+            selectSession(command_session);
+            return fail(memoryBudgetError(range_bytes, memory_budget_));
+        }
+        range.samples_ = getValues(range.start_time_, range.end_time_, points, mode);
+        if (range.samples_.empty()) {
+            selectSession(command_session);
+            return fail(message_error_);
+        }
+        range.counters_stat_ = session_->counters_stat_;
+        kept_bytes += samplesBytes(range.samples_.size(), range.counters_stat_.size());
+        if (!ranges_memory.reserve(memory_budget_, MemoryArea::Samples, kept_bytes)) {
+            selectSession(command_session);
+            return fail(memoryBudgetError(kept_bytes, memory_budget_));
+        }
+    }
+
+    //Счетчики разных сессий сопоставляются по английскому имени без компьютера
+    vector<optional<size_t>> target_indices(indices.size());
+    if (ranges[1].session_ == ranges[0].session_) {
+        for (size_t k = 0; k < indices.size(); ++k) {
+            target_indices[k] = indices[k];
+        }
+    }
+    else {
+        const vector<CounterInfo>& target_counters = session_->source_->counters();
+        map<wstring, size_t> target_keys;
+        for (size_t i = 0; i < target_counters.size(); ++i) {
+            target_keys.emplace(counterKey(target_counters[i]), i);
+        }
+        for (size_t k = 0; k < indices.size(); ++k) {
+            auto it = target_keys.find(counterKey(base_counters[indices[k]]));
+            if (it != target_keys.end()) {
+                target_indices[k] = it->second;
+            }
+        }
+    }
+    selectSession(command_session);
+
+    const size_t rows = min(ranges[0].samples_.size(), ranges[1].samples_.size());
+    const size_t columns = top ? min(top, indices.size()) : indices.size();
+    MemoryReservation output_memory;
+    const size_t output_bytes = (with_series ? rows * columns * 4 : 0) * JSON_VALUE_BYTES + indices.size() * 8 * JSON_VALUE_BYTES;
+    if (!output_memory.reserve(memory_budget_, MemoryArea::Output, output_bytes)) {
+        return fail(memoryBudgetError(output_bytes, memory_budget_));
+    }
+
+    auto average = [](const CounterStat& stat) -> optional<double> {
+        if (!stat.count_value_ || !*stat.count_value_) return nullopt;
+        return *stat.sum_value_ / *stat.count_value_;
+    };
+    vector<CounterDelta> deltas(indices.size());
+    vector<vector<optional<double>>> differences(indices.size());
+    vector<vector<optional<double>>> ratios(indices.size());
+    {
+        ScopedTimer timer(StatPhase::Aggregate);
+        pool_->parallelFor(indices.size(), [&](size_t k) {
+            CounterDelta& delta = deltas[k];
+            delta.base_ = average(ranges[0].counters_stat_[indices[k]]);
+            if (target_indices[k]) {
+                delta.target_ = average(ranges[1].counters_stat_[*target_indices[k]]);
+            }
+            completeDelta(delta);
+            vector<optional<double>> base(rows);
+            vector<optional<double>> target(rows);
+            for (size_t i = 0; i < rows; ++i) {
+                base[i] = ranges[0].samples_[i].values_[indices[k]];
+                if (target_indices[k]) {
+                    target[i] = ranges[1].samples_[i].values_[*target_indices[k]];
+                }
+            }
+            compareSeries(base, target, differences[k], ratios[k], delta);
+        });
+    }
+    vector<size_t> order = orderByChange(deltas, relative);
+    order.resize(columns);
+
+    //Смещение строки - начало интервала сетки шириной (end - start) / rows, как в get_values
+    const double distance = distanceBetweenPoints(ranges[0].start_time_, ranges[0].end_time_, rows);
+    json::array j_counters;
+    json::array j_offsets;
+    json::object j_series;
+    {
+        ScopedTimer timer(StatPhase::Json);
+        for (size_t k : order) {
+            const CounterDelta& delta = deltas[k];
+            json::object j_counter;
+            j_counter.emplace("counter", indices[k]);
+            if (target_indices[k]) { j_counter.emplace("target_counter", *target_indices[k]); }
+            else { j_counter.emplace("target_counter", nullptr); }
+            j_counter.emplace("base_avg", optionalToJson(delta.base_));
+            j_counter.emplace("target_avg", optionalToJson(delta.target_));
+            j_counter.emplace("base_max", optionalToJson(ranges[0].counters_stat_[indices[k]].max_value_));
+            j_counter.emplace("target_max", optionalToJson(target_indices[k]
+                ? ranges[1].counters_stat_[*target_indices[k]].max_value_ : nullopt));
+            j_counter.emplace("delta", optionalToJson(delta.delta_));
+            j_counter.emplace("ratio", optionalToJson(delta.ratio_));
+            j_counter.emplace("change", optionalToJson(delta.delta_ && *delta.base_ != 0
+                ? optional<double>(*delta.delta_ / fabs(*delta.base_)) : nullopt));
+            j_counter.emplace("max_delta", optionalToJson(delta.max_delta_));
+            if (delta.max_delta_) { j_counter.emplace("max_delta_offset", delta.max_delta_bucket_ * distance / TICKS_PER_SECOND); }
+            else { j_counter.emplace("max_delta_offset", nullptr); }
+            j_counters.push_back(j_counter);
+        }
+
+        if (with_series) {
+            //Строки - интервалы сетки, столбцы - счетчики в порядке counters
+            json::array j_base;
+            json::array j_target;
+            json::array j_difference;
+            json::array j_ratio;
+            for (size_t i = 0; i < rows; ++i) {
+                j_offsets.push_back(i * distance / TICKS_PER_SECOND);
+                json::array j_base_row;
+                json::array j_target_row;
+                json::array j_difference_row;
+                json::array j_ratio_row;
+                for (size_t k : order) {
+                    j_base_row.push_back(optionalToJson(ranges[0].samples_[i].values_[indices[k]]));
+                    j_target_row.push_back(optionalToJson(target_indices[k]
+                        ? ranges[1].samples_[i].values_[*target_indices[k]] : nullopt));
+                    j_difference_row.push_back(optionalToJson(differences[k][i]));
+                    j_ratio_row.push_back(optionalToJson(ratios[k][i]));
+                }
+                j_base.push_back(j_base_row);
+                j_target.push_back(j_target_row);
+                j_difference.push_back(j_difference_row);
+                j_ratio.push_back(j_ratio_row);
+            }
+            j_series.emplace("base", j_base);
+            j_series.emplace("target", j_target);
+            j_series.emplace("difference", j_difference);
+            j_series.emplace("ratio", j_ratio);
+        }
+    }
+
+    j_response.emplace("status", true);
+    j_response.emplace("points", rows);
+    j_response.emplace("interval", distance / TICKS_PER_SECOND);
+    j_response.emplace("counters", j_counters);
+    if (with_series) {
+        j_response.emplace("offsets", j_offsets);
+        j_response.emplace("series", j_series);
+    }
+    return serializeResponse(j_response);
+}
+
+//Загрузка рядов выбранных счетчиков в память с индексом диапазонов: get_values в режимах max, min и avg
+//отвечает по ним за O(точек) без сканирования источника. drop - удалить индексы сессии
+string PerfLogsReader::executeCommandIndex(boost::json::object* j_cmd) {
+    namespace json = boost::json;
+    json::object j_response;
+    if (const json::value* j_drop = j_cmd->if_contains("drop")) {
+        if (j_drop->as_bool()) {
+            session_->indexes_.clear();
+            session_->index_quality_.clear();
+            session_->index_memory_.reset();
+            j_response.emplace("status", true);
+            return serializeResponse(j_response);
+        }
+    }
+
+    vector<size_t> indices;
+    if (!session_->source_) {
+        message_error_ = L"Файлы не открыты!";
+    }
+    if (!session_->source_ || !selectedCounters(j_cmd, indices)) {
+        j_response.emplace("status", false);
+        j_response.emplace("error", wideCharToUtf(message_error_));
+        return serializeResponse(j_response);
+    }
+
+    //Индекс строится по всем данным источника на момент команды. Память сканирования и построения
+    //резервируется до чтения по числу записей: время, значение, префиксная сумма и таблица на выборку
+    const uint64_t start_time = session_->source_->startTime();
+    const uint64_t end_time = session_->source_->endTime();
+    const size_t sample_bytes = sizeof(uint64_t) + 3 * sizeof(double);
+    const uint64_t records_limit = memory_budget_.limit() / (sample_bytes * indices.size()) + 1;
+    uint64_t records;
+    {
+        TraceScope trace("count_records");
+        records = session_->source_->countRecords(start_time, end_time, records_limit);
+    }
+    const size_t build_bytes = static_cast<size_t>(min(records, records_limit)) * indices.size() * sample_bytes;
+    MemoryReservation build_memory;
+    if (!build_memory.reserve(memory_budget_, MemoryArea::Index, build_bytes)) {
+        j_response.emplace("status", false);
+        j_response.emplace("error", wideCharToUtf(memoryBudgetError(build_bytes, memory_budget_)));
+        return serializeResponse(j_response);
+    }
+
+    vector<vector<uint64_t>> times(indices.size());
+    vector<vector<double>> values(indices.size());
+    //Отброшенная выборка занимает меньше значения, поэтому укладывается в ту же оценку
+    vector<IndexedQuality> quality(indices.size());
+    auto sink = makeSink([&](size_t column, uint64_t timestamp, double value) {
+        times[column].push_back(timestamp);
+        values[column].push_back(value);
+    });
+    IndexQualitySink quality_sink(sink, quality, start_time, end_time);
+    {
+        TraceScope trace("scan", to_string(indices.size()) + " counters");
+        session_->source_->scan(start_time, end_time, indices, quality_sink);
+        quality_sink.finish();
+    }
+
+    vector<RangeIndex> built(indices.size());
+    {
+        ScopedTimer timer(StatPhase::Aggregate);
+        pool_->parallelFor(indices.size(), [&](size_t k) {
+            sortByTime(times[k], values[k]);
+            sortByTime(quality[k].times_, quality[k].statuses_);
+            built[k].build(move(times[k]), move(values[k]));
+        });
+    }
+
+    //Индексы прежнего конца данных заменяются целиком. Если итог не помещается в бюджет,
+    //прежние индексы остаются как были
+    const bool keep_old = session_->indexed_end_ == end_time;
+    size_t bytes = 0;
+    size_t samples = 0;
+    for (size_t k = 0; k < indices.size(); ++k) {
+        bytes += built[k].memoryUsage() + quality[k].memoryUsage();
+        samples += built[k].size();
+    }
+    if (keep_old) {
+        vector<size_t> replaced(indices);
+        sort(replaced.begin(), replaced.end());
+        for (auto& index : session_->indexes_) {
+            if (!binary_search(replaced.begin(), replaced.end(), index.first)) {
+                bytes += index.second.memoryUsage() + session_->index_quality_[index.first].memoryUsage();
+            }
+        }
+    }
+    build_memory.reset();
+    const size_t old_bytes = session_->index_memory_.bytes();
+    if (!session_->index_memory_.reserve(memory_budget_, MemoryArea::Index, bytes)) {
+        session_->index_memory_.reserve(memory_budget_, MemoryArea::Index, old_bytes);
+        j_response.emplace("status", false);
+        j_response.emplace("error", wideCharToUtf(memoryBudgetError(bytes, memory_budget_)));
+        return serializeResponse(j_response);
+    }
+    if (!keep_old) {
+        session_->indexes_.clear();
+        session_->index_quality_.clear();
+    }
+    map<string, size_t> encodings;
+    for (size_t k = 0; k < indices.size(); ++k) {
+        session_->indexes_[indices[k]] = move(built[k]);
+        session_->index_quality_[indices[k]] = move(quality[k]);
+    }
+    for (auto& index : session_->indexes_) {
+        ++encodings[seriesEncodingName(index.second.encoding())];
+    }
+    session_->indexed_end_ = end_time;
+
+    j_response.emplace("status", true);
+    j_response.emplace("counters", session_->indexes_.size());
+    j_response.emplace("samples", samples);
+    j_response.emplace("bytes", bytes);
+    json::object j_encodings;
+    for (auto& encoding : encodings) {
+        j_encodings.emplace(encoding.first, encoding.second);
+    }
+    j_response.emplace("encodings", j_encodings);
+    return serializeResponse(j_response);
+}
+
+//Интервалы выполнения пороговых правил для временной шкалы инцидентов. Правило относится к счетчику
+//(counter), списку (counters) или всем счетчикам с английским или национальным именем name.
+//Все правила проверяются за одно сканирование, счетчики с индексом диапазонов - по индексу
+string PerfLogsReader::executeCommandIntervals(boost::json::object* j_cmd) {
+    namespace json = boost::json;
+    json::object j_response;
+    auto fail = [&](const string& error) {
+        j_response.emplace("status", false);
+        j_response.emplace("error", error);
+        return serializeResponse(j_response);
+    };
+    if (!session_->source_) {
+        return fail(wideCharToUtf(L"Файлы не открыты!"));
+    }
+    uint64_t start_time = jsonToTicks(string(j_cmd->at("start_time").if_string()->c_str()));
+    uint64_t end_time = jsonToTicks(string(j_cmd->at("end_time").if_string()->c_str()));
+    size_t limit = 0;
+    if (const json::value* j_limit = j_cmd->if_contains("limit")) {
+        limit = json::value_to<size_t>(*j_limit);
+    }
+
+    //Счетчик может проверяться несколькими правилами
+    const vector<CounterInfo>& counters = session_->source_->counters();
+    vector<IntervalTracker> trackers;
+    map<size_t, vector<size_t>> counter_trackers;
+    const json::array& j_rules = j_cmd->at("rules").as_array();
+    for (size_t r = 0; r < j_rules.size(); ++r) {
+        const json::object& j_rule = j_rules[r].as_object();
+        ThresholdRule rule;
+        if (const json::value* j_op = j_rule.if_contains("op")) {
+            string op_name(j_op->as_string().c_str());
+            if (!thresholdOpFromString(op_name, rule.op_)) {
+                return fail(u8"Неизвестное сравнение: " + op_name);
+            }
+        }
+        rule.value_ = json::value_to<double>(j_rule.at("value"));
+        if (const json::value* j_duration = j_rule.if_contains("min_duration")) {
+            rule.min_duration_ = static_cast<uint64_t>(json::value_to<double>(*j_duration) * TICKS_PER_SECOND);
+        }
+        if (const json::value* j_gap = j_rule.if_contains("merge_gap")) {
+            rule.merge_gap_ = static_cast<uint64_t>(json::value_to<double>(*j_gap) * TICKS_PER_SECOND);
+        }
+
+        vector<size_t> indices;
+        if (const json::value* j_counter = j_rule.if_contains("counter")) {
+            indices.push_back(json::value_to<size_t>(*j_counter));
+            if (indices.back() >= counters.size()) {
+                return fail(wideCharToUtf(L"Неверный индекс счетчика: " + to_wstring(indices.back())));
+            }
+        }
+        else if (const json::value* j_name = j_rule.if_contains("name")) {
+            const wstring name = utfToWideChar(j_name->as_string().c_str());
+            for (size_t i = 0; i < counters.size(); ++i) {
+                if (counters[i].counter_eng_ == name || counters[i].counter_ == name) {
+                    indices.push_back(i);
+                }
+            }
+        }
+        else if (!selectedCounters(&j_rule, indices)) {
+            return fail(wideCharToUtf(message_error_));
+        }
+        for (size_t index : indices) {
+            counter_trackers[index].push_back(trackers.size());
+            trackers.emplace_back(index, r, rule);
+        }
+    }
+
+    vector<ThresholdInterval> intervals;
+    const bool use_index = !session_->indexes_.empty() && session_->indexed_end_ == session_->source_->endTime();
+    vector<size_t> scan_indices;
+    vector<const vector<size_t>*> scan_trackers;
+    for (auto& counter : counter_trackers) {
+        auto it = use_index ? session_->indexes_.find(counter.first) : session_->indexes_.end();
+        if (it == session_->indexes_.end()) {
+            scan_indices.push_back(counter.first);
+            scan_trackers.push_back(&counter.second);
+            continue;
+        }
+        //По индексу блоки, где ни одно правило счетчика не выполняется, пропускаются целиком
+        const RangeIndex& range_index = it->second;
+        const size_t first = range_index.lowerBound(start_time);
+        const size_t last = range_index.lowerBound(end_time + 1);
+        uint64_t block_times[RangeIndex::BLOCK];
+        double block_values[RangeIndex::BLOCK];
+        for (size_t block = first; block < last;) {
+            const size_t block_end = min(last, (block / RangeIndex::BLOCK + 1) * RangeIndex::BLOCK);
+            const RangeSummary summary = range_index.query(block, block_end);
+            bool may_hold = false;
+            for (size_t t : counter.second) {
+                may_hold = may_hold || trackers[t].threshold().mayHold(summary.min_, summary.max_);
+            }
+            //Блок без выполнения правил только закрывает открытые интервалы своей первой выборкой,
+            //а две последние задают трекеру настоящий шаг выборок перед следующим блоком
+            size_t count = block_end - block;
+            if (may_hold) {
+                range_index.decode(block, block_end, block_times, block_values);
+            }
+            else {
+                const size_t tail = max(block + 1, block_end - min<size_t>(2, block_end - block));
+                range_index.decode(block, block + 1, block_times, block_values);
+                range_index.decode(tail, block_end, block_times + 1, block_values + 1);
+                count = 1 + block_end - tail;
+            }
+            for (size_t i = 0; i < count; ++i) {
+                for (size_t t : counter.second) {
+                    trackers[t].add(block_times[i], block_values[i], intervals);
+                }
+            }
+            block = block_end;
+        }
+    }
+
+    if (!scan_indices.empty()) {
+        auto sink = makeSink([&](size_t column, uint64_t timestamp, double value) {
+            for (size_t t : *scan_trackers[column]) {
+                trackers[t].add(timestamp, value, intervals);
+            }
+        });
+        TraceScope trace("scan", to_string(scan_indices.size()) + " counters");
+        session_->source_->scan(start_time, end_time, scan_indices, sink);
+    }
+    for (auto& tracker : trackers) {
+        tracker.finish(intervals);
+    }
+
+    sort(intervals.begin(), intervals.end(), [](const ThresholdInterval& a, const ThresholdInterval& b) {
+        return a.start_ != b.start_ ? a.start_ < b.start_ : a.counter_ < b.counter_;
+    });
+    const bool truncated = limit && intervals.size() > limit;
+    if (truncated) {
+        intervals.resize(limit);
+    }
+
+    MemoryReservation output_memory;
+    const size_t output_bytes = intervals.size() * 8 * JSON_VALUE_BYTES;
+    if (!output_memory.reserve(memory_budget_, MemoryArea::Output, output_bytes)) {
+        return fail(wideCharToUtf(memoryBudgetError(output_bytes, memory_budget_)));
+    }
+    json::array j_intervals;
+    {
+        ScopedTimer timer(StatPhase::Json);
+        for (auto& interval : intervals) {
+            json::object j_interval;
+            j_interval.emplace("counter", interval.counter_);
+            j_interval.emplace("rule", interval.rule_);
+            j_interval.emplace("start", ticksToJson(interval.start_));
+            j_interval.emplace("end", ticksToJson(interval.end_));
+            j_interval.emplace("duration", static_cast<double>(interval.end_ - interval.start_) / TICKS_PER_SECOND);
+            j_interval.emplace("peak", interval.peak_);
+            j_interval.emplace("peak_time", ticksToJson(interval.peak_time_));
+            j_intervals.push_back(j_interval);
+        }
+    }
+
+    j_response.emplace("status", true);
+    j_response.emplace("intervals", j_intervals);
+    j_response.emplace("truncated", truncated);
+    return serializeResponse(j_response);
+}
+
+//Смещения часов компьютеров сессии: заданные вручную (offsets, секунды) и/или оцененные
+//по сдвигу корреляции счетчиков разных компьютеров с опорным (estimate). reset - сброс смещений
+string PerfLogsReader::executeCommandClockSkew(boost::json::object* j_cmd) {
+    namespace json = boost::json;
+    json::object j_response;
+    if (!session_->source_) {
+        j_response.emplace("status", false);
+        j_response.emplace("error", u8"Файлы не открыты!");
+        return serializeResponse(j_response);
+    }
+
+    auto skewed = dynamic_cast<SkewedCounterSource*>(session_->source_.get());
+    map<wstring, int64_t> offsets;
+    if (skewed) {
+        offsets = skewed->offsets();
+    }
+    bool changed = false;
+    if (const json::value* j_reset = j_cmd->if_contains("reset")) {
+        if (j_reset->as_bool()) {
+            changed = !offsets.empty();
+            offsets.clear();
+        }
+    }
+    if (const json::value* j_offsets = j_cmd->if_contains("offsets")) {
+        const vector<CounterInfo>& counters = session_->source_->counters();
+        for (auto& j_offset : j_offsets->as_object()) {
+            wstring machine = utfToWideChar(string(j_offset.key()));
+            bool found = any_of(counters.begin(), counters.end(), [&](const CounterInfo& info) {
+                return info.computer_ == machine;
+            });
+            if (!found) {
+                j_response.emplace("status", false);
+                j_response.emplace("error", u8"Компьютер не найден: " + string(j_offset.key()));
+                return serializeResponse(j_response);
+            }
+            offsets[machine] = llround(json::value_to<double>(j_offset.value()) * TICKS_PER_SECOND);
+            changed = true;
+        }
+    }
+    json::array j_estimates;
+    if (const json::value* j_estimate = j_cmd->if_contains("estimate")) {
+        //Оценка уточняет действующие смещения: ряды строятся уже на исправленной шкале
+        if (!estimateClockOffsets(j_estimate->as_object(), offsets, j_estimates)) {
+            j_response.emplace("status", false);
+            j_response.emplace("error", wideCharToUtf(message_error_));
+            return serializeResponse(j_response);
+        }
+        changed = true;
+    }
+    if (changed) {
+        setClockOffsets(offsets);
+    }
+
+    json::object j_offsets;
+    for (auto& offset : offsets) {
+        j_offsets.emplace(wideCharToUtf(offset.first), static_cast<double>(offset.second) / TICKS_PER_SECOND);
+    }
+    j_response.emplace("status", true);
+    j_response.emplace("offsets", j_offsets);
+    if (!j_estimates.empty()) {
+        j_response.emplace("estimates", j_estimates);
+    }
+    return serializeResponse(j_response);
+}
+
+//Сдвиг каждого счетчика counters относительно reference по максимуму |r| на сетке points интервалов;
+//компьютер получает поправку по счетчику с наибольшей по модулю корреляцией
+bool PerfLogsReader::estimateClockOffsets(const boost::json::object& j_estimate, map<wstring, int64_t>& offsets,
+    boost::json::array& j_estimates) {
+    namespace json = boost::json;
+    const uint64_t start_time = jsonToTicks(string(j_estimate.at("start_time").as_string().c_str()));
+    const uint64_t end_time = jsonToTicks(string(j_estimate.at("end_time").as_string().c_str()));
+    uint64_t points = 1000;
+    if (const json::value* j_points = j_estimate.if_contains("points")) {
+        points = json::value_to<uint64_t>(*j_points);
+    }
+    size_t max_lag = 60;
+    if (const json::value* j_max_lag = j_estimate.if_contains("max_lag")) {
+        max_lag = json::value_to<size_t>(*j_max_lag);
+    }
+    const vector<CounterInfo>& counters = session_->source_->counters();
+    vector<size_t> indices = { json::value_to<size_t>(j_estimate.at("reference")) };
+    vector<size_t> others;
+    if (indices[0] >= counters.size() || !selectedCounters(&j_estimate, others)) {
+        if (indices[0] >= counters.size()) message_error_ = L"Неверный индекс счетчика: " + to_wstring(indices[0]);
+        return false;
+    }
+    indices.insert(indices.end(), others.begin(), others.end());
+
+    vector<Sample> samples = getValues(start_time, end_time, points);
+    if (samples.empty()) return false;
+    const double interval = distanceBetweenPoints(start_time, end_time, samples.size());
+
+    MemoryReservation series_memory;
+    const size_t series_bytes = indices.size() * samples.size() * sizeof(optional<double>)
+        + indices.size() * indices.size() * (sizeof(double) + sizeof(int));
+    if (!series_memory.reserve(memory_budget_, MemoryArea::Samples, series_bytes)) {
+        message_error_ = memoryBudgetError(series_bytes, memory_budget_);
+        return false;
+    }
+    vector<vector<optional<double>>> series(indices.size(), vector<optional<double>>(samples.size()));
+    for (size_t k = 0; k < indices.size(); ++k) {
+        for (size_t i = 0; i < samples.size(); ++i) {
+            series[k][i] = samples[i].values_[indices[k]];
+        }
+    }
+    CorrelationMatrix matrix = correlate(series, CorrelationMethod::Pearson, max_lag, *pool_, 0);
+
+    //Лаг L: события счетчика на L интервалов позже опорных, его часы спешат
+    const wstring& reference_machine = counters[indices[0]].computer_;
+    map<wstring, size_t> best;
+    for (size_t k = 1; k < indices.size(); ++k) {
+        const wstring& machine = counters[indices[k]].computer_;
+        const double r = matrix.at(0, k);
+        if (machine == reference_machine || isnan(r)) continue;
+        auto it = best.find(machine);
+        if (it == best.end() || fabs(r) > fabs(matrix.at(0, it->second))) {
+            best[machine] = k;
+        }
+    }
+    for (size_t k = 1; k < indices.size(); ++k) {
+        const wstring& machine = counters[indices[k]].computer_;
+        const double r = matrix.at(0, k);
+        auto it = best.find(machine);
+        const bool applied = it != best.end() && it->second == k;
+        const int64_t correction = -llround(matrix.lagAt(0, k) * interval);
+        if (applied) {
+            offsets[machine] += correction;
+        }
+        json::object j_item;
+        j_item.emplace("counter", indices[k]);
+        j_item.emplace("machine", wideCharToUtf(machine));
+        if (isnan(r)) { j_item.emplace("r", nullptr); }
+        else { j_item.emplace("r", r); }
+        j_item.emplace("lag", matrix.lagAt(0, k));
+        j_item.emplace("correction", static_cast<double>(correction) / TICKS_PER_SECOND);
+        j_item.emplace("applied", applied);
+        j_estimates.push_back(j_item);
+    }
+    return true;
+}
+
+//Установка смещений: источник сессии оборачивается или разворачивается, результаты
+//прежней шкалы времени (кэши ответов и интервалов, индексы) сбрасываются
+void PerfLogsReader::setClockOffsets(map<wstring, int64_t> offsets) {
+    if (follow_session_ == session_) {
+        stopFollow();
+    }
+    for (auto it = offsets.begin(); it != offsets.end();) {
+        it = it->second ? next(it) : offsets.erase(it);
+    }
+    auto skewed = dynamic_cast<SkewedCounterSource*>(session_->source_.get());
+    if (offsets.empty()) {
+        if (skewed) session_->source_ = skewed->release();
+    }
+    else if (skewed) {
+        skewed->setOffsets(move(offsets));
+    }
+    else {
+        auto source = make_unique<SkewedCounterSource>(move(session_->source_));
+        source->setOffsets(move(offsets));
+        session_->source_ = move(source);
+    }
+    session_->responses_.clear();
+    session_->buckets_.clear();
+    session_->indexes_.clear();
+    session_->index_quality_.clear();
+    session_->index_memory_.reset();
+}
+
+//Построение или обновление индекса архива журналов в каталоге root
+string PerfLogsReader::executeCommandArchiveIndex(boost::json::object* j_cmd) {
+    namespace json = boost::json;
+    json::object j_response;
+    ArchiveIndex archive(utfToWideChar(string(j_cmd->at("root").as_string().c_str())));
+    ArchiveUpdate update;
+    if (!updateArchive(archive, j_cmd, update)) {
+        j_response.emplace("status", false);
+        j_response.emplace("error", wideCharToUtf(message_error_));
+        return serializeResponse(j_response);
+    }
+
+    uint64_t start_time = 0;
+    uint64_t end_time = 0;
+    json::array j_machines;
+    vector<string> machines;
+    for (auto& file : archive.files()) {
+        if (!start_time || file.start_time_ < start_time) start_time = file.start_time_;
+        if (file.end_time_ > end_time) end_time = file.end_time_;
+        machines.insert(machines.end(), file.machines_.begin(), file.machines_.end());
+    }
+    sort(machines.begin(), machines.end());
+    machines.erase(unique(machines.begin(), machines.end()), machines.end());
+    for (auto& machine : machines) {
+        j_machines.emplace_back(machine);
+    }
+
+    j_response.emplace("status", true);
+    j_response.emplace("files", archive.files().size());
+    j_response.emplace("counter_sets", archive.counterSets().size());
+    j_response.emplace("added", update.added_);
+    j_response.emplace("updated", update.updated_);
+    j_response.emplace("removed", update.removed_);
+    j_response.emplace("failed", update.failed_);
+    j_response.emplace("machines", j_machines);
+    if (!archive.files().empty()) {
+        j_response.emplace("start_time", ticksToJson(start_time));
+        j_response.emplace("end_time", ticksToJson(end_time));
+    }
+    return serializeResponse(j_response);
+}
+
+//Открытие файлов архива, покрывающих период; индекс по умолчанию сначала обновляется.
+//machine и counters (имена без компьютера) сужают выбор
+string PerfLogsReader::executeCommandOpenRange(boost::json::object* j_cmd) {
+    namespace json = boost::json;
+    json::object j_response;
+    ArchiveIndex archive(utfToWideChar(string(j_cmd->at("root").as_string().c_str())));
+    bool update_index = true;
+    if (const json::value* j_update = j_cmd->if_contains("update")) {
+        update_index = j_update->as_bool();
+    }
+    ArchiveUpdate update;
+    if (update_index ? !updateArchive(archive, j_cmd, update) : !archive.load()) {
+        if (!update_index) message_error_ = L"Индекс архива не найден!";
+        j_response.emplace("status", false);
+        j_response.emplace("error", wideCharToUtf(message_error_));
+        return serializeResponse(j_response);
+    }
+
+    uint64_t start_time = jsonToTicks(string(j_cmd->at("start_time").as_string().c_str()));
+    uint64_t end_time = jsonToTicks(string(j_cmd->at("end_time").as_string().c_str()));
+    string machine;
+    if (const json::value* j_machine = j_cmd->if_contains("machine")) {
+        machine = j_machine->as_string().c_str();
+    }
+    vector<string> counters;
+    if (const json::value* j_counters = j_cmd->if_contains("counters")) {
+        for (auto& j_counter : j_counters->as_array()) {
+            counters.push_back(j_counter.as_string().c_str());
+        }
+    }
+
+    vector<const ArchiveFile*> selected = archive.select(start_time, end_time, machine, counters);
+    if (selected.empty() || selected.size() > MAX_OPEN_FILES) {
+        j_response.emplace("status", false);
+        j_response.emplace("error", selected.empty() ? string(u8"Нет файлов за период!")
+            : u8"Период покрывают " + to_string(selected.size()) + u8" файлов, можно открыть не более "
+            + to_string(MAX_OPEN_FILES) + u8": сузьте период или выберите компьютер!");
+        return serializeResponse(j_response);
+    }
+
+    vector<wstring> files;
+    json::array j_files;
+    for (auto file : selected) {
+        files.push_back(archive.absolutePath(*file).wstring());
+        j_files.emplace_back(file->path_);
+    }
+    if (!open(files)) {
+        j_response.emplace("status", false);
+        j_response.emplace("error", wideCharToUtf(message_error_));
+        return serializeResponse(j_response);
+    }
+    j_response.emplace("status", true);
+    j_response.emplace("files", j_files);
+    return serializeResponse(j_response);
+}
+
+//Загрузка, обновление по времени изменения файлов и сохранение индекса архива
+bool PerfLogsReader::updateArchive(ArchiveIndex& archive, const boost::json::object* j_cmd, ArchiveUpdate& update) {
+    namespace json = boost::json;
+    error_code ec;
+    if (!filesystem::is_directory(archive.root(), ec)) {
+        message_error_ = L"Каталог архива не найден!";
+        return false;
+    }
+    vector<string> extensions = { ".blg", ".csv", ".tsv" };
+    if (const json::value* j_extensions = j_cmd->if_contains("extensions")) {
+        extensions.clear();
+        //Расширения файлов сравниваются в нижнем регистре
+        for (auto& j_extension : j_extensions->as_array()) {
+            string extension(j_extension.as_string().c_str());
+            transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return static_cast<char>(tolower(c)); });
+            extensions.push_back(extension);
+        }
+    }
+
+    archive.load();
+    {
+        ScopedTimer timer(StatPhase::Catalog);
+        update = archive.update(probeLogFile, extensions);
+    }
+    if ((update.added_ || update.updated_ || update.removed_) && !archive.save()) {
+        message_error_ = L"Не удалось записать индекс архива!";
+        return false;
+    }
+    return true;
+}
+
+string PerfLogsReader::executeCommandExport(boost::json::object* j_cmd) {
+    namespace json = boost::json;
+    json::object j_response;
+
+    vector<size_t> indices;
+    if (!selectedCounters(j_cmd, indices)) {
+        j_response.emplace("status", false);
+        j_response.emplace("error", wideCharToUtf(message_error_));
+        return serializeResponse(j_response);
+    }
+    if (!session_->source_ || indices.empty()) {
+        j_response.emplace("status", false);
+        j_response.emplace("error", u8"Нет счетчиков для выгрузки!");
+        return serializeResponse(j_response);
+    }
+
+    ExportFormat format = ExportFormat::Csv;
+    if (const json::value* j_format = j_cmd->if_contains("format")) {
+        string format_name(j_format->as_string().c_str());
+        if (!exportFormatFromString(format_name, format)) {
+            j_response.emplace("status", false);
+            j_response.emplace("error", u8"Неизвестный формат выгрузки: " + format_name);
+            return serializeResponse(j_response);
+        }
+    }
+
+    //По умолчанию выгружается весь период файлов
+    uint64_t start_time = session_->source_->startTime();
+    uint64_t end_time = session_->source_->endTime();
+    if (const json::value* j_start_time = j_cmd->if_contains("start_time")) {
+        start_time = jsonToTicks(string(j_start_time->as_string().c_str()));
+    }
+    if (const json::value* j_end_time = j_cmd->if_contains("end_time")) {
+        end_time = jsonToTicks(string(j_end_time->as_string().c_str()));
+    }
+
+    bool national_names = false;
+    if (const json::value* j_names = j_cmd->if_contains("names")) {
+        national_names = string(j_names->as_string().c_str()) == "national";
+    }
+    const vector<CounterInfo>& counters = session_->source_->counters();
+    vector<string> columns;
+    for (auto index : indices) {
+        columns.push_back(wideCharToUtf(national_names ? counters[index].national_name_ : counters[index].english_name_));
+    }
+
+    filesystem::path path(utfToWideChar(string(j_cmd->at("file").as_string().c_str())));
+    Exporter exporter(format, path, move(columns));
+    if (!exporter.start()) {
+        j_response.emplace("status", false);
+        j_response.emplace("error", exporter.error());
+        return serializeResponse(j_response);
+    }
+    exportValues(start_time, end_time, indices, exporter);
+    if (!exporter.finish()) {
+        j_response.emplace("status", false);
+        j_response.emplace("error", exporter.error());
+        return serializeResponse(j_response);
+    }
+
+    j_response.emplace("status", true);
+    j_response.emplace("rows", exporter.rows());
+    j_response.emplace("bytes", exporter.bytes());
+    return serializeResponse(j_response);
+}
+
+string PerfLogsReader::executeCommandFollow(boost::json::object* j_cmd) {
+    namespace json = boost::json;
+    json::object j_response;
+
+    bool enable = true;
+    if (const json::value* j_enable = j_cmd->if_contains("enable")) {
+        enable = j_enable->as_bool();
+    }
+    stopFollow();
+    if (!enable) {
+        j_response.emplace("status", true);
+        return serializeResponse(j_response);
+    }
+
+    if (!session_->source_ || session_->source_->counters().empty()) {
+        j_response.emplace("status", false);
+        j_response.emplace("error", u8"Файлы не прочитаны!");
+        return serializeResponse(j_response);
+    }
+    if (!selectedCounters(j_cmd, follow_indices_)) {
+        j_response.emplace("status", false);
+        j_response.emplace("error", wideCharToUtf(message_error_));
+        return serializeResponse(j_response);
+    }
+
+    follow_mode_ = DownsamplingMode::Max;
+    if (const json::value* j_mode = j_cmd->if_contains("mode")) {
+        string mode_name(j_mode->as_string().c_str());
+        if (!downsamplingModeFromString(mode_name, follow_mode_) || pointsPerBucket(follow_mode_) != 1 || follow_mode_ == DownsamplingMode::Lttb) {
+            j_response.emplace("status", false);
+            j_response.emplace("error", u8"Режим слежения поддерживает только max, min и avg: " + mode_name);
+            return serializeResponse(j_response);
+        }
+    }
+
+    //Период отправки событий и ширина интервала в секундах, интервал по умолчанию равен периоду
+    double interval = 5;
+    if (const json::value* j_interval = j_cmd->if_contains("interval")) {
+        interval = json::value_to<double>(*j_interval);
+    }
+    if (interval < 0.1) interval = 0.1;
+    double bucket = interval;
+    if (const json::value* j_bucket = j_cmd->if_contains("bucket")) {
+        bucket = json::value_to<double>(*j_bucket);
+    }
+    if (bucket < 1) bucket = 1;
+    follow_interval_ = chrono::milliseconds(static_cast<int64_t>(interval * 1000));
+    follow_bucket_ = static_cast<uint64_t>(bucket * TICKS_PER_SECOND);
+
+    follow_last_time_ = session_->source_->endTime();
+    follow_buckets_.clear();
+    follow_session_ = session_;
+    follow_session_name_ = session_name_;
+
+    follow_stop_ = false;
+    follow_thread_ = thread(&PerfLogsReader::followLoop, this);
+
+    j_response.emplace("status", true);
+    j_response.emplace("end_time", ticksToJson(follow_last_time_));
+    return serializeResponse(j_response);
+}
+
+//with_session - false, когда сессия занята заданием: качество счетчиков сессии не выдается и не сбрасывается
+string PerfLogsReader::executeCommandStats(boost::json::object* j_cmd, bool with_session) {
     namespace json = boost::json;
-    vector<wstring> files(j_array->size());
-    auto it_files = files.begin();
-    for (auto it = j_array->begin(); it < j_array->end(); ++it) {
-        *it_files = utfToWideChar(string(it->as_string().c_str()));
-        ++it_files;
+    Stats& stats = Stats::instance();
+    if (const json::value* j_depth = j_cmd->if_contains("depth")) {
+        stats.setHistoryDepth(json::value_to<size_t>(*j_depth));
     }
 
     json::object j_response;
-    if (open(files)) {
-        j_response.emplace("status", true);
+    j_response.emplace("status", true);
+    j_response.emplace("totals", statSnapshotToJson(stats.totals()));
+
+    bool history = true;
+    if (const json::value* j_history = j_cmd->if_contains("history")) {
+        history = j_history->as_bool();
     }
-    else {
-        j_response.emplace("status", false);
-        j_response.emplace("error", wideCharToUtf(message_error_));
+    if (history) {
+        json::array j_history;
+        for (auto& snapshot : stats.history()) {
+            json::object j_snapshot = statSnapshotToJson(snapshot);
+            j_snapshot.emplace("cmd", snapshot.command_);
+            j_snapshot.emplace("time", ticksToJson(snapshot.time_));
+            j_history.push_back(j_snapshot);
+        }
+        j_response.emplace("history", j_history);
+    }
+
+    //Счетчики сессии с отброшенными выборками, сначала самые проблемные
+    if (with_session && session_->source_ && !session_->quality_.empty()) {
+        vector<size_t> broken;
+        for (size_t i = 0; i < session_->quality_.size(); ++i) {
+            const CounterQuality& quality = session_->quality_[i];
+            if (quality.invalid_ || quality.gaps_ || !session_->source_->available(i)) {
+                broken.push_back(i);
+            }
+        }
+        auto wasted = [this](size_t i) {
+            return session_->source_->available(i) ? session_->quality_[i].invalid_ + session_->quality_[i].gaps_ : UINT64_MAX;
+        };
+        stable_sort(broken.begin(), broken.end(), [&](size_t a, size_t b) { return wasted(a) > wasted(b); });
+        const vector<CounterInfo>& counters = session_->source_->counters();
+        json::array j_quality;
+        for (auto i : broken) {
+            json::object j_counter = qualityToJson(session_->quality_[i], session_->source_->available(i));
+            j_counter.emplace("counter", i);
+            j_counter.emplace("name", wideCharToUtf(counters[i].english_name_));
+            j_quality.push_back(j_counter);
+        }
+        j_response.emplace("counters_quality", j_quality);
+    }
+
+    if (const json::value* j_reset = j_cmd->if_contains("reset")) {
+        if (j_reset->as_bool()) {
+            stats.reset();
+            if (with_session) {
+                for (auto& quality : session_->quality_) {
+                    quality = {};
+                }
+            }
+        }
     }
     return json::serialize(j_response);
 }
 
-string PerfLogsReader::executeCommandRead() {
+//Трассировка включается командой trace_start и выгружается командой trace_stop в файл или в ответ
+string PerfLogsReader::executeCommandTrace(boost::json::object* j_cmd, bool start) {
     namespace json = boost::json;
     json::object j_response;
-    if (read()) {
-        json::object j_data;
-        j_data.emplace("start_time", systemtimeToJson(start_time_));
-        j_data.emplace("end_time", systemtimeToJson(end_time_));
-        j_data.emplace("counters", countersToJsonObject());
-
+    Tracer& tracer = Tracer::instance();
+    if (start) {
+        size_t capacity = 1 << 16;
+        if (const json::value* j_capacity = j_cmd->if_contains("capacity")) {
+            capacity = json::value_to<size_t>(*j_capacity);
+        }
+        tracer.start(capacity);
         j_response.emplace("status", true);
-        j_response.emplace("data", j_data);
+        return json::serialize(j_response);
     }
-    else {
+
+    if (!tracer.enabled()) {
         j_response.emplace("status", false);
-        j_response.emplace("error", wideCharToUtf(message_error_));
+        j_response.emplace("error", u8"Трассировка не запущена!");
+        return json::serialize(j_response);
+    }
+    size_t events = 0;
+    uint64_t dropped = 0;
+    string trace = tracer.stop(events, dropped);
+    if (const json::value* j_file = j_cmd->if_contains("file")) {
+        filesystem::path path(utfToWideChar(string(j_file->as_string().c_str())));
+        ofstream file(path, ios::binary | ios::trunc);
+        file.write(trace.data(), trace.size());
+        if (!file.flush()) {
+            j_response.emplace("status", false);
+            j_response.emplace("error", u8"Не удалось записать файл трассировки!");
+            return json::serialize(j_response);
+        }
+    }
+    else {
+        j_response.emplace("trace", json::parse(trace));
     }
+    j_response.emplace("status", true);
+    j_response.emplace("events", events);
+    j_response.emplace("dropped", dropped);
     return json::serialize(j_response);
 }
 
-string PerfLogsReader::executeCommandGetValues(boost::json::object* j_cmd) {
+//Состояние бюджета памяти; limit_mb задает новый бюджет (0 - без ограничения), clear_cache очищает кэши ответов и интервалов,
+//reset_peak начинает отсчет пика заново
+string PerfLogsReader::executeCommandMemory(boost::json::object* j_cmd) {
     namespace json = boost::json;
-    SYSTEMTIME start_time = stringToSystemtime(string(j_cmd->at("start_time").if_string()->c_str()));
-    SYSTEMTIME end_time = stringToSystemtime(string(j_cmd->at("end_time").if_string()->c_str()));
-    uint64_t points = json::value_to<uint64_t>(j_cmd->at("points"));
+    if (const json::value* j_limit = j_cmd->if_contains("limit_mb")) {
+        memory_budget_.setLimit(static_cast<size_t>(json::value_to<double>(*j_limit) * 1024 * 1024));
+    }
+    if (const json::value* j_clear = j_cmd->if_contains("clear_cache")) {
+        if (j_clear->as_bool()) {
+            for (auto& session : sessions_) {
+                session.second->responses_.clear();
+                session.second->buckets_.clear();
+            }
+        }
+    }
+    if (const json::value* j_reset_peak = j_cmd->if_contains("reset_peak")) {
+        if (j_reset_peak->as_bool()) {
+            memory_budget_.resetPeak();
+        }
+    }
 
-    vector<Sample> samples = getValues(start_time, end_time, points);
+    json::object j_areas;
+    for (size_t i = 0; i < MEMORY_AREAS; ++i) {
+        j_areas.emplace(memoryAreaName(static_cast<MemoryArea>(i)), memory_budget_.used(static_cast<MemoryArea>(i)));
+    }
+    //Кэши ответов всех сессий
+    size_t entries = 0;
+    size_t bytes = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    for (auto& session : sessions_) {
+        entries += session.second->responses_.size();
+        bytes += session.second->responses_.bytes();
+        hits += session.second->responses_.hits();
+        misses += session.second->responses_.misses();
+    }
+    json::object j_cache;
+    j_cache.emplace("entries", entries);
+    j_cache.emplace("bytes", bytes);
+    j_cache.emplace("hits", hits);
+    j_cache.emplace("misses", misses);
+    j_cache.emplace("evictions", memory_budget_.evictions());
+    //Кэши выровненных интервалов
+    size_t bucket_entries = 0;
+    size_t bucket_bytes = 0;
+    uint64_t bucket_hits = 0;
+    uint64_t bucket_misses = 0;
+    for (auto& session : sessions_) {
+        bucket_entries += session.second->buckets_.size();
+        bucket_bytes += session.second->buckets_.bytes();
+        bucket_hits += session.second->buckets_.hits();
+        bucket_misses += session.second->buckets_.misses();
+    }
+    json::object j_bucket_cache;
+    j_bucket_cache.emplace("entries", bucket_entries);
+    j_bucket_cache.emplace("bytes", bucket_bytes);
+    j_bucket_cache.emplace("hits", bucket_hits);
+    j_bucket_cache.emplace("misses", bucket_misses);
 
     json::object j_response;
-    if (!samples.size() && !message_error_.empty()) {
-        j_response.emplace("status", false);
-        j_response.emplace("error", wideCharToUtf(message_error_));
-        return  json::serialize(j_response);
+    j_response.emplace("status", true);
+    j_response.emplace("limit", memory_budget_.limit());
+    j_response.emplace("used", memory_budget_.used());
+    j_response.emplace("peak", memory_budget_.peak());
+    j_response.emplace("areas", j_areas);
+    j_response.emplace("cache", j_cache);
+    j_response.emplace("bucket_cache", j_bucket_cache);
+    return serializeResponse(j_response);
+}
+
+//Закрытие источника сессии; именованная сессия удаляется, сессия по умолчанию остается пустой
+string PerfLogsReader::executeCommandClose() {
+    namespace json = boost::json;
+    close();
+    if (session_name_ != DEFAULT_SESSION) {
+        sessions_.erase(session_name_);
+        selectSession(DEFAULT_SESSION);
     }
+    json::object j_response;
+    j_response.emplace("status", true);
+    return serializeResponse(j_response);
+}
 
-    json::array j_counters_stat;
-    for (auto it = counters_.begin(); it < counters_.end(); ++it) {
-
-        json::object j_counter_stat;
-        if (it->max_value_) { j_counter_stat.emplace("max", *it->max_value_); }
-        else { j_counter_stat.emplace("max", nullptr); }
-        if (it->sum_value_) { j_counter_stat.emplace("sum", *it->sum_value_); }
-        else { j_counter_stat.emplace("sum", nullptr); }
-        if (it->count_value_) {
-            j_counter_stat.emplace("count", *it->count_value_);
-            double avg = *it->sum_value_ / *it->count_value_;
-            j_counter_stat.emplace("avg", avg);
-        }
-        else {
-            j_counter_stat.emplace("count", nullptr);
-            j_counter_stat.emplace("avg", nullptr);
+string PerfLogsReader::executeCommandSessions() {
+    namespace json = boost::json;
+    json::array j_sessions;
+    for (auto& session : sessions_) {
+        const CounterSource* source = session.second->source_.get();
+        json::object j_session;
+        j_session.emplace("name", session.first);
+        j_session.emplace("open", source != nullptr);
+        j_session.emplace("counters", source ? source->counters().size() : 0);
+        if (source) {
+            j_session.emplace("start_time", ticksToJson(source->startTime()));
+            j_session.emplace("end_time", ticksToJson(source->endTime()));
         }
-        j_counters_stat.push_back(j_counter_stat);
+        j_session.emplace("follow", session.second.get() == follow_session_);
+        j_sessions.push_back(j_session);
     }
+    json::object j_response;
+    j_response.emplace("status", true);
+    j_response.emplace("sessions", j_sessions);
+    return serializeResponse(j_response);
+}
 
-    json::array j_samples;
-    json::array j_points;
-    for (auto it_sample = samples.begin(); it_sample < samples.end(); ++it_sample) {
-        json::array j_values;
-        for (size_t index = 0; index < it_sample->values_.size(); ++index) {
-            if (it_sample->values_[index]) { j_values.push_back(*it_sample->values_[index]); }
-            else { j_values.push_back(nullptr); }
+bool PerfLogsReader::selectedCounters(const boost::json::object* j_cmd, vector<size_t>& indices) {
+    namespace json = boost::json;
+    indices.clear();
+    const size_t counters_count = session_->source_ ? session_->source_->counters().size() : 0;
+    const json::value* j_counters = j_cmd->if_contains("counters");
+    if (!j_counters) {
+        indices.resize(counters_count);
+        for (size_t i = 0; i < indices.size(); ++i) {
+            indices[i] = i;
         }
-        j_samples.push_back(j_values);
-        j_points.push_back(systemtimeToJson(it_sample->point_time_).c_str());
+        return true;
     }
 
-    j_response.emplace("status", true);
-    j_response.emplace("counters_stat", j_counters_stat);
-    j_response.emplace("points", j_points);
-    j_response.emplace("samples", j_samples);
-
-    return  json::serialize(j_response);
+    for (auto& j_index : j_counters->as_array()) {
+        size_t index = json::value_to<size_t>(j_index);
+        if (index >= counters_count) {
+            message_error_ = L"Неверный индекс счетчика: " + to_wstring(index);
+            return false;
+        }
+        indices.push_back(index);
+    }
+    return true;
 }
 
-bool PerfLogsReader::open(const vector<wstring>& files) {
+bool PerfLogsReader::open([[maybe_unused]] const vector<wstring>& files) {
 
     close();
 
-    if (files.size() > 32) {
-        message_error_ = L"Можно открыть не более 32 файлов одновременно!";
+#ifdef _WINDOWS
+    auto source = make_unique<PdhCounterSource>();
+    if (!source->open(files)) {
+        message_error_ = source->error();
         return false;
     }
+    session_->source_ = move(source);
+    return true;
+#else
+    message_error_ = L"Файлы журналов Performance monitor читаются только в Windows!";
+    return false;
+#endif
+}
 
-    vector<wchar_t> logFileNameList = move(vectorToWideChar(files));
+bool PerfLogsReader::openProc([[maybe_unused]] chrono::milliseconds interval, [[maybe_unused]] size_t capacity) {
 
-    //Формируем указатель на источник файлов логов
-    PDH_STATUS pdhStatus = PdhBindInputDataSourceW(&phDataSource_, &logFileNameList[0]);
-    if (pdhStatus != ERROR_SUCCESS) {
-        messageErrorPdh(pdhStatus);
-        return false;
-    }
+    close();
 
+#if !defined(_WINDOWS) && defined(__linux__)
+    session_->source_ = make_unique<ProcCounterSource>(interval, capacity);
     return true;
+#else
+    message_error_ = L"Сборщик счетчиков из /proc доступен только в Linux!";
+    return false;
+#endif
 }
 
-void PerfLogsReader::close() {
-    eng_counters_map_.clear();
-    national_index_counters_map_.clear();
-    counters_.clear();
-    perfCounters_ = nullptr;
-    if (phQuery_) {
-        PdhCloseQuery(phQuery_);
-        phQuery_ = nullptr;
+bool PerfLogsReader::openSynthetic(const SyntheticOptions& options) {
+
+    close();
+
+    session_->source_ = make_unique<SyntheticCounterSource>(options);
+    return true;
+}
+
+void PerfLogsReader::selectSession(const string& name) {
+    unique_ptr<Session>& session = sessions_[name];
+    if (!session) {
+        session = make_unique<Session>(memory_budget_, RESPONSE_CACHE_BYTES, BUCKET_CACHE_BYTES);
     }
-    if (phDataSource_) {
-        PdhCloseLog(phDataSource_, PDH_FLAGS_CLOSE_QUERY);
-        phDataSource_ = nullptr;
+    session_ = session.get();
+    session_name_ = name;
+}
+
+//Закрывается только источник текущей сессии, слежение останавливается, если следило за ней
+void PerfLogsReader::close() {
+    if (follow_session_ == session_) {
+        stopFollow();
     }
+    session_->counters_stat_.clear();
+    session_->quality_.clear();
+    session_->responses_.clear();
+    session_->buckets_.clear();
+    session_->indexes_.clear();
+    session_->index_quality_.clear();
+    session_->index_memory_.reset();
+    session_->catalog_memory_.reset();
+    session_->source_ = nullptr;
 }
 
 bool PerfLogsReader::read() {
-    if (phDataSource_) {
-        perfCounters_ = make_unique<PerfCounters>(phDataSource_);
-        perfCounters_->read();
-
-        DWORD pdwNumEntries = 0;
-        PDH_TIME_INFO pInfo;
-        DWORD pdwBufferSize = sizeof(PDH_TIME_INFO);
-        PDH_STATUS pdhStatus = PdhGetDataSourceTimeRangeH(phDataSource_, &pdwNumEntries, &pInfo, &pdwBufferSize);
-        if (pdhStatus != ERROR_SUCCESS) {
-            messageErrorPdh(pdhStatus);
+    if (session_->source_) {
+        ScopedTimer timer(StatPhase::Catalog);
+        if (!session_->source_->read()) {
+            message_error_ = session_->source_->error();
             return false;
         }
-
-        start_time_ = longLongToSystemtime(pInfo.StartTime);
-        end_time_ = longLongToSystemtime(pInfo.EndTime);
-
-        fillNationalIndicesFromRegistry();
-        fillEngCountersFromRegistry();
-        fillCounters();
-        createQuery();
-
+        //Каталог уже построен: если он не помещается в бюджет, источник закрывается и память возвращается
+        const size_t catalog_bytes = session_->source_->memoryUsage();
+        if (!session_->catalog_memory_.reserve(memory_budget_, MemoryArea::Catalog, catalog_bytes)) {
+            close();
+            message_error_ = memoryBudgetError(catalog_bytes, memory_budget_);
+            return false;
+        }
+        session_->counters_stat_.assign(session_->source_->counters().size(), {});
+        session_->quality_.assign(session_->source_->counters().size(), {});
         return true;
     }
     else {
@@ -288,148 +2230,428 @@ bool PerfLogsReader::read() {
     }
 }
 
-bool PerfLogsReader::createQuery() {
-    PDH_STATUS pdhStatus = PdhOpenQueryH(phDataSource_, 0, &phQuery_);
-    if (pdhStatus != ERROR_SUCCESS) {
-        messageErrorPdh(pdhStatus);
-        return false;
+void PerfLogsReader::stopFollow() {
+    if (!follow_thread_.joinable()) return;
+    {
+        lock_guard<mutex> lock(follow_mutex_);
+        follow_stop_ = true;
     }
+    follow_cv_.notify_all();
+    follow_thread_.join();
+    follow_session_ = nullptr;
+}
 
-    for (auto it = counters_.begin(); it < counters_.end(); ++it) {
-        pdhStatus = PdhAddCounterW(phQuery_, it->national_name_.c_str(), 0, &it->hCounter_);
-        if (pdhStatus != ERROR_SUCCESS) {
-            it->hCounter_ = NULL;
+void PerfLogsReader::followLoop() {
+    while (!follow_stop_) {
+        {
+            unique_lock<mutex> lock(follow_mutex_);
+            follow_cv_.wait_for(lock, follow_interval_, [this]() { return follow_stop_.load(); });
+        }
+        //Команду, остановившую слежение, нельзя ждать: она сама ждет завершения потока
+        unique_lock<mutex> lock(mutex_, defer_lock);
+        while (!follow_stop_ && !lock.try_lock()) {
+            this_thread::sleep_for(chrono::milliseconds(10));
         }
+        if (follow_stop_) break;
+        followStep();
     }
-    return true;
 }
 
-void PerfLogsReader::messageErrorPdh(DWORD dwErrorCode) {
-    HANDLE hPdhLibrary = NULL;
-    LPWSTR pMessage = NULL;
-
-    wstringstream wss;
+//Чтение записей, появившихся в источнике после прошлого шага, и отправка обновленных интервалов
+void PerfLogsReader::followStep() {
+    if (!follow_session_->source_->refresh()) return;
+    Stats::instance().beginCommand("follow_step", currentLocalTicks());
+    ScopedTimer timer(StatPhase::Command, "follow_step");
+    uint64_t end_time = follow_session_->source_->endTime();
+    if (end_time <= follow_last_time_) return;
+
+    //Период начинается с уже отправленной записи: по ней источник вычисляет первое новое значение
+    uint64_t first_bucket = UINT64_MAX;
+    auto sink = makeSink([this, &first_bucket](size_t column, uint64_t timestamp, double value) {
+        if (timestamp <= follow_last_time_) return;
+        uint64_t bucket = timestamp / follow_bucket_;
+        auto& aggregates = follow_buckets_[bucket];
+        aggregates.resize(follow_indices_.size());
+        aggregates[column].add(timestamp, value);
+        first_bucket = min(first_bucket, bucket);
+    });
+    follow_session_->source_->scan(follow_last_time_, end_time, follow_indices_, sink);
+    follow_last_time_ = end_time;
+    if (first_bucket == UINT64_MAX) return;
 
-    hPdhLibrary = LoadLibrary(L"pdh.dll");
-    if (NULL == hPdhLibrary)
-    {
-        wss << L"LoadLibrary failed with " << GetLastError();
-        message_error_ = wss.str();
-        return;
-    }
-
-    if (!FormatMessage(FORMAT_MESSAGE_FROM_HMODULE |
-        FORMAT_MESSAGE_ALLOCATE_BUFFER |
-        FORMAT_MESSAGE_IGNORE_INSERTS,
-        hPdhLibrary,
-        dwErrorCode,
-        0,
-        (LPWSTR)&pMessage,
-        0,
-        NULL))
-    {
-        wss << L"Format message failed with " << GetLastError();
-        message_error_ = wss.str();
-        return;
+    namespace json = boost::json;
+    json::array j_points;
+    json::array j_samples;
+    for (auto it = follow_buckets_.lower_bound(first_bucket); it != follow_buckets_.end(); ++it) {
+        json::array j_values;
+        for (auto& aggregate : it->second) {
+            optional<double> bucket_value = aggregate.value(follow_mode_);
+            if (bucket_value) { j_values.push_back(*bucket_value); }
+            else { j_values.push_back(nullptr); }
+        }
+        j_points.push_back(ticksToJson(it->first * follow_bucket_).c_str());
+        j_samples.push_back(j_values);
+    }
+    //Дополняться может только последний интервал
+    follow_buckets_.erase(follow_buckets_.begin(), prev(follow_buckets_.end()));
+
+    json::object j_data;
+    j_data.emplace("session", follow_session_name_);
+    j_data.emplace("end_time", ticksToJson(follow_last_time_));
+    j_data.emplace("points", j_points);
+    j_data.emplace("samples", j_samples);
+    if (event_handler_) {
+        event_handler_("follow", serializeResponse(j_data));
     }
+}
 
-    wss << L"Formatted message: " << pMessage;
-    message_error_ = wss.str();
+//Сканирование периода без агрегации: каждая запись источника становится строкой выгрузки
+void PerfLogsReader::exportValues(uint64_t startTime, uint64_t endTime, const vector<size_t>& indices, Exporter& exporter) {
+    resetCountersStat();
 
-    LocalFree(pMessage);
+    ExportSink sink(exporter);
+    session_->source_->scan(startTime, endTime, indices, sink);
 }
 
-uint64_t PerfLogsReader::pointsInPeriod(const SYSTEMTIME& startTime, const SYSTEMTIME& endTime, uint64_t points) {
-    PDH_TIME_INFO pInfo = { systemtimeToLongLong(startTime), systemtimeToLongLong(endTime) , 1 };
-    PDH_STATUS pdhStatus = PdhSetQueryTimeRange(phQuery_, &pInfo);
-    pdhStatus = PdhCollectQueryData(phQuery_);
-    size_t points_count = 0;
-    while (ERROR_SUCCESS == pdhStatus) {
-        pdhStatus = PdhCollectQueryData(phQuery_);
-        if (ERROR_SUCCESS == pdhStatus) {
-            ++points_count;
-            if (points_count > points) return points_count;
-        }
-    }
-    return points_count;
+uint64_t PerfLogsReader::pointsInPeriod(uint64_t startTime, uint64_t endTime, uint64_t points) {
+    return session_->source_->countRecords(startTime, endTime, points);
 }
 
-vector<Sample> PerfLogsReader::getValues(const SYSTEMTIME& startTime, const SYSTEMTIME& endTime, uint64_t points) {
-    if (!phDataSource_) {
+vector<Sample> PerfLogsReader::getValues(uint64_t startTime, uint64_t endTime, uint64_t points, DownsamplingMode mode) {
+    if (!session_->source_) {
         message_error_ = L"Файлы не открыты!";
         return {};
     }
 
-    uint64_t points_in_period_ = pointsInPeriod(startTime, endTime, points);
+    resetCountersStat();
+
+    uint64_t points_in_period_;
+    {
+        TraceScope trace("count_records");
+        points_in_period_ = pointsInPeriod(startTime, endTime, points);
+    }
     if (points > points_in_period_) points = points_in_period_;
     if (points < 2) points = 2;
 
+    const size_t counters_count = session_->counters_stat_.size();
     double distance = distanceBetweenPoints(startTime, endTime, points);
     double distance_time = distanceBetweenPoints(startTime, endTime, points - 1);
-    uint64_t uStartTime = systemtimeToLongLong(startTime);
-    vector<Sample> samples(points);
-    for (size_t i = 0; i < points; ++i) {
-        samples[i].start_period_ = uStartTime + i * distance;
-        samples[i].end_period_ = uStartTime + (i + 1) * distance;
-        samples[i].point_time_ = longLongToSystemtime(uStartTime + i * distance_time);
-        samples[i].values_.resize(counters_.size());
-    }
-
-    PDH_TIME_INFO pInfo = { systemtimeToLongLong(startTime), systemtimeToLongLong(endTime) , 1 };
-    PDH_STATUS pdhStatus = PdhSetQueryTimeRange(phQuery_, &pInfo);
-
-    pdhStatus = PdhCollectQueryData(phQuery_);
-
-    DWORD lpdwType = 0;
-    PDH_RAW_COUNTER pValue;
-    PDH_FMT_COUNTERVALUE fmtValue;
-    while (ERROR_SUCCESS == pdhStatus) {
-        pdhStatus = PdhCollectQueryData(phQuery_);
-        if (ERROR_SUCCESS == pdhStatus) {
-            for (size_t i = 0; i < counters_.size(); ++i) {
-                Counter& counter = counters_[i];
-                if (counter.hCounter_) {
-                    PDH_STATUS pdhStatusCounterValue = PdhGetRawCounterValue(counter.hCounter_, &lpdwType, &pValue);
-                    if (ERROR_SUCCESS == pdhStatusCounterValue && (PDH_CSTATUS_NEW_DATA == pValue.CStatus || PDH_CSTATUS_VALID_DATA == pValue.CStatus)) {
-                        if (counter.prevCounter_.CStatus != PDH_CSTATUS_ITEM_NOT_VALIDATED) {
-                            pdhStatusCounterValue = PdhCalculateCounterFromRawValue(counter.hCounter_, PDH_FMT_DOUBLE | PDH_FMT_NOCAP100, &pValue, &counter.prevCounter_, &fmtValue);
-                            if (ERROR_SUCCESS == pdhStatusCounterValue && (PDH_CSTATUS_NEW_DATA == fmtValue.CStatus || PDH_CSTATUS_VALID_DATA == fmtValue.CStatus)) {
-                                size_t index = (fileTimeToLongLong(pValue.TimeStamp) - uStartTime) / distance;
-                                if (index >= points) index = points - 1;
-                                Sample& sample = samples[index];
-                                if (!sample.values_[i] || fmtValue.doubleValue > *sample.values_[i]) {
-                                    sample.values_[i] = fmtValue.doubleValue;
-                                }
-                                if (!counter.max_value_ || fmtValue.doubleValue > *counter.max_value_) {
-                                    counter.max_value_ = fmtValue.doubleValue;
-                                }
-                                if (!counter.sum_value_) {
-                                    counter.sum_value_ = fmtValue.doubleValue;
-                                }
-                                else {
-                                    counter.sum_value_ = *counter.sum_value_ + fmtValue.doubleValue;
-                                }
-                                if (!counter.count_value_) {
-                                    counter.count_value_ = 1;
-                                }
-                                else {
-                                    counter.count_value_ = *counter.count_value_ + 1;
-                                }
-                            }
-                        }
-                        counter.prevCounter_ = pValue;
-                    }
-                }
+    //Режимы кроме максимума копят в интервале полный агрегат, а точки строятся после сканирования
+    const bool aggregate = mode != DownsamplingMode::Max;
+
+    //Матрица точек и агрегаты интервалов резервируются в бюджете до выделения
+    MemoryReservation samples_memory;
+    MemoryReservation aggregates_memory;
+    const size_t samples_bytes = samplesBytes(aggregate ? points * pointsPerBucket(mode) : points, counters_count);
+    const size_t aggregates_bytes = aggregate ? points * counters_count * sizeof(BucketAggregate) : 0;
+    if (!samples_memory.reserve(memory_budget_, MemoryArea::Samples, samples_bytes)
+        || !aggregates_memory.reserve(memory_budget_, MemoryArea::Aggregates, aggregates_bytes)) {
+        message_error_ = memoryBudgetError(samples_bytes + aggregates_bytes, memory_budget_);
+        return {};
+    }
+    vector<BucketAggregate> aggregates;
+    vector<Sample> samples;
+    if (aggregate) {
+        aggregates.resize(points * counters_count);
+    }
+    else {
+        samples.resize(points);
+        for (size_t i = 0; i < points; ++i) {
+            samples[i].start_period_ = startTime + i * distance;
+            samples[i].end_period_ = startTime + (i + 1) * distance;
+            samples[i].point_time_ = startTime + i * distance_time;
+            samples[i].values_.resize(counters_count);
+        }
+    }
+
+    //Счетчики с действующим индексом диапазонов не сканируются: интервалы и статистика по индексу
+    const bool use_index = !session_->indexes_.empty() && session_->indexed_end_ == session_->source_->endTime()
+        && (mode == DownsamplingMode::Max || mode == DownsamplingMode::Min || mode == DownsamplingMode::Avg);
+    vector<size_t> indices;
+    vector<size_t> indexed;
+    for (size_t i = 0; i < counters_count; ++i) {
+        auto it = use_index ? session_->indexes_.find(i) : session_->indexes_.end();
+        if (it == session_->indexes_.end()) {
+            indices.push_back(i);
+            continue;
+        }
+        const RangeIndex& range_index = it->second;
+        //Граница интервала b - первая выборка не раньше startTime + b * distance, как при сканировании
+        vector<size_t> bounds(points + 1);
+        bounds[0] = range_index.lowerBound(startTime);
+        for (size_t b = 1; b < points; ++b) {
+            bounds[b] = range_index.lowerBound(startTime + static_cast<uint64_t>(ceil(b * distance)));
+        }
+        bounds[points] = range_index.lowerBound(endTime + 1);
+        //Сканирование периода отбрасывает первую выборку скорости: выборка перед первой позицией
+        //в индексе есть, но в запросе не участвует
+        const IndexedQuality& skipped = session_->index_quality_[i];
+        const bool skip_first = skipped.rate_ && bounds[0] > 0 && bounds[0] < bounds[points];
+        if (skip_first) {
+            const size_t position = bounds[0];
+            for (size_t b = 0; bounds[b] == position; ++b) {
+                bounds[b] = position + 1;
+            }
+        }
+        for (size_t b = 0; b < points; ++b) {
+            RangeSummary summary = range_index.query(bounds[b], bounds[b + 1]);
+            if (!summary.count_) continue;
+            if (aggregate) {
+                BucketAggregate& bucket = aggregates[b * counters_count + i];
+                bucket.count_ = static_cast<uint32_t>(summary.count_);
+                bucket.sum_ = summary.sum_;
+                bucket.min_ = summary.min_;
+                bucket.max_ = summary.max_;
+            }
+            else {
+                samples[b].values_[i] = summary.max_;
+            }
+        }
+        RangeSummary total = range_index.query(bounds[0], bounds[points]);
+        CounterStat& stat = session_->counters_stat_[i];
+        if (total.count_) {
+            stat.max_value_ = total.max_;
+            stat.sum_value_ = total.sum_;
+            stat.count_value_ = total.count_;
+        }
+        stat.quality_ = indexedQuality(*session_->source_, range_index, skipped, bounds[0], bounds[points], startTime, endTime);
+        if (skip_first) ++stat.quality_.first_skipped_;
+        indexed.push_back(i);
+    }
+    accumulateQuality(indexed);
+
+    auto sink = makeSink([&](size_t column, uint64_t timestamp, double value) {
+        const size_t i = indices[column];
+        size_t index = (timestamp - startTime) / distance;
+        if (index >= points) index = points - 1;
+        if (aggregate) {
+            aggregates[index * counters_count + i].add(timestamp, value);
+        }
+        else {
+            Sample& sample = samples[index];
+            if (!sample.values_[i] || value > *sample.values_[i]) {
+                sample.values_[i] = value;
+            }
+        }
+        CounterStat& stat = session_->counters_stat_[i];
+        if (!stat.max_value_ || value > *stat.max_value_) {
+            stat.max_value_ = value;
+        }
+        if (!stat.sum_value_) {
+            stat.sum_value_ = value;
+        }
+        else {
+            stat.sum_value_ = *stat.sum_value_ + value;
+        }
+        if (!stat.count_value_) {
+            stat.count_value_ = 1;
+        }
+        else {
+            stat.count_value_ = *stat.count_value_ + 1;
+        }
+    });
+    if (!indices.empty()) {
+        TraceScope trace("scan", to_string(indices.size()) + " counters");
+        QualitySink quality_sink(sink, indices, session_->counters_stat_);
+        session_->source_->scan(startTime, endTime, indices, quality_sink);
+        accumulateQuality(indices);
+    }
+
+    if (aggregate) {
+        ScopedTimer timer(StatPhase::Aggregate);
+        //Первое значение счетчиков скорости вычисляется только со второй выборки, как и в режиме максимума
+        for (size_t i = 0; i < counters_count; ++i) {
+            if (!aggregates[i].count_) {
+                aggregates[i] = aggregates[counters_count + i];
             }
         }
+        return samplesFromAggregates(aggregates, startTime, endTime, points, mode);
     }
+
     samples[0].values_ = samples[1].values_;
 
     return samples;
 }
 
+//Границы интервалов кратны ширине, поэтому совпадают между запросами: закрытые интервалы
+//(целиком до конца данных источника) берутся из кэша сессии, источник сканируется только
+//на участках из недостающих интервалов. Статистика счетчиков относится к выровненному диапазону
+vector<Sample> PerfLogsReader::getAlignedValues(uint64_t startTime, uint64_t endTime, uint64_t points,
+    DownsamplingMode mode, uint64_t& width) {
+    if (!session_->source_) {
+        message_error_ = L"Файлы не открыты!";
+        return {};
+    }
+    if (endTime < startTime) {
+        message_error_ = L"Неверный диапазон времени!";
+        return {};
+    }
+
+    resetCountersStat();
+
+    width = alignedBucketWidth(endTime - startTime, points);
+    const uint64_t first = startTime / width;
+    //Не меньше двух интервалов, как и в getValues
+    const uint64_t last = max(endTime / width, first + 1);
+    const size_t buckets = last - first + 1;
+    const size_t counters_count = session_->counters_stat_.size();
+
+    MemoryReservation samples_memory;
+    MemoryReservation aggregates_memory;
+    const size_t samples_bytes = samplesBytes(buckets * pointsPerBucket(mode), counters_count);
+    const size_t aggregates_bytes = buckets * counters_count * sizeof(BucketAggregate);
+    if (!samples_memory.reserve(memory_budget_, MemoryArea::Samples, samples_bytes)
+        || !aggregates_memory.reserve(memory_budget_, MemoryArea::Aggregates, aggregates_bytes)) {
+        message_error_ = memoryBudgetError(samples_bytes + aggregates_bytes, memory_budget_);
+        return {};
+    }
+    vector<BucketAggregate> aggregates(buckets * counters_count);
+    vector<bool> cached(buckets, false);
+    for (size_t b = 0; b < buckets; ++b) {
+        if (const vector<BucketAggregate>* row = session_->buckets_.find({ width, first + b })) {
+            if (row->size() != counters_count) continue;
+            copy(row->begin(), row->end(), aggregates.begin() + b * counters_count);
+            cached[b] = true;
+        }
+    }
+
+    vector<size_t> indices(counters_count);
+    for (size_t i = 0; i < counters_count; ++i) {
+        indices[i] = i;
+    }
+
+    //Подряд идущие недостающие интервалы читаются одним сканированием
+    auto sink = makeSink([&](size_t i, uint64_t timestamp, double value) {
+        uint64_t index = timestamp / width;
+        if (index < first) index = first;
+        if (index > last) index = last;
+        aggregates[(index - first) * counters_count + i].add(timestamp, value);
+    });
+    //Качество учитывается только по сканированным интервалам, в кэше хранятся лишь агрегаты
+    QualitySink quality_sink(sink, indices, session_->counters_stat_);
+    //Участок читается с запасом, чтобы скорости первого интервала считались по предыдущей выборке
+    LeadInSink lead_in_sink(quality_sink);
+    const uint64_t source_start = session_->source_->startTime();
+    vector<bool> partial(buckets, false);
+    bool scanned = false;
+    for (size_t b = 0; b < buckets;) {
+        if (cached[b]) {
+            ++b;
+            continue;
+        }
+        size_t run_end = b;
+        while (run_end + 1 < buckets && !cached[run_end + 1]) {
+            ++run_end;
+        }
+        TraceScope trace("scan", to_string(run_end - b + 1) + " buckets");
+        const uint64_t from = (first + b) * width;
+        lead_in_sink.start(from);
+        session_->source_->scan(from > RUN_LEAD_IN ? from - RUN_LEAD_IN : 0, (first + run_end + 1) * width - 1,
+            indices, lead_in_sink);
+        //Без предыдущей выборки в запасе первый интервал неполон и в кэш не попадает
+        partial[b] = !lead_in_sink.seen() && from > source_start;
+        scanned = true;
+        b = run_end + 1;
+    }
+    if (scanned) {
+        accumulateQuality(indices);
+    }
+
+    const uint64_t source_end = session_->source_->endTime();
+    const size_t row_bytes = sizeof(BucketKey) + counters_count * sizeof(BucketAggregate);
+    for (size_t b = 0; b < buckets; ++b) {
+        if (cached[b] || partial[b] || (first + b + 1) * width - 1 > source_end) continue;
+        session_->buckets_.insert({ width, first + b },
+            vector<BucketAggregate>(aggregates.begin() + b * counters_count, aggregates.begin() + (b + 1) * counters_count),
+            row_bytes);
+    }
+
+    for (size_t b = 0; b < buckets; ++b) {
+        for (size_t i = 0; i < counters_count; ++i) {
+            const BucketAggregate& aggregate = aggregates[b * counters_count + i];
+            if (!aggregate.count_) continue;
+            CounterStat& stat = session_->counters_stat_[i];
+            if (!stat.max_value_ || aggregate.max_ > *stat.max_value_) {
+                stat.max_value_ = aggregate.max_;
+            }
+            stat.sum_value_ = stat.sum_value_.value_or(0) + aggregate.sum_;
+            stat.count_value_ = stat.count_value_.value_or(0) + aggregate.count_;
+        }
+    }
+
+    vector<Sample> samples;
+    {
+        ScopedTimer timer(StatPhase::Aggregate);
+        samples = samplesFromAggregates(aggregates, first * width, (last + 1) * width, buckets, mode);
+    }
+    //Точка ставится на начало своего интервала
+    for (auto& sample : samples) {
+        sample.point_time_ = sample.start_period_;
+    }
+    return samples;
+}
+
+vector<Sample> PerfLogsReader::samplesFromAggregates(vector<BucketAggregate>& aggregates,
+    uint64_t startTime, uint64_t endTime, uint64_t points, DownsamplingMode mode) {
+    const size_t counters_count = session_->counters_stat_.size();
+
+    const size_t per_bucket = pointsPerBucket(mode);
+    const size_t rows = points * per_bucket;
+    double distance = (endTime - startTime) / (1.0 * rows);
+    double distance_time = (endTime - startTime) / (1.0 * (rows - 1));
+    vector<Sample> samples(rows);
+    for (size_t i = 0; i < rows; ++i) {
+        samples[i].start_period_ = startTime + i * distance;
+        samples[i].end_period_ = startTime + (i + 1) * distance;
+        samples[i].point_time_ = startTime + i * distance_time;
+        samples[i].values_.resize(counters_count);
+    }
+
+    //Счетчики (LTTB) и интервалы (остальные режимы) независимы и сворачиваются в пуле
+    if (mode == DownsamplingMode::Lttb) {
+        pool_->parallelFor(counters_count, [&](size_t i) {
+            vector<optional<double>> values = lttb(&aggregates[i], points, counters_count);
+            for (size_t b = 0; b < points; ++b) {
+                samples[b].values_[i] = values[b];
+            }
+        });
+    }
+    else if (mode == DownsamplingMode::M4) {
+        pool_->parallelFor(points, [&](size_t b) {
+            optional<double> values[4];
+            for (size_t i = 0; i < counters_count; ++i) {
+                aggregates[b * counters_count + i].m4(values);
+                for (size_t k = 0; k < 4; ++k) {
+                    samples[b * 4 + k].values_[i] = values[k];
+                }
+            }
+        });
+    }
+    else {
+        pool_->parallelFor(points, [&](size_t b) {
+            for (size_t i = 0; i < counters_count; ++i) {
+                samples[b].values_[i] = aggregates[b * counters_count + i].value(mode);
+            }
+        });
+    }
+
+    return samples;
+}
+
+//Статистика относится к одному запросу
+void PerfLogsReader::resetCountersStat() {
+    session_->counters_stat_.assign(session_->counters_stat_.size(), {});
+}
+
+void PerfLogsReader::accumulateQuality(const vector<size_t>& indices) {
+    for (auto index : indices) {
+        session_->quality_[index].add(session_->counters_stat_[index].quality_);
+    }
+}
+
 boost::json::object PerfLogsReader::countersToJsonObject() {
     namespace json = boost::json;
+    ScopedTimer timer(StatPhase::Json);
     json::object j_counters;
     j_counters.emplace("columns", json::array({
         "national_name", "computer", "object", "instances", "counter",
@@ -438,7 +2660,8 @@ boost::json::object PerfLogsReader::countersToJsonObject() {
     );
 
     json::array j_counters_rows;
-    for (auto it_counter = counters_.begin(); it_counter < counters_.end(); ++it_counter) {
+    const vector<CounterInfo>& counters = session_->source_->counters();
+    for (auto it_counter = counters.begin(); it_counter < counters.end(); ++it_counter) {
         j_counters_rows.emplace_back(json::array({
             wideCharToUtf(it_counter->national_name_),
             wideCharToUtf(it_counter->computer_),
@@ -457,276 +2680,160 @@ boost::json::object PerfLogsReader::countersToJsonObject() {
     return j_counters;
 }
 
-bool PerfLogsReader::fillEngCountersFromRegistry() {
-    HKEY hKey;
-    if (RegOpenKeyExW(HKEY_LOCAL_MACHINE, L"SOFTWARE\\Microsoft\\Windows NT\\CurrentVersion\\Perflib\\009", 0, KEY_QUERY_VALUE, &hKey) != ERROR_SUCCESS) {
-        return false;
-    };
-    DWORD lpType;
-    DWORD lpcbData = 0;
-    if (RegQueryValueExW(hKey, L"Counter", NULL, &lpType, NULL, &lpcbData) != ERROR_SUCCESS) {
-        return false;
-    }
-    vector<wchar_t> lpData(lpcbData / sizeof(wchar_t));
-    if (RegQueryValueExW(hKey, L"Counter", NULL, &lpType, reinterpret_cast<LPBYTE>(&lpData[0]), &lpcbData) != ERROR_SUCCESS) {
-        return false;
-    }
+size_t samplesBytes(size_t rows, size_t counters) {
+    return rows * (sizeof(Sample) + counters * sizeof(optional<double>));
+}
 
-    vector<wstring> index_name_counters = pdhListToVector(lpData);
-    for (size_t index = 1; index < index_name_counters.size(); ++index) {
-        if (index % 2) {
-            eng_counters_map_.insert({ _wtol(&index_name_counters[index - 1][0]), index_name_counters[index] });
-        }
-    }
-    return true;
+wstring memoryBudgetError(size_t bytes, const MemoryBudget& budget) {
+    auto megabytes = [](size_t value) { return to_wstring((value + 1024 * 1024 - 1) / (1024 * 1024)); };
+    return L"Недостаточно памяти: запросу нужно " + megabytes(bytes) + L" МБ, занято "
+        + megabytes(budget.used()) + L" из " + megabytes(budget.limit()) + L" МБ!";
 }
 
-bool PerfLogsReader::fillNationalIndicesFromRegistry() {
-    HKEY hKey;
-    if (RegOpenKeyExW(HKEY_LOCAL_MACHINE, L"SOFTWARE\\Microsoft\\Windows NT\\CurrentVersion\\Perflib\\CurrentLanguage", 0, KEY_QUERY_VALUE, &hKey) != ERROR_SUCCESS) {
-        return false;
-    };
-    DWORD lpType;
-    DWORD lpcbData = 0;
-    if (RegQueryValueExW(hKey, L"Counter", NULL, &lpType, NULL, &lpcbData) != ERROR_SUCCESS) {
-        return false;
-    }
-    vector<wchar_t> lpData(lpcbData / sizeof(wchar_t));
-    if (RegQueryValueExW(hKey, L"Counter", NULL, &lpType, reinterpret_cast<LPBYTE>(&lpData[0]), &lpcbData) != ERROR_SUCCESS) {
+//Имя счетчика без компьютера: объект(экземпляр)\счетчик
+wstring counterKey(const CounterInfo& info) {
+    return info.object_eng_ + L"(" + info.instances_eng_ + L")\\" + info.counter_eng_;
+}
+
+//Период, компьютеры и счетчики одного файла для индекса архива. Файл открывается
+//отдельным источником, каталог которого остается в общем кэше каталогов PDH
+bool probeLogFile([[maybe_unused]] const filesystem::path& file, [[maybe_unused]] ArchiveProbeResult& result) {
+#ifdef _WINDOWS
+    PdhCounterSource source;
+    if (!source.open({ file.wstring() }) || !source.read()) {
         return false;
     }
-
-    vector<wstring> index_name_counters = pdhListToVector(lpData);
-    for (size_t index = 1; index < index_name_counters.size(); ++index) {
-        if (index % 2) {
-            national_index_counters_map_.insert({ index_name_counters[index], _wtol(&index_name_counters[index - 1][0]) });
-        }
+    result.start_time_ = source.startTime();
+    result.end_time_ = source.endTime();
+    for (auto& counter : source.counters()) {
+        result.machines_.push_back(wideCharToUtf(counter.computer_eng_));
+        result.counters_.push_back(wideCharToUtf(counterKey(counter)));
     }
+    sort(result.machines_.begin(), result.machines_.end());
+    result.machines_.erase(unique(result.machines_.begin(), result.machines_.end()), result.machines_.end());
     return true;
+#else
+    return false;
+#endif
 }
 
-const wstring& PerfLogsReader::getEngName(const std::wstring& national_name) {
-    auto it_index = national_index_counters_map_.find(national_name);
-    if (it_index == national_index_counters_map_.end()) {
-        return national_name;
-    }
-
-    auto it = eng_counters_map_.find(it_index->second);
-    if (it == eng_counters_map_.end()) {
-        return national_name;
-    }
-    return it->second;
-}
-
-bool PerfLogsReader::fillCounters() {
-    auto& computers = perfCounters_->getComputers();
-    for (auto it_computer = computers.begin(); it_computer < computers.end(); ++it_computer) {
-        const wchar_t* pComputer = it_computer->getCompName().c_str();
-        auto& objects = it_computer->getObjects();
-        for (auto it_object = objects.begin(); it_object < objects.end(); ++it_object) {
-            const wchar_t* pObject = it_object->getObjName().c_str();
-            const wchar_t* pObjectEng = getEngName(it_object->getObjName()).c_str();
-            auto& counters = it_object->getCounters();
-            for (auto it_counter = counters.begin(); it_counter < counters.end(); ++it_counter) {
-                const wchar_t* pCounter = it_counter->c_str();
-                const wchar_t* pCounterEng = getEngName(*it_counter).c_str();
-                auto& instances = it_object->getInstances();
-                if (instances.size()) {
-                    for (auto it_instance = instances.begin(); it_instance < instances.end(); ++it_instance) {
-                        const wchar_t* pInstances = it_instance->c_str();
-                        const wchar_t* pInstancesEng = getEngName(*it_instance).c_str();
-                        counters_.push_back({
-                                pComputer, pObject, pInstances, pCounter,
-                                pComputer, pObjectEng, pInstancesEng, pCounterEng
-                            });
-                    }
-                }
-                else {
-                    counters_.push_back({
-                            pComputer, pObject, NULL, pCounter,
-                            pComputer, pObjectEng, NULL, pCounterEng
-                        });
-                }
-            }
-        }
+//На стыке файлов порядок времени не гарантирован
+template <typename Value>
+void sortByTime(vector<uint64_t>& times, vector<Value>& values) {
+    if (is_sorted(times.begin(), times.end())) return;
+    vector<size_t> order(times.size());
+    iota(order.begin(), order.end(), size_t(0));
+    stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return times[a] < times[b]; });
+    vector<uint64_t> sorted_times(order.size());
+    vector<Value> sorted_values(order.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        sorted_times[i] = times[order[i]];
+        sorted_values[i] = values[order[i]];
     }
-
-    return true;
+    times.swap(sorted_times);
+    values.swap(sorted_values);
 }
 
-Counter::Counter(
-    const wchar_t* computer, const wchar_t* object, const wchar_t* instances, const wchar_t* counter,
-    const wchar_t* computer_eng, const wchar_t* object_eng, const wchar_t* instances_eng, const wchar_t* counter_eng) {
-    computer_ = computer;
-    object_ = object;
-    instances_ = (instances) ? instances : L"- - -";
-    counter_ = counter;
-    computer_eng_ = computer_eng;
-    object_eng_ = object_eng;
-    instances_eng_ = (instances_eng) ? instances_eng : L"- - -";
-    counter_eng_ = counter_eng;
-    national_name_ = makeCounter(computer, object, instances, counter);
-    english_name_ = makeCounter(computer_eng, object_eng, instances_eng, counter_eng);
-    hCounter_ = NULL;
-}
-
-wstring  makeCounter(const wchar_t* computer, const wchar_t* object, const wchar_t* instance, const wchar_t* counter) {
-    _PDH_COUNTER_PATH_ELEMENTS_W  pdhElement{
-        const_cast<wchar_t*>(computer),
-        const_cast<wchar_t*>(object),
-        const_cast<wchar_t*>(instance),
-        NULL,
-        NULL,
-        const_cast<wchar_t*>(counter)
-    };
-
-    DWORD pcchBufferSize = 0;
-    PdhMakeCounterPathW(&pdhElement, NULL, &pcchBufferSize, 0);
-    wstring wstr(pcchBufferSize, L'\000');
-    PdhMakeCounterPathW(&pdhElement, &wstr[0], &pcchBufferSize, 0);
-
-    wstr.pop_back();
-    return  wstr;
-}
-
-wstring utfToWideChar(const string& str) {
-    int count = MultiByteToWideChar(CP_UTF8, 0, str.c_str(), static_cast<int>(str.length()), NULL, 0);
-    std::wstring wstr(count, 0);
-    MultiByteToWideChar(CP_UTF8, 0, str.c_str(), static_cast<int>(str.length()), &wstr[0], count);
-    return wstr;
-}
-
-string wideCharToUtf(const wstring& wstr) {
-    int count = WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), static_cast<int>(wstr.length()), NULL, 0, NULL, NULL);
-    std::string str(count, 0);
-    WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), -1, &str[0], count, NULL, NULL);
-    return str;
-}
-
-vector<wchar_t> vectorToWideChar(const vector<wstring>& files) {
-    //Считаем место под wchar_t
-    size_t wchar_t_size = 0;
-    for (auto it = files.begin(); it < files.end(); ++it) {
-        wchar_t_size += (it->size() + 1);
+//Качество позиций индекса [first, last) за период [start, end], как его дало бы сканирование периода.
+//Записи без времени на границах периода делятся по числу записей источника до границы
+CounterQuality indexedQuality(CounterSource& source, const RangeIndex& index, const IndexedQuality& skipped,
+    size_t first, size_t last, uint64_t start, uint64_t end) {
+    CounterQuality quality;
+    quality.valid_ = last > first ? last - first : 0;
+    const size_t CHUNK = 1024;
+    vector<uint64_t> times(CHUNK);
+    vector<double> values(CHUNK);
+    for (size_t from = first; from < last; from += CHUNK) {
+        const size_t to = min(last, from + CHUNK);
+        index.decode(from, to, times.data(), values.data());
+        for (size_t i = 0; i < to - from; ++i) {
+            if (quality.last_time_ && times[i] - quality.last_time_ > quality.longest_gap_) {
+                quality.longest_gap_ = times[i] - quality.last_time_;
+            }
+            quality.last_time_ = times[i];
+        }
     }
-    ++wchar_t_size;
 
-    //Формируем vector<wchar> списка файлов для PdhBindInputDataSourceW
-    vector<wchar_t> v_wchar_t(wchar_t_size);
-    wchar_t* p = &v_wchar_t[0];
-    for (auto it = files.begin(); it < files.end(); ++it) {
-        wmemcpy(p, it->c_str(), it->size());
-        p += it->size();
-        *p = L'\000';
-        ++p;
+    const size_t skipped_first = lower_bound(skipped.times_.begin(), skipped.times_.end(), start) - skipped.times_.begin();
+    const size_t skipped_last = upper_bound(skipped.times_.begin(), skipped.times_.end(), end) - skipped.times_.begin();
+    for (size_t i = skipped_first; i < skipped_last; ++i) {
+        quality.skipped(skipped.statuses_[i]);
     }
-    *p = L'\000';
-
-    return v_wchar_t;
-}
-
-vector<wstring> getComputers(const PDH_HLOG phDataSource) {
-    DWORD  pcchBufferSize = 0;
-    PdhEnumMachinesHW(phDataSource, NULL, &pcchBufferSize);
-    vector<wchar_t> v_comps(pcchBufferSize);
-    PdhEnumMachinesHW(phDataSource, &v_comps[0], &pcchBufferSize);
 
-    vector<wstring> computers;
-    wchar_t* start = &v_comps[0];
-    for (wchar_t* p = &v_comps[0]; p < &v_comps.back(); ++p) {
-        if (*p == L'\000') {
-            computers.push_back(wstring(start));
-            start = p + 1;
+    auto run = lower_bound(skipped.runs_.begin(), skipped.runs_.end(), start,
+        [](const IndexedQuality::Run& run, uint64_t time) { return run.last_ < time; });
+    for (; run != skipped.runs_.end() && run->first_ <= end; ++run) {
+        uint64_t from = 0;
+        uint64_t to = run->records_;
+        if (run->first_ < start) {
+            from = min(run->records_, source.countRecords(run->first_, start - 1, run->records_));
         }
-    }
-
-    return computers;
-}
-
-vector<wstring> pdhListToVector(const vector<wchar_t>& v_wchar_t) {
-    vector<wstring> v;
-    const wchar_t* start = &v_wchar_t[0];
-    for (const wchar_t* p = &v_wchar_t[0]; p < &v_wchar_t.back(); ++p) {
-        if (*p == L'\000') {
-            v.push_back(wstring(start));
-            start = p + 1;
-            if (*start == L'\000') break;
+        if (run->last_ > end) {
+            to -= min(run->records_, source.countRecords(end + 1, run->last_, run->records_));
+        }
+        const size_t entries_end = run + 1 != skipped.runs_.end() ? (run + 1)->entries_ : skipped.run_records_.size();
+        for (size_t i = run->entries_; i < entries_end; ++i) {
+            if (skipped.run_records_[i] >= from && skipped.run_records_[i] < to) {
+                quality.skipped(skipped.run_statuses_[i]);
+            }
         }
     }
-    return v;
-}
-
-SYSTEMTIME longLongToSystemtime(LONGLONG ll) {
-    FILETIME ft = { (DWORD)ll, ll >> 32 };
-    SYSTEMTIME systemTime;
-    FileTimeToSystemTime(&ft, &systemTime);
-    return systemTime;
-}
-
-LONGLONG fileTimeToLongLong(const FILETIME& fileTime) {
-    uint64_t uTime;
-    memcpy(&uTime, &fileTime, sizeof(uTime));
-    return uTime;
+    return quality;
 }
 
-LONGLONG systemtimeToLongLong(const SYSTEMTIME& time) {
-    FILETIME fileTime;
-    SystemTimeToFileTime(&time, &fileTime);
-    return fileTimeToLongLong(fileTime);
+//available - false, если счетчик не удалось добавить в запрос источника
+boost::json::object qualityToJson(const CounterQuality& quality, bool available) {
+    boost::json::object j_quality;
+    j_quality.emplace("available", available);
+    j_quality.emplace("valid", quality.valid_);
+    j_quality.emplace("invalid", quality.invalid_);
+    j_quality.emplace("first_skipped", quality.first_skipped_);
+    j_quality.emplace("gaps", quality.gaps_);
+    j_quality.emplace("longest_gap", static_cast<double>(quality.longest_gap_) / TICKS_PER_SECOND);
+    return j_quality;
 }
 
-string systemtimeToJson(const SYSTEMTIME& time) {
-    const auto w2 = setw(2);
-    ss_ << setfill('0') << setw(4) << time.wYear << '-' << w2 << time.wMonth << '-' << w2 << time.wDay
-        << 'T'
-        << w2 << time.wHour << ':' << w2 << time.wMinute << ':' << w2 << time.wSecond;
-    string str = ss_.str();
-    ss_.str("");
-    ss_.clear();
-    return str;
+boost::json::value optionalToJson(const optional<double>& value) {
+    if (value) return *value;
+    return nullptr;
 }
 
-SYSTEMTIME stringToSystemtime(const string& str) {
-    SYSTEMTIME time{};
-    WORD a = 0;
-    time.wYear = stoi(str.substr(0, 4));
-    time.wMonth = stoi(str.substr(5, 2));
-    time.wDay = stoi(str.substr(8, 2));
-    time.wHour = stoi(str.substr(11, 2));
-    time.wMinute = stoi(str.substr(14, 2));
-    time.wSecond = stoi(str.substr(17, 2));
-
-    time.wDayOfWeek = dayOfWeek(time.wYear, time.wMonth, time.wDay);
-
-    return time;
+//Сериализация ответа с учетом времени и размера в статистике
+string serializeResponse(const boost::json::object& j_response) {
+    ScopedTimer timer(StatPhase::Serialize);
+    string response = boost::json::serialize(j_response);
+    Stats::instance().add(StatCounter::Bytes, response.size());
+    return response;
 }
 
-int dayOfWeek(unsigned int year, unsigned int month, unsigned int day) {
-    unsigned int y, c, m, d;
-    if (month == 1 || month == 2) {
-        c = (year - 1) / 100;
-        y = (year - 1) % 100;
-        m = month + 12;
-        d = day;
-    }
-    else {
-        c = year / 100;
-        y = year % 100;
-        m = month;
-        d = day;
+//Этапы: число вызовов, суммарное и максимальное время в миллисекундах
+boost::json::object statSnapshotToJson(const StatSnapshot& snapshot) {
+    namespace json = boost::json;
+    json::object j_phases;
+    for (size_t i = 0; i < STAT_PHASES; ++i) {
+        if (!snapshot.calls_[i]) continue;
+        json::object j_phase;
+        j_phase.emplace("calls", snapshot.calls_[i]);
+        j_phase.emplace("ms", snapshot.nanoseconds_[i] / 1e6);
+        j_phase.emplace("max_ms", snapshot.max_nanoseconds_[i] / 1e6);
+        j_phases.emplace(statPhaseName(static_cast<StatPhase>(i)), j_phase);
     }
-    int week_day = y + y / 4 + c / 4 - 2 * c + 26 * (m + 1) / 10 + d - 1;   // Формула Целера
-    week_day = week_day >= 0 ? (week_day % 7) : (week_day % 7 + 7);         // По модулю, когда iWeek отрицательный
 
-    return week_day;
-}
+    json::object j_counters;
+    for (size_t i = 0; i < STAT_COUNTERS; ++i) {
+        j_counters.emplace(statCounterName(static_cast<StatCounter>(i)), snapshot.counters_[i]);
+    }
+    if (snapshot.allocations_) { j_counters.emplace("allocations", *snapshot.allocations_); }
+    else { j_counters.emplace("allocations", nullptr); }
 
-double distanceBetweenPoints(const SYSTEMTIME& startTime, const SYSTEMTIME& endTime, uint64_t points) {
-    return (systemtimeToLongLong(endTime) - systemtimeToLongLong(startTime)) / (1.0 * points);
+    json::object j_snapshot;
+    j_snapshot.emplace("phases", j_phases);
+    j_snapshot.emplace("counters", j_counters);
+    return j_snapshot;
 }
 
-void printSystemtime(const SYSTEMTIME& time) {
-    wcout << time.wYear << L"." << time.wMonth << L"." << time.wDay << L" " << time.wHour << L":" << time.wMinute << L":" << time.wSecond << L"." << time.wMilliseconds << endl;
+double distanceBetweenPoints(uint64_t startTime, uint64_t endTime, uint64_t points) {
+    return (endTime - startTime) / (1.0 * points);
 }
 
 double getScale(double max_value, double max_scale_value) {
@@ -1,120 +1,230 @@
 ﻿#pragma once
 
 #include <iostream>
+#include <cmath>
 
 #include <vector>
 #include <string>
-#include <Pdh.h>
-#include <PdhMsg.h>
-#include <unordered_map>
+#include <memory>
 #include <optional>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <condition_variable>
 
 #include "boost/json.hpp"
 
-#pragma comment(lib,"pdh.lib")
+#include "ArchiveIndex.h"
+#include "Comparison.h"
+#include "Conversion.h"
+#include "CounterSource.h"
+#include "Correlation.h"
+#include "Downsampling.h"
+#include "Exporter.h"
+#include "Intervals.h"
+#include "LruCache.h"
+#include "MemoryBudget.h"
+#include "RangeIndex.h"
+#include "Resampling.h"
+#include "SkewedCounterSource.h"
+#include "SyntheticCounterSource.h"
+#include "WorkerPool.h"
 
-class PerfCountersComp;
-class PerfCountersObject;
-class PerfCountersItem;
-
-class PerfCounters {
-public:
-	PerfCounters(PDH_HLOG phDataSource);
-	void read();
-	const std::vector<PerfCountersComp>& getComputers() const { return computers_; }
-private:
-	const PDH_HLOG phDataSource_;
-	std::vector<PerfCountersComp> computers_;
+//Статистика счетчика за последний запрос значений
+struct CounterStat {
+	std::optional<double> max_value_;
+	std::optional<double> sum_value_;
+	std::optional<std::size_t> count_value_;
+	CounterQuality quality_;
 };
 
-class PerfCountersComp {
-public:
-	PerfCountersComp(PDH_HLOG phDataSource, std::wstring computer);
-	void read();
-	const std::vector<PerfCountersObject>& getObjects() const { return objects_; }
-	const std::wstring& getCompName() const { return computer_; }
-private:
-	const PDH_HLOG phDataSource_;
-	std::wstring computer_;
-	std::vector< PerfCountersObject> objects_;
+//Ответ get_values в кэше вместе со статистикой счетчиков, по которой он построен
+struct CachedResponse {
+	std::string response_;
+	std::vector<CounterStat> counters_stat_;
 };
 
-class PerfCountersObject {
-public:
-	PerfCountersObject(PDH_HLOG phDataSource, std::wstring computer, std::wstring object);
-	void read();
-	const std::vector<std::wstring>& getInstances() const { return instances_; }
-	const std::vector<std::wstring>& getCounters() const { return counters_; }
-	const std::wstring& getObjName() const { return object_; }
-private:
-	const PDH_HLOG phDataSource_;
-	std::wstring computer_;
-	std::wstring object_;
-	std::vector<std::wstring> counters_;
-	std::vector<std::wstring> instances_;
-};
+//Отброшенные выборки индексированного счетчика: качество по индексу считается так же,
+//как при сканировании
+struct IndexedQuality {
+	//Подряд идущие записи без значений индексированных счетчиков: их время неизвестно,
+	//известны границы отрезка, число записей и номер записи каждой выборки
+	struct Run {
+		std::uint64_t first_;
+		std::uint64_t last_;
+		std::uint64_t records_;
+		std::size_t entries_;		//начало выборок отрезка в run_records_ и run_statuses_
+	};
 
-struct Counter {
-	Counter(
-		const wchar_t* computer, const wchar_t* object, const wchar_t* instances, const wchar_t* counter,
-		const wchar_t* computer_eng, const wchar_t* object_eng, const wchar_t* instances_eng, const wchar_t* counter_eng);
-	std::wstring computer_;
-	std::wstring object_;
-	std::wstring instances_;
-	std::wstring counter_;
-	std::wstring national_name_;
-	std::wstring computer_eng_;
-	std::wstring object_eng_;
-	std::wstring instances_eng_;
-	std::wstring counter_eng_;
-	std::wstring english_name_;
-
-	HCOUNTER hCounter_;
-	_PDH_RAW_COUNTER prevCounter_ = { PDH_CSTATUS_ITEM_NOT_VALIDATED , 0, 0, 0, 0 };
-	std::optional<double> max_value_;
-	std::optional<double> sum_value_;
-	std::optional<std::size_t> count_value_;
+	bool rate_ = false;		//сканирование отбрасывает первую выборку: значение скорости
+	//Выборки записей с известным временем
+	std::vector<std::uint64_t> times_;
+	std::vector<SampleStatus> statuses_;
+	std::vector<Run> runs_;
+	std::vector<std::uint64_t> run_records_;
+	std::vector<SampleStatus> run_statuses_;
+
+	std::size_t memoryUsage() const {
+		return times_.capacity() * sizeof(std::uint64_t) + statuses_.capacity() * sizeof(SampleStatus)
+			+ runs_.capacity() * sizeof(Run) + run_records_.capacity() * sizeof(std::uint64_t)
+			+ run_statuses_.capacity() * sizeof(SampleStatus);
+	}
 };
 
 struct Sample {
 	uint64_t start_period_;
 	uint64_t end_period_;
-	SYSTEMTIME point_time_;
+	uint64_t point_time_;
 	std::vector<std::optional<double>> values_;
 };
 
+//Выровненный интервал: ширина в тиках и номер интервала от начала эпохи
+struct BucketKey {
+	uint64_t width_;
+	uint64_t index_;
+	bool operator==(const BucketKey& other) const { return width_ == other.width_ && index_ == other.index_; }
+};
+
+struct BucketKeyHash {
+	std::size_t operator()(const BucketKey& key) const {
+		return std::hash<uint64_t>()(key.index_ * 0x9E3779B97F4A7C15ULL ^ key.width_);
+	}
+};
+
+//Именованная сессия: открытый источник со своей статистикой и кэшами.
+//Каталоги и словари имен PDH источники разделяют между сессиями сами
+struct Session {
+	Session(MemoryBudget& budget, std::size_t responses_bytes, std::size_t buckets_bytes) :
+		responses_(budget, responses_bytes), buckets_(budget, buckets_bytes) {}
+	std::unique_ptr<CounterSource> source_;
+	std::vector<CounterStat> counters_stat_;
+	//Качество выборок счетчиков по всем запросам значений с чтения источника
+	std::vector<CounterQuality> quality_;
+	MemoryReservation catalog_memory_;
+	LruCache<std::string, CachedResponse> responses_;
+	//Агрегаты всех счетчиков закрытых выровненных интервалов
+	LruCache<BucketKey, std::vector<BucketAggregate>, BucketKeyHash> buckets_;
+	//Загруженные ряды счетчиков с индексом диапазонов; действуют, пока конец данных источника равен indexed_end_
+	std::map<std::size_t, RangeIndex> indexes_;
+	std::map<std::size_t, IndexedQuality> index_quality_;
+	uint64_t indexed_end_ = 0;
+	MemoryReservation index_memory_;
+};
+
+enum class JobState {
+	Queued,
+	Running,
+	Done
+};
+
+//Команда, выполняемая в пуле потоков
+struct Job {
+	std::string command_;
+	boost::json::value request_;
+	std::chrono::steady_clock::duration parse_time_{};
+	JobState state_ = JobState::Queued;
+	std::string result_;
+};
+
 class PerfLogsReader {
 public:
 	PerfLogsReader();
 	~PerfLogsReader();
 	std::wstring executeCommandW(const std::string& cmd);
 	std::string executeCommand(const std::string& cmd);
+	//Файлы журналов Performance monitor (только Windows)
 	bool open(const std::vector<std::wstring>& files);
+	//Локальный сборщик счетчиков из /proc и /sys (только Linux)
+	bool openProc(std::chrono::milliseconds interval, std::size_t capacity);
+	//Синтетические счетчики для замеров и проверок
+	bool openSynthetic(const SyntheticOptions& options);
 	void close();
 	bool read();
-	const SYSTEMTIME& getStartTime() const { return start_time_; }
-	const SYSTEMTIME& getEndTime() const { return end_time_; }
-	std::vector<Sample> getValues(const SYSTEMTIME& startTime, const SYSTEMTIME& endTime, uint64_t points);
+	//Сессия, к которой относятся последующие вызовы; создается при первом выборе
+	void selectSession(const std::string& name);
+	uint64_t getStartTime() const { return session_->source_ ? session_->source_->startTime() : 0; }
+	uint64_t getEndTime() const { return session_->source_ ? session_->source_->endTime() : 0; }
+	std::vector<Sample> getValues(uint64_t startTime, uint64_t endTime, uint64_t points,
+		DownsamplingMode mode = DownsamplingMode::Max);
+	//Интервалы естественной ширины, выровненные по эпохе; width - выбранная ширина в тиках
+	std::vector<Sample> getAlignedValues(uint64_t startTime, uint64_t endTime, uint64_t points,
+		DownsamplingMode mode, uint64_t& width);
+	//Обработчик внешних событий компоненты: имя события и данные
+	void setEventHandler(std::function<void(const std::string&, const std::string&)> handler) { event_handler_ = std::move(handler); }
 private:
-	std::uint64_t pointsInPeriod(const SYSTEMTIME& startTime, const SYSTEMTIME& endTime, uint64_t points);
-	std::string executeCommandOpen(const boost::json::array* j_array);
+	std::string executeObject(const std::string& cmd, boost::json::object* j_object, std::chrono::steady_clock::duration parse_time);
+	std::string submitJob(const std::string& cmd, boost::json::value jv, std::chrono::steady_clock::duration parse_time);
+	bool jobsPending();
+	std::string executeCommandJobStatus(boost::json::object* j_object);
+	std::uint64_t pointsInPeriod(uint64_t startTime, uint64_t endTime, uint64_t points);
+	std::vector<Sample> samplesFromAggregates(std::vector<BucketAggregate>& aggregates,
+		uint64_t startTime, uint64_t endTime, uint64_t points, DownsamplingMode mode);
+	std::string executeCommandOpen(const boost::json::object* j_object);
 	std::string executeCommandRead();
 	std::string executeCommandGetValues(boost::json::object* j_object);
-	bool fillEngCountersFromRegistry();
-	bool fillNationalIndicesFromRegistry();
-	bool fillCounters();
-	const std::wstring& getEngName(const std::wstring& national_name);
-	bool createQuery();
-	void messageErrorPdh(DWORD dwErrorCode);
+	std::string executeCommandCorrelate(boost::json::object* j_object);
+	std::string executeCommandResample(boost::json::object* j_object);
+	bool resampleCounters(const ResampleGrid& grid, const std::vector<std::size_t>& indices, FillMode fill,
+		uint64_t max_gap, std::vector<std::vector<double>>& columns);
+	bool resampleOptions(const boost::json::object* j_object, FillMode& fill, uint64_t& max_gap);
+	std::string executeCommandCompare(boost::json::object* j_object);
+	std::string executeCommandIndex(boost::json::object* j_object);
+	std::string executeCommandIntervals(boost::json::object* j_object);
+	std::string executeCommandClockSkew(boost::json::object* j_object);
+	bool estimateClockOffsets(const boost::json::object& j_estimate, std::map<std::wstring, std::int64_t>& offsets,
+		boost::json::array& j_estimates);
+	void setClockOffsets(std::map<std::wstring, std::int64_t> offsets);
+	std::string executeCommandArchiveIndex(boost::json::object* j_object);
+	std::string executeCommandOpenRange(boost::json::object* j_object);
+	bool updateArchive(ArchiveIndex& archive, const boost::json::object* j_object, ArchiveUpdate& update);
+	std::string executeCommandExport(boost::json::object* j_object);
+	std::string executeCommandFollow(boost::json::object* j_object);
+	std::string executeCommandStats(boost::json::object* j_object, bool with_session);
+	std::string executeCommandTrace(boost::json::object* j_object, bool start);
+	std::string executeCommandMemory(boost::json::object* j_object);
+	std::string executeCommandClose();
+	std::string executeCommandSessions();
+	bool selectedCounters(const boost::json::object* j_object, std::vector<std::size_t>& indices);
+	void resetCountersStat();
+	void accumulateQuality(const std::vector<std::size_t>& indices);
+	void exportValues(uint64_t startTime, uint64_t endTime, const std::vector<std::size_t>& indices, Exporter& exporter);
 	boost::json::object countersToJsonObject();
+	void stopFollow();
+	void followLoop();
+	void followStep();
 
-	PDH_HLOG phDataSource_;
-	HQUERY phQuery_;
-	std::unique_ptr<PerfCounters> perfCounters_;
-	SYSTEMTIME start_time_;
-	SYSTEMTIME end_time_;
-	std::unordered_map<std::uint32_t, std::wstring> eng_counters_map_;
-	std::unordered_map<std::wstring, std::uint32_t> national_index_counters_map_;
-	std::vector<Counter> counters_;
 	std::wstring message_error_;
+	std::mutex mutex_;
+	std::function<void(const std::string&, const std::string&)> event_handler_;
+
+	//Бюджет памяти общий для всех сессий: каталоги источников, матрицы запросов и кэши ответов
+	MemoryBudget memory_budget_;
+	std::map<std::string, std::unique_ptr<Session>> sessions_;
+	Session* session_;
+	std::string session_name_;
+
+	//Режим слежения за дописываемыми файлами и локальным сборщиком одной из сессий
+	Session* follow_session_;
+	std::string follow_session_name_;
+	std::thread follow_thread_;
+	std::atomic<bool> follow_stop_;
+	std::mutex follow_mutex_;
+	std::condition_variable follow_cv_;
+	std::chrono::milliseconds follow_interval_;
+	uint64_t follow_bucket_;
+	uint64_t follow_last_time_;
+	DownsamplingMode follow_mode_;
+	std::vector<std::size_t> follow_indices_;
+	std::map<uint64_t, std::vector<BucketAggregate>> follow_buckets_;
+
+	//Фоновые задания и пул потоков; пул объявлен последним и останавливается первым
+	std::mutex jobs_mutex_;
+	std::map<uint64_t, Job> jobs_;
+	std::deque<uint64_t> job_queue_;
+	uint64_t next_job_;
+	std::unique_ptr<WorkerPool> pool_;
 };
\ No newline at end of file
@@ -0,0 +1,504 @@
+﻿#include "ProcCounterSource.h"
+#include "Conversion.h"
+#include "Stats.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <limits>
+#include <string_view>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+//Поля строки cpu в /proc/stat: user nice system idle iowait irq softirq steal
+constexpr size_t CPU_FIELDS = 8;
+//Поля /sys/block/<диск>/stat
+constexpr size_t DISK_FIELDS = 11;
+//Байты и пакеты приема и передачи из /proc/net/dev
+constexpr size_t NET_FIELDS = 4;
+//Размер сектора в /sys/block/<диск>/stat не зависит от устройства
+constexpr uint64_t SECTOR_SIZE = 512;
+constexpr double NO_VALUE = numeric_limits<double>::quiet_NaN();
+
+//Строки /proc/meminfo в порядке хранения сырых значений
+constexpr string_view MEMINFO_KEYS[] = {
+    "MemAvailable", "Buffers", "Cached", "SwapTotal", "SwapFree", "Committed_AS", "CommitLimit"
+};
+constexpr size_t MEM_FIELDS = sizeof(MEMINFO_KEYS) / sizeof(MEMINFO_KEYS[0]);
+
+const char* parseUnsigned(const char* p, const char* end, uint64_t& value);
+const char* nextLine(const char* p, const char* end);
+bool startsWith(const char* p, const char* end, string_view prefix);
+uint64_t delta(const uint64_t* raw, const uint64_t* prev, size_t index);
+
+ProcCounterSource::ProcCounterSource(chrono::milliseconds interval, size_t capacity) :
+    interval_(interval),
+    capacity_(capacity),
+    stat_fd_(-1),
+    meminfo_fd_(-1),
+    net_fd_(-1),
+    cpus_(0),
+    buffer_(64 * 1024),
+    length_(0),
+    raw_system_(0),
+    raw_memory_(0),
+    raw_disks_(0),
+    raw_nets_(0),
+    head_(0),
+    size_(0),
+    open_time_(currentLocalTicks()),
+    refreshed_time_(0),
+    stop_(false) {}
+
+ProcCounterSource::~ProcCounterSource() {
+    if (sampler_.joinable()) {
+        {
+            lock_guard<mutex> lock(stop_mutex_);
+            stop_ = true;
+        }
+        stop_cv_.notify_all();
+        sampler_.join();
+    }
+    closeFiles();
+}
+
+bool ProcCounterSource::read() {
+    //Сборщик запускается при первом чтении и дальше только пополняет буфер
+    if (sampler_.joinable()) {
+        return true;
+    }
+
+    if (!openFiles()) {
+        return false;
+    }
+    fillCounters();
+
+    raw_.assign(raw_nets_ + nets_.size() * NET_FIELDS, 0);
+    prev_raw_ = raw_;
+    row_.assign(counters_.size(), NO_VALUE);
+    times_.assign(capacity_, 0);
+    values_.assign(capacity_ * counters_.size(), NO_VALUE);
+
+    //Первый опрос только запоминает сырые значения: скорости считаются по двум опросам
+    collect(&prev_raw_[0]);
+    prev_sample_ = chrono::steady_clock::now();
+    sampler_ = thread(&ProcCounterSource::samplerLoop, this);
+    return true;
+}
+
+uint64_t ProcCounterSource::startTime() const {
+    lock_guard<mutex> lock(mutex_);
+    if (!size_) return open_time_;
+    return times_[(head_ + capacity_ - size_) % capacity_];
+}
+
+uint64_t ProcCounterSource::endTime() const {
+    lock_guard<mutex> lock(mutex_);
+    if (!size_) return open_time_;
+    return times_[(head_ + capacity_ - 1) % capacity_];
+}
+
+//Буфер блокируется на время сканирования: поток опроса подождет, выборки не теряются
+bool ProcCounterSource::scan(uint64_t start, uint64_t end, const vector<size_t>& counters, ValueSink& sink) {
+    ScopedTimer timer(StatPhase::Cook);
+    lock_guard<mutex> lock(mutex_);
+    const size_t counters_count = counters_.size();
+    uint64_t records = 0;
+    uint64_t values_count = 0;
+    uint64_t gaps = 0;
+    for (size_t k = 0; k < size_; ++k) {
+        size_t pos = (head_ + capacity_ - size_ + k) % capacity_;
+        uint64_t timestamp = times_[pos];
+        if (timestamp < start) continue;
+        if (timestamp > end) break;
+        const double* values = &values_[pos * counters_count];
+        for (size_t column = 0; column < counters.size(); ++column) {
+            double value = values[counters[column]];
+            if (!isnan(value)) {
+                sink.value(column, timestamp, value);
+                ++values_count;
+            }
+            else {
+                sink.skipped(column, SampleStatus::Missing);
+                ++gaps;
+            }
+        }
+        sink.endRecord();
+        ++records;
+    }
+    Stats::instance().add(StatCounter::Records, records);
+    Stats::instance().add(StatCounter::Values, values_count);
+    Stats::instance().add(StatCounter::Gaps, gaps);
+    return true;
+}
+
+uint64_t ProcCounterSource::countRecords(uint64_t start, uint64_t end, uint64_t limit) {
+    lock_guard<mutex> lock(mutex_);
+    uint64_t count = 0;
+    for (size_t k = 0; k < size_; ++k) {
+        uint64_t timestamp = times_[(head_ + capacity_ - size_ + k) % capacity_];
+        if (timestamp < start) continue;
+        if (timestamp > end) break;
+        if (++count > limit) break;
+    }
+    return count;
+}
+
+bool ProcCounterSource::refresh() {
+    lock_guard<mutex> lock(mutex_);
+    if (!size_) return false;
+    uint64_t end_time = times_[(head_ + capacity_ - 1) % capacity_];
+    if (end_time == refreshed_time_) return false;
+    refreshed_time_ = end_time;
+    return true;
+}
+
+//Кольцевой буфер выделяется целиком при чтении каталога
+size_t ProcCounterSource::memoryUsage() const {
+    return catalogBytes(counters_) + buffer_.capacity()
+        + (raw_.capacity() + prev_raw_.capacity() + times_.capacity()) * sizeof(uint64_t)
+        + (row_.capacity() + values_.capacity()) * sizeof(double);
+}
+
+bool ProcCounterSource::openFiles() {
+    stat_fd_ = ::open("/proc/stat", O_RDONLY | O_CLOEXEC);
+    meminfo_fd_ = ::open("/proc/meminfo", O_RDONLY | O_CLOEXEC);
+    net_fd_ = ::open("/proc/net/dev", O_RDONLY | O_CLOEXEC);
+    if (stat_fd_ < 0 || meminfo_fd_ < 0) {
+        error_ = L"Не удалось открыть /proc/stat или /proc/meminfo!";
+        closeFiles();
+        return false;
+    }
+
+    //Процессоры: строки cpuN в /proc/stat, отключенные процессоры в нем отсутствуют
+    int max_cpu = -1;
+    vector<int> cpu_ids;
+    if (readFile(stat_fd_)) {
+        const char* end = &buffer_[0] + length_;
+        for (const char* p = &buffer_[0]; p < end; p = nextLine(p, end)) {
+            if (startsWith(p, end, "cpu") && p + 3 < end && p[3] != ' ') {
+                uint64_t id;
+                parseUnsigned(p + 3, end, id);
+                cpu_ids.push_back(static_cast<int>(id));
+                max_cpu = max(max_cpu, static_cast<int>(id));
+            }
+        }
+    }
+    cpu_slots_.assign(max_cpu + 1, -1);
+    for (size_t i = 0; i < cpu_ids.size(); ++i) {
+        cpu_slots_[cpu_ids[i]] = static_cast<int>(i + 1);
+    }
+    cpus_ = cpu_ids.size() + 1;
+
+    //Блочные устройства без виртуальных loop и ram
+    error_code ec;
+    for (auto& entry : filesystem::directory_iterator("/sys/block", ec)) {
+        string name = entry.path().filename().string();
+        if (name.rfind("loop", 0) == 0 || name.rfind("ram", 0) == 0) continue;
+        int fd = ::open((entry.path() / "stat").c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) continue;
+        disks_.push_back(name);
+        disk_fds_.push_back(fd);
+    }
+
+    //Сетевые интерфейсы: первые две строки /proc/net/dev - заголовок
+    if (net_fd_ >= 0 && readFile(net_fd_)) {
+        const char* end = &buffer_[0] + length_;
+        const char* p = nextLine(nextLine(&buffer_[0], end), end);
+        for (; p < end; p = nextLine(p, end)) {
+            while (p < end && *p == ' ') ++p;
+            const char* colon = find(p, end, ':');
+            if (colon == end) break;
+            nets_.push_back(string(p, colon));
+        }
+    }
+
+    raw_system_ = cpus_ * CPU_FIELDS;
+    raw_memory_ = raw_system_ + 2;
+    raw_disks_ = raw_memory_ + MEM_FIELDS;
+    raw_nets_ = raw_disks_ + disks_.size() * DISK_FIELDS;
+    return true;
+}
+
+void ProcCounterSource::closeFiles() {
+    for (int fd : { stat_fd_, meminfo_fd_, net_fd_ }) {
+        if (fd >= 0) ::close(fd);
+    }
+    stat_fd_ = meminfo_fd_ = net_fd_ = -1;
+    for (int fd : disk_fds_) {
+        ::close(fd);
+    }
+    disk_fds_.clear();
+}
+
+//Порядок счетчиков совпадает с порядком значений в computeRow
+void ProcCounterSource::fillCounters() {
+    char host[256] = {};
+    gethostname(host, sizeof(host) - 1);
+    computer_ = L"\\\\" + utfToWideChar(host);
+
+    for (size_t slot = 0; slot < cpus_; ++slot) {
+        string instance = "_Total";
+        if (slot) {
+            size_t id = find(cpu_slots_.begin(), cpu_slots_.end(), static_cast<int>(slot)) - cpu_slots_.begin();
+            instance = to_string(id);
+        }
+        addCounter("Processor", instance, "% Processor Time");
+        addCounter("Processor", instance, "% User Time");
+        addCounter("Processor", instance, "% Privileged Time");
+        addCounter("Processor", instance, "% Interrupt Time");
+        addCounter("Processor", instance, "% Idle Time");
+    }
+    addCounter("System", "", "Processor Queue Length");
+    addCounter("System", "", "Context Switches/sec");
+    addCounter("Memory", "", "Available MBytes");
+    addCounter("Memory", "", "Available Bytes");
+    addCounter("Memory", "", "Cache Bytes");
+    addCounter("Memory", "", "Committed Bytes");
+    addCounter("Memory", "", "Commit Limit");
+    addCounter("Memory", "", "% Committed Bytes In Use");
+    addCounter("Paging File", "_Total", "% Usage");
+    for (auto& disk : disks_) {
+        addCounter("PhysicalDisk", disk, "Disk Reads/sec");
+        addCounter("PhysicalDisk", disk, "Disk Writes/sec");
+        addCounter("PhysicalDisk", disk, "Disk Read Bytes/sec");
+        addCounter("PhysicalDisk", disk, "Disk Write Bytes/sec");
+        addCounter("PhysicalDisk", disk, "% Disk Time");
+        addCounter("PhysicalDisk", disk, "Avg. Disk sec/Transfer");
+        addCounter("PhysicalDisk", disk, "Current Disk Queue Length");
+        addCounter("PhysicalDisk", disk, "Avg. Disk Queue Length");
+    }
+    for (auto& net : nets_) {
+        addCounter("Network Interface", net, "Bytes Received/sec");
+        addCounter("Network Interface", net, "Bytes Sent/sec");
+        addCounter("Network Interface", net, "Bytes Total/sec");
+        addCounter("Network Interface", net, "Packets Received/sec");
+        addCounter("Network Interface", net, "Packets Sent/sec");
+    }
+}
+
+void ProcCounterSource::addCounter(const string& object, const string& instance, const string& counter) {
+    CounterInfo info;
+    info.computer_ = computer_;
+    info.object_ = utfToWideChar(object);
+    info.instances_ = instance.empty() ? L"- - -" : utfToWideChar(instance);
+    info.counter_ = utfToWideChar(counter);
+    info.national_name_ = computer_ + L"\\" + info.object_
+        + (instance.empty() ? L"" : L"(" + info.instances_ + L")") + L"\\" + info.counter_;
+    info.computer_eng_ = info.computer_;
+    info.object_eng_ = info.object_;
+    info.instances_eng_ = info.instances_;
+    info.counter_eng_ = info.counter_;
+    info.english_name_ = info.national_name_;
+    counters_.push_back(move(info));
+}
+
+//Чтение файла с начала в buffer_; буфер растет, только если файл в него не поместился
+bool ProcCounterSource::readFile(int fd) {
+    while (true) {
+        ssize_t length = pread(fd, &buffer_[0], buffer_.size(), 0);
+        if (length < 0) {
+            length_ = 0;
+            return false;
+        }
+        if (static_cast<size_t>(length) < buffer_.size()) {
+            length_ = static_cast<size_t>(length);
+            return true;
+        }
+        buffer_.resize(buffer_.size() * 2);
+    }
+}
+
+void ProcCounterSource::collect(uint64_t* raw) {
+    if (readFile(stat_fd_)) {
+        const char* end = &buffer_[0] + length_;
+        for (const char* p = &buffer_[0]; p < end; p = nextLine(p, end)) {
+            if (startsWith(p, end, "cpu")) {
+                size_t slot = 0;
+                p += 3;
+                if (p < end && *p != ' ') {
+                    uint64_t id;
+                    p = parseUnsigned(p, end, id);
+                    if (id >= cpu_slots_.size() || cpu_slots_[id] < 0) continue;
+                    slot = cpu_slots_[id];
+                }
+                for (size_t field = 0; field < CPU_FIELDS; ++field) {
+                    p = parseUnsigned(p, end, raw[slot * CPU_FIELDS + field]);
+                }
+            }
+            else if (startsWith(p, end, "ctxt ")) {
+                parseUnsigned(p + 5, end, raw[raw_system_ + 1]);
+            }
+            else if (startsWith(p, end, "procs_running ")) {
+                parseUnsigned(p + 14, end, raw[raw_system_]);
+            }
+        }
+    }
+
+    if (readFile(meminfo_fd_)) {
+        const char* end = &buffer_[0] + length_;
+        for (const char* p = &buffer_[0]; p < end; p = nextLine(p, end)) {
+            for (size_t field = 0; field < MEM_FIELDS; ++field) {
+                const string_view& key = MEMINFO_KEYS[field];
+                if (startsWith(p, end, key) && p + key.size() < end && p[key.size()] == ':') {
+                    parseUnsigned(p + key.size() + 1, end, raw[raw_memory_ + field]);
+                    break;
+                }
+            }
+        }
+    }
+
+    for (size_t disk = 0; disk < disk_fds_.size(); ++disk) {
+        if (!readFile(disk_fds_[disk])) continue;
+        const char* p = &buffer_[0];
+        const char* end = p + length_;
+        for (size_t field = 0; field < DISK_FIELDS; ++field) {
+            p = parseUnsigned(p, end, raw[raw_disks_ + disk * DISK_FIELDS + field]);
+        }
+    }
+
+    if (net_fd_ >= 0 && readFile(net_fd_)) {
+        const char* end = &buffer_[0] + length_;
+        const char* p = nextLine(nextLine(&buffer_[0], end), end);
+        for (; p < end; p = nextLine(p, end)) {
+            while (p < end && *p == ' ') ++p;
+            const char* colon = find(p, end, ':');
+            if (colon == end) break;
+            string_view name(p, colon - p);
+            auto it = find(nets_.begin(), nets_.end(), name);
+            if (it == nets_.end()) continue;
+            uint64_t* net = &raw[raw_nets_ + (it - nets_.begin()) * NET_FIELDS];
+            //Прием: bytes packets errs drop fifo frame compressed multicast, затем передача
+            uint64_t fields[10];
+            p = colon + 1;
+            for (auto& field : fields) {
+                p = parseUnsigned(p, end, field);
+            }
+            net[0] = fields[0];
+            net[1] = fields[1];
+            net[2] = fields[8];
+            net[3] = fields[9];
+        }
+    }
+}
+
+//Значения счетчиков по разнице сырых значений двух опросов за seconds секунд
+void ProcCounterSource::computeRow(double seconds) {
+    const uint64_t* raw = &raw_[0];
+    const uint64_t* prev = &prev_raw_[0];
+    double* row = &row_[0];
+
+    for (size_t slot = 0; slot < cpus_; ++slot) {
+        const size_t base = slot * CPU_FIELDS;
+        uint64_t total = 0;
+        for (size_t field = 0; field < CPU_FIELDS; ++field) {
+            total += delta(raw, prev, base + field);
+        }
+        if (!total) {
+            for (size_t k = 0; k < 5; ++k) *row++ = NO_VALUE;
+            continue;
+        }
+        const double scale = 100.0 / total;
+        const uint64_t idle = delta(raw, prev, base + 3) + delta(raw, prev, base + 4);
+        *row++ = (total - idle) * scale;
+        *row++ = (delta(raw, prev, base) + delta(raw, prev, base + 1)) * scale;
+        *row++ = delta(raw, prev, base + 2) * scale;
+        *row++ = (delta(raw, prev, base + 5) + delta(raw, prev, base + 6)) * scale;
+        *row++ = idle * scale;
+    }
+
+    *row++ = static_cast<double>(raw[raw_system_]);
+    *row++ = delta(raw, prev, raw_system_ + 1) / seconds;
+
+    const uint64_t* memory = raw + raw_memory_;
+    *row++ = memory[0] / 1024.0;
+    *row++ = memory[0] * 1024.0;
+    *row++ = (memory[1] + memory[2]) * 1024.0;
+    *row++ = memory[5] * 1024.0;
+    *row++ = memory[6] * 1024.0;
+    *row++ = memory[6] ? 100.0 * memory[5] / memory[6] : NO_VALUE;
+    *row++ = memory[3] ? 100.0 * (memory[3] - min(memory[3], memory[4])) / memory[3] : 0;
+
+    for (size_t disk = 0; disk < disks_.size(); ++disk) {
+        const size_t base = raw_disks_ + disk * DISK_FIELDS;
+        const uint64_t reads = delta(raw, prev, base);
+        const uint64_t writes = delta(raw, prev, base + 4);
+        const double ms = seconds * 1000;
+        *row++ = reads / seconds;
+        *row++ = writes / seconds;
+        *row++ = delta(raw, prev, base + 2) * SECTOR_SIZE / seconds;
+        *row++ = delta(raw, prev, base + 6) * SECTOR_SIZE / seconds;
+        *row++ = 100.0 * delta(raw, prev, base + 9) / ms;
+        *row++ = (reads + writes) ? (delta(raw, prev, base + 3) + delta(raw, prev, base + 7)) / 1000.0 / (reads + writes) : 0;
+        *row++ = static_cast<double>(raw[base + 8]);
+        *row++ = delta(raw, prev, base + 10) / ms;
+    }
+
+    for (size_t net = 0; net < nets_.size(); ++net) {
+        const size_t base = raw_nets_ + net * NET_FIELDS;
+        const uint64_t received = delta(raw, prev, base);
+        const uint64_t sent = delta(raw, prev, base + 2);
+        *row++ = received / seconds;
+        *row++ = sent / seconds;
+        *row++ = (received + sent) / seconds;
+        *row++ = delta(raw, prev, base + 1) / seconds;
+        *row++ = delta(raw, prev, base + 3) / seconds;
+    }
+}
+
+void ProcCounterSource::sample() {
+    collect(&raw_[0]);
+    auto now = chrono::steady_clock::now();
+    double seconds = chrono::duration<double>(now - prev_sample_).count();
+    prev_sample_ = now;
+    computeRow(seconds > 0 ? seconds : 1);
+    raw_.swap(prev_raw_);
+
+    uint64_t timestamp = currentLocalTicks();
+    lock_guard<mutex> lock(mutex_);
+    times_[head_] = timestamp;
+    copy(row_.begin(), row_.end(), values_.begin() + head_ * row_.size());
+    head_ = (head_ + 1) % capacity_;
+    if (size_ < capacity_) ++size_;
+}
+
+void ProcCounterSource::samplerLoop() {
+    auto next = chrono::steady_clock::now();
+    while (true) {
+        next += interval_;
+        {
+            unique_lock<mutex> lock(stop_mutex_);
+            if (stop_cv_.wait_until(lock, next, [this]() { return stop_; })) return;
+        }
+        TraceScope trace("sample");
+        sample();
+    }
+}
+
+const char* parseUnsigned(const char* p, const char* end, uint64_t& value) {
+    while (p < end && (*p == ' ' || *p == '\t')) ++p;
+    value = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        value = value * 10 + static_cast<uint64_t>(*p - '0');
+        ++p;
+    }
+    return p;
+}
+
+const char* nextLine(const char* p, const char* end) {
+    p = find(p, end, '\n');
+    return p < end ? p + 1 : end;
+}
+
+bool startsWith(const char* p, const char* end, string_view prefix) {
+    return static_cast<size_t>(end - p) >= prefix.size() && string_view(p, prefix.size()) == prefix;
+}
+
+//Сырые счетчики только растут; уменьшение (переполнение, сброс устройства) дает ноль
+uint64_t delta(const uint64_t* raw, const uint64_t* prev, size_t index) {
+    return raw[index] >= prev[index] ? raw[index] - prev[index] : 0;
+}
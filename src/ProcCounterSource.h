@@ -0,0 +1,79 @@
+﻿#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CounterSource.h"
+
+//Локальный сборщик счетчиков Linux: поток опроса с заданным периодом читает /proc и /sys
+//и пишет вычисленные значения в кольцевой буфер. Имена счетчиков - как в Performance monitor.
+//Файлы открываются один раз и перечитываются с начала в постоянный буфер, разбор без выделения памяти
+class ProcCounterSource : public CounterSource {
+public:
+	ProcCounterSource(std::chrono::milliseconds interval, std::size_t capacity);
+	~ProcCounterSource() override;
+	bool read() override;
+	const std::vector<CounterInfo>& counters() const override { return counters_; }
+	std::size_t memoryUsage() const override;
+	std::uint64_t startTime() const override;
+	std::uint64_t endTime() const override;
+	bool scan(std::uint64_t start, std::uint64_t end, const std::vector<std::size_t>& counters, ValueSink& sink) override;
+	std::uint64_t countRecords(std::uint64_t start, std::uint64_t end, std::uint64_t limit) override;
+	bool refresh() override;
+private:
+	bool openFiles();
+	void closeFiles();
+	void fillCounters();
+	void addCounter(const std::string& object, const std::string& instance, const std::string& counter);
+	bool readFile(int fd);
+	void collect(std::uint64_t* raw);
+	void computeRow(double seconds);
+	void sample();
+	void samplerLoop();
+
+	const std::chrono::milliseconds interval_;
+	const std::size_t capacity_;
+	std::wstring computer_;
+	std::vector<CounterInfo> counters_;
+
+	//Открытые файлы и найденные при открытии процессоры, диски и сетевые интерфейсы
+	int stat_fd_;
+	int meminfo_fd_;
+	int net_fd_;
+	std::vector<int> disk_fds_;
+	std::vector<std::string> disks_;
+	std::vector<std::string> nets_;
+	std::vector<int> cpu_slots_;	//номер процессора -> позиция в сырых значениях, 0 - _Total
+	std::size_t cpus_;
+	std::vector<char> buffer_;
+	std::size_t length_;
+
+	//Сырые значения текущего и предыдущего опроса и смещения групп в них
+	std::vector<std::uint64_t> raw_;
+	std::vector<std::uint64_t> prev_raw_;
+	std::size_t raw_system_;
+	std::size_t raw_memory_;
+	std::size_t raw_disks_;
+	std::size_t raw_nets_;
+	std::chrono::steady_clock::time_point prev_sample_;
+	std::vector<double> row_;
+
+	//Кольцевой буфер выборок: значения выборки k в values_[k * counters_.size() + i], NaN - нет значения
+	mutable std::mutex mutex_;
+	std::vector<std::uint64_t> times_;
+	std::vector<double> values_;
+	std::size_t head_;
+	std::size_t size_;
+	std::uint64_t open_time_;
+	std::uint64_t refreshed_time_;
+
+	std::thread sampler_;
+	std::mutex stop_mutex_;
+	std::condition_variable stop_cv_;
+	bool stop_;
+};
@@ -0,0 +1,266 @@
+﻿#include "RangeIndex.h"
+
+#include <algorithm>
+
+using namespace std;
+
+size_t floorLog2(size_t value);
+
+//Оценка байт на серию и отрезок шага против байт на выборку: серия - позиция, значение и сумма,
+//выборка - значение и префиксная сумма; отрезок - позиция, время и шаг, выборка - время
+constexpr size_t RUN_BYTES = sizeof(uint32_t) + 2 * sizeof(double);
+constexpr size_t VALUE_BYTES = 2 * sizeof(double);
+constexpr size_t STEP_BYTES = sizeof(uint32_t) + 2 * sizeof(uint64_t);
+constexpr size_t TIME_BYTES = sizeof(uint64_t);
+
+const char* seriesEncodingName(SeriesEncoding encoding) {
+    switch (encoding) {
+    case SeriesEncoding::Constant: return "constant";
+    case SeriesEncoding::Runs: return "rle";
+    case SeriesEncoding::Dense: return "dense";
+    default: return "sparse";
+    }
+}
+
+void RangeIndex::build(vector<uint64_t> times, vector<double> values) {
+    clear();
+    size_ = values.size();
+    buildTimes(move(times));
+    buildValues(move(values));
+}
+
+void RangeIndex::clear() {
+    size_ = 0;
+    times_ = {};
+    step_positions_ = {};
+    step_times_ = {};
+    steps_ = {};
+    values_ = {};
+    prefix_sum_ = {};
+    run_positions_ = {};
+    run_values_ = {};
+    run_sum_ = {};
+    block_min_ = {};
+    block_max_ = {};
+}
+
+SeriesEncoding RangeIndex::encoding() const {
+    if (!run_values_.empty()) {
+        return run_values_.size() == 1 ? SeriesEncoding::Constant : SeriesEncoding::Runs;
+    }
+    return steps_.empty() ? SeriesEncoding::Sparse : SeriesEncoding::Dense;
+}
+
+uint64_t RangeIndex::time(size_t i) const {
+    if (steps_.empty()) return times_[i];
+    const size_t s = stepAt(i);
+    return step_times_[s] + (i - step_positions_[s]) * steps_[s];
+}
+
+double RangeIndex::value(size_t i) const {
+    return run_values_.empty() ? values_[i] : run_values_[runAt(i)];
+}
+
+//Проход по отрезкам и сериям без поиска на каждую выборку
+void RangeIndex::decode(size_t first, size_t last, uint64_t* times, double* values) const {
+    last = min(last, size_);
+    if (first >= last) return;
+    if (steps_.empty()) {
+        copy(times_.begin() + first, times_.begin() + last, times);
+    }
+    else {
+        for (size_t s = stepAt(first), i = first; i < last; ++s) {
+            const size_t end = min(last, s + 1 < steps_.size() ? size_t(step_positions_[s + 1]) : size_);
+            for (; i < end; ++i) {
+                *times++ = step_times_[s] + (i - step_positions_[s]) * steps_[s];
+            }
+        }
+    }
+    if (run_values_.empty()) {
+        copy(values_.begin() + first, values_.begin() + last, values);
+    }
+    else {
+        for (size_t r = runAt(first), i = first; i < last; ++r) {
+            const size_t end = min(last, r + 1 < run_values_.size() ? size_t(run_positions_[r + 1]) : size_);
+            values = fill_n(values, end - i, run_values_[r]);
+            i = end;
+        }
+    }
+}
+
+size_t RangeIndex::lowerBound(uint64_t time) const {
+    if (steps_.empty()) {
+        return lower_bound(times_.begin(), times_.end(), time) - times_.begin();
+    }
+    //Последний отрезок, начавшийся раньше time: на его конце время может совпасть с началом следующего
+    const size_t next = lower_bound(step_times_.begin(), step_times_.end(), time) - step_times_.begin();
+    if (!next) return 0;
+    const size_t s = next - 1;
+    const size_t start = step_positions_[s];
+    const size_t length = (next < steps_.size() ? size_t(step_positions_[next]) : size_) - start;
+    const uint64_t offset = time - step_times_[s];
+    const size_t k = steps_[s] ? static_cast<size_t>((offset + steps_[s] - 1) / steps_[s]) : length;
+    return start + min(k, length);
+}
+
+RangeSummary RangeIndex::query(size_t first, size_t last) const {
+    RangeSummary summary;
+    last = min(last, size_);
+    if (first >= last) return summary;
+    summary.count_ = last - first;
+    if (run_values_.empty()) {
+        summary.sum_ = prefix_sum_[last] - prefix_sum_[first];
+        summary.min_ = values_[first];
+        summary.max_ = values_[first];
+        tableQuery(values_, first, last, summary);
+        return summary;
+    }
+
+    //Серии, задетые отрезком, входят в экстремумы целиком: их значение в отрезке есть
+    const size_t first_run = runAt(first);
+    const size_t last_run = runAt(last - 1);
+    summary.sum_ = runningSum(last) - runningSum(first);
+    summary.min_ = run_values_[first_run];
+    summary.max_ = run_values_[first_run];
+    if (first_run != last_run) {
+        tableQuery(run_values_, first_run, last_run + 1, summary);
+    }
+    return summary;
+}
+
+size_t RangeIndex::memoryUsage() const {
+    size_t bytes = (times_.capacity() + step_times_.capacity() + steps_.capacity()) * sizeof(uint64_t)
+        + (step_positions_.capacity() + run_positions_.capacity()) * sizeof(uint32_t)
+        + (values_.capacity() + prefix_sum_.capacity() + run_values_.capacity() + run_sum_.capacity()) * sizeof(double);
+    for (size_t k = 0; k < block_min_.size(); ++k) {
+        bytes += (block_min_[k].capacity() + block_max_[k].capacity()) * sizeof(double);
+    }
+    return bytes;
+}
+
+//Отрезки с постоянным шагом выделяются жадно: каждый, кроме последнего, - не меньше двух выборок.
+//Выделение прекращается, как только отрезки перестают окупаться
+void RangeIndex::buildTimes(vector<uint64_t> times) {
+    vector<uint32_t> positions;
+    vector<uint64_t> starts;
+    vector<uint64_t> steps;
+    size_t i = 0;
+    if (size_ <= UINT32_MAX) {
+        while (i < size_ && (positions.size() + 1) * STEP_BYTES < size_ * TIME_BYTES) {
+            const uint64_t step = i + 1 < size_ ? times[i + 1] - times[i] : 0;
+            size_t end = i + 1;
+            while (end < size_ && times[end] - times[end - 1] == step) ++end;
+            positions.push_back(static_cast<uint32_t>(i));
+            starts.push_back(times[i]);
+            steps.push_back(step);
+            i = end;
+        }
+    }
+    if (size_ && i >= size_) {
+        step_positions_ = move(positions);
+        step_times_ = move(starts);
+        steps_ = move(steps);
+    }
+    else {
+        times_ = move(times);
+    }
+}
+
+void RangeIndex::buildValues(vector<double> values) {
+    size_t runs = 0;
+    for (size_t i = 0; i < size_; ++i) {
+        if (!i || values[i] != values[i - 1]) ++runs;
+    }
+    if (size_ && size_ <= UINT32_MAX && runs * RUN_BYTES < size_ * VALUE_BYTES) {
+        run_positions_.reserve(runs);
+        run_values_.reserve(runs);
+        run_sum_.reserve(runs + 1);
+        double sum = 0;
+        for (size_t i = 0; i < size_; ++i) {
+            if (i && values[i] == values[i - 1]) continue;
+            if (!run_positions_.empty()) {
+                sum += run_values_.back() * (i - run_positions_.back());
+            }
+            run_positions_.push_back(static_cast<uint32_t>(i));
+            run_values_.push_back(values[i]);
+            run_sum_.push_back(sum);
+        }
+        run_sum_.push_back(sum + run_values_.back() * (size_ - run_positions_.back()));
+        buildTable(run_values_);
+        return;
+    }
+
+    values_ = move(values);
+    prefix_sum_.resize(size_ + 1);
+    prefix_sum_[0] = 0;
+    for (size_t i = 0; i < size_; ++i) {
+        prefix_sum_[i + 1] = prefix_sum_[i] + values_[i];
+    }
+    buildTable(values_);
+}
+
+void RangeIndex::buildTable(const vector<double>& values) {
+    const size_t blocks = values.size() / BLOCK;
+    if (!blocks) return;
+    block_min_.emplace_back(blocks);
+    block_max_.emplace_back(blocks);
+    for (size_t j = 0; j < blocks; ++j) {
+        auto range = minmax_element(values.begin() + j * BLOCK, values.begin() + (j + 1) * BLOCK);
+        block_min_[0][j] = *range.first;
+        block_max_[0][j] = *range.second;
+    }
+    for (size_t k = 1; (size_t(1) << k) <= blocks; ++k) {
+        const size_t half = size_t(1) << (k - 1);
+        const size_t count = blocks - (size_t(1) << k) + 1;
+        block_min_.emplace_back(count);
+        block_max_.emplace_back(count);
+        for (size_t j = 0; j < count; ++j) {
+            block_min_[k][j] = min(block_min_[k - 1][j], block_min_[k - 1][j + half]);
+            block_max_[k][j] = max(block_max_[k - 1][j], block_max_[k - 1][j + half]);
+        }
+    }
+}
+
+//Экстремумы values на [first, last): целые блоки - двумя перекрывающимися окнами таблицы,
+//неполные крайние блоки просматриваются
+void RangeIndex::tableQuery(const vector<double>& values, size_t first, size_t last, RangeSummary& summary) const {
+    auto scan = [&](size_t from, size_t to) {
+        for (size_t i = from; i < to; ++i) {
+            summary.min_ = min(summary.min_, values[i]);
+            summary.max_ = max(summary.max_, values[i]);
+        }
+    };
+    const size_t first_block = (first + BLOCK - 1) / BLOCK;
+    const size_t last_block = last / BLOCK;
+    if (first_block >= last_block) {
+        scan(first, last);
+        return;
+    }
+    scan(first, first_block * BLOCK);
+    scan(last_block * BLOCK, last);
+    const size_t k = floorLog2(last_block - first_block);
+    const size_t second = last_block - (size_t(1) << k);
+    summary.min_ = min({ summary.min_, block_min_[k][first_block], block_min_[k][second] });
+    summary.max_ = max({ summary.max_, block_max_[k][first_block], block_max_[k][second] });
+}
+
+size_t RangeIndex::runAt(size_t i) const {
+    return upper_bound(run_positions_.begin(), run_positions_.end(), i) - run_positions_.begin() - 1;
+}
+
+size_t RangeIndex::stepAt(size_t i) const {
+    return upper_bound(step_positions_.begin(), step_positions_.end(), i) - step_positions_.begin() - 1;
+}
+
+//Сумма значений позиций [0, i)
+double RangeIndex::runningSum(size_t i) const {
+    if (i >= size_) return run_sum_.back();
+    const size_t r = runAt(i);
+    return run_sum_[r] + run_values_[r] * (i - run_positions_[r]);
+}
+
+size_t floorLog2(size_t value) {
+    size_t log = 0;
+    while (value >>= 1) ++log;
+    return log;
+}
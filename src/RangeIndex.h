@@ -0,0 +1,73 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//Сводка значений ряда на отрезке позиций
+struct RangeSummary {
+	std::size_t count_ = 0;
+	double sum_ = 0;
+	double min_ = 0;
+	double max_ = 0;
+};
+
+//Хранение ряда в памяти, выбирается по данным при построении
+enum class SeriesEncoding {
+	Constant,	//одно значение на весь ряд
+	Runs,		//серии равных значений (RLE)
+	Dense,		//все значения подряд, время - отрезками с постоянным шагом
+	Sparse		//все значения и время каждой выборки
+};
+
+const char* seriesEncodingName(SeriesEncoding encoding);
+
+//Индекс диапазонов ряда одного счетчика, загруженного в память. Минимум и максимум - по разреженной
+//таблице над блоками по BLOCK значений (неполные крайние блоки просматриваются), сумма - по префиксным
+//суммам. Запрос отрезка стоит O(BLOCK) независимо от его длины.
+//Значения хранятся сериями равных, если серий заметно меньше выборок: таблица и суммы строятся по сериям,
+//запрос не разворачивает ряд. Время хранится отрезками с постоянным шагом, если их мало, иначе - по выборке
+class RangeIndex {
+public:
+	static constexpr std::size_t BLOCK = 32;
+
+	//Время выборок по возрастанию
+	void build(std::vector<std::uint64_t> times, std::vector<double> values);
+	void clear();
+	bool empty() const { return !size_; }
+	std::size_t size() const { return size_; }
+	SeriesEncoding encoding() const;
+	std::uint64_t time(std::size_t i) const;
+	double value(std::size_t i) const;
+	//Выборки позиций [first, last) в буферы на last - first элементов
+	void decode(std::size_t first, std::size_t last, std::uint64_t* times, double* values) const;
+	//Первая позиция со временем не меньше time
+	std::size_t lowerBound(std::uint64_t time) const;
+	//Позиции [first, last)
+	RangeSummary query(std::size_t first, std::size_t last) const;
+	std::size_t memoryUsage() const;
+private:
+	void buildTimes(std::vector<std::uint64_t> times);
+	void buildValues(std::vector<double> values);
+	void buildTable(const std::vector<double>& values);
+	void tableQuery(const std::vector<double>& values, std::size_t first, std::size_t last, RangeSummary& summary) const;
+	std::size_t runAt(std::size_t i) const;
+	std::size_t stepAt(std::size_t i) const;
+	double runningSum(std::size_t i) const;
+
+	std::size_t size_ = 0;
+	//Время: по выборке либо отрезки - позиция начала, время начала и шаг
+	std::vector<std::uint64_t> times_;
+	std::vector<std::uint32_t> step_positions_;
+	std::vector<std::uint64_t> step_times_;
+	std::vector<std::uint64_t> steps_;
+	//Значения: по выборке с префиксными суммами либо серии - позиция начала, значение и сумма до серии
+	std::vector<double> values_;
+	std::vector<double> prefix_sum_;	//prefix_sum_[i] - сумма values_[0, i)
+	std::vector<std::uint32_t> run_positions_;
+	std::vector<double> run_values_;
+	std::vector<double> run_sum_;
+	//Уровень k: экстремумы 2^k блоков, начиная с блока j; блоки - из значений или из серий
+	std::vector<std::vector<double>> block_min_;
+	std::vector<std::vector<double>> block_max_;
+};
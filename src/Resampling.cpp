@@ -0,0 +1,103 @@
+﻿#include "Resampling.h"
+
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+//Узлов в блоке: соседи блока лежат в буферах на стеке
+constexpr size_t RESAMPLE_BLOCK = 256;
+
+bool fillModeFromString(const string& name, FillMode& mode) {
+    if (name == "none") mode = FillMode::None;
+    else if (name == "step") mode = FillMode::Step;
+    else if (name == "linear") mode = FillMode::Linear;
+    else return false;
+    return true;
+}
+
+ResampleGrid uniformGrid(uint64_t start, uint64_t end, size_t points) {
+    ResampleGrid grid;
+    grid.start_ = start;
+    grid.points_ = max<size_t>(points, 2);
+    grid.step_ = end > start ? max<uint64_t>((end - start) / (grid.points_ - 1), 1) : 1;
+    return grid;
+}
+
+void resampleColumn(const uint64_t* times, const double* values, size_t count,
+    const ResampleGrid& grid, FillMode fill, uint64_t max_gap, double* out) {
+    const double infinity = numeric_limits<double>::infinity();
+    const double nan = numeric_limits<double>::quiet_NaN();
+    const double gap = max_gap ? static_cast<double>(max_gap) : infinity;
+    const double half_step = static_cast<double>(grid.step_) / 2;
+
+    //Время - смещение от начала сетки; отсутствующий сосед - бесконечно далеко и без значения
+    double node_time[RESAMPLE_BLOCK];
+    double prev_time[RESAMPLE_BLOCK];
+    double prev_value[RESAMPLE_BLOCK];
+    double next_time[RESAMPLE_BLOCK];
+    double next_value[RESAMPLE_BLOCK];
+    double divisor[RESAMPLE_BLOCK];
+    size_t j = 0;
+    for (size_t first = 0; first < grid.points_; first += RESAMPLE_BLOCK) {
+        const size_t n = min(RESAMPLE_BLOCK, grid.points_ - first);
+        for (size_t k = 0; k < n; ++k) {
+            const uint64_t t = grid.time(first + k);
+            //j - первая выборка позже узла
+            while (j < count && times[j] <= t) ++j;
+            node_time[k] = static_cast<double>(t - grid.start_);
+            if (j > 0) {
+                prev_time[k] = static_cast<double>(times[j - 1]) - static_cast<double>(grid.start_);
+                prev_value[k] = values[j - 1];
+            }
+            else {
+                prev_time[k] = -infinity;
+                prev_value[k] = nan;
+            }
+            if (j > 0 && times[j - 1] == t) {
+                //Выборка в узле: оба соседа - она сама
+                next_time[k] = prev_time[k];
+                next_value[k] = prev_value[k];
+            }
+            else if (j < count) {
+                next_time[k] = static_cast<double>(times[j]) - static_cast<double>(grid.start_);
+                next_value[k] = values[j];
+            }
+            else {
+                next_time[k] = infinity;
+                next_value[k] = nan;
+            }
+            //Делитель интерполяции не меньше тика, в узле с выборкой вес нулевой
+            const double span = next_time[k] - prev_time[k];
+            divisor[k] = span > 1 ? span : 1;
+        }
+
+        double* block_out = out + first;
+        switch (fill) {
+        case FillMode::Linear:
+            for (size_t k = 0; k < n; ++k) {
+                const double span = next_time[k] - prev_time[k];
+                const double weight = (node_time[k] - prev_time[k]) / divisor[k];
+                const double value = prev_value[k] + (next_value[k] - prev_value[k]) * weight;
+                //Сложение с NaN вместо выбора: деление не попадает под условие и цикл векторизуется
+                block_out[k] = value + (span <= gap ? 0.0 : nan);
+            }
+            break;
+        case FillMode::Step:
+            for (size_t k = 0; k < n; ++k) {
+                block_out[k] = node_time[k] - prev_time[k] <= gap ? prev_value[k] : nan;
+            }
+            break;
+        default:
+            for (size_t k = 0; k < n; ++k) {
+                const double to_prev = node_time[k] - prev_time[k];
+                const double to_next = next_time[k] - node_time[k];
+                const bool use_prev = to_prev <= to_next;
+                const double distance = use_prev ? to_prev : to_next;
+                const double value = use_prev ? prev_value[k] : next_value[k];
+                block_out[k] = distance < half_step || distance == 0 ? value : nan;
+            }
+            break;
+        }
+    }
+}
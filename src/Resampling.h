@@ -0,0 +1,29 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <string>
+
+enum class FillMode {
+	None,	//только выборка, ближайшая к узлу в пределах половины шага
+	Step,	//последнее значение не позже узла
+	Linear	//линейная интерполяция между соседними выборками
+};
+
+bool fillModeFromString(const std::string& name, FillMode& mode);
+
+//Равномерная сетка: points_ узлов с шагом step_ тиков от start_
+struct ResampleGrid {
+	std::uint64_t start_ = 0;
+	std::uint64_t step_ = 0;
+	std::size_t points_ = 0;
+	std::uint64_t time(std::size_t i) const { return start_ + i * step_; }
+};
+
+//Сетка из points узлов (не меньше двух) от start до end включительно, шаг округляется вниз
+ResampleGrid uniformGrid(std::uint64_t start, std::uint64_t end, std::size_t points);
+
+//Проекция ряда на сетку. times - по возрастанию, out - points_ значений, NaN - значения нет.
+//max_gap - наибольший разрыв между выборками (Linear) или возраст значения (Step) в тиках, 0 - без предела.
+//Соседи узлов находятся слиянием, значения считаются циклом без ветвлений по блокам узлов
+void resampleColumn(const std::uint64_t* times, const double* values, std::size_t count,
+	const ResampleGrid& grid, FillMode fill, std::uint64_t max_gap, double* out);
@@ -0,0 +1,178 @@
+﻿#include "SkewedCounterSource.h"
+#include "Conversion.h"
+
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+uint64_t shiftTime(uint64_t time, int64_t offset);
+
+//Слияние для упорядоченных приемников идет отрезками исправленного времени, каждый
+//компьютер читается с запасом, чтобы скорости в начале отрезка считались по предыдущей выборке
+constexpr uint64_t MERGE_SLICE = 15 * 60 * TICKS_PER_SECOND;
+constexpr uint64_t MERGE_OVERLAP = 5 * 60 * TICKS_PER_SECOND;
+
+//Значения одного компьютера со сдвигом времени: напрямую в приемник или в буфер слияния
+class ShiftSink : public ValueSink {
+public:
+    struct Entry {
+        uint64_t time_;
+        uint64_t record_;
+        size_t column_;
+        double value_;
+    };
+
+    ShiftSink(const vector<size_t>& columns, int64_t offset, ValueSink* target, vector<Entry>* entries,
+        uint64_t from, uint64_t& record) :
+        columns_(columns), offset_(offset), target_(target), entries_(entries), from_(from), record_(record) {}
+    void value(size_t column, uint64_t timestamp, double value) override {
+        const uint64_t time = shiftTime(timestamp, offset_);
+        if (target_) {
+            target_->value(columns_[column], time, value);
+        }
+        else if (time >= from_) {
+            entries_->push_back({ time, record_, columns_[column], value });
+        }
+    }
+    //Отброшенные выборки нужны только неупорядоченным приемникам: в слиянии они не учитываются
+    void skipped(size_t column, SampleStatus status) override {
+        if (target_) target_->skipped(columns_[column], status);
+    }
+    void endRecord() override {
+        if (target_) target_->endRecord();
+        ++record_;
+    }
+private:
+    const vector<size_t>& columns_;
+    int64_t offset_;
+    ValueSink* target_;
+    vector<Entry>* entries_;
+    uint64_t from_;
+    uint64_t& record_;
+};
+
+SkewedCounterSource::SkewedCounterSource(unique_ptr<CounterSource> source) :
+    source_(move(source)) {
+    updateCounterOffsets();
+}
+
+void SkewedCounterSource::setOffsets(map<wstring, int64_t> offsets) {
+    offsets_ = move(offsets);
+    updateCounterOffsets();
+}
+
+bool SkewedCounterSource::read() {
+    if (!source_->read()) {
+        error_ = source_->error();
+        return false;
+    }
+    updateCounterOffsets();
+    return true;
+}
+
+uint64_t SkewedCounterSource::startTime() const {
+    return shiftTime(source_->startTime(), min_offset_);
+}
+
+uint64_t SkewedCounterSource::endTime() const {
+    return shiftTime(source_->endTime(), max_offset_);
+}
+
+size_t SkewedCounterSource::memoryUsage() const {
+    return source_->memoryUsage() + counter_offsets_.capacity() * sizeof(int64_t);
+}
+
+bool SkewedCounterSource::scan(uint64_t start, uint64_t end, const vector<size_t>& counters, ValueSink& sink) {
+    //Столбцы по смещению: компьютеры с одинаковым смещением читаются одним сканированием
+    map<int64_t, vector<size_t>> groups;
+    for (size_t column = 0; column < counters.size(); ++column) {
+        groups[counterOffset(counters[column])].push_back(column);
+    }
+    if (groups.size() <= 1 && (groups.empty() || groups.begin()->first == 0)) {
+        if (!source_->scan(start, end, counters, sink)) {
+            error_ = source_->error();
+            return false;
+        }
+        return true;
+    }
+    if (end < start) return true;
+
+    vector<size_t> group_counters;
+    auto scanGroup = [&](const vector<size_t>& columns, int64_t offset, uint64_t from, uint64_t to,
+        ValueSink* target, vector<ShiftSink::Entry>* entries, uint64_t& record) {
+        //Окно в часах компьютера; отрезок целиком до начала его шкалы пропускается
+        if (offset > 0 && to < static_cast<uint64_t>(offset)) return true;
+        group_counters.clear();
+        for (auto column : columns) {
+            group_counters.push_back(counters[column]);
+        }
+        const uint64_t scan_from = shiftTime(target ? from : (from > MERGE_OVERLAP ? from - MERGE_OVERLAP : 0), -offset);
+        ShiftSink shift_sink(columns, offset, target, entries, from, record);
+        if (!source_->scan(scan_from, shiftTime(to, -offset), group_counters, shift_sink)) {
+            error_ = source_->error();
+            return false;
+        }
+        ++record;
+        return true;
+    };
+
+    uint64_t record = 0;
+    if (!sink.ordered()) {
+        //Порядок внутри столбца сохраняется, компьютеры передаются друг за другом
+        for (auto& group : groups) {
+            if (!scanGroup(group.second, group.first, start, end, &sink, nullptr, record)) return false;
+        }
+        return true;
+    }
+
+    vector<ShiftSink::Entry> entries;
+    for (uint64_t from = start; ; from += MERGE_SLICE) {
+        const uint64_t to = end - from < MERGE_SLICE ? end : from + MERGE_SLICE - 1;
+        entries.clear();
+        for (auto& group : groups) {
+            if (!scanGroup(group.second, group.first, from, to, nullptr, &entries, record)) return false;
+        }
+        //Записи одного времени остаются в порядке компьютеров, значения записи - вместе
+        stable_sort(entries.begin(), entries.end(), [](const ShiftSink::Entry& a, const ShiftSink::Entry& b) {
+            return a.time_ < b.time_;
+        });
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (i && entries[i].record_ != entries[i - 1].record_) sink.endRecord();
+            sink.value(entries[i].column_, entries[i].time_, entries[i].value_);
+        }
+        if (!entries.empty()) sink.endRecord();
+        if (to == end) break;
+    }
+    return true;
+}
+
+uint64_t SkewedCounterSource::countRecords(uint64_t start, uint64_t end, uint64_t limit) {
+    //Оценка сверху: записи всех компьютеров, попадающие в период хотя бы с одним из смещений
+    return source_->countRecords(shiftTime(start, -max_offset_), shiftTime(end, -min_offset_), limit);
+}
+
+void SkewedCounterSource::updateCounterOffsets() {
+    const vector<CounterInfo>& counters = source_->counters();
+    counter_offsets_.assign(counters.size(), 0);
+    min_offset_ = 0;
+    max_offset_ = 0;
+    if (offsets_.empty()) return;
+    for (size_t i = 0; i < counters.size(); ++i) {
+        auto it = offsets_.find(counters[i].computer_);
+        if (it == offsets_.end()) continue;
+        counter_offsets_[i] = it->second;
+        min_offset_ = min(min_offset_, it->second);
+        max_offset_ = max(max_offset_, it->second);
+    }
+}
+
+//Сдвиг с насыщением на границах шкалы тиков
+uint64_t shiftTime(uint64_t time, int64_t offset) {
+    if (offset < 0) {
+        const uint64_t shift = static_cast<uint64_t>(-(offset + 1)) + 1;
+        return time > shift ? time - shift : 0;
+    }
+    const uint64_t shift = static_cast<uint64_t>(offset);
+    return numeric_limits<uint64_t>::max() - time > shift ? time + shift : numeric_limits<uint64_t>::max();
+}
@@ -0,0 +1,41 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "CounterSource.h"
+
+//Источник с поправкой часов компьютеров: время выборок счетчика сдвигается на смещение его компьютера,
+//и записи разных компьютеров сливаются в одну шкалу времени до разбиения на интервалы.
+//Смещение в тиках: исправленное время = время в журнале + смещение
+class SkewedCounterSource : public CounterSource {
+public:
+	explicit SkewedCounterSource(std::unique_ptr<CounterSource> source);
+	//Смещения по имени компьютера (CounterInfo::computer_); компьютеры без смещения не сдвигаются
+	void setOffsets(std::map<std::wstring, std::int64_t> offsets);
+	const std::map<std::wstring, std::int64_t>& offsets() const { return offsets_; }
+	std::int64_t counterOffset(std::size_t counter) const { return counter < counter_offsets_.size() ? counter_offsets_[counter] : 0; }
+	//Исходный источник; обертка после вызова пуста
+	std::unique_ptr<CounterSource> release() { return std::move(source_); }
+
+	bool read() override;
+	const std::vector<CounterInfo>& counters() const override { return source_->counters(); }
+	std::uint64_t startTime() const override;
+	std::uint64_t endTime() const override;
+	bool scan(std::uint64_t start, std::uint64_t end, const std::vector<std::size_t>& counters, ValueSink& sink) override;
+	std::uint64_t countRecords(std::uint64_t start, std::uint64_t end, std::uint64_t limit) override;
+	bool available(std::size_t counter) const override { return source_->available(counter); }
+	bool refresh() override { return source_->refresh(); }
+	std::size_t memoryUsage() const override;
+private:
+	void updateCounterOffsets();
+
+	std::unique_ptr<CounterSource> source_;
+	std::map<std::wstring, std::int64_t> offsets_;
+	std::vector<std::int64_t> counter_offsets_;
+	std::int64_t min_offset_ = 0;
+	std::int64_t max_offset_ = 0;
+};
@@ -0,0 +1,166 @@
+﻿#include "Stats.h"
+
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+#ifdef COUNT_ALLOCATIONS
+
+//Счетчик выделений памяти модуля. Отдельная переменная, а не поле Stats:
+//operator new вызывается и при создании самого Stats
+atomic<uint64_t> allocations_count(0);
+
+void* operator new(size_t size) {
+    allocations_count.fetch_add(1, memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+optional<uint64_t> allocationsCount() {
+    return allocations_count.load(memory_order_relaxed);
+}
+
+#else
+
+optional<uint64_t> allocationsCount() {
+    return nullopt;
+}
+
+#endif
+
+void updateMax(atomic<uint64_t>& max_value, uint64_t value);
+
+const char* statPhaseName(StatPhase phase) {
+    static const char* names[STAT_PHASES] = {
+        "command", "parse", "catalog", "collect", "cook", "aggregate", "json", "serialize", "store"
+    };
+    return names[static_cast<size_t>(phase)];
+}
+
+const char* statCounterName(StatCounter counter) {
+    static const char* names[STAT_COUNTERS] = { "records", "values", "bytes", "invalid", "skipped", "gaps" };
+    return names[static_cast<size_t>(counter)];
+}
+
+Stats& Stats::instance() {
+    static Stats stats;
+    return stats;
+}
+
+void Stats::add(StatPhase phase, uint64_t nanoseconds) {
+    const size_t index = static_cast<size_t>(phase);
+    calls_[index].fetch_add(1, memory_order_relaxed);
+    nanoseconds_[index].fetch_add(nanoseconds, memory_order_relaxed);
+    updateMax(max_nanoseconds_[index], nanoseconds);
+    current_calls_[index].fetch_add(1, memory_order_relaxed);
+    current_nanoseconds_[index].fetch_add(nanoseconds, memory_order_relaxed);
+    updateMax(current_max_nanoseconds_[index], nanoseconds);
+}
+
+void Stats::add(StatCounter counter, uint64_t value) {
+    const size_t index = static_cast<size_t>(counter);
+    counters_[index].fetch_add(value, memory_order_relaxed);
+    current_counters_[index].fetch_add(value, memory_order_relaxed);
+}
+
+void Stats::beginCommand(const string& command, uint64_t time) {
+    lock_guard<mutex> lock(mutex_);
+    if (!current_command_.empty()) {
+        history_.push_back(current());
+        while (history_.size() > history_depth_) {
+            history_.pop_front();
+        }
+    }
+    for (size_t i = 0; i < STAT_PHASES; ++i) {
+        current_calls_[i].store(0, memory_order_relaxed);
+        current_nanoseconds_[i].store(0, memory_order_relaxed);
+        current_max_nanoseconds_[i].store(0, memory_order_relaxed);
+    }
+    for (auto& counter : current_counters_) {
+        counter.store(0, memory_order_relaxed);
+    }
+    current_command_ = command;
+    current_time_ = time;
+    current_allocations_ = allocationsCount().value_or(0);
+}
+
+StatSnapshot Stats::totals() const {
+    StatSnapshot snapshot;
+    for (size_t i = 0; i < STAT_PHASES; ++i) {
+        snapshot.calls_[i] = calls_[i].load(memory_order_relaxed);
+        snapshot.nanoseconds_[i] = nanoseconds_[i].load(memory_order_relaxed);
+        snapshot.max_nanoseconds_[i] = max_nanoseconds_[i].load(memory_order_relaxed);
+    }
+    for (size_t i = 0; i < STAT_COUNTERS; ++i) {
+        snapshot.counters_[i] = counters_[i].load(memory_order_relaxed);
+    }
+    lock_guard<mutex> lock(mutex_);
+    if (auto allocations = allocationsCount()) {
+        snapshot.allocations_ = *allocations - reset_allocations_;
+    }
+    return snapshot;
+}
+
+vector<StatSnapshot> Stats::history() const {
+    lock_guard<mutex> lock(mutex_);
+    vector<StatSnapshot> history(history_.begin(), history_.end());
+    if (!current_command_.empty()) {
+        history.push_back(current());
+    }
+    return history;
+}
+
+void Stats::setHistoryDepth(size_t depth) {
+    lock_guard<mutex> lock(mutex_);
+    history_depth_ = depth;
+    while (history_.size() > history_depth_) {
+        history_.pop_front();
+    }
+}
+
+void Stats::reset() {
+    lock_guard<mutex> lock(mutex_);
+    for (size_t i = 0; i < STAT_PHASES; ++i) {
+        calls_[i].store(0, memory_order_relaxed);
+        nanoseconds_[i].store(0, memory_order_relaxed);
+        max_nanoseconds_[i].store(0, memory_order_relaxed);
+    }
+    for (auto& counter : counters_) {
+        counter.store(0, memory_order_relaxed);
+    }
+    history_.clear();
+    reset_allocations_ = allocationsCount().value_or(0);
+}
+
+//Вызывается под mutex_
+StatSnapshot Stats::current() const {
+    StatSnapshot snapshot;
+    snapshot.command_ = current_command_;
+    snapshot.time_ = current_time_;
+    for (size_t i = 0; i < STAT_PHASES; ++i) {
+        snapshot.calls_[i] = current_calls_[i].load(memory_order_relaxed);
+        snapshot.nanoseconds_[i] = current_nanoseconds_[i].load(memory_order_relaxed);
+        snapshot.max_nanoseconds_[i] = current_max_nanoseconds_[i].load(memory_order_relaxed);
+    }
+    for (size_t i = 0; i < STAT_COUNTERS; ++i) {
+        snapshot.counters_[i] = current_counters_[i].load(memory_order_relaxed);
+    }
+    if (auto allocations = allocationsCount()) {
+        snapshot.allocations_ = *allocations - current_allocations_;
+    }
+    return snapshot;
+}
+
+void updateMax(atomic<uint64_t>& max_value, uint64_t value) {
+    uint64_t current = max_value.load(memory_order_relaxed);
+    while (value > current && !max_value.compare_exchange_weak(current, value, memory_order_relaxed)) {}
+}
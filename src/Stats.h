@@ -0,0 +1,108 @@
+﻿#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "Trace.h"
+
+//Этапы обработки команды
+enum class StatPhase : std::size_t {
+	Command,	//команда целиком
+	Parse,		//разбор JSON команды
+	Catalog,	//построение каталога счетчиков
+	Collect,	//чтение записей журнала PDH
+	Cook,		//вычисление значений и раскладка по интервалам
+	Aggregate,	//построение точек из агрегатов интервалов
+	Json,		//формирование объектов ответа
+	Serialize,	//сериализация ответа
+	Store,		//преобразование строки ответа для Native API
+	Count
+};
+
+enum class StatCounter : std::size_t {
+	Records,	//прочитано записей источника
+	Values,		//вычислено значений счетчиков
+	Bytes,		//байт в ответах
+	Invalid,	//выборок с ошибочным статусом или ошибкой вычисления
+	Skipped,	//первых выборок сканирования без предыдущей для скорости
+	Gaps,		//выборок без счетчика в записи
+	Count
+};
+
+constexpr std::size_t STAT_PHASES = static_cast<std::size_t>(StatPhase::Count);
+constexpr std::size_t STAT_COUNTERS = static_cast<std::size_t>(StatCounter::Count);
+
+const char* statPhaseName(StatPhase phase);
+const char* statCounterName(StatCounter counter);
+
+//Итоги по этапам и счетчикам: одна команда или все команды с последнего сброса
+struct StatSnapshot {
+	std::string command_;
+	std::uint64_t time_ = 0;
+	std::array<std::uint64_t, STAT_PHASES> calls_{};
+	std::array<std::uint64_t, STAT_PHASES> nanoseconds_{};
+	std::array<std::uint64_t, STAT_PHASES> max_nanoseconds_{};
+	std::array<std::uint64_t, STAT_COUNTERS> counters_{};
+	std::optional<std::uint64_t> allocations_;	//только при сборке с COUNT_ALLOCATIONS
+};
+
+//Счетчики процесса: атомарные сложения без блокировок, история последних команд.
+//Команда в истории закрывается началом следующей, чтобы учесть преобразование ответа в Native API
+class Stats {
+public:
+	static Stats& instance();
+	void add(StatPhase phase, std::uint64_t nanoseconds);
+	void add(StatCounter counter, std::uint64_t value);
+	void beginCommand(const std::string& command, std::uint64_t time);
+	StatSnapshot totals() const;
+	//Завершенные команды и текущая, от старых к новым
+	std::vector<StatSnapshot> history() const;
+	void setHistoryDepth(std::size_t depth);
+	void reset();
+private:
+	Stats() = default;
+	StatSnapshot current() const;
+
+	std::array<std::atomic<std::uint64_t>, STAT_PHASES> calls_{};
+	std::array<std::atomic<std::uint64_t>, STAT_PHASES> nanoseconds_{};
+	std::array<std::atomic<std::uint64_t>, STAT_PHASES> max_nanoseconds_{};
+	std::array<std::atomic<std::uint64_t>, STAT_COUNTERS> counters_{};
+	std::array<std::atomic<std::uint64_t>, STAT_PHASES> current_calls_{};
+	std::array<std::atomic<std::uint64_t>, STAT_PHASES> current_nanoseconds_{};
+	std::array<std::atomic<std::uint64_t>, STAT_PHASES> current_max_nanoseconds_{};
+	std::array<std::atomic<std::uint64_t>, STAT_COUNTERS> current_counters_{};
+
+	mutable std::mutex mutex_;
+	std::string current_command_;
+	std::uint64_t current_time_ = 0;
+	std::uint64_t current_allocations_ = 0;
+	std::uint64_t reset_allocations_ = 0;
+	std::deque<StatSnapshot> history_;
+	std::size_t history_depth_ = 64;
+};
+
+//Замер этапа от создания до разрушения, при включенной трассировке - еще и участок трассы
+class ScopedTimer {
+public:
+	explicit ScopedTimer(StatPhase phase) :
+		phase_(phase), trace_(statPhaseName(phase)), start_(std::chrono::steady_clock::now()) {}
+	ScopedTimer(StatPhase phase, const std::string& detail) :
+		phase_(phase), trace_(statPhaseName(phase), detail), start_(std::chrono::steady_clock::now()) {}
+	~ScopedTimer() {
+		auto elapsed = std::chrono::steady_clock::now() - start_;
+		Stats::instance().add(phase_, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+	}
+	ScopedTimer(const ScopedTimer&) = delete;
+	ScopedTimer& operator=(const ScopedTimer&) = delete;
+private:
+	StatPhase phase_;
+	TraceScope trace_;
+	std::chrono::steady_clock::time_point start_;
+};
@@ -0,0 +1,202 @@
+﻿#include "SyntheticCounterSource.h"
+#include "Conversion.h"
+#include "Stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+uint64_t mixBits(uint64_t x);
+double unitFraction(uint64_t hash);
+
+SyntheticCounterSource::SyntheticCounterSource(const SyntheticOptions& options) :
+    options_(options) {
+    if (!options_.start_time_) {
+        options_.start_time_ = ticksFromCivil({ 2024, 1, 1, 0, 0, 0, 0 });
+    }
+    if (!options_.interval_) {
+        options_.interval_ = TICKS_PER_SECOND;
+    }
+    if (!options_.machines_) options_.machines_ = 1;
+    if (!(options_.kinds_ & 0xF)) options_.kinds_ = 0xF;
+    if (!options_.gap_length_) options_.gap_length_ = 1;
+    if (!options_.spike_length_) options_.spike_length_ = 1;
+}
+
+bool SyntheticCounterSource::read() {
+    if (!counters_.empty()) {
+        return true;
+    }
+
+    vector<SyntheticKind> enabled;
+    for (SyntheticKind kind : { SyntheticLevel, SyntheticPercent, SyntheticRate, SyntheticSteps }) {
+        if (options_.kinds_ & kind) enabled.push_back(kind);
+    }
+    auto kindName = [](SyntheticKind kind) {
+        switch (kind) {
+        case SyntheticLevel: return L"Level";
+        case SyntheticPercent: return L"% Usage";
+        case SyntheticRate: return L"Operations/sec";
+        default: return L"Steps";
+        }
+    };
+
+    counters_.reserve(options_.counters_);
+    levels_.resize(options_.counters_);
+    kinds_.resize(options_.counters_);
+    machines_.resize(options_.counters_);
+    instance_phases_.resize(options_.counters_);
+    const size_t per_machine = (options_.counters_ + options_.machines_ - 1) / options_.machines_;
+    for (size_t i = 0; i < options_.counters_; ++i) {
+        //Внутри компьютера: объект на 100 счетчиков, экземпляр на 4 счетчика
+        const size_t machine = i / per_machine;
+        const size_t j = i % per_machine;
+        const SyntheticKind kind = enabled[j % enabled.size()];
+
+        CounterInfo info;
+        info.computer_ = L"\\\\SYNTHETIC" + (options_.machines_ > 1 ? L"-" + to_wstring(machine) : L"");
+        info.object_ = L"Object " + to_wstring(j / 100);
+        info.instances_ = to_wstring(j / 4 % 25);
+        info.counter_ = kindName(kind);
+        if (enabled.size() < 4) {
+            info.counter_ += L" " + to_wstring(j % 4);
+        }
+        info.national_name_ = info.computer_ + L"\\" + info.object_ + L"(" + info.instances_ + L")\\" + info.counter_;
+        info.computer_eng_ = info.computer_;
+        info.object_eng_ = info.object_;
+        info.instances_eng_ = info.instances_;
+        info.counter_eng_ = info.counter_;
+        info.english_name_ = info.national_name_;
+        counters_.push_back(move(info));
+
+        levels_[i] = 10.0 + mixBits(options_.seed_ ^ (i * 0x9E3779B97F4A7C15ULL)) % 1000;
+        kinds_[i] = kind;
+        machines_[i] = machine;
+        //Счетчики одного экземпляра появляются и исчезают вместе
+        instance_phases_[i] = mixBits(options_.seed_ ^ (machine << 40) ^ (j / 4 * 0xD6E8FEB86659FD93ULL));
+    }
+    return true;
+}
+
+uint64_t SyntheticCounterSource::endTime() const {
+    uint64_t records = options_.samples_ ? options_.samples_ - 1 : 0;
+    return recordTime(records);
+}
+
+size_t SyntheticCounterSource::memoryUsage() const {
+    return catalogBytes(counters_) + levels_.capacity() * sizeof(double) + kinds_.capacity() * sizeof(SyntheticKind)
+        + machines_.capacity() * sizeof(size_t) + instance_phases_.capacity() * sizeof(uint64_t);
+}
+
+bool SyntheticCounterSource::scan(uint64_t start, uint64_t end, const vector<size_t>& counters, ValueSink& sink) {
+    uint64_t first;
+    uint64_t last;
+    if (!recordRange(start, end, first, last)) return true;
+
+    ScopedTimer timer(StatPhase::Cook);
+    uint64_t records = 0;
+    uint64_t values = 0;
+    uint64_t gaps = 0;
+    for (uint64_t record = first; record <= last; ++record) {
+        if (!recordExists(record)) continue;
+        uint64_t timestamp = recordTime(record);
+        for (size_t column = 0; column < counters.size(); ++column) {
+            double value = valueAt(counters[column], record);
+            if (!isnan(value)) {
+                sink.value(column, timestamp, value);
+                ++values;
+            }
+            else {
+                sink.skipped(column, SampleStatus::Missing);
+                ++gaps;
+            }
+        }
+        sink.endRecord();
+        ++records;
+    }
+    Stats::instance().add(StatCounter::Records, records);
+    Stats::instance().add(StatCounter::Values, values);
+    Stats::instance().add(StatCounter::Gaps, gaps);
+    return true;
+}
+
+uint64_t SyntheticCounterSource::countRecords(uint64_t start, uint64_t end, uint64_t limit) {
+    uint64_t first;
+    uint64_t last;
+    if (!recordRange(start, end, first, last)) return 0;
+    if (options_.gaps_ <= 0) {
+        return min(last - first + 1, limit + 1);
+    }
+    uint64_t count = 0;
+    for (uint64_t record = first; record <= last && count <= limit; ++record) {
+        if (recordExists(record)) ++count;
+    }
+    return count;
+}
+
+bool SyntheticCounterSource::recordExists(uint64_t record) const {
+    if (options_.gaps_ <= 0) return true;
+    for (size_t machine = 0; machine < options_.machines_; ++machine) {
+        if (!machineInGap(machine, record)) return true;
+    }
+    return false;
+}
+
+double SyntheticCounterSource::valueAt(size_t counter, uint64_t record) const {
+    if (machineInGap(machines_[counter], record)) {
+        return numeric_limits<double>::quiet_NaN();
+    }
+    if (options_.lifetime_ && (record + instance_phases_[counter] % (2 * options_.lifetime_)) / options_.lifetime_ % 2) {
+        return numeric_limits<double>::quiet_NaN();
+    }
+
+    const uint64_t hash = mixBits(options_.seed_ ^ (counter * 0x9E3779B97F4A7C15ULL) ^ (record * 0xC2B2AE3D27D4EB4FULL));
+    const double noise = unitFraction(hash);
+    const double level = levels_[counter];
+    //Треугольная волна периодом в час выборок со сдвигом фазы по счетчику
+    const uint64_t period = 3600;
+    const double phase = static_cast<double>((record + counter * 37) % period) / period;
+    const double wave = phase < 0.5 ? phase * 2 : 2 - phase * 2;
+    const bool spike = options_.spikes_ > 0
+        && unitFraction(mixBits(options_.seed_ ^ (counter * 0x94D049BB133111EBULL) ^ (record / options_.spike_length_ * 0xBF58476D1CE4E5B9ULL))) < options_.spikes_;
+
+    switch (kinds_[counter]) {
+    case SyntheticLevel:
+        return (level * (0.9 + 0.2 * wave) + level * 0.05 * noise) * (spike ? options_.spike_scale_ : 1);
+    case SyntheticPercent:
+        return spike ? 100.0 : min(100.0, 80.0 * wave + 20.0 * noise);
+    case SyntheticRate:
+        //Выбросы над шумом - то, ради чего строится график максимумов
+        return spike ? level * options_.spike_scale_ * (1 + noise) : level * noise;
+    default:
+        return level * static_cast<double>((record / 600 + counter) % 4);
+    }
+}
+
+bool SyntheticCounterSource::recordRange(uint64_t start, uint64_t end, uint64_t& first, uint64_t& last) const {
+    if (!options_.samples_ || end < start || end < options_.start_time_) return false;
+    first = start <= options_.start_time_ ? 0 : (start - options_.start_time_ + options_.interval_ - 1) / options_.interval_;
+    last = min(options_.samples_ - 1, (end - options_.start_time_) / options_.interval_);
+    return first <= last;
+}
+
+bool SyntheticCounterSource::machineInGap(size_t machine, uint64_t record) const {
+    if (options_.gaps_ <= 0) return false;
+    const uint64_t segment = record / options_.gap_length_;
+    return unitFraction(mixBits(options_.seed_ ^ 0x5851F42D4C957F2DULL ^ (machine << 48) ^ (segment * 0x2545F4914F6CDD1DULL))) < options_.gaps_;
+}
+
+//Финализатор splitmix64
+uint64_t mixBits(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+//Равномерное число [0, 1) из старших 53 бит
+double unitFraction(uint64_t hash) {
+    return (hash >> 11) * (1.0 / 9007199254740992.0);
+}
@@ -0,0 +1,62 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "CounterSource.h"
+
+//Виды синтетических счетчиков, маска SyntheticOptions::kinds_
+enum SyntheticKind : unsigned {
+	SyntheticLevel = 1,		//уровень с медленным дрейфом
+	SyntheticPercent = 2,	//процент 0..100
+	SyntheticRate = 4,		//скорость с шумом
+	SyntheticSteps = 8		//ступени
+};
+
+//Параметры синтетического источника
+struct SyntheticOptions {
+	std::size_t counters_ = 100;
+	std::uint64_t samples_ = 3600;
+	std::uint64_t interval_ = 10000000;	//тики между выборками
+	std::uint64_t start_time_ = 0;		//0 - 2024-01-01T00:00:00
+	std::uint64_t seed_ = 1;
+	std::size_t machines_ = 1;			//счетчики делятся между компьютерами поровну
+	unsigned kinds_ = SyntheticLevel | SyntheticPercent | SyntheticRate | SyntheticSteps;
+	std::uint64_t lifetime_ = 0;		//выборок между появлением и исчезновением экземпляра, 0 - экземпляры есть всегда
+	double gaps_ = 0;					//доля отрезков времени без записи компьютера
+	std::uint64_t gap_length_ = 60;		//длина отрезка пропуска в выборках
+	double spikes_ = 1.0 / 1024;		//доля отрезков с выбросом
+	std::uint64_t spike_length_ = 1;	//длина выброса в выборках
+	double spike_scale_ = 20;			//во сколько раз выброс выше фона
+};
+
+//Воспроизводимый источник без файлов для замеров, проверок и генерации журналов:
+//значение счетчика вычисляется из номера счетчика, номера выборки и seed, данные не хранятся
+class SyntheticCounterSource : public CounterSource {
+public:
+	explicit SyntheticCounterSource(const SyntheticOptions& options);
+	bool read() override;
+	const std::vector<CounterInfo>& counters() const override { return counters_; }
+	std::size_t memoryUsage() const override;
+	std::uint64_t startTime() const override { return options_.start_time_; }
+	std::uint64_t endTime() const override;
+	bool scan(std::uint64_t start, std::uint64_t end, const std::vector<std::size_t>& counters, ValueSink& sink) override;
+	std::uint64_t countRecords(std::uint64_t start, std::uint64_t end, std::uint64_t limit) override;
+	const SyntheticOptions& options() const { return options_; }
+	std::uint64_t recordTime(std::uint64_t record) const { return options_.start_time_ + record * options_.interval_; }
+	//Запись отсутствует, если в пропуске все компьютеры
+	bool recordExists(std::uint64_t record) const;
+	//NaN - у счетчика нет значения (пропуск компьютера или экземпляр отсутствует)
+	double valueAt(std::size_t counter, std::uint64_t record) const;
+private:
+	bool recordRange(std::uint64_t start, std::uint64_t end, std::uint64_t& first, std::uint64_t& last) const;
+	bool machineInGap(std::size_t machine, std::uint64_t record) const;
+
+	SyntheticOptions options_;
+	std::vector<CounterInfo> counters_;
+	std::vector<double> levels_;
+	std::vector<SyntheticKind> kinds_;
+	std::vector<std::size_t> machines_;
+	std::vector<std::uint64_t> instance_phases_;
+};
@@ -0,0 +1,95 @@
+﻿#include "Trace.h"
+
+#include "boost/json.hpp"
+
+using namespace std;
+
+//Буфер потока для текущей трассировки. Владение разделено с Tracer: после остановки
+//поток может дописать событие в свой старый буфер, не обращаясь к освобожденной памяти
+thread_local shared_ptr<TraceBuffer> thread_buffer;
+
+Tracer& Tracer::instance() {
+    static Tracer tracer;
+    return tracer;
+}
+
+void Tracer::start(size_t capacity) {
+    lock_guard<mutex> lock(mutex_);
+    buffers_.clear();
+    next_thread_id_ = 1;
+    capacity_ = capacity ? capacity : 1;
+    start_ = chrono::steady_clock::now();
+    generation_.fetch_add(1, memory_order_release);
+    enabled_.store(true, memory_order_release);
+}
+
+string Tracer::stop(size_t& events, uint64_t& dropped) {
+    namespace json = boost::json;
+    enabled_.store(false, memory_order_release);
+
+    lock_guard<mutex> lock(mutex_);
+    events = 0;
+    dropped = 0;
+    json::array j_events;
+    for (auto& buffer : buffers_) {
+        const size_t size = buffer->size_.load(memory_order_acquire);
+        for (size_t i = 0; i < size; ++i) {
+            const TraceEvent& event = buffer->events_[i];
+            json::object j_event;
+            j_event.emplace("name", event.name_);
+            j_event.emplace("ph", string(1, event.phase_));
+            j_event.emplace("ts", event.nanoseconds_ / 1000.0);
+            j_event.emplace("pid", 1);
+            j_event.emplace("tid", buffer->thread_id_);
+            if (!event.detail_.empty()) {
+                json::object j_args;
+                j_args.emplace("detail", event.detail_);
+                j_event.emplace("args", j_args);
+            }
+            j_events.push_back(j_event);
+        }
+        events += size;
+        dropped += buffer->dropped_.load(memory_order_relaxed);
+    }
+    buffers_.clear();
+
+    json::object j_trace;
+    j_trace.emplace("traceEvents", j_events);
+    j_trace.emplace("displayTimeUnit", "ms");
+    return json::serialize(j_trace);
+}
+
+void Tracer::record(const char* name, const string& detail, char phase) {
+    TraceBuffer* buffer = threadBuffer();
+    if (!buffer) return;
+    const size_t size = buffer->size_.load(memory_order_relaxed);
+    if (size == buffer->events_.size()) {
+        buffer->dropped_.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+    TraceEvent& event = buffer->events_[size];
+    event.name_ = name;
+    event.detail_ = detail;
+    event.nanoseconds_ = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - buffer->start_).count();
+    event.phase_ = phase;
+    buffer->size_.store(size + 1, memory_order_release);
+}
+
+//Буфер создается при первом событии потока в каждой трассировке, дальше запись идет без блокировок
+TraceBuffer* Tracer::threadBuffer() {
+    const uint64_t generation = generation_.load(memory_order_acquire);
+    if (thread_buffer && thread_buffer->generation_ == generation) {
+        return thread_buffer.get();
+    }
+
+    lock_guard<mutex> lock(mutex_);
+    if (!enabled_.load(memory_order_relaxed)) return nullptr;
+    auto buffer = make_shared<TraceBuffer>();
+    buffer->events_.resize(capacity_);
+    buffer->thread_id_ = next_thread_id_++;
+    buffer->generation_ = generation_.load(memory_order_relaxed);
+    buffer->start_ = start_;
+    buffers_.push_back(buffer);
+    thread_buffer = buffer;
+    return thread_buffer.get();
+}
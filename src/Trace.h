@@ -0,0 +1,71 @@
+﻿#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//Событие трассировки: начало или конец участка
+struct TraceEvent {
+	const char* name_;			//статическая строка
+	std::string detail_;		//уточнение участка: команда, объект, файл
+	std::uint64_t nanoseconds_;	//от начала трассировки
+	char phase_;				//'B' или 'E'
+};
+
+//Буфер одного потока. Пишет только поток-владелец, размер публикуется после записи события,
+//поэтому чтение при остановке обходится без блокировок
+struct TraceBuffer {
+	std::vector<TraceEvent> events_;
+	std::atomic<std::size_t> size_{ 0 };
+	std::atomic<std::uint64_t> dropped_{ 0 };
+	std::uint32_t thread_id_ = 0;
+	std::uint64_t generation_ = 0;
+	std::chrono::steady_clock::time_point start_;
+};
+
+//Трассировка этапов в формате Chrome trace_event (открывается в Perfetto и chrome://tracing).
+//Выключена по умолчанию, проверка включения - одно атомарное чтение
+class Tracer {
+public:
+	static Tracer& instance();
+	bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+	//capacity - событий на поток, при переполнении события отбрасываются
+	void start(std::size_t capacity);
+	//Останавливает запись и возвращает события в JSON trace_event
+	std::string stop(std::size_t& events, std::uint64_t& dropped);
+	void record(const char* name, const std::string& detail, char phase);
+private:
+	Tracer() = default;
+	TraceBuffer* threadBuffer();
+
+	std::atomic<bool> enabled_{ false };
+	std::atomic<std::uint64_t> generation_{ 0 };
+	std::size_t capacity_ = 0;
+	std::chrono::steady_clock::time_point start_;
+	std::mutex mutex_;
+	std::vector<std::shared_ptr<TraceBuffer>> buffers_;
+	std::uint32_t next_thread_id_ = 1;
+};
+
+//Участок трассировки от создания до разрушения
+class TraceScope {
+public:
+	explicit TraceScope(const char* name) : name_(name), active_(Tracer::instance().enabled()) {
+		if (active_) Tracer::instance().record(name_, {}, 'B');
+	}
+	TraceScope(const char* name, const std::string& detail) : name_(name), active_(Tracer::instance().enabled()) {
+		if (active_) Tracer::instance().record(name_, detail, 'B');
+	}
+	~TraceScope() {
+		if (active_) Tracer::instance().record(name_, {}, 'E');
+	}
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+private:
+	const char* name_;
+	bool active_;
+};
@@ -0,0 +1,131 @@
+﻿#include "WorkerPool.h"
+
+#include <algorithm>
+
+using namespace std;
+
+//Пул и номер очереди текущего потока, если он поток пула
+thread_local const WorkerPool* current_pool = nullptr;
+thread_local size_t current_queue = 0;
+
+WorkerPool::WorkerPool(size_t threads) {
+    if (!threads) {
+        threads = max(1u, thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        queues_.push_back(make_unique<Queue>());
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        threads_.emplace_back(&WorkerPool::workerLoop, this, i);
+    }
+}
+
+//Поставленные задачи выполняются до конца
+WorkerPool::~WorkerPool() {
+    {
+        lock_guard<mutex> lock(wake_mutex_);
+        stop_ = true;
+    }
+    wake_cv_.notify_all();
+    for (auto& worker : threads_) {
+        worker.join();
+    }
+}
+
+void WorkerPool::submit(function<void()> task) {
+    const size_t index = current_pool == this ? current_queue : next_queue_++ % queues_.size();
+    //Счетчик растет раньше, чем задача появляется в очереди, и не уходит в минус при ее мгновенном разборе
+    {
+        lock_guard<mutex> lock(wake_mutex_);
+        ++pending_;
+    }
+    {
+        lock_guard<mutex> lock(queues_[index]->mutex_);
+        queues_[index]->tasks_.push_back(move(task));
+    }
+    wake_cv_.notify_one();
+}
+
+void WorkerPool::parallelFor(size_t count, const function<void(size_t)>& fn, size_t parallelism) {
+    if (!count) return;
+    size_t helpers = min(count, queues_.size() + 1) - 1;
+    if (parallelism) {
+        helpers = min(helpers, parallelism - 1);
+    }
+    if (!helpers) {
+        for (size_t i = 0; i < count; ++i) fn(i);
+        return;
+    }
+
+    //Индексы раздаются по одному: стоимость элементов бывает неравномерной.
+    //Помощник, начавший после закрытия, выходит, не обращаясь к fn
+    struct State {
+        atomic<size_t> next{ 0 };
+        mutex mutex_;
+        condition_variable done_cv_;
+        size_t active = 0;
+        bool closed = false;
+    };
+    auto state = make_shared<State>();
+    auto run = [state, count, &fn]() {
+        for (size_t i = state->next++; i < count; i = state->next++) {
+            fn(i);
+        }
+    };
+    for (size_t h = 0; h < helpers; ++h) {
+        submit([state, run]() {
+            {
+                lock_guard<mutex> lock(state->mutex_);
+                if (state->closed) return;
+                ++state->active;
+            }
+            run();
+            {
+                lock_guard<mutex> lock(state->mutex_);
+                --state->active;
+            }
+            state->done_cv_.notify_all();
+        });
+    }
+    run();
+
+    unique_lock<mutex> lock(state->mutex_);
+    state->closed = true;
+    state->done_cv_.wait(lock, [&state]() { return state->active == 0; });
+}
+
+void WorkerPool::workerLoop(size_t index) {
+    current_pool = this;
+    current_queue = index;
+    function<void()> task;
+    while (true) {
+        if (popTask(index, task)) {
+            task();
+            task = nullptr;
+            continue;
+        }
+        unique_lock<mutex> lock(wake_mutex_);
+        wake_cv_.wait(lock, [this]() { return stop_ || pending_ > 0; });
+        if (stop_ && !pending_) return;
+    }
+}
+
+//Своя очередь разбирается с конца (свежие задачи), чужие - с начала
+bool WorkerPool::popTask(size_t index, function<void()>& task) {
+    for (size_t k = 0; k < queues_.size(); ++k) {
+        Queue& queue = *queues_[(index + k) % queues_.size()];
+        lock_guard<mutex> lock(queue.mutex_);
+        if (queue.tasks_.empty()) continue;
+        if (k == 0) {
+            task = move(queue.tasks_.back());
+            queue.tasks_.pop_back();
+        }
+        else {
+            task = move(queue.tasks_.front());
+            queue.tasks_.pop_front();
+        }
+        --pending_;
+        return true;
+    }
+    return false;
+}
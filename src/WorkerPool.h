@@ -0,0 +1,44 @@
+﻿#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Пул потоков компоненты. У каждого потока своя очередь: задачи, поставленные из потока пула,
+//попадают в его очередь, свободные потоки забирают задачи из чужих очередей с другого конца
+class WorkerPool {
+public:
+	//threads = 0 - по числу ядер
+	explicit WorkerPool(std::size_t threads = 0);
+	~WorkerPool();
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+	std::size_t size() const { return threads_.size(); }
+	void submit(std::function<void()> task);
+	//fn(i) для всех i из [0, count). Вызывающий поток участвует сам и не ждет помощников,
+	//которые не успели начать, поэтому вызов безопасен и из задачи пула.
+	//parallelism - предел числа исполнителей, 0 - без предела
+	void parallelFor(std::size_t count, const std::function<void(std::size_t)>& fn, std::size_t parallelism = 0);
+private:
+	struct Queue {
+		std::mutex mutex_;
+		std::deque<std::function<void()>> tasks_;
+	};
+
+	void workerLoop(std::size_t index);
+	bool popTask(std::size_t index, std::function<void()>& task);
+
+	std::vector<std::unique_ptr<Queue>> queues_;
+	std::vector<std::thread> threads_;
+	std::atomic<std::size_t> pending_{ 0 };
+	std::atomic<std::size_t> next_queue_{ 0 };
+	std::mutex wake_mutex_;
+	std::condition_variable wake_cv_;
+	bool stop_ = false;
+};
@@ -0,0 +1,316 @@
+﻿#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WINDOWS
+#include <windows.h>
+#include <Pdh.h>
+#include <PdhMsg.h>
+#pragma comment(lib,"pdh.lib")
+#endif
+
+#include "Conversion.h"
+#include "SyntheticCounterSource.h"
+
+using namespace std;
+
+//Генератор журналов счетчиков по синтетической модели: CSV Performance monitor
+//и (в Windows) двоичный .blg. Строки CSV формируются параллельно блоками по времени,
+//блоки пишутся в файл по порядку
+
+struct GeneratorOptions {
+    filesystem::path out_;
+    bool binary_ = false;
+    size_t threads_ = 0;
+    SyntheticOptions synthetic_;
+};
+
+constexpr size_t CHUNK_BYTES = 16 * 1024 * 1024;
+
+bool parseOptions(int argc, char* argv[], GeneratorOptions& options);
+uint64_t parseDuration(const string& str, uint64_t interval);
+unsigned parseKinds(const string& str);
+void usage();
+bool writeCsv(const filesystem::path& path, SyntheticCounterSource& source, size_t threads, uint64_t& bytes);
+size_t formatRows(const SyntheticCounterSource& source, uint64_t first, uint64_t last, vector<char>& buffer);
+#ifdef _WINDOWS
+bool relogToBinary(const filesystem::path& csv, const filesystem::path& blg, const SyntheticCounterSource& source);
+#endif
+
+int main(int argc, char* argv[]) {
+    GeneratorOptions options;
+    if (!parseOptions(argc, argv, options)) {
+        usage();
+        return 1;
+    }
+
+    SyntheticCounterSource source(options.synthetic_);
+    source.read();
+
+    auto begin = chrono::steady_clock::now();
+    filesystem::path csv = options.out_;
+    if (options.binary_) {
+#ifdef _WINDOWS
+        csv += ".csv";
+#else
+        fprintf(stderr, "Binary .blg logs are written through PDH and need Windows\n");
+        return 1;
+#endif
+    }
+
+    uint64_t bytes = 0;
+    if (!writeCsv(csv, source, options.threads_, bytes)) {
+        fprintf(stderr, "Cannot write %s\n", csv.u8string().c_str());
+        return 1;
+    }
+
+#ifdef _WINDOWS
+    if (options.binary_) {
+        bool relogged = relogToBinary(csv, options.out_, source);
+        error_code ec;
+        filesystem::remove(csv, ec);
+        if (!relogged) {
+            fprintf(stderr, "Cannot relog into %s\n", options.out_.u8string().c_str());
+            return 1;
+        }
+        bytes = filesystem::file_size(options.out_, ec);
+    }
+#endif
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    printf("%s: %zu counters, %llu samples, %.1f MB in %.2f s (%.1f MB/s)\n",
+        options.out_.u8string().c_str(), source.counters().size(),
+        static_cast<unsigned long long>(options.synthetic_.samples_),
+        bytes / (1024.0 * 1024.0), seconds, bytes / (1024.0 * 1024.0) / seconds);
+    return 0;
+}
+
+bool parseOptions(int argc, char* argv[], GeneratorOptions& options) {
+    SyntheticOptions& synthetic = options.synthetic_;
+    string duration;
+    string format;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const string name = argv[i];
+        const string value = argv[i + 1];
+        if (name == "--out") options.out_ = filesystem::u8path(value);
+        else if (name == "--format") format = value;
+        else if (name == "--threads") options.threads_ = stoull(value);
+        else if (name == "--counters") synthetic.counters_ = stoull(value);
+        else if (name == "--samples") synthetic.samples_ = stoull(value);
+        else if (name == "--duration") duration = value;
+        else if (name == "--interval") synthetic.interval_ = static_cast<uint64_t>(stod(value) * TICKS_PER_SECOND);
+        else if (name == "--start") synthetic.start_time_ = jsonToTicks(value);
+        else if (name == "--seed") synthetic.seed_ = stoull(value);
+        else if (name == "--machines") synthetic.machines_ = stoull(value);
+        else if (name == "--kinds") synthetic.kinds_ = parseKinds(value);
+        else if (name == "--lifetime") synthetic.lifetime_ = stoull(value);
+        else if (name == "--gaps") synthetic.gaps_ = stod(value);
+        else if (name == "--gap-length") synthetic.gap_length_ = stoull(value);
+        else if (name == "--spikes") synthetic.spikes_ = stod(value);
+        else if (name == "--spike-length") synthetic.spike_length_ = stoull(value);
+        else if (name == "--spike-scale") synthetic.spike_scale_ = stod(value);
+        else {
+            fprintf(stderr, "Unknown option %s\n", name.c_str());
+            return false;
+        }
+    }
+    if (options.out_.empty() || !synthetic.interval_) return false;
+    if (!duration.empty()) {
+        synthetic.samples_ = parseDuration(duration, synthetic.interval_);
+    }
+    if (format.empty()) {
+        format = options.out_.extension() == ".blg" ? "blg" : "csv";
+    }
+    if (format != "csv" && format != "blg") return false;
+    options.binary_ = format == "blg";
+    if (!options.threads_) {
+        options.threads_ = max(1u, thread::hardware_concurrency());
+    }
+    return true;
+}
+
+//Длительность вида 90s, 15m, 12h, 30d в число выборок
+uint64_t parseDuration(const string& str, uint64_t interval) {
+    double value = stod(str);
+    uint64_t unit = 1;
+    switch (str.back()) {
+    case 'm': unit = 60; break;
+    case 'h': unit = 3600; break;
+    case 'd': unit = 86400; break;
+    default: break;
+    }
+    return static_cast<uint64_t>(value * unit * TICKS_PER_SECOND / interval) + 1;
+}
+
+unsigned parseKinds(const string& str) {
+    unsigned kinds = 0;
+    if (str.find("level") != string::npos) kinds |= SyntheticLevel;
+    if (str.find("percent") != string::npos) kinds |= SyntheticPercent;
+    if (str.find("rate") != string::npos) kinds |= SyntheticRate;
+    if (str.find("steps") != string::npos) kinds |= SyntheticSteps;
+    return kinds;
+}
+
+void usage() {
+    fprintf(stderr,
+        "PerfLogGenerator --out file.csv|file.blg [--format csv|blg] [--threads N]\n"
+        "    [--counters 100] [--samples 3600 | --duration 30d] [--interval 1] [--start 2024-01-01T00:00:00]\n"
+        "    [--machines 1] [--kinds level,percent,rate,steps] [--lifetime samples]\n"
+        "    [--gaps fraction] [--gap-length samples] [--spikes fraction] [--spike-length samples] [--spike-scale 20]\n"
+        "    [--seed 1]\n");
+}
+
+bool writeCsv(const filesystem::path& path, SyntheticCounterSource& source, size_t threads, uint64_t& bytes) {
+    ofstream file(path, ios::binary | ios::trunc);
+    if (!file) return false;
+
+    string header = "\"(PDH-CSV 4.0)\"";
+    for (auto& counter : source.counters()) {
+        header += ",\"" + wideCharToUtf(counter.english_name_) + "\"";
+    }
+    header += "\r\n";
+    file.write(header.data(), header.size());
+    bytes = header.size();
+
+    //Блок - столько выборок, сколько помещается примерно в CHUNK_BYTES
+    const uint64_t samples = source.options().samples_;
+    const uint64_t row_bytes = 32 + source.counters().size() * 20;
+    const uint64_t chunk_rows = max<uint64_t>(1, CHUNK_BYTES / row_bytes);
+    const uint64_t chunks = (samples + chunk_rows - 1) / chunk_rows;
+
+    //Готовые блоки ждут записи в окне ограниченного размера, поэтому память не растет с размером файла
+    const size_t window = threads * 2;
+    vector<vector<char>> slots(window);
+    vector<bool> filled(window, false);
+    uint64_t written = 0;
+    atomic<uint64_t> next_chunk(0);
+    mutex slots_mutex;
+    condition_variable slots_cv;
+
+    auto worker = [&]() {
+        vector<char> buffer;
+        uint64_t chunk;
+        while ((chunk = next_chunk++) < chunks) {
+            {
+                unique_lock<mutex> lock(slots_mutex);
+                slots_cv.wait(lock, [&]() { return chunk < written + window; });
+            }
+            const uint64_t first = chunk * chunk_rows;
+            const uint64_t last = min(samples, first + chunk_rows);
+            buffer.resize(formatRows(source, first, last, buffer));
+            {
+                lock_guard<mutex> lock(slots_mutex);
+                slots[chunk % window].swap(buffer);
+                filled[chunk % window] = true;
+            }
+            slots_cv.notify_all();
+        }
+    };
+
+    vector<thread> workers;
+    for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back(worker);
+    }
+
+    vector<char> data;
+    for (uint64_t chunk = 0; chunk < chunks; ++chunk) {
+        {
+            unique_lock<mutex> lock(slots_mutex);
+            slots_cv.wait(lock, [&]() { return filled[chunk % window]; });
+            data.swap(slots[chunk % window]);
+            filled[chunk % window] = false;
+        }
+        file.write(data.data(), data.size());
+        bytes += data.size();
+        {
+            lock_guard<mutex> lock(slots_mutex);
+            ++written;
+        }
+        slots_cv.notify_all();
+    }
+
+    for (auto& worker_thread : workers) {
+        worker_thread.join();
+    }
+    return static_cast<bool>(file.flush());
+}
+
+//Строки выборок [first, last) в buffer, возвращает число байт
+size_t formatRows(const SyntheticCounterSource& source, uint64_t first, uint64_t last, vector<char>& buffer) {
+    const size_t counters = source.counters().size();
+    const size_t line_bytes = 32 + counters * 32;
+    size_t used = 0;
+    for (uint64_t record = first; record < last; ++record) {
+        if (!source.recordExists(record)) continue;
+        if (buffer.size() < used + line_bytes) {
+            buffer.resize(max(buffer.size() * 2, used + line_bytes));
+        }
+        char* p = buffer.data() + used;
+        *p++ = '"';
+        p += ticksToCsv(source.recordTime(record), p);
+        *p++ = '"';
+        for (size_t counter = 0; counter < counters; ++counter) {
+            *p++ = ',';
+            *p++ = '"';
+            double value = source.valueAt(counter, record);
+            if (!isnan(value)) {
+                p = to_chars(p, p + 30, value).ptr;
+            }
+            else {
+                *p++ = ' ';
+            }
+            *p++ = '"';
+        }
+        *p++ = '\r';
+        *p++ = '\n';
+        used = p - buffer.data();
+    }
+    return used;
+}
+
+#ifdef _WINDOWS
+
+//Двоичный журнал пишет сам PDH: запрос к CSV как к источнику данных и PdhUpdateLog на каждую запись
+bool relogToBinary(const filesystem::path& csv, const filesystem::path& blg, const SyntheticCounterSource& source) {
+    wstring csv_list = csv.wstring();
+    csv_list.push_back(L'\000');
+    PDH_HLOG hSource = NULL;
+    if (PdhBindInputDataSourceW(&hSource, csv_list.c_str()) != ERROR_SUCCESS) {
+        return false;
+    }
+
+    HQUERY hQuery = NULL;
+    if (PdhOpenQueryH(hSource, 0, &hQuery) != ERROR_SUCCESS) {
+        PdhCloseLog(hSource, 0);
+        return false;
+    }
+    for (auto& counter : source.counters()) {
+        HCOUNTER hCounter;
+        PdhAddCounterW(hQuery, counter.english_name_.c_str(), 0, &hCounter);
+    }
+
+    DWORD log_type = PDH_LOG_TYPE_BINARY;
+    PDH_HLOG hLog = NULL;
+    PDH_STATUS pdhStatus = PdhOpenLogW(blg.wstring().c_str(), PDH_LOG_WRITE_ACCESS | PDH_LOG_CREATE_ALWAYS,
+        &log_type, hQuery, 0, NULL, &hLog);
+    if (pdhStatus == ERROR_SUCCESS) {
+        while (PdhUpdateLogW(hLog, NULL) == ERROR_SUCCESS) {}
+        PdhCloseLog(hLog, 0);
+    }
+    PdhCloseQuery(hQuery);
+    PdhCloseLog(hSource, 0);
+    return pdhStatus == ERROR_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,334 @@
+﻿#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "boost/json.hpp"
+
+#include "PerfLogsReader.h"
+
+using namespace std;
+
+//Пакетная обработка журналов без клиента 1С: каждый набор файлов открывается в своем PerfLogsReader,
+//после open и read выполняется общий список команд компоненты. Наборы обрабатываются параллельно,
+//ответы пишутся в JSON, а табличные ответы (get_values, intervals) при --format csv - в CSV
+//PerfLogsCli --input dir|file [--input ...] --commands commands.json | --command '{"cmd":...}'
+//    [--out dir] [--format json|csv] [--group dir|file] [--ext .blg,.csv] [--threads N]
+
+struct CliOptions {
+    vector<filesystem::path> inputs_;
+    vector<string> commands_;
+    filesystem::path out_ = ".";
+    bool csv_ = false;
+    bool group_dir_ = true;
+    vector<string> extensions_ = { ".blg", ".csv" };
+    size_t threads_ = 0;
+};
+
+//Набор файлов, открываемых вместе
+struct LogSet {
+    string name_;
+    vector<filesystem::path> files_;
+};
+
+bool parseOptions(int argc, char* argv[], CliOptions& options);
+bool loadCommands(const filesystem::path& path, vector<string>& commands);
+vector<LogSet> collectSets(const CliOptions& options);
+bool runSet(const LogSet& log_set, const CliOptions& options, string& error);
+bool writeCsv(const filesystem::path& path, const boost::json::object& j_response, const vector<string>& counters);
+string csvField(const string& value);
+string jsonNumber(const boost::json::value& value);
+void usage();
+
+int main(int argc, char* argv[]) {
+    CliOptions options;
+    if (!parseOptions(argc, argv, options)) {
+        usage();
+        return 1;
+    }
+
+    //Без --input список команд выполняется один раз, источник открывают сами команды
+    vector<LogSet> sets = options.inputs_.empty() ? vector<LogSet>{ { "commands", {} } } : collectSets(options);
+    if (sets.empty()) {
+        fprintf(stderr, "No log files found\n");
+        return 1;
+    }
+    error_code ec;
+    filesystem::create_directories(options.out_, ec);
+
+    atomic<size_t> next_set(0);
+    atomic<size_t> failed(0);
+    mutex print_mutex;
+    auto worker = [&]() {
+        size_t index;
+        while ((index = next_set++) < sets.size()) {
+            auto begin = chrono::steady_clock::now();
+            string error;
+            bool ok = false;
+            try {
+                ok = runSet(sets[index], options, error);
+            }
+            catch (const exception& e) {
+                error = e.what();
+            }
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+            if (!ok) ++failed;
+            lock_guard<mutex> lock(print_mutex);
+            printf("%s: %zu files, %.2f s%s%s\n", sets[index].name_.c_str(), sets[index].files_.size(), seconds,
+                ok ? "" : ", error: ", error.c_str());
+        }
+    };
+    const size_t threads = min(options.threads_, sets.size());
+    vector<thread> workers;
+    for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back(worker);
+    }
+    for (auto& worker_thread : workers) {
+        worker_thread.join();
+    }
+    return failed ? 2 : 0;
+}
+
+bool parseOptions(int argc, char* argv[], CliOptions& options) {
+    string format = "json";
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const string name = argv[i];
+        const string value = argv[i + 1];
+        if (name == "--input") options.inputs_.push_back(filesystem::u8path(value));
+        else if (name == "--command") options.commands_.push_back(value);
+        else if (name == "--commands") {
+            if (!loadCommands(filesystem::u8path(value), options.commands_)) {
+                fprintf(stderr, "Cannot read commands from %s\n", value.c_str());
+                return false;
+            }
+        }
+        else if (name == "--out") options.out_ = filesystem::u8path(value);
+        else if (name == "--format") format = value;
+        else if (name == "--group") options.group_dir_ = value == "dir";
+        else if (name == "--ext") {
+            options.extensions_.clear();
+            stringstream stream(value);
+            string extension;
+            //Расширения файлов сравниваются в нижнем регистре
+            while (getline(stream, extension, ',')) {
+                transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return static_cast<char>(tolower(c)); });
+                options.extensions_.push_back(extension);
+            }
+        }
+        else if (name == "--threads") options.threads_ = stoull(value);
+        else {
+            fprintf(stderr, "Unknown option %s\n", name.c_str());
+            return false;
+        }
+    }
+    if (options.commands_.empty() || (format != "json" && format != "csv")) return false;
+    options.csv_ = format == "csv";
+    if (!options.threads_) {
+        options.threads_ = max(1u, thread::hardware_concurrency());
+    }
+    return true;
+}
+
+//Файл команд - JSON-массив объектов команд
+bool loadCommands(const filesystem::path& path, vector<string>& commands) {
+    ifstream file(path, ios::binary);
+    if (!file) return false;
+    stringstream content;
+    content << file.rdbuf();
+    error_code ec;
+    boost::json::value jv = boost::json::parse(content.str(), ec);
+    if (ec || !jv.is_array()) return false;
+    for (auto& j_command : jv.as_array()) {
+        commands.push_back(boost::json::serialize(j_command));
+    }
+    return true;
+}
+
+//Каталоги просматриваются рекурсивно; при --group dir файлы одного каталога - один набор
+vector<LogSet> collectSets(const CliOptions& options) {
+    vector<LogSet> sets;
+    auto matches = [&](const filesystem::path& path) {
+        string extension = path.extension().u8string();
+        transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return static_cast<char>(tolower(c)); });
+        return find(options.extensions_.begin(), options.extensions_.end(), extension) != options.extensions_.end();
+    };
+    //Имя набора - путь относительно каталога --input, для отдельного файла - его имя
+    auto addFile = [&](const filesystem::path& root, const filesystem::path& file) {
+        const filesystem::path set_path = options.group_dir_ ? file.parent_path() : file;
+        string name = set_path.lexically_relative(root).u8string();
+        if (root == file || name.empty() || name == ".") {
+            filesystem::path base = (root == file ? set_path : root).lexically_normal();
+            if (!base.has_filename()) base = base.parent_path();
+            name = base.filename().u8string();
+        }
+        if (name.empty() || name == "." || name == "..") name = "logs";
+        replace_if(name.begin(), name.end(), [](char c) { return c == '/' || c == '\\' || c == ':'; }, '_');
+        auto it = find_if(sets.begin(), sets.end(), [&](const LogSet& log_set) { return log_set.name_ == name; });
+        if (it == sets.end()) {
+            sets.push_back({ name, {} });
+            it = prev(sets.end());
+        }
+        it->files_.push_back(file);
+    };
+
+    for (auto& input : options.inputs_) {
+        error_code ec;
+        if (filesystem::is_directory(input, ec)) {
+            vector<filesystem::path> files;
+            for (auto& entry : filesystem::recursive_directory_iterator(input, ec)) {
+                if (entry.is_regular_file() && matches(entry.path())) {
+                    files.push_back(entry.path());
+                }
+            }
+            sort(files.begin(), files.end());
+            for (auto& file : files) {
+                addFile(input, file);
+            }
+        }
+        else if (filesystem::is_regular_file(input, ec)) {
+            addFile(input, input);
+        }
+    }
+    return sets;
+}
+
+bool runSet(const LogSet& log_set, const CliOptions& options, string& error) {
+    namespace json = boost::json;
+    PerfLogsReader reader;
+    vector<string> commands;
+    if (!log_set.files_.empty()) {
+        json::array j_files;
+        for (auto& file : log_set.files_) {
+            j_files.emplace_back(file.u8string());
+        }
+        commands.push_back(json::serialize(json::object{ { "cmd", "open" }, { "files", j_files } }));
+        commands.push_back("{\"cmd\":\"read\"}");
+    }
+    commands.insert(commands.end(), options.commands_.begin(), options.commands_.end());
+
+    json::array j_results;
+    vector<string> counters;
+    bool ok = true;
+    for (size_t k = 0; k < commands.size(); ++k) {
+        json::value j_command = json::parse(commands[k]);
+        const string cmd(j_command.as_object().at("cmd").as_string().c_str());
+        const string response = reader.executeCommand(commands[k]);
+        json::value j_response = response.empty()
+            ? json::value(json::object{ { "status", false }, { "error", "unknown command" } }) : json::parse(response);
+        json::object& j_object = j_response.as_object();
+        if (!j_object.at("status").as_bool()) {
+            ok = false;
+            if (error.empty()) error = cmd + ": " + string(j_object.at("error").as_string().c_str());
+        }
+        //Имена столбцов CSV - английские имена из каталога
+        if (cmd == "read" && j_object.at("status").as_bool()) {
+            counters.clear();
+            for (auto& j_row : j_object.at("data").as_object().at("counters").as_object().at("rows").as_array()) {
+                counters.push_back(j_row.as_array().at(5).as_string().c_str());
+            }
+        }
+        if (options.csv_ && j_object.at("status").as_bool() && (cmd == "get_values" || cmd == "intervals")) {
+            filesystem::path csv = options.out_ / filesystem::u8path(log_set.name_ + "." + to_string(k) + "." + cmd + ".csv");
+            if (!writeCsv(csv, j_object, counters)) {
+                ok = false;
+                if (error.empty()) error = "cannot write " + csv.u8string();
+            }
+            j_object.erase("samples");
+            j_object.erase("intervals");
+            j_object.emplace("file", csv.u8string());
+        }
+        //Каталог счетчиков из read в отчет не попадает: он есть в самих журналах
+        if (cmd == "read" && j_object.contains("data")) {
+            j_object.at("data").as_object().erase("counters");
+            j_object.at("data").as_object().emplace("counters", counters.size());
+        }
+        j_results.push_back(json::object{ { "command", j_command }, { "response", j_response } });
+    }
+
+    json::array j_files;
+    for (auto& file : log_set.files_) {
+        j_files.emplace_back(file.u8string());
+    }
+    json::object j_report{ { "name", log_set.name_ }, { "files", j_files }, { "status", ok }, { "results", j_results } };
+    ofstream report(options.out_ / filesystem::u8path(log_set.name_ + ".json"), ios::binary | ios::trunc);
+    const string report_text = json::serialize(j_report);
+    report.write(report_text.data(), report_text.size());
+    if (!report.flush()) {
+        if (error.empty()) error = "cannot write report";
+        return false;
+    }
+    return ok;
+}
+
+//get_values - строка на точку со значениями всех счетчиков, intervals - строка на интервал
+bool writeCsv(const filesystem::path& path, const boost::json::object& j_response, const vector<string>& counters) {
+    ofstream file(path, ios::binary | ios::trunc);
+    if (!file) return false;
+    string text;
+    if (const boost::json::value* j_samples = j_response.if_contains("samples")) {
+        text = "\"time\"";
+        for (auto& counter : counters) {
+            text += "," + csvField(counter);
+        }
+        text += "\r\n";
+        const boost::json::array& j_points = j_response.at("points").as_array();
+        const boost::json::array& j_rows = j_samples->as_array();
+        for (size_t i = 0; i < j_rows.size(); ++i) {
+            text += csvField(j_points[i].as_string().c_str());
+            for (auto& j_value : j_rows[i].as_array()) {
+                text += "," + jsonNumber(j_value);
+            }
+            text += "\r\n";
+        }
+    }
+    else if (const boost::json::value* j_intervals = j_response.if_contains("intervals")) {
+        text = "\"counter\",\"rule\",\"start\",\"end\",\"duration\",\"peak\",\"peak_time\"\r\n";
+        for (auto& j_interval : j_intervals->as_array()) {
+            const boost::json::object& j_object = j_interval.as_object();
+            const size_t counter = boost::json::value_to<size_t>(j_object.at("counter"));
+            text += csvField(counter < counters.size() ? counters[counter] : to_string(counter))
+                + "," + jsonNumber(j_object.at("rule"))
+                + "," + csvField(j_object.at("start").as_string().c_str())
+                + "," + csvField(j_object.at("end").as_string().c_str())
+                + "," + jsonNumber(j_object.at("duration"))
+                + "," + jsonNumber(j_object.at("peak"))
+                + "," + csvField(j_object.at("peak_time").as_string().c_str()) + "\r\n";
+        }
+    }
+    file.write(text.data(), text.size());
+    return static_cast<bool>(file.flush());
+}
+
+string csvField(const string& value) {
+    string field = "\"";
+    for (char c : value) {
+        if (c == '"') field += '"';
+        field += c;
+    }
+    return field + "\"";
+}
+
+//Пустая ячейка для отсутствующего значения
+string jsonNumber(const boost::json::value& value) {
+    if (value.is_double()) {
+        char buffer[32];
+        return string(buffer, to_chars(buffer, buffer + sizeof(buffer), value.as_double()).ptr);
+    }
+    return value.is_null() ? string() : boost::json::serialize(value);
+}
+
+void usage() {
+    fprintf(stderr,
+        "PerfLogsCli --input dir|file [--input ...] --commands commands.json | --command '{\"cmd\":...}' [--command ...]\n"
+        "    [--out dir] [--format json|csv] [--group dir|file] [--ext .blg,.csv] [--threads N]\n"
+        "Each file set is opened and read, then the commands run in order; without --input\n"
+        "the commands run once and must open a source themselves.\n");
+}